@@ -79,6 +79,7 @@ unsigned int bolt_rec_rel_log_pos = 0;
 unsigned short bolt_rec_rel_peak[LOG_ENTRIES];
 unsigned short *bolt_rec_rel_scanlines[MAX_SCANLINES];
 unsigned short bolt_rec_rel_scanline_buf[MAX_SCANLINES * MAX_WIDTH];
+unsigned short bolt_rec_line_buf[MAX_WIDTH];
 
 unsigned short bolt_rec_abs_max = 800;
 unsigned int bolt_rec_abs_log_pos = 0;
@@ -113,13 +114,20 @@ static unsigned int bolt_rec_calculate_abs(unsigned char *buf)
 
     for(unsigned int scanLine = 0; scanLine < bolt_rec_scanlines; scanLine++)
     {
-        for(unsigned int pos = 0; pos < (bolt_rec_x_end-bolt_rec_x_start); pos++)
+        for(unsigned int pos = 0; pos < (bolt_rec_x_end-bolt_rec_x_start); pos += MAX_WIDTH)
         {
-            unsigned short value = raw_get_pixel_ex(buf, bolt_rec_x_start + pos, (scanLine + 1) * bolt_rec_y_step);
+            unsigned int count = MIN((bolt_rec_x_end-bolt_rec_x_start) - pos, MAX_WIDTH);
 
-            sum += value;
-            peak = MAX(value, peak);
-            pixelCount++;
+            raw_unpack_row(buf, bolt_rec_x_start + pos, (scanLine + 1) * bolt_rec_y_step, 1, count, bolt_rec_line_buf);
+
+            for(unsigned int i = 0; i < count; i++)
+            {
+                unsigned short value = bolt_rec_line_buf[i];
+
+                sum += value;
+                peak = MAX(value, peak);
+                pixelCount++;
+            }
         }
     }
 
@@ -154,10 +162,13 @@ static unsigned int bolt_rec_calculate_rel(unsigned char *buf)
     for(unsigned int scanLine = 0; scanLine < bolt_rec_scanlines; scanLine++)
     {
         unsigned short *line = bolt_rec_rel_scanlines[scanLine];
+        unsigned int count = MIN((bolt_rec_x_end-bolt_rec_x_start), MAX_WIDTH);
+
+        raw_unpack_row(buf, bolt_rec_x_start, (scanLine + 1) * bolt_rec_y_step, 1, count, bolt_rec_line_buf);
 
-        for(unsigned int pos = 0; pos < MIN((bolt_rec_x_end-bolt_rec_x_start), MAX_WIDTH); pos++)
+        for(unsigned int pos = 0; pos < count; pos++)
         {
-            unsigned short value = raw_get_pixel_ex(buf, bolt_rec_x_start + pos, (scanLine + 1) * bolt_rec_y_step);
+            unsigned short value = bolt_rec_line_buf[pos];
             unsigned short last = line[pos];
             unsigned short delta = ABS(value-last);
 
@@ -113,7 +113,7 @@ static void post_deflicker_save_sidecar_file_for_cr2(int type, int file_number,
 static float raw_to_ev_custom(int raw, int white_level)
 {
     int raw_max = white_level - raw_info.black_level;
-    float raw_ev = -log2f(raw_max) + log2f(COERCE(raw - raw_info.black_level, 1, raw_max));
+    float raw_ev = -raw_log2(raw_max) + raw_log2(COERCE(raw - raw_info.black_level, 1, raw_max));
     return raw_ev;
 }
 
@@ -34,20 +34,32 @@
 #include <time.h>
 
 #include "amaze-port.c"
+#include "parallel.h"
 
-void amaze_demosaic_RT(
-    float** rawData,    /* holds preprocessed pixel values, rawData[i][j] corresponds to the ith row and jth column */
-    float** red,        /* the interpolated red plane */
-    float** green,      /* the interpolated green plane */
-    float** blue,       /* the interpolated blue plane */
-    int winx, int winy, /* crop window for demosaicing */
-    int winw, int winh
-)
+struct amaze_ctx
 {
-    printf ("AMaZE interpolation ...\n");
-
-    clock_t	t1,t2;
-    t1 = clock();
+    float** rawData;
+    float** red;
+    float** green;
+    float** blue;
+    int winx, winy;
+    int winw, winh;
+    int tile0;          /* first tile row */
+    int cols;           /* tiles in each tile row */
+};
+
+/* processes the tiles t0 ... t1-1, numbered row by row from the tile row ctx->tile0; each tile writes its own pixels only */
+/* (the tiles overlap by 32 pixels, but only the inner part of each tile is written back) */
+static void amaze_tiles(void* arg, int band, int t0, int t1)
+{
+    struct amaze_ctx * ctx = arg;
+    float** rawData = ctx->rawData;
+    float** red = ctx->red;
+    float** green = ctx->green;
+    float** blue = ctx->blue;
+    int winx = ctx->winx, winy = ctx->winy;
+    int winw = ctx->winw, winh = ctx->winh;
+    (void)band;
 
 #define HCLIP(x) x //is this still necessary???
 	//min(clip_pt,x)
@@ -100,7 +112,7 @@ void amaze_demosaic_RT(
 		float v;
 	};
 
-//~ #pragma omp parallel
+// per-thread tile buffers
 {
 	//position of top/left corner of the tile
 	int top, left;
@@ -214,8 +226,10 @@ void amaze_demosaic_RT(
 // Issue 1676
 // use collapse(2) to collapse the 2 loops to one large loop, so there is better scaling
 //~ #pragma omp for schedule(dynamic) collapse(2) nowait
-	for (top=winy-16; top < winy+height; top += TS-32)
-		for (left=winx-16; left < winx+width; left += TS-32) {
+	// each thread gets a range of tiles (see amaze_demosaic_tiles) and its own tile buffer
+	for (int t = t0; t < t1; t++) {
+			top = winy-16 + (ctx->tile0 + t / ctx->cols)*(TS-32);
+			left = winx-16 + (t % ctx->cols)*(TS-32);
 			memset(nyquist, 0, sizeof(char)*TS*TSH);
 			memset(rbint, 0, sizeof(float)*TS*TSH);
 			//location of tile bottom edge
@@ -1403,10 +1417,65 @@ void amaze_demosaic_RT(
 }
 
 	// done
+}
+
+/* only the tile rows tile0 ... tile1-1 of the crop window; returns the number of threads used */
+/* tile row k writes the rows winy + k*(TS-32) ... winy + (k+1)*(TS-32) - 1 and reads 16 more rows above and below */
+/* (rawData may hold only these rows; the output rows must be allocated) */
+int amaze_demosaic_tiles(
+    float** rawData,    /* holds preprocessed pixel values, rawData[i][j] corresponds to the ith row and jth column */
+    float** red,        /* the interpolated red plane */
+    float** green,      /* the interpolated green plane */
+    float** blue,       /* the interpolated blue plane */
+    int winx, int winy, /* crop window for demosaicing */
+    int winw, int winh,
+    int tile0, int tile1
+)
+{
+    struct amaze_ctx ctx = {
+        .rawData = rawData, .red = red, .green = green, .blue = blue,
+        .winx = winx, .winy = winy, .winw = winw, .winh = winh,
+        .tile0 = tile0,
+        .cols = (winw + 16 + (TS-32) - 1) / (TS-32),
+    };
+
+    return parallel_rows(0, (tile1 - tile0) * ctx.cols, 1, amaze_tiles, &ctx);
+}
+
+/* same as amaze_demosaic_RT, without messages (for mlv_dump); returns the number of threads used */
+int amaze_demosaic(
+    float** rawData,    /* holds preprocessed pixel values, rawData[i][j] corresponds to the ith row and jth column */
+    float** red,        /* the interpolated red plane */
+    float** green,      /* the interpolated green plane */
+    float** blue,       /* the interpolated blue plane */
+    int winx, int winy, /* crop window for demosaicing */
+    int winw, int winh
+)
+{
+    /* tiles start at winy-16, every TS-32 rows, and cover winy+winh */
+    int tile_rows = (winh + 16 + (TS-32) - 1) / (TS-32);
+    return amaze_demosaic_tiles(rawData, red, green, blue, winx, winy, winw, winh, 0, tile_rows);
 
 #undef TS
+}
+
+void amaze_demosaic_RT(
+    float** rawData,    /* holds preprocessed pixel values, rawData[i][j] corresponds to the ith row and jth column */
+    float** red,        /* the interpolated red plane */
+    float** green,      /* the interpolated green plane */
+    float** blue,       /* the interpolated blue plane */
+    int winx, int winy, /* crop window for demosaicing */
+    int winw, int winh
+)
+{
+    printf ("AMaZE interpolation ...\n");
+
+    clock_t	t1,t2;
+    t1 = clock();
+
+    int bands = amaze_demosaic(rawData, red, green, blue, winx, winy, winw, winh);
 
 t2 = clock() - t1;
-printf("Amaze took %.2f s\n", (double)t2 / CLOCKS_PER_SEC);
+printf("Amaze took %.2f s (CPU time, %d thread%s)\n", (double)t2 / CLOCKS_PER_SEC, bands, bands == 1 ? "" : "s");
 
 }
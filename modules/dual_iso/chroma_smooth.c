@@ -15,10 +15,8 @@
 #define CHROMA_SMOOTH_MEDIAN opt_med25
 #endif
 
-static void CHROMA_SMOOTH_FUNC(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw)
+static void CHROMA_SMOOTH_FUNC(uint32_t * inp, uint32_t * out, int w, int h, int* raw2ev, int* ev2raw)
 {
-    int w = raw_info.width;
-    int h = raw_info.height;
     int x,y;
 
     for (y = 4; y < h-5; y += 2)
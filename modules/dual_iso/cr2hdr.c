@@ -38,6 +38,11 @@ static int is_bright[4];
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#if !defined(__WIN32)
+#include <sys/wait.h>
+#endif
 
 #include "../../src/raw.h"
 #include "../../src/chdk-dng.h"
@@ -52,6 +57,10 @@ static int is_bright[4];
 #include "dither.h"
 #include "timing.h"
 #include "kelvin.h"
+#include "parallel.h"
+#include "../mlv_rec/mlv.h"
+#include "../mlv_rec/lj92.h"
+#include "mlv-bridge.h"
 
 #define MODULE_STRINGS_PREFIX dual_iso_strings
 #include "../module_strings_wrapper.h"
@@ -96,6 +105,14 @@ int embed_original = 0;
 
 int shortcut_fast = 0;
 
+int num_threads = 0;             /* 0: one per CPU */
+int num_jobs = 1;                /* files converted at the same time */
+int use_dcraw = 0;               /* decode all files with dcraw (default: only those we can't decode) */
+int use_exiftool = 0;            /* copy all metadata with exiftool (default: only the main EXIF tags) */
+int mlv_calib_frames = 5;        /* MLV video: frames used for measuring the clip calibration */
+int profile_json = 0;            /* print the time spent in each processing step */
+int low_mem = 0;                 /* process the image in bands of rows (see hdr_interpolate_bands) */
+
 void check_shortcuts()
 {
     if (shortcut_fast)
@@ -193,14 +210,16 @@ struct cmd_group options[] = {
             { (int*)&same_levels,    1, "--same-levels",       "Adjust output white levels to keep the same overall exposure\n"
                                             "                  for all frames passed in a single command line\n"
                                             "                  (useful to avoid flicker - for video or panoramas)" },
+            { &mlv_calib_frames, 1, "--calib-frames=%d", "MLV video: measure the ISO pattern, white levels and exposure match\n"
+                                            "                  on N frames spread over the clip and use them for all frames (default: 5)" },
             /* todo: deflicker, percentiles... */
             OPTION_EOL
         },
     },
     {
-        "DNG compression (requires Adobe DNG Converter)", (struct cmd_option[]) {
-            { &compress,     1, "--compress",       "Lossless DNG compression" },
-            { &compress,     2, "--compress-lossy", "Lossy DNG compression (be careful, may destroy shadow detail)" },
+        "DNG compression", (struct cmd_option[]) {
+            { &compress,     1, "--compress",       "Lossless DNG compression (lossless JPEG, built-in)" },
+            { &compress,     2, "--compress-lossy", "Lossy DNG compression (requires Adobe DNG Converter; be careful, may destroy shadow detail)" },
             OPTION_EOL
         },
     },
@@ -213,6 +232,16 @@ struct cmd_group options[] = {
                                     "                  To recover the original: exiftool IMG_1234.DNG -OriginalRawFileData -b > IMG_1234.CR2" },
             { &embed_original, 2, "--embed-original-copy",  "\n"
                                     "                  Similar to --embed-original, but without deleting the original.\n" },
+            { &num_threads,    1, "--threads=%d",   "Number of threads used for processing (default: one per CPU core)" },
+            { &num_jobs,       1, "--jobs=%d",      "Number of files converted at the same time, in separate processes (default: 1)\n"
+                                    "                  The CPU cores are shared between them, unless --threads is also given." },
+            { &use_dcraw,      1, "--dcraw",        "Decode the raw data with dcraw (default: built-in decoder for CR2 files from known cameras)" },
+            { &use_exiftool,   1, "--exiftool",     "Copy all the metadata with exiftool, including maker notes (default: main EXIF tags only, built-in)" },
+            { &profile_json,   1, "--profile=json", "Print wall time, CPU time, bytes processed and peak memory for each processing step,\n"
+                                    "                  as one JSON line per file or video frame on stderr (plus a summary for each process)." },
+            { &low_mem,        1, "--low-mem",      "Process the image in bands of rows, keeping in memory only the rows each step still needs.\n"
+                                    "                  Same output, except with --soft-film (the curve is applied to the 16-bit result).\n"
+                                    "                  Not available with --debug-blend, --debug-amaze, --debug-edge or --debug-alias." },
             OPTION_EOL
         },
     },
@@ -356,6 +385,8 @@ static void parse_commandline_option(char* option)
 static void show_commandline_help(char* progname)
 {
     printf("Command-line usage: %s [OPTIONS] [FILES]\n\n", progname);
+    printf("FILES can be CR2 or DNG files, Dual ISO video clips (MLV, converted to a DNG sequence),\n");
+    printf("directories (all CR2/DNG/MLV files inside) or @list.txt (a text file with one file or directory per line).\n\n");
     for (struct cmd_group * g = options; g->name; g++)
     {
         printf("%s:\n", g->name);
@@ -374,6 +405,15 @@ static void solve_commandline_deps()
 {
     if (!use_fullres)
         use_alias_map = 0;
+
+    /* these save full-frame intermediate images */
+    if (low_mem && (debug_blend || debug_amaze || debug_edge || debug_alias))
+    {
+        printf("Note: --low-mem is ignored with the --debug-* image options.\n");
+        low_mem = 0;
+    }
+
+    parallel_set_threads(num_threads);
 }
 
 static void show_active_options()
@@ -457,10 +497,39 @@ struct raw_info raw_info = {
 static int hdr_check();
 static int hdr_interpolate();
 static int black_subtract(int left_margin, int top_margin);
-static int black_subtract_simple(int left_margin, int top_margin);
+static int black_subtract_simple(int left_margin, int top_margin, int (*raw_get_pixel)(int x, int y));
 static void white_detect(int* white_dark, int* white_bright);
 static void white_balance_gray(float* red_balance, float* blue_balance, int method);
 
+/* Dual ISO video: the line pattern, the white levels and the exposure match are measured */
+/* on a few frames of the clip, then locked for all frames (measuring each frame makes the output flicker) */
+static struct
+{
+    int locked;                 /* use the values below instead of measuring them */
+    int measure_only;           /* stop after measuring (skip the actual processing) */
+    int is_bright[4];
+    int white, white_bright;    /* from white_detect (14-bit) */
+    double a, b;                /* exposure match: dark = bright * a + b (16-bit) */
+} clip_calib;
+
+/* --profile=json: processing steps of the current file or frame (one at a time in each process) */
+static struct profile prof;
+static const char* prof_step = 0;
+static int64_t prof_bytes = 0;
+
+/* ends the current step and starts the next one (0 = none); bytes: amount of data processed by the new step */
+static void profile_next_step(const char* step, int64_t bytes)
+{
+    if (prof_step)
+        profile_end(&prof, prof_step, prof_bytes);
+
+    if (step)
+        profile_begin(&prof, step);
+
+    prof_step = step;
+    prof_bytes = bytes;
+}
+
 static inline int raw_get_pixel16(int x, int y)
 {
     uint16_t * buf = raw_info.buffer;
@@ -567,366 +636,1008 @@ static int is_file(const char* filename)
     }
 }
 
-int main(int argc, char** argv)
+static int64_t file_size(const char* filename)
 {
-    printf("cr2hdr: a post processing tool for Dual ISO images\n\n");
-    printf("Last update: %s\n", module_get_string(dual_iso_strings, "Last update"));
+    struct stat st;
+    return stat(filename, &st) == 0 ? st.st_size : 0;
+}
 
-    fast_randn_init();
+/* input files, after expanding directories and file lists */
+static char** input_files = 0;
+static int num_input_files = 0;
 
-    if (argc == 1)
+static void add_input_file(char* filename)
+{
+    static int max_input_files = 0;
+    if (num_input_files == max_input_files)
     {
-        printf("No input files.\n\n");
-        printf("GUI usage: drag some CR2 or DNG files over cr2hdr.exe.\n\n");
-        show_commandline_help(argv[0]);
-        return 0;
+        max_input_files = MAX(max_input_files * 2, 64);
+        input_files = realloc(input_files, max_input_files * sizeof(input_files[0]));
+        CHECK(input_files, "realloc");
     }
-    
-    int r;
+    input_files[num_input_files++] = filename;
+}
 
-    /* parse all command-line options */
-    for (int k = 1; k < argc; k++)
-        if (argv[k][0] == '-')
-            parse_commandline_option(argv[k]);
-    
-    solve_commandline_deps();
-    show_active_options();
-    
-    /* keep track of black and white levels (useful for deflicker) */
-    /* (we will not have more than "argc" files) */
-    int* file_indices = malloc(argc * sizeof(file_indices[0]));
-    int* blacks = malloc(argc * sizeof(blacks[0]));
-    int* whites = malloc(argc * sizeof(whites[0]));
-    int num_files = 0;
-    
-    /* all other arguments are input files */
-    for (int k = 1; k < argc; k++)
+static int has_extension(const char* filename, const char* ext)
+{
+    int len = strlen(filename);
+    int ext_len = strlen(ext);
+    return len > ext_len && strcasecmp(filename + len - ext_len, ext) == 0;
+}
+
+static int is_directory(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* all CR2, DNG and MLV files from a directory, sorted by name */
+/* DNGs next to a CR2 with the same name are most likely our own output, so they are skipped */
+static void add_input_directory(char* dir)
+{
+    DIR* d = opendir(dir);
+    if (!d)
     {
-        if (argv[k][0] == '-')
-            continue;
-        
-        char* filename = argv[k];
+        printf("Could not open directory %s\n", dir);
+        return;
+    }
 
-        printf("\nInput file      : %s\n", filename);
-        int len = strlen(filename);
+    int first = num_input_files;
+    int dir_len = strlen(dir);
+    while (dir_len > 1 && dir[dir_len-1] == '/')
+        dir_len--;
 
-        char orig_filename[1000]; orig_filename[0] = 0;
-        char out_filename[1000];
+    struct dirent * e;
+    while ((e = readdir(d)))
+    {
+        char* name = e->d_name;
+        int is_dng = has_extension(name, ".DNG");
+        if (!is_dng && !has_extension(name, ".CR2") && !has_extension(name, ".MLV"))
+            continue;
 
-        if (strcmp(filename+len-4, ".DNG") == 0)
-        {
-            /* this DNG might have embedded CR2 data inside */
-            /* note: we only save uppercase .DNGs, so a case-sensitive extension check should be fine */
+        int size = dir_len + strlen(name) + 2;
+        char* path = malloc(size);
+        snprintf(path, size, "%.*s/%s", dir_len, dir, name);
 
-            if (dng_has_original_raw(filename))
+        if (is_dng)
+        {
+            char cr2_filename[1000];
+            snprintf(cr2_filename, sizeof(cr2_filename), "%s", path);
+            int len = strlen(cr2_filename);
+            memcpy(cr2_filename + len - 3, "CR2", 3);
+            int found = is_file(cr2_filename);
+            memcpy(cr2_filename + len - 3, "cr2", 3);
+            found = found || is_file(cr2_filename);
+            if (found)
             {
-                snprintf(orig_filename, sizeof(orig_filename), "%s", filename);
-                orig_filename[len-3] = 'C';
-                orig_filename[len-2] = 'R';
-                orig_filename[len-1] = '2';
-                
-                if (is_file(orig_filename))
-                {
-                    printf("Already exists  : %s (error)\n", orig_filename);
-                    continue;
-                }
-
-                if (extract_original_raw(filename, orig_filename))
-                {
-                    /* use the extracted CR2 as input */
-                    filename = orig_filename;
-                }
-                else
-                {
-                    /* error message was already printed, now just skip this file */
-                    continue;
-                }
+                free(path);
+                continue;
             }
         }
 
-        snprintf(out_filename, sizeof(out_filename), "%s", filename);
-        out_filename[len-3] = 'D';
-        out_filename[len-2] = 'N';
-        out_filename[len-1] = 'G';
-        
-        /* note: skip_existing will be ignored if we are working on a DNG file with embedded RAW */
-        if (skip_existing && is_file(out_filename) && !orig_filename[0])
-        {
-            printf("Already exists  : %s (skipping)\n", out_filename);
+        add_input_file(path);
+    }
+    closedir(d);
+
+    #define filename_lt(a,b) (strcmp(*(a), *(b)) < 0)
+    QSORT(char*, input_files + first, num_input_files - first, filename_lt);
+    #undef filename_lt
+}
+
+static void add_input_path(char* path)
+{
+    if (is_directory(path))
+        add_input_directory(path);
+    else
+        add_input_file(path);
+}
+
+/* @list.txt: one file or directory per line; empty lines and lines starting with # are ignored */
+static void add_input_list(char* list_filename)
+{
+    FILE* f = fopen(list_filename, "r");
+    if (!f)
+    {
+        printf("Could not open file list %s\n", list_filename);
+        return;
+    }
+
+    char line[1000];
+    while (fgets(line, sizeof(line), f))
+    {
+        int len = strlen(line);
+        while (len > 0 && isspace(line[len-1]))
+            line[--len] = 0;
+
+        if (len == 0 || line[0] == '#')
             continue;
+
+        char* path = strdup(line);
+        CHECK(path, "strdup");
+        add_input_path(path);
+    }
+    fclose(f);
+}
+
+/* raw data decoded by dcraw, as 16-bit values (with one spare row), or NULL on error */
+static void* load_raw_dcraw(char* filename, int* raw_width, int* raw_height, int* out_width, int* out_height)
+{
+    int r;
+    char dcraw_cmd[1000];
+    snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -v -i -t 0 \"%s\"", filename);
+    FILE* t = popen(dcraw_cmd, "r");
+    CHECK(t, "%s", filename);
+
+    *raw_width = *raw_height = 0;
+    *out_width = *out_height = 0;
+    
+    char line[100];
+    while (fgets(line, sizeof(line), t))
+    {
+        if (startswith(line, "Full size: "))
+        {
+            r = sscanf(line, "Full size: %d x %d\n", raw_width, raw_height);
+            CHECK(r == 2, "sscanf");
+        }
+        else if (startswith(line, "Output size: "))
+        {
+            r = sscanf(line, "Output size: %d x %d\n", out_width, out_height);
+            CHECK(r == 2, "sscanf");
+        }
+    }
+    pclose(t);
+    
+    if (*raw_width == 0)
+    {
+        printf("dcraw could not open this file\n");
+        return 0;
+    }
+
+    snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -4 -E -c -t 0 \"%s\"", filename);
+    FILE* fp = popen(dcraw_cmd, "r");
+    CHECK(fp, "%s", filename);
+    #ifdef _O_BINARY
+    _setmode(_fileno(fp), _O_BINARY);
+    #endif
+
+    /* PGM read code from dcraw */
+      int dim[3]={0,0,0}, comment=0, number=0, error=0, nd=0, c;
+
+      if (fgetc(fp) != 'P' || fgetc(fp) != '5') error = 1;
+      while (!error && nd < 3 && (c = fgetc(fp)) != EOF) {
+        if (c == '#')  comment = 1;
+        if (c == '\n') comment = 0;
+        if (comment) continue;
+        if (isdigit(c)) number = 1;
+        if (number) {
+          if (isdigit(c)) dim[nd] = dim[nd]*10 + c -'0';
+          else if (isspace(c)) {
+        number = 0;  nd++;
+          } else error = 1;
         }
+      }
 
-        char dcraw_cmd[1000];
-        snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -v -i -t 0 \"%s\"", filename);
-        FILE* t = popen(dcraw_cmd, "r");
-        CHECK(t, "%s", filename);
-        
-        const char * model = get_camera_model(filename);
-        get_raw_info(model, &raw_info);
+    if (error || nd < 3)
+    {
+        pclose(fp);
+        printf("dcraw output is not a valid PGM file\n");
+        return 0;
+    }
 
-        int raw_width = 0, raw_height = 0;
-        int out_width = 0, out_height = 0;
-        
-        char line[100];
-        while (fgets(line, sizeof(line), t))
+    int width = dim[0];
+    int height = dim[1];
+    CHECK(width == *raw_width, "pgm width");
+    CHECK(height == *raw_height, "pgm height");
+
+    void* buf = malloc(width * (height+1) * 2); /* 1 extra line for handling GBRG easier */
+    int size = fread(buf, 1, width * height * 2, fp);
+    CHECK(size == width * height * 2, "fread");
+    pclose(fp);
+
+    /* PGM is big endian, need to reverse it */
+    reverse_bytes_order(buf, width * height * 2);
+    return buf;
+}
+
+/* returns 1 if the file was converted; black and white are the output levels (for --same-levels) */
+static int convert_file(char* filename, int* black, int* white)
+{
+    printf("\nInput file      : %s\n", filename);
+
+    /* the dithering noise starts over for each file, so the output does not depend on the other input files */
+    fast_randn_reset();
+    profile_start(&prof, filename, -1);
+    int ok = 0;
+    int len = strlen(filename);
+
+    char orig_filename[1000]; orig_filename[0] = 0;
+    char out_filename[1000];
+
+    if (strcmp(filename+len-4, ".DNG") == 0)
+    {
+        /* this DNG might have embedded CR2 data inside */
+        /* note: we only save uppercase .DNGs, so a case-sensitive extension check should be fine */
+
+        if (dng_has_original_raw(filename))
         {
-            if (startswith(line, "Full size: "))
+            snprintf(orig_filename, sizeof(orig_filename), "%s", filename);
+            orig_filename[len-3] = 'C';
+            orig_filename[len-2] = 'R';
+            orig_filename[len-1] = '2';
+            
+            if (is_file(orig_filename))
             {
-                r = sscanf(line, "Full size: %d x %d\n", &raw_width, &raw_height);
-                CHECK(r == 2, "sscanf");
+                printf("Already exists  : %s (error)\n", orig_filename);
+                return 0;
             }
-            else if (startswith(line, "Output size: "))
+
+            if (extract_original_raw(filename, orig_filename))
             {
-                r = sscanf(line, "Output size: %d x %d\n", &out_width, &out_height);
-                CHECK(r == 2, "sscanf");
+                /* use the extracted CR2 as input */
+                filename = orig_filename;
+            }
+            else
+            {
+                /* error message was already printed, now just skip this file */
+                return 0;
             }
         }
-        pclose(t);
-        
-        if (raw_width == 0)
-        {
-            printf("dcraw could not open this file\n");
-            continue;
-        }
+    }
 
-        printf("Full size       : %d x %d\n", raw_width, raw_height);
-        printf("Active area     : %d x %d\n", out_width, out_height);
-        
-        int left_margin = raw_width - out_width;
-        int top_margin = raw_height - out_height;
-
-        snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -4 -E -c -t 0 \"%s\"", filename);
-        FILE* fp = popen(dcraw_cmd, "r");
-        CHECK(fp, "%s", filename);
-        #ifdef _O_BINARY
-        _setmode(_fileno(fp), _O_BINARY);
-        #endif
+    snprintf(out_filename, sizeof(out_filename), "%s", filename);
+    out_filename[len-3] = 'D';
+    out_filename[len-2] = 'N';
+    out_filename[len-1] = 'G';
+    
+    /* note: skip_existing will be ignored if we are working on a DNG file with embedded RAW */
+    if (skip_existing && is_file(out_filename) && !orig_filename[0])
+    {
+        printf("Already exists  : %s (skipping)\n", out_filename);
+        return 0;
+    }
 
-        /* PGM read code from dcraw */
-          int dim[3]={0,0,0}, comment=0, number=0, error=0, nd=0, c;
+    profile_next_step("decode", file_size(filename));
+    const char * model = get_camera_model(filename);
+    get_raw_info(model, &raw_info);
 
-          if (fgetc(fp) != 'P' || fgetc(fp) != '5') error = 1;
-          while (!error && nd < 3 && (c = fgetc(fp)) != EOF) {
-            if (c == '#')  comment = 1;
-            if (c == '\n') comment = 0;
-            if (comment) continue;
-            if (isdigit(c)) number = 1;
-            if (number) {
-              if (isdigit(c)) dim[nd] = dim[nd]*10 + c -'0';
-              else if (isspace(c)) {
-            number = 0;  nd++;
-              } else error = 1;
-            }
-          }
+    int raw_width = 0, raw_height = 0;
+    int out_width = 0, out_height = 0;
+    void* buf = 0;
 
-        if (error || nd < 3)
-        {
-            pclose(fp);
-            printf("dcraw output is not a valid PGM file\n");
-            continue;
-        }
+    if (!use_dcraw)
+        buf = load_cr2_raw(filename, &raw_width, &raw_height, &out_width, &out_height);
 
-        int width = dim[0];
-        int height = dim[1];
-        CHECK(width == raw_width, "pgm width");
-        CHECK(height == raw_height, "pgm height");
+    if (!buf)
+        buf = load_raw_dcraw(filename, &raw_width, &raw_height, &out_width, &out_height);
 
-        void* buf = malloc(width * (height+1) * 2); /* 1 extra line for handling GBRG easier */
-        int size = fread(buf, 1, width * height * 2, fp);
-        CHECK(size == width * height * 2, "fread");
-        pclose(fp);
+    if (!buf)
+    {
+        profile_next_step(0, 0);
+        profile_report(&prof);
+        return 0;
+    }
 
-        /* PGM is big endian, need to reverse it */
-        reverse_bytes_order(buf, width * height * 2);
+    printf("Full size       : %d x %d\n", raw_width, raw_height);
+    printf("Active area     : %d x %d\n", out_width, out_height);
+    
+    int left_margin = raw_width - out_width;
+    int top_margin = raw_height - out_height;
+    int width = raw_width;
+    int height = raw_height;
 
-        raw_info.buffer = buf;
-        
-        /* did we read the PGM correctly? (right byte order etc) */
-        //~ for (int i = 0; i < 10; i++)
-            //~ printf("%d ", raw_get_pixel16(i, 0));
-        //~ printf("\n");
-        
-        raw_info.black_level = 2048;
-        raw_info.white_level = 15000;
-
-        raw_info.width = width;
-        raw_info.height = height;
-        raw_info.pitch = width * 2;
-        raw_info.frame_size = raw_info.height * raw_info.pitch;
-
-        raw_info.active_area.x1 = left_margin;
-        raw_info.active_area.x2 = raw_info.width;
-        raw_info.active_area.y1 = top_margin;
-        raw_info.active_area.y2 = raw_info.height;
-        raw_info.jpeg.x = 0;
-        raw_info.jpeg.y = 0;
-        raw_info.jpeg.width = raw_info.width - left_margin;
-        raw_info.jpeg.height = raw_info.height - top_margin;
-        
-        dng_set_thumbnail_size(384, 252);
+    raw_info.buffer = buf;
+    
+    /* did we read the PGM correctly? (right byte order etc) */
+    //~ for (int i = 0; i < 10; i++)
+        //~ printf("%d ", raw_get_pixel16(i, 0));
+    //~ printf("\n");
+    
+    raw_info.black_level = 2048;
+    raw_info.white_level = 15000;
+
+    raw_info.width = width;
+    raw_info.height = height;
+    raw_info.pitch = width * 2;
+    raw_info.frame_size = raw_info.height * raw_info.pitch;
+
+    raw_info.active_area.x1 = left_margin;
+    raw_info.active_area.x2 = raw_info.width;
+    raw_info.active_area.y1 = top_margin;
+    raw_info.active_area.y2 = raw_info.height;
+    raw_info.jpeg.x = 0;
+    raw_info.jpeg.y = 0;
+    raw_info.jpeg.width = raw_info.width - left_margin;
+    raw_info.jpeg.height = raw_info.height - top_margin;
+    
+    dng_set_thumbnail_size(384, 252);
+
+    profile_next_step("hdr_check", raw_info.frame_size);
+    if (hdr_check())
+    {
+        profile_next_step("black_subtract", raw_info.frame_size);
+        if (!black_subtract(left_margin, top_margin))
+            printf("Black subtract didn't work\n");
 
-        if (hdr_check())
+        if (hdr_interpolate())
         {
-            if (!black_subtract(left_margin, top_margin))
-                printf("Black subtract didn't work\n");
+            reverse_bytes_order(raw_info.buffer, raw_info.frame_size);
 
-            if (hdr_interpolate())
+            /* This option doesn't really work, since Canon WB is broken with Dual ISO. */
+            if (exif_wb)
             {
-                reverse_bytes_order(raw_info.buffer, raw_info.frame_size);
-
-                /* This option doesn't really work, since Canon WB is broken with Dual ISO. */
-                if (exif_wb)
+                float red_balance = -1, blue_balance = -1;
+                read_white_balance(filename, &red_balance, &blue_balance);
+                if ((red_balance > 0) && (blue_balance > 0))
                 {
-                    float red_balance = -1, blue_balance = -1;
-                    read_white_balance(filename, &red_balance, &blue_balance);
-                    if ((red_balance > 0) && (blue_balance > 0))
-                    {
-                        dng_set_wbgain(1000000, red_balance*1000000, 1, 1, 1000000, blue_balance*1000000);
-                        printf("AsShotNeutral   : %.2f 1 %.2f\n", 1/red_balance, 1/blue_balance);
-                    }
-                    else
-                    {
-                        printf("AsShotNeutral   : (using default values)\n");
-                    }
+                    dng_set_wbgain(1000000, red_balance*1000000, 1, 1, 1000000, blue_balance*1000000);
+                    printf("AsShotNeutral   : %.2f 1 %.2f\n", 1/red_balance, 1/blue_balance);
                 }
-                
-                char renamed_filename[1000];
-                char* old_filename = 0;
-                if (strcasecmp(filename, out_filename) == 0)
+                else
                 {
-                    /* if the filesystem is not case-sensitive, we will overwrite the input file */
-                    /* I don't know how to detect this in a portable way, so I'll rename the input file just in case */
-                    /* if no overwriting takes place, the renaming will be undone */
-                    //~ printf("Might overwrite input file.\n");
-                    snprintf(renamed_filename, sizeof(renamed_filename), "%s", filename);
-                    int len = strlen(renamed_filename);
-                    renamed_filename[len-1] = '6';
-                    rename(filename, renamed_filename);
-                    old_filename = filename;
-                    filename = renamed_filename;
+                    printf("AsShotNeutral   : (using default values)\n");
                 }
+            }
+            
+            char renamed_filename[1000];
+            char* old_filename = 0;
+            if (strcasecmp(filename, out_filename) == 0)
+            {
+                /* if the filesystem is not case-sensitive, we will overwrite the input file */
+                /* I don't know how to detect this in a portable way, so I'll rename the input file just in case */
+                /* if no overwriting takes place, the renaming will be undone */
+                //~ printf("Might overwrite input file.\n");
+                snprintf(renamed_filename, sizeof(renamed_filename), "%s", filename);
+                int len = strlen(renamed_filename);
+                renamed_filename[len-1] = '6';
+                rename(filename, renamed_filename);
+                old_filename = filename;
+                filename = renamed_filename;
+            }
 
-                if (orig_filename[0])
-                {
-                    dng_backup_metadata(out_filename);
-                }
+            if (orig_filename[0])
+            {
+                dng_backup_metadata(out_filename);
+            }
+
+            printf("Output file     : %s %s\n", out_filename, is_file(out_filename) ? "(already exists, overwriting)" : "");
+            /* without exiftool, the tags are set up before saving */
+            profile_next_step("tags", 0);
+            int tags_ok = !use_exiftool && set_dng_tags_from_source(filename);
 
-                printf("Output file     : %s %s\n", out_filename, is_file(out_filename) ? "(already exists, overwriting)" : "");
-                save_dng(out_filename);
+            profile_next_step("save_dng", 0);
+            save_dng(out_filename);
+            prof_bytes = file_size(out_filename);
 
+            if (!tags_ok)
+            {
+                profile_next_step("tags", 0);
                 copy_tags_from_source(filename, out_filename);
+            }
 
-                if (orig_filename[0])
-                {
-                    dng_restore_metadata(out_filename);
-                }
-                
-                if (compress)
-                {
-                    dng_compress(out_filename, compress-1);
-                }
-                
-                if (embed_original || orig_filename[0])
+            if (orig_filename[0])
+            {
+                dng_restore_metadata(out_filename);
+            }
+            
+            if (compress == 2)
+            {
+                profile_next_step("compress", file_size(out_filename));
+                dng_compress(out_filename, compress-1);
+            }
+            
+            if (embed_original || orig_filename[0])
+            {
+                /* this will move the input file into the DNG (and maybe delete the original) */
+                profile_next_step("embed_original", file_size(filename));
+                int delete_original = (embed_original != 2);
+                embed_original_raw(out_filename, filename, delete_original);
+            }
+
+            if (old_filename && is_file(renamed_filename))
+            {
+                if (!is_file(old_filename))
                 {
-                    /* this will move the input file into the DNG (and maybe delete the original) */
-                    int delete_original = (embed_original != 2);
-                    embed_original_raw(out_filename, filename, delete_original);
+                    /* input file not overwritten, undo renaming */
+                    rename(renamed_filename, old_filename);
                 }
-
-                if (old_filename && is_file(renamed_filename))
+                else
                 {
-                    if (!is_file(old_filename))
-                    {
-                        /* input file not overwritten, undo renaming */
-                        rename(renamed_filename, old_filename);
-                    }
-                    else
-                    {
-                        /* output file would overwrite the input file */
-                        unlink(renamed_filename);
-                    }
+                    /* output file would overwrite the input file */
+                    unlink(renamed_filename);
                 }
-
-                /* record black and white levels */
-                file_indices[num_files] = k;
-                blacks[num_files] = raw_info.black_level;
-                whites[num_files] = raw_info.white_level;
-                num_files++;
-            }
-            else
-            {
-                printf("ISO blending didn't work\n");
             }
+
+            /* record black and white levels */
+            *black = raw_info.black_level;
+            *white = raw_info.white_level;
+            ok = 1;
         }
         else
         {
-            printf("Doesn't look like interlaced ISO\n");
+            printf("ISO blending didn't work\n");
         }
+    }
+    else
+    {
+        printf("Doesn't look like interlaced ISO\n");
+    }
 
-        free(buf);
+    free(buf);
+    profile_next_step(0, 0);
+    profile_report(&prof);
+    return ok;
+}
+
+/* Dual ISO video: a MLV clip is converted to a DNG sequence (M12-1234.MLV -> M12-1234_000000.DNG ...) */
+/* the calibration (see clip_calib) is measured on a few frames spread over the clip and reused for all frames */
+static struct mlv_clip clip;
+
+static void mlv_frame_filename(int index, char* out, int size)
+{
+    int len = strlen(clip.filename);
+    snprintf(out, size, "%.*s_%06d.DNG", len - 4, clip.filename, index);
+}
+
+static void* load_mlv_frame(int index)
+{
+    void* buf = mlv_clip_read_frame(&clip, index);
+    if (!buf)
+        return 0;
+
+    raw_info.buffer = buf;
+    raw_info.black_level = clip.black_level;
+    raw_info.white_level = clip.white_level;
+
+    raw_info.width = clip.width;
+    raw_info.height = clip.height;
+    raw_info.pitch = clip.width * 2;
+    raw_info.frame_size = raw_info.height * raw_info.pitch;
+
+    raw_info.active_area.x1 = clip.x1;
+    raw_info.active_area.x2 = clip.x2;
+    raw_info.active_area.y1 = clip.y1;
+    raw_info.active_area.y2 = clip.y2;
+    raw_info.jpeg.x = 0;
+    raw_info.jpeg.y = 0;
+    raw_info.jpeg.width = clip.x2 - clip.x1;
+    raw_info.jpeg.height = clip.y2 - clip.y1;
+
+    return buf;
+}
+
+static int convert_mlv_frame(int index, int* black, int* white)
+{
+    char out_filename[1000];
+    mlv_frame_filename(index, out_filename, sizeof(out_filename));
+
+    printf("\nInput frame     : %s #%d\n", clip.filename, index);
+
+    /* same as for files, the output does not depend on the other frames */
+    fast_randn_reset();
+    int ok = 0;
+
+    if (skip_existing && is_file(out_filename))
+    {
+        printf("Already exists  : %s (skipping)\n", out_filename);
+        return 0;
     }
-    
-    if (same_levels && num_files > 1)
+
+    profile_start(&prof, clip.filename, index);
+    profile_next_step("decode", clip.frames[index].size);
+    void* buf = load_mlv_frame(index);
+    if (!buf)
     {
-        /* Equalize white-black for all shots.
-         * 
-         * Assuming all the pictures were shot at the same exposure settings,
-         * this step will make sure they are all rendered identically (without flicker).
-         * 
-         * However, for this to work, all the files must be passed in the same command line.
-         * 
-         * We will use something close to maximum range among all files (with outlier filter).
-         * 
-         * This should work even if the black level is not the same in all shots.
-         */
-        
-        printf("\nEqualizing levels...\n");
-        
-        int* ranges = malloc(num_files * sizeof(ranges[0]));
-        for (int i = 0; i < num_files; i++)
-        {
-            ranges[i] = whites[i] - blacks[i];
-        }
-        int new_range = kth_smallest_int(ranges, num_files, num_files * 8 / 9 - 1);
+        profile_next_step(0, 0);
+        profile_report(&prof);
+        return 0;
+    }
 
-        for (int i = 0; i < num_files; i++)
-        {
-            char* input_file = argv[file_indices[i]];
+    /* no hdr_check: the clip was already recognized as Dual ISO during calibration */
+    profile_next_step("black_subtract", raw_info.frame_size);
+    if (!black_subtract(clip.x1, clip.y1))
+        printf("Black subtract didn't work\n");
 
-            /* fixme: duplicate code */
-            char out_filename[1000];
-            snprintf(out_filename, sizeof(out_filename), "%s", input_file);
-            int len = strlen(out_filename);
-            out_filename[len-3] = 'D';
-            out_filename[len-2] = 'N';
-            out_filename[len-1] = 'G';
+    if (hdr_interpolate())
+    {
+        reverse_bytes_order(raw_info.buffer, raw_info.frame_size);
+
+        printf("Output file     : %s %s\n", out_filename, is_file(out_filename) ? "(already exists, overwriting)" : "");
+        profile_next_step("save_dng", 0);
+        mlv_clip_set_dng_tags(&clip);
+        save_dng(out_filename);
+        prof_bytes = file_size(out_filename);
 
-            int new_white = blacks[i] + new_range;
-            printf("%-16s: %d ... %d\n", out_filename, blacks[i], new_white);
-            set_white_level(out_filename, new_white);
+        if (compress == 2)
+        {
+            profile_next_step("compress", prof_bytes);
+            dng_compress(out_filename, compress-1);
         }
-        
-        free(ranges);
+
+        *black = raw_info.black_level;
+        *white = raw_info.white_level;
+        ok = 1;
     }
-    
-    free(whites);
-    free(blacks);
-    free(file_indices);
-    
-    return 0;
+    else
+    {
+        printf("ISO blending didn't work\n");
+    }
+
+    free(buf);
+    profile_next_step(0, 0);
+    profile_report(&prof);
+    return ok;
 }
 
-static void white_detect(int* white_dark, int* white_bright)
+/* measures the calibration on frames spread over the clip and locks the median values */
+static int calibrate_clip()
 {
-    /* sometimes the white level is much lower than 15000; this would cause pink highlights */
-    /* workaround: consider the white level as a little under the maximum pixel value from the raw file */
-    /* caveat: bright and dark exposure may have different white levels, so we'll take the minimum value */
-    /* side effect: if the image is not overexposed, it may get brightened a little; shouldn't hurt */
-    
-    int whites[2]         = {  0,    0};
-    int discard_pixels[2] = { 10,   50}; /* discard the brightest N pixels */
-    int safety_margins[2] = {100, 1500}; /* use a higher safety margin for the higher ISO */
-    /* note: with the high-ISO WL underestimated by 1500, you would lose around 0.15 EV of non-aliased detail */
+    int n = MIN(MAX(mlv_calib_frames, 1), clip.num_frames);
+    double* a = malloc(n * sizeof(a[0]));
+    double* b = malloc(n * sizeof(b[0]));
+    int* whites = malloc(n * sizeof(whites[0]));
+    int* whites_bright = malloc(n * sizeof(whites_bright[0]));
+    int* order = malloc(n * sizeof(order[0]));
+    int pattern[4];
+    int num = 0;
+
+    clip_calib.locked = 0;
+    clip_calib.measure_only = 1;
+
+    /* --profile=json: all the calibration frames are reported together, as frame -1 */
+    profile_start(&prof, clip.filename, -1);
+
+    for (int k = 0; k < n; k++)
+    {
+        /* middle of the k-th part of the clip */
+        int index = (2*k + 1) * clip.num_frames / (2*n);
+        printf("\nCalibration     : %s #%d\n", clip.filename, index);
+        fast_randn_reset();
+
+        profile_next_step("decode", clip.frames[index].size);
+        void* buf = load_mlv_frame(index);
+        if (!buf)
+            continue;
+
+        profile_next_step("hdr_check", raw_info.frame_size);
+        if (!hdr_check())
+        {
+            printf("Doesn't look like interlaced ISO\n");
+        }
+        else
+        {
+            profile_next_step("black_subtract", raw_info.frame_size);
+            black_subtract(clip.x1, clip.y1);
+
+            if (hdr_interpolate())
+            {
+                if (num == 0)
+                    memcpy(pattern, clip_calib.is_bright, sizeof(pattern));
+
+                if (memcmp(pattern, clip_calib.is_bright, sizeof(pattern)))
+                {
+                    printf("ISO pattern different from the first calibration frame, ignoring\n");
+                }
+                else
+                {
+                    a[num] = clip_calib.a;
+                    b[num] = clip_calib.b;
+                    whites[num] = clip_calib.white;
+                    whites_bright[num] = clip_calib.white_bright;
+                    order[num] = num;
+                    num++;
+                }
+            }
+        }
+
+        free(buf);
+    }
+
+    clip_calib.measure_only = 0;
+    profile_next_step(0, 0);
+    profile_report(&prof);
+
+    if (num)
+    {
+        /* the offset belongs to the slope it was fitted with, so both come from the frame with the median slope */
+        #define slope_lt(i,j) (a[*(i)] < a[*(j)])
+        QSORT(int, order, num, slope_lt);
+        #undef slope_lt
+
+        int m = order[num/2];
+        memcpy(clip_calib.is_bright, pattern, sizeof(pattern));
+        clip_calib.a = a[m];
+        clip_calib.b = b[m];
+        clip_calib.white = kth_smallest_int(whites, num, num/2);
+        clip_calib.white_bright = kth_smallest_int(whites_bright, num, num/2);
+        clip_calib.locked = 1;
+
+        printf("\nClip calibration: %c%c%c%c, white %d %d, ISO difference %.2f EV, black delta %.2f (from %d frames)\n",
+            pattern[0] ? 'B' : 'd', pattern[1] ? 'B' : 'd', pattern[2] ? 'B' : 'd', pattern[3] ? 'B' : 'd',
+            clip_calib.white, clip_calib.white_bright, -log2(clip_calib.a), clip_calib.b/4, num
+        );
+    }
+    else
+    {
+        printf("\nCould not calibrate %s\n", clip.filename);
+    }
+
+    free(order);
+    free(whites_bright);
+    free(whites);
+    free(b);
+    free(a);
+    return num > 0;
+}
+
+#if !defined(__WIN32)
+struct convert_result
+{
+    int index;
+    int black;
+    int white;
+};
+
+/* batch mode: convert items 0 ... count-1 (files or video frames) in num_jobs worker processes, each one taking every num_jobs'th item */
+/* (the processing steps work on global state, so images can't be processed by threads of the same process) */
+/* the results are passed back to the parent through a pipe */
+static void convert_in_workers(int num_jobs, int count, int (*convert)(int index, int* black, int* white), void (*worker_init)(), int* converted, int* blacks, int* whites)
+{
+    int results[2];
+    CHECK(pipe(results) == 0, "pipe");
+    fflush(stdout);
+
+    pid_t* workers = malloc(num_jobs * sizeof(workers[0]));
+    int started = 0;
+
+    for (int j = 0; j < num_jobs; j++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(results[0]);
+
+            /* write the log of each file in one piece, so the outputs of the workers don't get mixed */
+            setvbuf(stdout, 0, _IOFBF, 65536);
+
+            if (worker_init)
+                worker_init();
+
+            for (int i = j; i < count; i += num_jobs)
+            {
+                struct convert_result r = { .index = i };
+                if (convert(i, &r.black, &r.white))
+                    CHECK(write(results[1], &r, sizeof(r)) == sizeof(r), "write");
+                fflush(stdout);
+            }
+            profile_summary();
+            exit(0);
+        }
+
+        if (pid < 0)
+        {
+            /* convert the remaining items ourselves */
+            printf("Could not start worker %d, converting its files here\n", j);
+            for (int i = j; i < count; i++)
+                if ((i % num_jobs) >= j)
+                    converted[i] = convert(i, &blacks[i], &whites[i]);
+            break;
+        }
+
+        workers[started++] = pid;
+    }
+
+    close(results[1]);
+
+    struct convert_result r;
+    while (read(results[0], &r, sizeof(r)) == sizeof(r))
+    {
+        converted[r.index] = 1;
+        blacks[r.index] = r.black;
+        whites[r.index] = r.white;
+    }
+    close(results[0]);
+
+    for (int j = 0; j < started; j++)
+    {
+        int status = 0;
+        waitpid(workers[j], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            printf("Worker %d failed, some files may not have been converted\n", j);
+    }
+
+    free(workers);
+}
+
+static int convert_input_file(int index, int* black, int* white)
+{
+    return convert_file(input_files[index], black, white);
+}
+
+/* the workers must not share the file offsets of the parent */
+static void mlv_worker_init()
+{
+    mlv_clip_reopen(&clip);
+}
+
+/* the workers take the frames after the first converted one */
+static int mlv_first_worker_frame = 0;
+
+static int convert_mlv_worker_frame(int index, int* black, int* white)
+{
+    return convert_mlv_frame(mlv_first_worker_frame + index, black, white);
+}
+#endif
+
+static void equalize_levels(char** out_filenames, int* blacks, int* whites, int num_files);
+
+static void convert_mlv(char* filename)
+{
+    printf("\nInput clip      : %s\n", filename);
+
+    if (!mlv_clip_open(&clip, filename))
+        return;
+
+    printf("Frames          : %d (%d x %d, %d-bit%s)\n", clip.num_frames, clip.width, clip.height, clip.bits_per_pixel,
+        (clip.video_class & MLV_VIDEO_CLASS_FLAG_LJ92) ? ", lossless" : "");
+
+    if (!clip.dual_iso)
+        printf("No Dual ISO info in the clip, trying anyway\n");
+
+    /* IDNT has the full name, e.g. "Canon EOS 5D Mark III" */
+    char* model = clip.camera;
+    if (strncmp(model, "Canon ", 6) == 0)
+        model += 6;
+    get_raw_info(model, &raw_info);
+
+    dng_set_thumbnail_size(384, 252);
+    dng_set_sequence(1);
+
+    int n = clip.num_frames;
+    int* converted = malloc(n * sizeof(converted[0]));
+    int* blacks = malloc(n * sizeof(blacks[0]));
+    int* whites = malloc(n * sizeof(whites[0]));
+    memset(converted, 0, n * sizeof(converted[0]));
+
+    if (!calibrate_clip())
+        goto end;
+
+    /* the white balance is measured on the first converted frame and kept for the others, */
+    /* so the frames before the first successful one are converted here (before starting the workers) */
+    int first = 0;
+    while (first < n && !(converted[first] = convert_mlv_frame(first, &blacks[first], &whites[first])))
+        first++;
+    first++;
+
+    int jobs = MIN(num_jobs, n - first);
+
+#if defined(__WIN32)
+    jobs = 1;
+#else
+    if (jobs > 1)
+    {
+        /* share the CPUs between the workers, unless the number of threads was given */
+        if (num_threads == 0)
+            parallel_set_threads(MAX(1, parallel_get_threads() / jobs));
+
+        mlv_first_worker_frame = first;
+        convert_in_workers(jobs, n - first, convert_mlv_worker_frame, mlv_worker_init, converted + first, blacks + first, whites + first);
+
+        /* restore the setting for the next inputs */
+        parallel_set_threads(num_threads);
+    }
+#endif
+
+    if (jobs <= 1)
+    {
+        for (int i = first; i < n; i++)
+            converted[i] = convert_mlv_frame(i, &blacks[i], &whites[i]);
+    }
+
+    if (same_levels)
+    {
+        char** out_filenames = malloc(n * sizeof(out_filenames[0]));
+        int num_files = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (converted[i])
+            {
+                out_filenames[num_files] = malloc(1000);
+                mlv_frame_filename(i, out_filenames[num_files], 1000);
+                blacks[num_files] = blacks[i];
+                whites[num_files] = whites[i];
+                num_files++;
+            }
+        }
+
+        if (num_files > 1)
+            equalize_levels(out_filenames, blacks, whites, num_files);
+
+        for (int i = 0; i < num_files; i++)
+            free(out_filenames[i]);
+        free(out_filenames);
+    }
+
+end:
+    dng_set_sequence(0);
+    clip_calib.locked = 0;
+    free(whites);
+    free(blacks);
+    free(converted);
+    mlv_clip_close(&clip);
+}
+
+static void equalize_levels(char** out_filenames, int* blacks, int* whites, int num_files)
+{
+    /* Equalize white-black for all shots.
+     * 
+     * Assuming all the pictures were shot at the same exposure settings,
+     * this step will make sure they are all rendered identically (without flicker).
+     * 
+     * However, for this to work, all the files must be passed in the same command line.
+     * 
+     * We will use something close to maximum range among all files (with outlier filter).
+     * 
+     * This should work even if the black level is not the same in all shots.
+     */
+    
+    printf("\nEqualizing levels...\n");
+    
+    int* ranges = malloc(num_files * sizeof(ranges[0]));
+    for (int i = 0; i < num_files; i++)
+    {
+        ranges[i] = whites[i] - blacks[i];
+    }
+    int new_range = kth_smallest_int(ranges, num_files, num_files * 8 / 9 - 1);
+
+    for (int i = 0; i < num_files; i++)
+    {
+        int new_white = blacks[i] + new_range;
+        printf("%-16s: %d ... %d\n", out_filenames[i], blacks[i], new_white);
+        set_white_level(out_filenames[i], new_white);
+    }
+    
+    free(ranges);
+}
+
+int main(int argc, char** argv)
+{
+    printf("cr2hdr: a post processing tool for Dual ISO images\n\n");
+    printf("Last update: %s\n", module_get_string(dual_iso_strings, "Last update"));
+
+    fast_randn_init();
+
+    if (argc == 1)
+    {
+        printf("No input files.\n\n");
+        printf("GUI usage: drag some CR2 or DNG files over cr2hdr.exe.\n\n");
+        show_commandline_help(argv[0]);
+        return 0;
+    }
+    
+    /* parse all command-line options */
+    for (int k = 1; k < argc; k++)
+        if (argv[k][0] == '-')
+            parse_commandline_option(argv[k]);
+    
+    solve_commandline_deps();
+    show_active_options();
+
+    /* lossless compression is done while saving, lossy compression by Adobe DNG Converter afterwards */
+    if (compress == 1)
+        dng_set_compression(&lj92_encode, 256, 256);
+
+    if (profile_json)
+        profile_init("cr2hdr", 0);
+    
+    /* all other arguments are input files, directories or @file lists */
+    for (int k = 1; k < argc; k++)
+    {
+        if (argv[k][0] == '-')
+            continue;
+
+        if (argv[k][0] == '@')
+            add_input_list(argv[k] + 1);
+        else
+            add_input_path(argv[k]);
+    }
+
+    /* video clips are converted one by one (each clip to a DNG sequence), the workers process the frames of a clip */
+    int num_photos = 0;
+    for (int i = 0; i < num_input_files; i++)
+    {
+        if (has_extension(input_files[i], ".MLV"))
+            convert_mlv(input_files[i]);
+        else
+            input_files[num_photos++] = input_files[i];
+    }
+    num_input_files = num_photos;
+
+    /* keep track of black and white levels (useful for deflicker) */
+    int* converted = malloc(MAX(num_input_files, 1) * sizeof(converted[0]));
+    int* blacks = malloc(MAX(num_input_files, 1) * sizeof(blacks[0]));
+    int* whites = malloc(MAX(num_input_files, 1) * sizeof(whites[0]));
+    memset(converted, 0, MAX(num_input_files, 1) * sizeof(converted[0]));
+
+    int jobs = MIN(num_jobs, num_input_files);
+
+#if defined(__WIN32)
+    if (jobs > 1)
+    {
+        printf("--jobs is not available on Windows, converting one file at a time.\n");
+        jobs = 1;
+    }
+#else
+    if (jobs > 1)
+    {
+        /* share the CPUs between the workers, unless the number of threads was given */
+        if (num_threads == 0)
+            parallel_set_threads(MAX(1, parallel_get_threads() / jobs));
+
+        convert_in_workers(jobs, num_input_files, convert_input_file, 0, converted, blacks, whites);
+    }
+#endif
+
+    if (jobs <= 1)
+    {
+        for (int i = 0; i < num_input_files; i++)
+            converted[i] = convert_file(input_files[i], &blacks[i], &whites[i]);
+    }
+
+    /* only the converted files, in input order */
+    char** out_filenames = malloc(MAX(num_input_files, 1) * sizeof(out_filenames[0]));
+    int num_files = 0;
+    for (int i = 0; i < num_input_files; i++)
+    {
+        if (converted[i])
+        {
+            /* fixme: duplicate code */
+            out_filenames[num_files] = malloc(1000);
+            snprintf(out_filenames[num_files], 1000, "%s", input_files[i]);
+            int len = strlen(out_filenames[num_files]);
+            out_filenames[num_files][len-3] = 'D';
+            out_filenames[num_files][len-2] = 'N';
+            out_filenames[num_files][len-1] = 'G';
+
+            blacks[num_files] = blacks[i];
+            whites[num_files] = whites[i];
+            num_files++;
+        }
+    }
+    
+    if (same_levels && num_files > 1)
+    {
+        equalize_levels(out_filenames, blacks, whites, num_files);
+    }
+    
+    for (int i = 0; i < num_files; i++)
+        free(out_filenames[i]);
+    free(out_filenames);
+    free(whites);
+    free(blacks);
+    free(converted);
+    
+    profile_summary();
+    return 0;
+}
+
+static void white_detect(int* white_dark, int* white_bright)
+{
+    /* sometimes the white level is much lower than 15000; this would cause pink highlights */
+    /* workaround: consider the white level as a little under the maximum pixel value from the raw file */
+    /* caveat: bright and dark exposure may have different white levels, so we'll take the minimum value */
+    /* side effect: if the image is not overexposed, it may get brightened a little; shouldn't hurt */
+
+    if (clip_calib.locked)
+    {
+        *white_dark = clip_calib.white;
+        *white_bright = clip_calib.white_bright;
+        return;
+    }
+    
+    int whites[2]         = {  0,    0};
+    int discard_pixels[2] = { 10,   50}; /* discard the brightest N pixels */
+    int safety_margins[2] = {100, 1500}; /* use a higher safety margin for the higher ISO */
+    /* note: with the high-ISO WL underestimated by 1500, you would lose around 0.15 EV of non-aliased detail */
     
     int* pixels[2];
     int max_pix = raw_info.width * raw_info.height / 2 / 9;
@@ -961,6 +1672,8 @@ static void white_detect(int* white_dark, int* white_bright)
     *white_bright = COERCE(whites[1], 5000, 16383);
     
     printf("White levels    : %d %d\n", *white_dark, *white_bright);
+    clip_calib.white = *white_dark;
+    clip_calib.white_bright = *white_bright;
 
     free(pixels[0]);
     free(pixels[1]);
@@ -1170,7 +1883,8 @@ static int black_subtract(int left_margin, int top_margin)
 }
 
 
-static int black_subtract_simple(int left_margin, int top_margin)
+/* raw_get_pixel: 20-bit pixels */
+static int black_subtract_simple(int left_margin, int top_margin, int (*raw_get_pixel)(int x, int y))
 {
     if (left_margin < 10) return 0;
     if (top_margin < 10) return 0;
@@ -1185,15 +1899,22 @@ static int black_subtract_simple(int left_margin, int top_margin)
     {
         for (int x = 16; x < left_margin - 16; x++)
         {
-            int p = raw_get_pixel20(x, y);
+            int p = raw_get_pixel(x, y);
             samples[num++] = p;
         }
     }
-    
+
+    /* video frames may have narrow margins */
+    if (num == 0)
+    {
+        free(samples);
+        return 0;
+    }
+
     int new_black = median_int_wirth(samples, num);
-    
+
     free(samples); samples = 0;
-        
+
     int black_delta = raw_info.black_level - new_black;
     
     printf("Black adjust    : %d\n", (int)black_delta);
@@ -1359,6 +2080,12 @@ static int identify_bright_and_dark_fields(int rggb)
     /* first we need to know which lines are dark and which are bright */
     /* the pattern is not always the same, so we need to autodetect it */
 
+    if (clip_calib.locked)
+    {
+        memcpy(is_bright, clip_calib.is_bright, sizeof(is_bright));
+        return 1;
+    }
+
     /* it may look like this */                       /* or like this */
     /*
                ab cd ef gh  ab cd ef gh               ab cd ef gh  ab cd ef gh
@@ -1518,45 +2245,29 @@ static int identify_bright_and_dark_fields(int rggb)
         printf("Interlacing method not supported\n");
         return 0;
     }
-    return 1;
-}
 
-#if 0
-typedef int (*CritFunc)(int);
-// crit returns negative if the tested value is too high, positive if too low, 0 if perfect
-
-static int bin_search(int lo, int hi, CritFunc crit)
-{
-    if (lo >= hi-1) return lo;
-    int m = (lo+hi)/2;
-    int c = crit(m);
-    if (c == 0) return m;
-    if (c > 0) return bin_search(m, hi, crit);
-    return bin_search(lo, m, crit);
+    memcpy(clip_calib.is_bright, is_bright, sizeof(is_bright));
+    return 1;
 }
-#endif
 
 static int mean2(int a, int b, int white, int* err);
 
-static int match_exposures(double* corr_ev, int* white_darkened)
+/* robust line fit between the bright and dark exposures: dark = bright * a + b (16-bit units, black subtracted) */
+/* raw_get_pixel: 16-bit pixels; only a 3x3 subsampled grid is read */
+static void fit_exposures(int black, int clip0, int clip, double* out_a, double* out_b, int (*raw_get_pixel)(int x, int y))
 {
-    /* guess ISO - find the factor and the offset for matching the bright and dark images */
-    int black20 = raw_info.black_level;
-    int white20 = MIN(raw_info.white_level, *white_darkened);
-    int black = black20/16;
-    int white = white20/16;
-    int clip0 = white - black;
-    int clip  = clip0 * 0.95;    /* there may be nonlinear response in very bright areas */
-
     int w = raw_info.width;
     int h = raw_info.height;
     int y0 = raw_info.active_area.y1 + 2;
 
-    /* quick interpolation for matching */
-    int* dark   = malloc(w * h * sizeof(dark[0]));
-    int* bright = malloc(w * h * sizeof(bright[0]));
-    memset(dark, 0, w * h * sizeof(dark[0]));
-    memset(bright, 0, w * h * sizeof(bright[0]));
+    /* quick interpolation for matching, only stored on the sampling grid */
+    /* (x,y) with x multiple of 3 and y = y0 + multiple of 3 is at (x/3 + (y-y0)/3 * gw); the plot below uses the same grid */
+    int gw = (w + 2) / 3;
+    int gh = MAX(0, (h - 2 - y0 + 2) / 3);
+    int gy0 = y0;
+    #define GRID(x,y) ((x)/3 + ((y)-gy0)/3 * gw)
+    int* dark   = malloc(MAX(gw * gh, 1) * sizeof(dark[0]));
+    int* bright = malloc(MAX(gw * gh, 1) * sizeof(bright[0]));
     
     for (int y = y0; y < h-2; y += 3)
     {
@@ -1565,14 +2276,14 @@ static int match_exposures(double* corr_ev, int* white_darkened)
 
         for (int x = 0; x < w; x += 3)
         {
-            int pa = raw_get_pixel_20to16(x, y-2) - black;
-            int pb = raw_get_pixel_20to16(x, y+2) - black;
-            int pn = raw_get_pixel_20to16(x, y) - black;
+            int pa = raw_get_pixel(x, y-2) - black;
+            int pb = raw_get_pixel(x, y+2) - black;
+            int pn = raw_get_pixel(x, y) - black;
             int pi = (pa + pb + 1) / 2;
             if (pa >= clip || pb >= clip) pi = clip0;               /* pixel too bright? discard */
             if (pi >= clip) pn = clip0;                             /* interpolated pixel not good? discard the other one too */
-            interp[x + y * w] = pi;
-            native[x + y * w] = pn;
+            interp[GRID(x,y)] = pi;
+            native[GRID(x,y)] = pn;
         }
     }
     
@@ -1596,7 +2307,7 @@ static int match_exposures(double* corr_ev, int* white_darkened)
     {
         for (int x = 0; x < w; x += 3)
         {
-             int b = bright[x + y*w];
+             int b = bright[GRID(x,y)];
              if (b >= clip) continue;
              tmp[n++] = b;
         }
@@ -1624,8 +2335,8 @@ static int match_exposures(double* corr_ev, int* white_darkened)
     {
         for (int x = 0; x < w; x += 3)
         {
-             int d = dark[x + y*w];
-             int b = bright[x + y*w];
+             int d = dark[GRID(x,y)];
+             int b = bright[GRID(x,y)];
              if (b >= clip) continue;
              tmp[n++] = d;
         }
@@ -1654,8 +2365,8 @@ static int match_exposures(double* corr_ev, int* white_darkened)
     {
         for (int x = 0; x < w; x += 3)
         {
-             int d = dark[x + y*w];
-             int b = bright[x + y*w];
+             int d = dark[GRID(x,y)];
+             int b = bright[GRID(x,y)];
              if (b >= b_hi) continue;
              if (b <= b_lo) continue;
              hi_dark[hi_n] = d;
@@ -1709,8 +2420,8 @@ static int match_exposures(double* corr_ev, int* white_darkened)
         {
             int x = (rand() % w)/3*3;
             int y = (rand() % (h-y0-5))/3*3 + y0;
-            int d = dark[x + y*w];
-            int b = bright[x + y*w];
+            int d = dark[GRID(x,y)];
+            int b = bright[GRID(x,y)];
             if (b >= clip0)
             {
                 /* retry (discard this pixel) */
@@ -1747,36 +2458,96 @@ static int match_exposures(double* corr_ev, int* white_darkened)
         fclose(f);
         if(system("octave --persist iso-curve.m"));
     }
+    #undef GRID
     free(dark);
     free(bright);
     if (dps) free(dps);
     if (bps) free(bps);
 
-    /* apply the correction */
-    double b20 = b * 16;
-    for (int y = 0; y < h; y ++)
-    {
-        for (int x = 0; x < w; x ++)
-        {
-            int p = raw_get_pixel32(x, y);
-            if (p == 0) continue;
+    *out_a = a;
+    *out_b = b;
+}
 
-            if (BRIGHT_ROW)
-            {
-                /* bright exposure: darken and apply the black offset (fixme: why not half?) */
-                p = (p - black20) * a + black20 + b20*a;
-            }
-            else
-            {
-                p = p - b20 + b20*a;
-            }
-            
-            /* out of range? */
-            /* note: this breaks M24-1127 */
-            p = COERCE(p, 0, 0xFFFFF);
-            
-            raw_set_pixel20(x, y, p);
-        }
+/* exposure correction found by match_exposures (see exposure_corr_pixel) */
+static struct
+{
+    double a;
+    double b20;
+    int black20;
+} exposure_corr;
+
+/* 20-bit pixel from row y, after exposure matching */
+static inline int exposure_corr_pixel(int p, int y)
+{
+    if (p == 0) return 0;
+
+    double a = exposure_corr.a;
+    double b20 = exposure_corr.b20;
+    int black20 = exposure_corr.black20;
+
+    if (BRIGHT_ROW)
+    {
+        /* bright exposure: darken and apply the black offset (fixme: why not half?) */
+        p = (p - black20) * a + black20 + b20*a;
+    }
+    else
+    {
+        p = p - b20 + b20*a;
+    }
+    
+    /* out of range? */
+    /* note: this breaks M24-1127 */
+    return COERCE(p, 0, 0xFFFFF);
+}
+
+/* same, from the 14-bit input (low-memory mode) */
+static int raw_get_pixel_matched20(int x, int y)
+{
+    return exposure_corr_pixel(raw_get_pixel_14to20(x, y), y);
+}
+
+/* raw: the 20-bit image, corrected in place; */
+/* without it (low-memory mode), the 14-bit input is sampled and the correction is applied later, row by row */
+static int match_exposures(double* corr_ev, int* white_darkened, uint32_t* raw)
+{
+    /* guess ISO - find the factor and the offset for matching the bright and dark images */
+    int black20 = raw_info.black_level;
+    int white20 = MIN(raw_info.white_level, *white_darkened);
+    int black = black20/16;
+    int white = white20/16;
+    int clip0 = white - black;
+    int clip  = clip0 * 0.95;    /* there may be nonlinear response in very bright areas */
+
+    int w = raw_info.width;
+    int h = raw_info.height;
+
+    double a = 0;
+    double b = 0;
+
+    if (clip_calib.locked)
+    {
+        /* video: same exposure match for the entire clip, to avoid flicker */
+        a = clip_calib.a;
+        b = clip_calib.b;
+    }
+    else
+    {
+        fit_exposures(black, clip0, clip, &a, &b, raw ? raw_get_pixel_20to16 : raw_get_pixel_14to16);
+        clip_calib.a = a;
+        clip_calib.b = b;
+    }
+
+    /* apply the correction */
+    double b20 = b * 16;
+    exposure_corr.a = a;
+    exposure_corr.b20 = b20;
+    exposure_corr.black20 = black20;
+
+    if (raw)
+    {
+        for (int y = 0; y < h; y ++)
+            for (int x = 0; x < w; x ++)
+                raw[x + y*w] = exposure_corr_pixel(raw[x + y*w], y);
     }
     *white_darkened = (white20 - black20 + b20) * a + black20;
 
@@ -1839,22 +2610,50 @@ static int mean3(int a, int b, int c, int white, int* err)
 #include "chroma_smooth.c"
 #undef CHROMA_SMOOTH_5X5
 
-static void chroma_smooth(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw)
+struct chroma_smooth_ctx
+{
+    uint32_t * inp;
+    uint32_t * out;
+    int* raw2ev;
+    int* ev2raw;
+};
+
+/* the filters write rows 4 ... h-6 (in steps of 2), reading up to 4 rows above and 5 rows below */
+/* so each band gets a view of the image starting 4 rows above its first output row */
+static void chroma_smooth_rows(void* arg, int band, int y0, int y1)
 {
+    struct chroma_smooth_ctx * ctx = arg;
+    int w = raw_info.width;
+    uint32_t * inp = ctx->inp + (y0 - 4) * w;
+    uint32_t * out = ctx->out + (y0 - 4) * w;
+    int h = y1 - y0 + 9;
+
     switch (chroma_smooth_method)
     {
         case 2:
-            chroma_smooth_2x2(inp, out, raw2ev, ev2raw);
+            chroma_smooth_2x2(inp, out, w, h, ctx->raw2ev, ctx->ev2raw);
             break;
         case 3:
-            chroma_smooth_3x3(inp, out, raw2ev, ev2raw);
+            chroma_smooth_3x3(inp, out, w, h, ctx->raw2ev, ctx->ev2raw);
             break;
         case 5:
-            chroma_smooth_5x5(inp, out, raw2ev, ev2raw);
+            chroma_smooth_5x5(inp, out, w, h, ctx->raw2ev, ctx->ev2raw);
             break;
     }
 }
 
+/* only the 2x2 blocks starting on rows y0 ... y1-1 (y0 must be even) */
+static void chroma_smooth_part(uint32_t * inp, uint32_t * out, int y0, int y1, int* raw2ev, int* ev2raw)
+{
+    struct chroma_smooth_ctx ctx = { inp, out, raw2ev, ev2raw };
+    parallel_rows(MAX(y0, 4), MIN(y1, raw_info.height - 5), 2, chroma_smooth_rows, &ctx);
+}
+
+static void chroma_smooth(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw)
+{
+    chroma_smooth_part(inp, out, 0, raw_info.height, raw2ev, ev2raw);
+}
+
 static inline int FC(int row, int col)
 {
     if ((row%2) == 0 && (col%2) == 0)
@@ -1865,32 +2664,36 @@ static inline int FC(int row, int col)
         return 1;  /* green */
 }
 
-static void find_and_fix_bad_pixels(int dark_noise, int bright_noise, int* raw2ev, int* ev2raw)
+struct bad_pixel_ctx
+{
+    int dark_noise;
+    int* raw2ev;
+    uint32_t* raw;              /* 20-bit image, x + y*w */
+    uint32_t* hotpixel;
+    int hot_pixels[PARALLEL_MAX_BANDS];
+    int cold_pixels[PARALLEL_MAX_BANDS];
+};
+
+static void find_bad_pixels_rows(void* arg, int band, int y0, int y1)
 {
+    struct bad_pixel_ctx * ctx = arg;
     int w = raw_info.width;
-    int h = raw_info.height;
-    
     int black = raw_info.black_level;
-    
-    printf("Looking for hot/cold pixels...\n");
-
-    /* hot pixel map */
-    uint32_t* hotpixel = malloc(w * h * sizeof(uint32_t));
-    memset(hotpixel, 0, w * h * sizeof(uint32_t));
-
-    int hot_pixels = 0;
-    int cold_pixels = 0;
+    int dark_noise = ctx->dark_noise;
+    int* raw2ev = ctx->raw2ev;
+    uint32_t* raw = ctx->raw;
+    uint32_t* hotpixel = ctx->hotpixel;
 
     /* really dark pixels (way below the black level) are probably noise */
     /* there might be dark pixels not that much below the black level, but they need further checking */
     int cold_thr = MAX(0, black - dark_noise*8);
     int maybe_cold_thr = black + dark_noise*2;
 
-    for (int y = 6; y < h-6; y ++)
+    for (int y = y0; y < y1; y ++)
     {
         for (int x = 6; x < w-6; x ++)
         {
-            int p = raw_get_pixel20(x, y);
+            int p = raw[x + y*w] & 0xFFFFF;
             
             int is_hot = 0;
             int is_cold = (p < cold_thr);
@@ -1921,7 +2724,7 @@ static void find_and_fix_bad_pixels(int dark_noise, int bright_noise, int* raw2e
                         if (FC(x+j, y+i) != fc0)
                             continue;
                         
-                        int p = raw_get_pixel20(x+j, y+i);
+                        int p = raw[x+j + (y+i)*w] & 0xFFFFF;
                         neighbours[k++] = -p;
                         max = MAX(max, p);
                     }
@@ -1950,58 +2753,1661 @@ static void find_and_fix_bad_pixels(int dark_noise, int bright_noise, int* raw2e
 
                 if (is_hot)
                 {
-                    hot_pixels++;
+                    ctx->hot_pixels[band]++;
                     hotpixel[x + y*w] = -kth_smallest_int(neighbours, k, 2);
                 }
                 
                 if (is_cold)
                 {
-                    cold_pixels++;
-                    hotpixel[x + y*w] = -median_int_wirth(neighbours, k);
+                    ctx->cold_pixels[band]++;
+                    hotpixel[x + y*w] = -median_int_wirth(neighbours, k);
+                }
+            }
+        }
+    }
+}
+
+/* replace the bad pixels marked in the hot pixel map, on rows y0 ... y1-1 */
+static void fix_bad_pixels_rows(uint32_t* raw, uint32_t* hotpixel, int y0, int y1)
+{
+    int w = raw_info.width;
+    int black = raw_info.black_level;
+
+    for (int y = y0; y < y1; y ++)
+        for (int x = 0; x < w; x ++)
+            if (hotpixel[x + y*w])
+                raw[x + y*w] = COERCE(debug_bad_pixels ? black : (int) hotpixel[x + y*w], 0, 0xFFFFF);
+}
+
+static void find_and_fix_bad_pixels(uint32_t* raw, int dark_noise, int bright_noise, int* raw2ev, int* ev2raw)
+{
+    int w = raw_info.width;
+    int h = raw_info.height;
+    
+    printf("Looking for hot/cold pixels...\n");
+
+    /* hot pixel map */
+    uint32_t* hotpixel = malloc(w * h * sizeof(uint32_t));
+    memset(hotpixel, 0, w * h * sizeof(uint32_t));
+
+    /* the map is only applied after all the bands were scanned */
+    struct bad_pixel_ctx ctx = {
+        .dark_noise = dark_noise,
+        .raw2ev = raw2ev,
+        .raw = raw,
+        .hotpixel = hotpixel,
+    };
+    parallel_rows(6, h-6, 1, find_bad_pixels_rows, &ctx);
+
+    int hot_pixels = 0;
+    int cold_pixels = 0;
+    for (int i = 0; i < PARALLEL_MAX_BANDS; i++)
+    {
+        hot_pixels += ctx.hot_pixels[i];
+        cold_pixels += ctx.cold_pixels[i];
+    }
+
+    /* apply the correction */
+    fix_bad_pixels_rows(raw, hotpixel, 0, h);
+
+    if (hot_pixels)
+        printf("Hot pixels      : %d\n", hot_pixels);
+
+    if (cold_pixels)
+        printf("Cold pixels     : %d\n", cold_pixels);
+    
+    free(hotpixel);
+}
+
+/* soft-film curve from ufraw-mod */
+static double soft_film(double raw, double exposure, int in_black, int in_white, int out_black, int out_white)
+{
+    double a = MAX(exposure - 1, 1e-5);
+    if (raw > in_black)
+    {
+        /* at low values, force the derivative equal to exposure (in linear units) */
+        /* at high values, map in_white to out_white (which normally happens at exposure=1) */
+        double x = (raw - in_black) / (in_white - in_black);
+        return (1.0 - 1.0/(1.0 + a*x)) / (1.0 - 1.0/(1.0 + a)) * (out_white - out_black) + out_black;
+    }
+    else
+    {
+        /* linear extrapolation below black */
+        return COERCE((raw - in_black) * exposure / (in_white - in_black) * (out_white - out_black) + out_black, 0, out_white);
+    }
+}
+
+static int soft_film_bakedwb(double raw, double exposure, int in_black, int in_white, int out_black, int out_white, double wb, double max_wb)
+{
+    double raw_baked = (raw - in_black) * wb / max_wb + in_black;
+    double raw_soft = soft_film(raw_baked, exposure * max_wb, in_black, in_white, out_black, out_white);
+    double raw_adjusted = (raw_soft - out_black) / wb + out_black;
+    return round(raw_adjusted + fast_randn05());
+}
+
+/* define edge directions for interpolation */
+struct xy { int x; int y; };
+static const struct
+{
+    struct xy ack;      /* verification pixel near a */
+    struct xy a;        /* interpolation pixel from the nearby line: normally (0,s) but also (1,s) or (-1,s) */
+    struct xy b;        /* interpolation pixel from the other line: normally (0,-2s) but also (1,-2s), (-1,-2s), (2,-2s) or (-2,-2s) */
+    struct xy bck;      /* verification pixel near b */
+}
+edge_directions[] = {       /* note: all y coords should be multiplied by s */
+    //~ { {-6,2}, {-3,1}, { 6,-2}, { 9,-3} },     /* almost horizontal (little or no improvement) */
+    { {-4,2}, {-2,1}, { 4,-2}, { 6,-3} },
+    { {-3,2}, {-1,1}, { 3,-2}, { 4,-3} },
+    { {-2,2}, {-1,1}, { 2,-2}, { 3,-3} },     /* 45-degree diagonal */
+    { {-1,2}, {-1,1}, { 1,-2}, { 2,-3} },
+    { {-1,2}, { 0,1}, { 1,-2}, { 1,-3} },
+    { { 0,2}, { 0,1}, { 0,-2}, { 0,-3} },     /* vertical, preferred; no extra confirmations needed */
+    { { 1,2}, { 0,1}, {-1,-2}, {-1,-3} },
+    { { 1,2}, { 1,1}, {-1,-2}, {-2,-3} },
+    { { 2,2}, { 1,1}, {-2,-2}, {-3,-3} },     /* 45-degree diagonal */
+    { { 3,2}, { 1,1}, {-3,-2}, {-4,-3} },
+    { { 4,2}, { 2,1}, {-4,-2}, {-6,-3} },
+    //~ { { 6,2}, { 3,1}, {-6,-2}, {-9,-3} },     /* almost horizontal */
+};
+
+/* everything the processing steps of hdr_interpolate need, so they can run on row bands (see parallel.h) */
+/* each band writes only its own rows; statistics are counted per band and summed afterwards */
+struct hdr_ctx
+{
+    int w;
+    int h;
+    int black;
+    int white;
+    int white_darkened;
+    double dark_noise;
+
+    /* lookup tables */
+    int* raw2ev;
+    int* ev2raw;
+    double* fullres_curve;
+    double* log2_signal;
+    double fullres_thr;
+    double* mix_curve;
+    double corr_ev;
+    double max_ev;
+    double overlap;
+
+    /* images */
+    uint32_t* raw;              /* 20-bit input, after exposure matching and bad pixel fixing */
+    uint32_t* out;              /* 20-bit output */
+    uint32_t* dark;
+    uint32_t* bright;
+    uint32_t* fullres;
+    uint32_t* fullres_smooth;
+    uint32_t* halfres;
+    uint32_t* halfres_smooth;
+    uint16_t* alias_map;
+    uint16_t* alias_aux;
+    int alias_map_max;
+    uint16_t* overexposed;
+    uint16_t* over_aux;
+
+    /* amaze-edge */
+    float** red;
+    float** green;
+    float** blue;
+    int* squeezed;
+    uint32_t* gray;
+    uint8_t* edge_direction;
+    int semi_overexposed[PARALLEL_MAX_BANDS];
+    int not_overexposed[PARALLEL_MAX_BANDS];
+    int deep_shadow[PARALLEL_MAX_BANDS];
+    int not_shadow[PARALLEL_MAX_BANDS];
+
+    /* stripe fix: offsets rejected as too large, reported afterwards (in order) */
+    int* stripe_rejected;
+};
+
+/* dark and bright are filled by the interpolation step, so they are allocated right before it */
+static void hdr_alloc_dark_bright(struct hdr_ctx * ctx)
+{
+    int size = ctx->w * ctx->h * sizeof(uint32_t);
+    ctx->dark   = malloc(size);
+    ctx->bright = malloc(size);
+    memset(ctx->dark, 0, size);
+    memset(ctx->bright, 0, size);
+}
+
+/* lookup tables that depend only on the signal (raw - black), not on the black level itself */
+/* they are shared by all the files converted in one run; each file uses a view shifted by its black level */
+/* (array index = signal + SIGNAL_RANGE; only the range needed so far is computed) */
+#define SIGNAL_RANGE (1<<20)
+
+static const double fullres_start = 4;
+static const double fullres_transition = 4;
+
+static struct
+{
+    int raw2ev[2*SIGNAL_RANGE];                 /* EV x EV_RESOLUTION */
+    double log2_signal[2*SIGNAL_RANGE];         /* log2(signal/64), clipped at 0 EV */
+    double fullres_curve[2*SIGNAL_RANGE];
+    int lo, hi;                                 /* valid indices: lo ... hi-1 */
+
+    double ev2raw_pow[14*EV_RESOLUTION];        /* round(64 * 2^(i/EV_RESOLUTION)), for ev2raw */
+    int ev2raw_pow_ok;
+} signal_tables;
+
+static void signal_tables_rows(void* arg, int band, int i0, int i1)
+{
+    for (int i = i0; i < i1; i++)
+    {
+        double signal = MAX((i - SIGNAL_RANGE) / 64.0, -1023);
+        if (signal > 0)
+            signal_tables.raw2ev[i] = (int)round(log2(1+signal) * EV_RESOLUTION);
+        else
+            signal_tables.raw2ev[i] = -(int)round(log2(1-signal) * EV_RESOLUTION);
+
+        double ev2 = log2(MAX((i - SIGNAL_RANGE) / 64.0, 1));
+        double c2 = -cos(COERCE(ev2 - fullres_start, 0, fullres_transition)*M_PI/fullres_transition);
+        double f = (c2+1) / 2;
+        signal_tables.log2_signal[i] = ev2;
+        signal_tables.fullres_curve[i] = f;
+    }
+}
+
+static void ev2raw_pow_rows(void* arg, int band, int i0, int i1)
+{
+    for (int i = i0; i < i1; i++)
+        signal_tables.ev2raw_pow[i] = round(64*pow(2, ((double)i/EV_RESOLUTION)));
+}
+
+/* make sure the shared tables cover raw values 0 ... (1<<20)-1 for this black level */
+static void signal_tables_prepare(int black)
+{
+    int lo = SIGNAL_RANGE - black;
+    int hi = lo + (1<<20);
+
+    if (signal_tables.lo == signal_tables.hi)
+    {
+        parallel_rows(lo, hi, 1, signal_tables_rows, 0);
+        signal_tables.lo = lo;
+        signal_tables.hi = hi;
+    }
+    else
+    {
+        /* both ranges are at least 1<<20 wide, so the union is contiguous */
+        if (lo < signal_tables.lo)
+        {
+            parallel_rows(lo, signal_tables.lo, 1, signal_tables_rows, 0);
+            signal_tables.lo = lo;
+        }
+        if (hi > signal_tables.hi)
+        {
+            parallel_rows(signal_tables.hi, hi, 1, signal_tables_rows, 0);
+            signal_tables.hi = hi;
+        }
+    }
+
+    if (!signal_tables.ev2raw_pow_ok)
+    {
+        parallel_rows(0, 14*EV_RESOLUTION, 1, ev2raw_pow_rows, 0);
+        signal_tables.ev2raw_pow_ok = 1;
+    }
+}
+
+/* the "rows" of the lookup tables are their indices */
+static void hdr_ev2raw_rows(void* arg, int band, int i0, int i1)
+{
+    struct hdr_ctx * ctx = arg;
+    int black = ctx->black;
+    int white = ctx->white;
+    int* raw2ev = ctx->raw2ev;
+    int* ev2raw = ctx->ev2raw;
+    double* pow = signal_tables.ev2raw_pow;
+
+    for (int i = i0; i < i1; i++)
+    {
+        if (i < 0)
+        {
+            ev2raw[i] = COERCE(black+64 - pow[-i], 0, black);
+            continue;
+        }
+
+        ev2raw[i] = COERCE(black-64 + pow[i], black, (1<<20)-1);
+        
+        if (i >= raw2ev[white])
+        {
+            ev2raw[i] = MAX(ev2raw[i], white);
+        }
+    }
+}
+
+static void hdr_mix_curve_rows(void* arg, int band, int i0, int i1)
+{
+    struct hdr_ctx * ctx = arg;
+    double max_ev = ctx->max_ev;
+    double overlap = ctx->overlap;
+
+    for (int i = i0; i < i1; i++)
+    {
+        double ev = ctx->log2_signal[i] + ctx->corr_ev;
+        double c = -cos(MAX(MIN(ev-(max_ev-overlap),overlap),0)*M_PI/overlap);
+        double k = (c+1) / 2;
+        ctx->mix_curve[i] = k;
+    }
+}
+
+static void hdr_edge_search_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    int* raw2ev = ctx->raw2ev;
+    uint32_t* gray = ctx->gray;
+    int d0 = COUNT(edge_directions)/2;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
+        for (int x = 5; x < w-5; x ++)
+        {
+            int e_best = INT_MAX;
+            int d_best = d0;
+            int dmin = 0;
+            int dmax = COUNT(edge_directions)-1;
+            int search_area = 5;
+
+            /* only use high accuracy on the dark exposure where the bright ISO is overexposed */
+            if (!BRIGHT_ROW)
+            {
+                /* interpolating bright exposure */
+                if (ctx->fullres_curve[ctx->raw[x + y*w]] > ctx->fullres_thr && !debug_edge)
+                {
+                    /* no high accuracy needed, just interpolate vertically */
+                    ctx->not_shadow[band]++;
+                    dmin = d0;
+                    dmax = d0;
+                }
+                else
+                {
+                    /* deep shadows, unlikely to use fullres, so we need a good interpolation */
+                    ctx->deep_shadow[band]++;
+                }
+            }
+            else if (ctx->raw[x + y*w] < ctx->white_darkened && !debug_edge)
+            {
+                /* interpolating dark exposure, but we also have good data from the bright one */
+                ctx->not_overexposed[band]++;
+                dmin = d0;
+                dmax = d0;
+            }
+            else
+            {
+                /* interpolating dark exposure, but the bright one is clipped */
+                ctx->semi_overexposed[band]++;
+            }
+
+            if (dmin == dmax)
+            {
+                d_best = dmin;
+            }
+            else
+            {
+                for (int d = dmin; d <= dmax; d++)
+                {
+                    int e = 0;
+                    for (int j = -search_area; j <= search_area; j++)
+                    {
+                        int dx1 = edge_directions[d].ack.x + j;
+                        int dy1 = edge_directions[d].ack.y * s;
+                        int p1 = raw2ev[gray[x+dx1 + (y+dy1)*w]];
+                        int dx2 = edge_directions[d].a.x + j;
+                        int dy2 = edge_directions[d].a.y * s;
+                        int p2 = raw2ev[gray[x+dx2 + (y+dy2)*w]];
+                        int dx3 = edge_directions[d].b.x + j;
+                        int dy3 = edge_directions[d].b.y * s;
+                        int p3 = raw2ev[gray[x+dx3 + (y+dy3)*w]];
+                        int dx4 = edge_directions[d].bck.x + j;
+                        int dy4 = edge_directions[d].bck.y * s;
+                        int p4 = raw2ev[gray[x+dx4 + (y+dy4)*w]];
+                        e += ABS(p1-p2) + ABS(p2-p3) + ABS(p3-p4);
+                    }
+                    
+                    /* add a small penalty for diagonal directions */
+                    /* (the improvement should be significant in order to choose one of these) */
+                    e += ABS(d - d0) * EV_RESOLUTION/8;
+                    
+                    if (e < e_best)
+                    {
+                        e_best = e;
+                        d_best = d;
+                    }
+                }
+            }
+            
+            ctx->edge_direction[x + y*w] = d_best;
+        }
+    }
+}
+
+static inline int edge_interp(struct hdr_ctx * ctx, float** plane, int x, int y, int s, int dir)
+{
+    int dxa = edge_directions[dir].a.x;
+    int dya = edge_directions[dir].a.y * s;
+    int pa = COERCE((int)plane[ctx->squeezed[y+dya]][x+dxa], 0, 0xFFFFF);
+    int dxb = edge_directions[dir].b.x;
+    int dyb = edge_directions[dir].b.y * s;
+    int pb = COERCE((int)plane[ctx->squeezed[y+dyb]][x+dxb], 0, 0xFFFFF);
+    int pi = (ctx->raw2ev[pa] * 2 + ctx->raw2ev[pb]) / 3;
+    
+    return pi;
+}
+
+static void hdr_edge_interp_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        uint32_t* native = BRIGHT_ROW ? ctx->bright : ctx->dark;
+        uint32_t* interp = BRIGHT_ROW ? ctx->dark : ctx->bright;
+        int is_rg = (y % 2 == 0); /* RG or GB? */
+        int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
+
+        for (int x = 2; x < w-2; x += 2)
+        {
+            for (int k = 0; k < 2; k++, x++)
+            {
+                float** plane = is_rg ? (x%2 == 0 ? ctx->red   : ctx->green)
+                                      : (x%2 == 0 ? ctx->green : ctx->blue );
+
+                int dir = ctx->edge_direction[x + y*w];
+                
+                /* vary the interpolation direction and average the result (reduces aliasing) */
+                int pi0 = edge_interp(ctx, plane, x, y, s, dir);
+                int pip = edge_interp(ctx, plane, x, y, s, MIN(dir+1, COUNT(edge_directions)-1));
+                int pim = edge_interp(ctx, plane, x, y, s, MAX(dir-1,0));
+                
+                interp[x   + y * w] = ctx->ev2raw[(2*pi0+pip+pim)/4];
+                native[x   + y * w] = ctx->raw[x + y*w];
+            }
+            x -= 2;
+        }
+    }
+}
+
+static void hdr_mean23_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    int* raw2ev = ctx->raw2ev;
+    int* ev2raw = ctx->ev2raw;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        uint32_t* native = BRIGHT_ROW ? ctx->bright : ctx->dark;
+        uint32_t* interp = BRIGHT_ROW ? ctx->dark : ctx->bright;
+        int is_rg = (y % 2 == 0); /* RG or GB? */
+        int white = !BRIGHT_ROW ? ctx->white_darkened : raw_info.white_level;
+        
+        for (int x = 2; x < w-3; x += 2)
+        {
+        
+            /* red/blue: interpolate from (x,y+2) and (x,y-2) */
+            /* green: interpolate from (x+1,y+1),(x-1,y+1),(x,y-2) or (x+1,y-1),(x-1,y-1),(x,y+2), whichever has the correct brightness */
+            
+            int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;
+            
+            if (is_rg)
+            {
+                int ra = ctx->raw[x + (y-2)*w];
+                int rb = ctx->raw[x + (y+2)*w];
+                int ri = mean2(raw2ev[ra], raw2ev[rb], raw2ev[white], 0);
+                
+                int ga = ctx->raw[x+1+1 + (y+s)*w];
+                int gb = ctx->raw[x+1-1 + (y+s)*w];
+                int gc = ctx->raw[x+1 + (y-2*s)*w];
+                int gi = mean3(raw2ev[ga], raw2ev[gb], raw2ev[gc], raw2ev[white], 0);
+
+                interp[x   + y * w] = ev2raw[ri];
+                interp[x+1 + y * w] = ev2raw[gi];
+            }
+            else
+            {
+                int ba = ctx->raw[x+1 + (y-2)*w];
+                int bb = ctx->raw[x+1 + (y+2)*w];
+                int bi = mean2(raw2ev[ba], raw2ev[bb], raw2ev[white], 0);
+
+                int ga = ctx->raw[x+1 + (y+s)*w];
+                int gb = ctx->raw[x-1 + (y+s)*w];
+                int gc = ctx->raw[x + (y-2*s)*w];
+                int gi = mean3(raw2ev[ga], raw2ev[gb], raw2ev[gc], raw2ev[white], 0);
+
+                interp[x   + y * w] = ev2raw[gi];
+                interp[x+1 + y * w] = ev2raw[bi];
+            }
+
+            native[x   + y * w] = ctx->raw[x + y*w];
+            native[x+1 + y * w] = ctx->raw[x+1 + y*w];
+        }
+    }
+}
+
+static void hdr_stripe_fix_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    uint32_t* dark = ctx->dark;
+    uint32_t* bright = ctx->bright;
+    int* delta = malloc(w * sizeof(delta[0]));
+
+    /* adjust dark lines to match the bright ones */
+    for (int y = y0; y < y1; y ++)
+    {
+        /* apply a constant offset (estimated from unclipped areas) */
+        int delta_num = 0;
+        for (int x = raw_info.active_area.x1; x < raw_info.active_area.x2; x ++)
+        {
+            int b = bright[x + y*w];
+            int d = dark[x + y*w];
+            if (MAX(b,d) < ctx->white_darkened)
+            {
+                delta[delta_num++] = b - d;
+            }
+        }
+
+        if (delta_num < 200)
+        {
+            //~ printf("%d: too few points (%d)\n", y, delta_num);
+            continue;
+        }
+
+        /* compute median difference */
+        int med_delta = median_int_wirth(delta, delta_num);
+
+        if (ABS(med_delta) > 200*16)
+        {
+            ctx->stripe_rejected[y] = med_delta;
+            continue;
+        }
+
+        /* shift the dark lines */
+        for (int x = 0; x < w; x ++)
+        {
+            dark[x + y*w] = COERCE(dark[x + y*w] + med_delta, 0, 0xFFFFF);
+        }
+    }
+    free(delta);
+}
+
+static void hdr_fullres_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 0; x < w; x ++)
+        {
+            if (BRIGHT_ROW)
+            {
+                int f = ctx->bright[x + y*w];
+                /* if the brighter copy is overexposed, the guessed pixel for sure has higher brightness */
+                ctx->fullres[x + y*w] = f < ctx->white_darkened ? f : MAX(f, ctx->dark[x + y*w]);
+            }
+            else
+            {
+                ctx->fullres[x + y*w] = ctx->dark[x + y*w]; 
+            }
+        }
+    }
+}
+
+static void hdr_halfres_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    int* raw2ev = ctx->raw2ev;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 0; x < w; x ++)
+        {
+            /* bright and dark source pixels  */
+            /* they may be real or interpolated */
+            /* they both have the same brightness (they were adjusted before this loop), so we are ready to mix them */ 
+            int b = ctx->bright[x + y*w];
+            int d = ctx->dark[x + y*w];
+
+            /* go from linear to EV space */
+            int bev = raw2ev[b];
+            int dev = raw2ev[d];
+
+            /* blending factor */
+            double k = COERCE(ctx->mix_curve[b & 0xFFFFF], 0, 1);
+            
+            /* mix bright and dark exposures */
+            int mixed = bev * (1-k) + dev * k;
+            ctx->halfres[x + y*w] = ctx->ev2raw[mixed];
+        }
+    }
+}
+
+static void hdr_alias_build_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    int* raw2ev = ctx->raw2ev;
+    uint16_t* alias_map = ctx->alias_map;
+
+    /* build the aliasing maps (where it's likely to get aliasing) */
+    /* do this by comparing fullres and halfres images */
+    /* if the difference is small, we'll prefer halfres for less noise, otherwise fullres for less aliasing */
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 0; x < w; x ++)
+        {
+            /* do not compute alias map where we'll use fullres detail anyway */
+            if (ctx->fullres_curve[ctx->bright[x + y*w]] > ctx->fullres_thr)
+                continue;
+
+            int f = ctx->fullres_smooth[x + y*w];
+            int h = ctx->halfres_smooth[x + y*w];
+            int fe = raw2ev[f];
+            int he = raw2ev[h];
+            int e_lin = ABS(f - h); /* error in linear space, for shadows (downweights noise) */
+            e_lin = MAX(e_lin - ctx->dark_noise*3/2, 0);
+            int e_log = ABS(fe - he); /* error in EV space, for highlights (highly sensitive to noise) */
+            alias_map[x + y*w] = MIN(MIN(e_lin/2, e_log/16), 65530);
+        }
+    }
+}
+
+static void hdr_alias_filter_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    uint16_t* alias_map = ctx->alias_map;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 6; x < w-6; x ++)
+        {
+            /* do not compute alias map where we'll use fullres detail anyway */
+            if (ctx->fullres_curve[ctx->bright[x + y*w]] > ctx->fullres_thr)
+                continue;
+            
+            /* use 5th max (out of 37) to filter isolated pixels */
+            
+            int neighbours[] = {
+                                                                          -alias_map[x-2 + (y-6) * w], -alias_map[x+0 + (y-6) * w], -alias_map[x+2 + (y-6) * w],
+                                             -alias_map[x-4 + (y-4) * w], -alias_map[x-2 + (y-4) * w], -alias_map[x+0 + (y-4) * w], -alias_map[x+2 + (y-4) * w], -alias_map[x+4 + (y-4) * w],
+                -alias_map[x-6 + (y-2) * w], -alias_map[x-4 + (y-2) * w], -alias_map[x-2 + (y-2) * w], -alias_map[x+0 + (y-2) * w], -alias_map[x+2 + (y-2) * w], -alias_map[x+4 + (y-2) * w], -alias_map[x+6 + (y-2) * w], 
+                -alias_map[x-6 + (y+0) * w], -alias_map[x-4 + (y+0) * w], -alias_map[x-2 + (y+0) * w], -alias_map[x+0 + (y+0) * w], -alias_map[x+2 + (y+0) * w], -alias_map[x+4 + (y+0) * w], -alias_map[x+6 + (y+0) * w], 
+                -alias_map[x-6 + (y+2) * w], -alias_map[x-4 + (y+2) * w], -alias_map[x-2 + (y+2) * w], -alias_map[x+0 + (y+2) * w], -alias_map[x+2 + (y+2) * w], -alias_map[x+4 + (y+2) * w], -alias_map[x+6 + (y+2) * w], 
+                                             -alias_map[x-4 + (y+4) * w], -alias_map[x-2 + (y+4) * w], -alias_map[x+0 + (y+4) * w], -alias_map[x+2 + (y+4) * w], -alias_map[x+4 + (y+4) * w],
+                                                                          -alias_map[x-2 + (y+6) * w], -alias_map[x+0 + (y+6) * w], -alias_map[x+2 + (y+6) * w],
+            };
+            
+            /* code generation & unoptimized version */
+            /*
+            int neighbours[50];
+            int k = 0;
+            for (int i = -3; i <= 3; i++)
+            {
+                for (int j = -3; j <= 3; j++)
+                {
+                    //~ neighbours[k++] = -alias_map[x+j*2 + (y+i*2)*w];
+                    printf("-alias_map[x%+d + (y%+d) * w], ", j*2, i*2);
+                }
+                printf("\n");
+            }
+            exit(1);
+            */
+            
+            ctx->alias_aux[x + y * w] = -kth_smallest_int(neighbours, COUNT(neighbours), 5);
+        }
+    }
+}
+
+static void hdr_alias_smooth_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    uint16_t* alias_aux = ctx->alias_aux;
+
+    /* gaussian blur */
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 6; x < w-6; x ++)
+        {
+            /* do not compute alias map where we'll use fullres detail anyway */
+            if (ctx->fullres_curve[ctx->bright[x + y*w]] > ctx->fullres_thr)
+                continue;
+
+/* code generation
+            const int blur[4][4] = {
+                {1024,  820,  421,  139},
+                { 820,  657,  337,  111},
+                { 421,  337,  173,   57},
+                { 139,  111,   57,    0},
+            };
+            const int blur_unique[] = {1024, 820, 657, 421, 337, 173, 139, 111, 57};
+
+            for (int k = 0; k < COUNT(blur_unique); k++)
+            {
+                int c = 0;
+                printf("(");
+                for (int dy = -3; dy <= 3; dy++)
+                {
+                    for (int dx = -3; dx <= 3; dx++)
+                    {
+                        c += alias_aux[x + dx + (y + dy) * w] * blur[ABS(dx)][ABS(dy)] / 1024;
+                        if (blur[ABS(dx)][ABS(dy)] == blur_unique[k])
+                            printf("alias_aux[x%+d + (y%+d) * w] + ", dx, dy);
+                    }
+                }
+                printf("\b\b\b) * %d / 1024 + \n", blur_unique[k]);
+            }
+            exit(1);
+*/
+            /* optimizing... the brute force way */
+            int c = 
+                (alias_aux[x+0 + (y+0) * w])+ 
+                (alias_aux[x+0 + (y-2) * w] + alias_aux[x-2 + (y+0) * w] + alias_aux[x+2 + (y+0) * w] + alias_aux[x+0 + (y+2) * w]) * 820 / 1024 + 
+                (alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w]) * 657 / 1024 + 
+                (alias_aux[x+0 + (y-2) * w] + alias_aux[x-2 + (y+0) * w] + alias_aux[x+2 + (y+0) * w] + alias_aux[x+0 + (y+2) * w]) * 421 / 1024 + 
+                (alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w]) * 337 / 1024 + 
+                (alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w]) * 173 / 1024 + 
+                (alias_aux[x+0 + (y-6) * w] + alias_aux[x-6 + (y+0) * w] + alias_aux[x+6 + (y+0) * w] + alias_aux[x+0 + (y+6) * w]) * 139 / 1024 + 
+                (alias_aux[x-2 + (y-6) * w] + alias_aux[x+2 + (y-6) * w] + alias_aux[x-6 + (y-2) * w] + alias_aux[x+6 + (y-2) * w] + alias_aux[x-6 + (y+2) * w] + alias_aux[x+6 + (y+2) * w] + alias_aux[x-2 + (y+6) * w] + alias_aux[x+2 + (y+6) * w]) * 111 / 1024 + 
+                (alias_aux[x-2 + (y-6) * w] + alias_aux[x+2 + (y-6) * w] + alias_aux[x-6 + (y-2) * w] + alias_aux[x+6 + (y-2) * w] + alias_aux[x-6 + (y+2) * w] + alias_aux[x+6 + (y+2) * w] + alias_aux[x-2 + (y+6) * w] + alias_aux[x+2 + (y+6) * w]) * 57 / 1024;
+            ctx->alias_map[x + y * w] = c;
+        }
+    }
+}
+
+/* bands must start at even rows (2x2 blocks) */
+static void hdr_alias_gray_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    uint16_t* alias_map = ctx->alias_map;
+
+    /* make it grayscale */
+    for (int y = y0; y < y1; y += 2)
+    {
+        for (int x = 2; x < w-2; x += 2)
+        {
+            int a = alias_map[x   +     y * w];
+            int b = alias_map[x+1 +     y * w];
+            int c = alias_map[x   + (y+1) * w];
+            int d = alias_map[x+1 + (y+1) * w];
+            int C = MAX(MAX(a,b), MAX(c,d));
+            
+            C = MIN(C, ctx->alias_map_max);
+
+            alias_map[x   +     y * w] = 
+            alias_map[x+1 +     y * w] = 
+            alias_map[x   + (y+1) * w] = 
+            alias_map[x+1 + (y+1) * w] = C;
+        }
+    }
+}
+
+static void hdr_overexposed_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 0; x < w; x ++)
+        {
+            ctx->overexposed[x + y * w] = ctx->bright[x + y * w] >= ctx->white_darkened || ctx->dark[x + y * w] >= ctx->white ? 100 : 0;
+        }
+    }
+}
+
+static void hdr_overexposed_blur_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    uint16_t* over_aux = ctx->over_aux;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 3; x < w-3; x ++)
+        {
+            ctx->overexposed[x + y * w] = 
+                (over_aux[x+0 + (y+0) * w])+ 
+                (over_aux[x+0 + (y-1) * w] + over_aux[x-1 + (y+0) * w] + over_aux[x+1 + (y+0) * w] + over_aux[x+0 + (y+1) * w]) * 820 / 1024 + 
+                (over_aux[x-1 + (y-1) * w] + over_aux[x+1 + (y-1) * w] + over_aux[x-1 + (y+1) * w] + over_aux[x+1 + (y+1) * w]) * 657 / 1024 + 
+                //~ (over_aux[x+0 + (y-2) * w] + over_aux[x-2 + (y+0) * w] + over_aux[x+2 + (y+0) * w] + over_aux[x+0 + (y+2) * w]) * 421 / 1024 + 
+                //~ (over_aux[x-1 + (y-2) * w] + over_aux[x+1 + (y-2) * w] + over_aux[x-2 + (y-1) * w] + over_aux[x+2 + (y-1) * w] + over_aux[x-2 + (y+1) * w] + over_aux[x+2 + (y+1) * w] + over_aux[x-1 + (y+2) * w] + over_aux[x+1 + (y+2) * w]) * 337 / 1024 + 
+                //~ (over_aux[x-2 + (y-2) * w] + over_aux[x+2 + (y-2) * w] + over_aux[x-2 + (y+2) * w] + over_aux[x+2 + (y+2) * w]) * 173 / 1024 + 
+                //~ (over_aux[x+0 + (y-3) * w] + over_aux[x-3 + (y+0) * w] + over_aux[x+3 + (y+0) * w] + over_aux[x+0 + (y+3) * w]) * 139 / 1024 + 
+                //~ (over_aux[x-1 + (y-3) * w] + over_aux[x+1 + (y-3) * w] + over_aux[x-3 + (y-1) * w] + over_aux[x+3 + (y-1) * w] + over_aux[x-3 + (y+1) * w] + over_aux[x+3 + (y+1) * w] + over_aux[x-1 + (y+3) * w] + over_aux[x+1 + (y+3) * w]) * 111 / 1024 + 
+                //~ (over_aux[x-2 + (y-3) * w] + over_aux[x+2 + (y-3) * w] + over_aux[x-3 + (y-2) * w] + over_aux[x+3 + (y-2) * w] + over_aux[x-3 + (y+2) * w] + over_aux[x+3 + (y+2) * w] + over_aux[x-2 + (y+3) * w] + over_aux[x+2 + (y+3) * w]) * 57 / 1024;
+                0;
+        }
+    }
+}
+
+static void hdr_final_blend_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    int* raw2ev = ctx->raw2ev;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        for (int x = 0; x < w; x ++)
+        {
+            /* high-iso image (for measuring signal level) */
+            int b = ctx->bright[x + y*w];
+
+            /* half-res image (interpolated and chroma filtered, best for low-contrast shadows) */
+            int hr = ctx->halfres_smooth[x + y*w];
+            
+            /* full-res image (non-interpolated, except where one ISO is blown out) */
+            int fr = ctx->fullres[x + y*w];
+
+            /* full res with some smoothing applied to hide aliasing artifacts */
+            int frs = ctx->fullres_smooth[x + y*w];
+
+            /* go from linear to EV space */
+            int hrev = raw2ev[hr];
+            int frev = raw2ev[fr];
+            int frsev = raw2ev[frs];
+
+            int output = hrev;
+            
+            if (use_fullres)
+            {
+                /* blending factor */
+                double f = ctx->fullres_curve[b & 0xFFFFF];
+                
+                double c = 0;
+                if (use_alias_map)
+                {
+                    int co = ctx->alias_map[x + y*w];
+                    c = COERCE(co / (double) ctx->alias_map_max, 0, 1);
+                }
+
+                double ovf = COERCE(ctx->overexposed[x + y*w] / 200.0, 0, 1);
+                c = MAX(c, ovf);
+
+                double noisy_or_overexposed = MAX(ovf, 1-f);
+
+                /* use data from both ISOs in high-detail areas, even if it's noisier (less aliasing) */
+                f = MAX(f, c);
+                
+                /* use smoothing in noisy near-overexposed areas to hide color artifacts */
+                double fev = noisy_or_overexposed * frsev + (1-noisy_or_overexposed) * frev;
+                
+                /* limit the use of fullres in dark areas (fixes some black spots, but may increase aliasing) */
+                int sig = (ctx->dark[x + y*w] + ctx->bright[x + y*w]) / 2;
+                f = MAX(0, MIN(f, (double)(sig - ctx->black) / (4*ctx->dark_noise)));
+                
+                /* blend "half-res" and "full-res" images smoothly to avoid banding*/
+                output = hrev * (1-f) + fev * f;
+
+                /* show full-res map (for debugging) */
+                //~ output = f * 14*EV_RESOLUTION;
+                
+                /* show alias map (for debugging) */
+                //~ output = c * 14*EV_RESOLUTION;
+
+                //~ output = hotpixel[x+y*w] ? 14*EV_RESOLUTION : 0;
+                //~ output = raw2ev[dark[x+y*w]];
+                /* safeguard */
+                output = COERCE(output, -10*EV_RESOLUTION, 14*EV_RESOLUTION-1);
+            }
+            
+            /* back to linear space and commit */
+            ctx->out[x + y*w] = ctx->ev2raw[output];
+        }
+    }
+}
+
+/* AMaZE runs on a "squeezed" image: the dark rows first, then the bright ones, starting at the middle */
+/* squeezed[y] is the row of the squeezed image holding the raw row y; */
+/* unsqueezed[s] is the raw row copied to the squeezed row s (the bright rows win), or -1 for none */
+static void hdr_squeeze_map(int h, int* squeezed, int* unsqueezed)
+{
+    for (int y = 0; y < h; y ++)
+    {
+        squeezed[y] = 0;
+        unsqueezed[y] = -1;
+    }
+
+    /* squeeze the dark image by deleting fields from the bright exposure */
+    int yh = -1;
+    for (int y = 0; y < h; y ++)
+    {
+        if (BRIGHT_ROW)
+            continue;
+        
+        if (yh < 0) /* make sure we start at the same parity (RGGB cell) */
+            yh = y;
+        
+        squeezed[y] = yh;
+        unsqueezed[yh] = y;
+        
+        yh++;
+    }
+
+    /* now the same for the bright exposure */
+    yh = -1;
+    for (int y = 0; y < h; y ++)
+    {
+        if (!BRIGHT_ROW)
+            continue;
+
+        if (yh < 0) /* make sure we start with the same parity (RGGB cell) */
+            yh = h/4*2 + y;
+        
+        squeezed[y] = yh;
+        unsqueezed[yh] = y;
+        
+        yh++;
+        if (yh >= h) break; /* just in case */
+    }
+}
+
+/* the raw row y, as AMaZE input */
+static void hdr_amaze_input_row(float* out, uint32_t* raw, int y, int w, int black)
+{
+    for (int x = 0; x < w; x++)
+    {
+        int p = raw[x];
+        
+        if (x%2 != y%2) /* divide green channel by 2 to approximate the final WB better */
+            p = (p - black) / 2 + black;
+        
+        out[x] = p;
+    }
+}
+
+/* the "rows" are the rows of the squeezed image (AMaZE output) */
+static void hdr_amaze_output_rows(void* arg, int band, int s0, int s1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    int black = ctx->black;
+
+    /* undo green channel scaling and clamp the other channels */
+    for (int y = s0; y < s1; y ++)
+    {
+        for (int x = 0; x < w; x ++)
+        {
+            ctx->green[y][x] = COERCE((ctx->green[y][x] - black) * 2 + black, 0, 0xFFFFF);
+            ctx->red[y][x] = COERCE(ctx->red[y][x], 0, 0xFFFFF);
+            ctx->blue[y][x] = COERCE(ctx->blue[y][x], 0, 0xFFFFF);
+        }
+    }
+}
+
+/* convert to grayscale and de-squeeze for easier processing */
+static void hdr_gray_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        int s = ctx->squeezed[y];
+        for (int x = 0; x < w; x ++)
+            ctx->gray[x + y*w] = ctx->green[s][x]/2 + ctx->red[s][x]/4 + ctx->blue[s][x]/4;
+    }
+}
+
+static void hdr_edge_stats(struct hdr_ctx * ctx)
+{
+    int semi_overexposed = 0;
+    int not_overexposed = 0;
+    int deep_shadow = 0;
+    int not_shadow = 0;
+    
+    for (int i = 0; i < PARALLEL_MAX_BANDS; i++)
+    {
+        semi_overexposed += ctx->semi_overexposed[i];
+        not_overexposed += ctx->not_overexposed[i];
+        deep_shadow += ctx->deep_shadow[i];
+        not_shadow += ctx->not_shadow[i];
+    }
+
+    printf("Semi-overexposed: %.02f%%\n", semi_overexposed * 100.0 / (semi_overexposed + not_overexposed));
+    printf("Deep shadows    : %.02f%%\n", deep_shadow * 100.0 / (deep_shadow + not_shadow));
+}
+
+/* border interpolation (image edges, not handled by the interpolation step) */
+static void hdr_border_rows(void* arg, int band, int y0, int y1)
+{
+    struct hdr_ctx * ctx = arg;
+    int w = ctx->w;
+    int h = ctx->h;
+    uint32_t* raw = ctx->raw;
+
+    for (int y = y0; y < y1; y ++)
+    {
+        uint32_t* native = BRIGHT_ROW ? ctx->bright : ctx->dark;
+        uint32_t* interp = BRIGHT_ROW ? ctx->dark : ctx->bright;
+        
+        if (y < 3)
+        {
+            for (int x = 0; x < w; x ++)
+            {
+                interp[x + y * w] = raw[x + (y+2) * w];
+                native[x + y * w] = raw[x + y * w];
+            }
+        }
+
+        if (y >= h-4)
+        {
+            for (int x = 0; x < w; x ++)
+            {
+                interp[x + y * w] = raw[x + (y-2) * w];
+                native[x + y * w] = raw[x + y * w];
+            }
+        }
+
+        if (y >= 2)
+        {
+            for (int x = 0; x < 2; x ++)
+            {
+                interp[x + y * w] = raw[x + (y-2) * w];
+                native[x + y * w] = raw[x + y * w];
+            }
+
+            for (int x = w-3; x < w; x ++)
+            {
+                interp[x + y * w] = raw[x-2 + (y-2) * w];
+                native[x + y * w] = raw[x-2 + y * w];
+            }
+        }
+    }
+}
+
+/* estimate ISO overlap; below 0.5 EV, the image can't be blended */
+static double hdr_iso_overlap(double lowiso_dr, double corr_ev)
+{
+    /*
+      ISO 100:       ###...........  (11 stops)
+      ISO 1600:  ####..........      (10 stops)
+      Combined:  XX##..............  (14 stops)
+    */
+    double clipped_ev = corr_ev;
+    double overlap = lowiso_dr - clipped_ev;
+
+    /* you get better colors, less noise, but a little more jagged edges if we underestimate the overlap amount */
+    /* maybe expose a tuning factor? (preference towards resolution or colors) */
+    overlap -= MIN(3, overlap - 3);
+    
+    printf("ISO overlap     : %.1f EV (approx)\n", overlap);
+    
+    if (overlap < 0.5)
+    {
+        printf("Overlap error\n");
+    }
+    else if (overlap < 2)
+    {
+        printf("Overlap too small, use a smaller ISO difference for better results.\n");
+    }
+
+    return overlap;
+}
+
+/* mixing curve for the half-res blending */
+static void hdr_mix_curve(struct hdr_ctx * ctx, double corr_ev, double overlap)
+{
+    int black = ctx->black;
+    int white = ctx->white;
+    double max_ev = log2(white/64 - black/64);
+    static double mix_curve[1<<20];
+    
+    ctx->mix_curve = mix_curve;
+    ctx->log2_signal = signal_tables.log2_signal + SIGNAL_RANGE - black;
+    ctx->corr_ev = corr_ev;
+    ctx->max_ev = max_ev;
+    ctx->overlap = overlap;
+    parallel_rows(0, 1<<20, 1, hdr_mix_curve_rows, ctx);
+
+    if (plot_mix_curve)
+    {
+        FILE* f = fopen("mix-curve.m", "w");
+        fprintf(f, "x = 0:65535; \n");
+
+        fprintf(f, "ev = [");
+        for (int i = 0; i < 65536; i++)
+            fprintf(f, "%f ", log2(MAX(i/4.0 - black/4.0, 1)));
+        fprintf(f, "];\n");
+        
+        fprintf(f, "k = [");
+        for (int i = 0; i < 65536; i++)
+            fprintf(f, "%f ", mix_curve[i*16]);
+        fprintf(f, "];\n");
+        
+        fprintf(f, "plot(ev, k);\n");
+        fprintf(f, "print -dpng mix-curve.png\n");
+        fclose(f);
+        
+        if(system("octave --persist mix-curve.m"));
+    }
+}
+
+/* low-memory mode (--low-mem): the same steps, run on bands of rows */
+/* each full-frame image is replaced by a window holding only the rows its readers still need */
+
+/* output rows per band (even, for the 2x2 steps) */
+#define HDR_BAND 128
+
+/* AMaZE tile rows (see amaze_demosaic_tiles) write AMAZE_TILE_STEP rows each, */
+/* reading AMAZE_TILE_BORDER more rows above and below */
+#define AMAZE_TILE_STEP 128
+#define AMAZE_TILE_BORDER 16
+
+/* the left margin (columns 0 ... active_area.x1-1) of the bright image and of the output, */
+/* saved on the way for the noise checks and for the final black level */
+static struct
+{
+    uint32_t* bright;
+    uint32_t* out;
+    int w;
+} hdr_margin;
+
+static int hdr_margin_bright(int x, int y)
+{
+    return hdr_margin.bright[x + y * hdr_margin.w];
+}
+
+static int hdr_margin_out(int x, int y)
+{
+    return hdr_margin.out[x + y * hdr_margin.w];
+}
+
+/* a few consecutive rows of a full-frame image */
+struct row_window
+{
+    char* mem;
+    int row_size;               /* bytes */
+    int fill;                   /* byte value for the new rows */
+    int y0, y1;                 /* rows held: y0 ... y1-1 */
+    int capacity;               /* rows */
+};
+
+/* hold the rows lo ... hi-1 (none of them may move up); the rows not held before are filled with win->fill */
+/* returns a pointer to where row 0 would be, so the rows are indexed as in the full image */
+static void* row_window_move(struct row_window * win, int lo, int hi)
+{
+    int row = win->row_size;
+    int k0 = MAX(lo, win->y0);
+    int k1 = MIN(hi, win->y1);
+
+    if (hi - lo > win->capacity)
+    {
+        char* mem = malloc((hi - lo) * row);
+        if (k1 > k0)
+            memcpy(mem + (k0 - lo) * row, win->mem + (k0 - win->y0) * row, (k1 - k0) * row);
+        free(win->mem);
+        win->mem = mem;
+        win->capacity = hi - lo;
+    }
+    else if (k1 > k0)
+    {
+        memmove(win->mem + (k0 - lo) * row, win->mem + (k0 - win->y0) * row, (k1 - k0) * row);
+    }
+
+    int n0 = MAX(lo, win->y1);
+    if (hi > n0)
+        memset(win->mem + (n0 - lo) * row, win->fill, (hi - n0) * row);
+
+    win->y0 = lo;
+    win->y1 = hi;
+    return win->mem - lo * row;
+}
+
+/* low-memory mode state, besides the windows */
+struct hdr_bands
+{
+    struct hdr_ctx * ctx;
+
+    /* 20-bit input (exposure matched, bad pixels fixed), computed from the 14-bit one as needed */
+    struct row_window raw;
+    int raw_done;               /* rows computed so far */
+    struct bad_pixel_ctx bad;   /* only counts the rows computed in order */
+
+    /* AMaZE rows, allocated when needed (see hdr_squeeze_map) */
+    float** rawData;
+    int* unsqueezed;
+    int* last_use;              /* last raw row using each squeezed row, -1 if none */
+    int tile_rows;
+    char* tile_done;
+};
+
+/* rows y0 ... y1-1 of the 20-bit input, into out (indexed as the full image) */
+static void hdr_bands_raw_rows(struct hdr_bands * st, struct bad_pixel_ctx * bad, uint32_t* out, int y0, int y1)
+{
+    int w = st->ctx->w;
+    int h = st->ctx->h;
+
+    /* the bad pixel search looks at the 4 rows above and below, before fixing */
+    int m0 = MAX(y0 - 4, 0);
+    int m1 = MIN(y1 + 4, h);
+    uint32_t* matched_mem = malloc((m1 - m0) * w * sizeof(uint32_t));
+    uint32_t* matched = matched_mem - m0 * w;
+
+    for (int y = m0; y < m1; y ++)
+        for (int x = 0; x < w; x ++)
+            matched[x + y*w] = raw_get_pixel_matched20(x, y);
+
+    if (fix_bad_pixels)
+    {
+        uint32_t* hotpixel_mem = malloc((y1 - y0) * w * sizeof(uint32_t));
+        memset(hotpixel_mem, 0, (y1 - y0) * w * sizeof(uint32_t));
+        uint32_t* hotpixel = hotpixel_mem - y0 * w;
+
+        bad->raw = matched;
+        bad->hotpixel = hotpixel;
+        parallel_rows(MAX(y0, 6), MIN(y1, h-6), 1, find_bad_pixels_rows, bad);
+        fix_bad_pixels_rows(matched, hotpixel, y0, y1);
+        free(hotpixel_mem);
+    }
+
+    memcpy(out + y0 * w, matched + y0 * w, (y1 - y0) * w * sizeof(uint32_t));
+    free(matched_mem);
+}
+
+/* does any tile row still to be computed read the squeezed row s? */
+static int hdr_bands_amaze_reads(struct hdr_bands * st, int s)
+{
+    int k1 = MIN((s + AMAZE_TILE_BORDER) / AMAZE_TILE_STEP, st->tile_rows - 1);
+    for (int k = MAX(k1 - 2, 0); k <= k1; k++)
+    {
+        if (!st->tile_done[k] && s >= k * AMAZE_TILE_STEP - AMAZE_TILE_BORDER && s < (k+1) * AMAZE_TILE_STEP + AMAZE_TILE_BORDER)
+            return 1;
+    }
+    return 0;
+}
+
+/* squeezed row s of the AMaZE input, from the 20-bit input rows (0 = no data for it) */
+static void hdr_bands_amaze_input(struct hdr_bands * st, int s, uint32_t* raw)
+{
+    int w = st->ctx->w;
+    int y = st->unsqueezed[s];
+
+    if (!st->rawData[s])
+    {
+        st->rawData[s] = malloc((w + 16) * sizeof(float));
+        memset(st->rawData[s], 0, (w + 16) * sizeof(float));
+    }
+
+    if (y >= 0 && raw)
+        hdr_amaze_input_row(st->rawData[s], raw + y * w, y, w, st->ctx->black);
+}
+
+/* compute the 20-bit input up to row y1 (not included), at least one band at a time */
+static void hdr_bands_raw_until(struct hdr_bands * st, int y1)
+{
+    struct hdr_ctx * ctx = st->ctx;
+    int y0 = st->raw_done;
+
+    if (y1 <= y0)
+        return;
+
+    y1 = MIN(MAX(y1, y0 + HDR_BAND), ctx->h);
+    ctx->raw = row_window_move(&st->raw, st->raw.y0, y1);
+    hdr_bands_raw_rows(st, &st->bad, ctx->raw, y0, y1);
+    st->raw_done = y1;
+
+    if (!st->rawData)
+        return;
+
+    /* AMaZE input rows are filled right away, since the tile rows reading them may run much later */
+    for (int y = y0; y < y1; y ++)
+    {
+        int s = ctx->squeezed[y];
+        if (st->unsqueezed[s] == y && hdr_bands_amaze_reads(st, s))
+            hdr_bands_amaze_input(st, s, ctx->raw);
+    }
+}
+
+/* AMaZE tile row k; its input rows not filled yet are computed on the way */
+static void hdr_bands_amaze(struct hdr_bands * st, int k)
+{
+    struct hdr_ctx * ctx = st->ctx;
+    int w = ctx->w;
+    int h = ctx->h;
+
+    if (st->tile_done[k])
+        return;
+
+    int s0 = MAX(k * AMAZE_TILE_STEP - AMAZE_TILE_BORDER, 0);
+    int s1 = MIN((k+1) * AMAZE_TILE_STEP + AMAZE_TILE_BORDER, h);
+    int y_last = -1;
+    for (int s = s0; s < s1; s++)
+        if (!st->rawData[s])
+            y_last = MAX(y_last, st->unsqueezed[s]);
+
+    hdr_bands_raw_until(st, y_last + 1);
+
+    /* rows without data */
+    for (int s = s0; s < s1; s++)
+        if (!st->rawData[s])
+            hdr_bands_amaze_input(st, s, 0);
+
+    int o0 = k * AMAZE_TILE_STEP;
+    int o1 = MIN(o0 + AMAZE_TILE_STEP, h);
+    for (int s = o0; s < o1; s++)
+    {
+        ctx->red[s]   = malloc((w + 16) * sizeof(float));
+        ctx->green[s] = malloc((w + 16) * sizeof(float));
+        ctx->blue[s]  = malloc((w + 16) * sizeof(float));
+    }
+
+    int amaze_demosaic_tiles(
+        float** rawData, float** red, float** green, float** blue,
+        int winx, int winy, int winw, int winh,
+        int tile0, int tile1
+    );
+
+    amaze_demosaic_tiles(st->rawData, ctx->red, ctx->green, ctx->blue, 0, 0, w, h, k, k+1);
+    st->tile_done[k] = 1;
+
+    parallel_rows(o0, o1, 1, hdr_amaze_output_rows, ctx);
+
+    for (int s = o0; s < o1; s++)
+    {
+        if (st->last_use[s] < 0)
+        {
+            free(ctx->red[s]);   ctx->red[s] = 0;
+            free(ctx->green[s]); ctx->green[s] = 0;
+            free(ctx->blue[s]);  ctx->blue[s] = 0;
+        }
+    }
+
+    for (int s = s0; s < s1; s++)
+    {
+        if (st->rawData[s] && !hdr_bands_amaze_reads(st, s))
+        {
+            free(st->rawData[s]);
+            st->rawData[s] = 0;
+        }
+    }
+}
+
+/* the tile rows at the middle of the squeezed image read dark rows from the bottom of the image */
+/* and bright rows from the top, so their input is computed separately (and not counted as bad pixels) */
+static void hdr_bands_amaze_middle(struct hdr_bands * st)
+{
+    struct hdr_ctx * ctx = st->ctx;
+    int w = ctx->w;
+    int h = ctx->h;
+
+    for (int k = 0; k < st->tile_rows; k++)
+    {
+        if (st->tile_done[k])
+            continue;
+
+        int s0 = MAX(k * AMAZE_TILE_STEP - AMAZE_TILE_BORDER, 0);
+        int s1 = MIN((k+1) * AMAZE_TILE_STEP + AMAZE_TILE_BORDER, h);
+
+        /* raw rows read from each exposure */
+        int first[2] = {h, h};
+        int last[2] = {-1, -1};
+        for (int s = s0; s < s1; s++)
+        {
+            int y = st->unsqueezed[s];
+            if (y < 0) continue;
+            int b = BRIGHT_ROW;
+            first[b] = MIN(first[b], y);
+            last[b] = MAX(last[b], y);
+        }
+
+        if (last[0] < 0 || last[1] < 0)
+            continue;
+
+        for (int b = 0; b < 2; b++)
+        {
+            int y0 = first[b];
+            int y1 = last[b] + 1;
+            uint32_t* raw_mem = malloc((y1 - y0) * w * sizeof(uint32_t));
+            uint32_t* raw = raw_mem - y0 * w;
+            struct bad_pixel_ctx bad = { .dark_noise = st->bad.dark_noise, .raw2ev = st->bad.raw2ev };
+            hdr_bands_raw_rows(st, &bad, raw, y0, y1);
+
+            for (int s = s0; s < s1; s++)
+            {
+                int y = st->unsqueezed[s];
+                if (y >= y0 && y < y1)
+                    hdr_bands_amaze_input(st, s, raw);
+            }
+            free(raw_mem);
+        }
+
+        hdr_bands_amaze(st, k);
+    }
+}
+
+static void hdr_interpolate_bands(struct hdr_ctx * ctx, int dark_noise)
+{
+    int w = ctx->w;
+    int h = ctx->h;
+    int* raw2ev = ctx->raw2ev;
+    int* ev2raw = ctx->ev2raw;
+
+    printf("Low-memory mode : %d rows at a time\n", HDR_BAND);
+    profile_next_step("bands", raw_info.frame_size);
+
+    struct hdr_bands st = {
+        .ctx = ctx,
+        .raw = { .row_size = w * sizeof(uint32_t) },
+        .bad = { .dark_noise = dark_noise, .raw2ev = raw2ev },
+    };
+
+    if (fix_bad_pixels)
+        printf("Looking for hot/cold pixels...\n");
+
+    int d0 = COUNT(edge_directions)/2;
+    struct row_window gray_win = { .row_size = w * sizeof(uint32_t) };
+    struct row_window edge_win = { .row_size = w * sizeof(uint8_t), .fill = d0 };
+
+    if (interp_method == 0) /* amaze-edge */
+    {
+        ctx->squeezed = malloc(h * sizeof(ctx->squeezed[0]));
+        st.unsqueezed = malloc(h * sizeof(st.unsqueezed[0]));
+        st.last_use = malloc(h * sizeof(st.last_use[0]));
+        hdr_squeeze_map(h, ctx->squeezed, st.unsqueezed);
+
+        for (int s = 0; s < h; s++)
+            st.last_use[s] = -1;
+        for (int y = 0; y < h; y++)
+            st.last_use[ctx->squeezed[y]] = y;
+
+        st.rawData = malloc(h * sizeof(st.rawData[0]));
+        ctx->red   = malloc(h * sizeof(ctx->red[0]));
+        ctx->green = malloc(h * sizeof(ctx->green[0]));
+        ctx->blue  = malloc(h * sizeof(ctx->blue[0]));
+        memset(st.rawData, 0, h * sizeof(st.rawData[0]));
+        memset(ctx->red,   0, h * sizeof(ctx->red[0]));
+        memset(ctx->green, 0, h * sizeof(ctx->green[0]));
+        memset(ctx->blue,  0, h * sizeof(ctx->blue[0]));
+
+        /* tile rows whose output is not used are skipped */
+        st.tile_rows = (h + AMAZE_TILE_BORDER + AMAZE_TILE_STEP - 1) / AMAZE_TILE_STEP;
+        st.tile_done = malloc(st.tile_rows);
+        for (int k = 0; k < st.tile_rows; k++)
+        {
+            st.tile_done[k] = 1;
+            for (int s = k * AMAZE_TILE_STEP; s < MIN((k+1) * AMAZE_TILE_STEP, h); s++)
+                if (st.last_use[s] >= 0)
+                    st.tile_done[k] = 0;
+        }
+
+        hdr_bands_amaze_middle(&st);
+    }
+    else
+    {
+        printf("Interpolation   : mean23\n");
+    }
+
+    if (use_stripe_fix)
+    {
+        printf("Horizontal stripe fix...\n");
+        ctx->stripe_rejected = malloc(h * sizeof(ctx->stripe_rejected[0]));
+        memset(ctx->stripe_rejected, 0, h * sizeof(ctx->stripe_rejected[0]));
+    }
+
+    struct row_window dark_win = { .row_size = w * sizeof(uint32_t) };
+    struct row_window bright_win = { .row_size = w * sizeof(uint32_t) };
+    struct row_window fullres_win = { .row_size = w * sizeof(uint32_t) };
+    struct row_window fullres_smooth_win = { .row_size = w * sizeof(uint32_t) };
+    struct row_window halfres_win = { .row_size = w * sizeof(uint32_t) };
+    struct row_window halfres_smooth_win = { .row_size = w * sizeof(uint32_t) };
+    struct row_window alias_win = { .row_size = w * sizeof(uint16_t) };
+    struct row_window alias_aux_win = { .row_size = w * sizeof(uint16_t) };
+    struct row_window over_win = { .row_size = w * sizeof(uint16_t) };
+    struct row_window over_aux_win = { .row_size = w * sizeof(uint16_t) };
+    struct row_window out_win = { .row_size = w * sizeof(uint32_t) };
+
+    hdr_margin.w = MAX(raw_info.active_area.x1, 1);
+    hdr_margin.bright = malloc(hdr_margin.w * h * sizeof(uint32_t));
+    hdr_margin.out = malloc(hdr_margin.w * h * sizeof(uint32_t));
+    int mw = MIN(hdr_margin.w, w);
+
+    /* rows done by each step so far; each one runs as far as the next steps need for the output rows y0 ... y1-1 */
+    /* (interpolation 16 rows ahead, chroma smoothing and alias map 12, alias filter 6, overexposure map 1) */
+    int done_interp = 0, done_gray = 0, done_chroma = 0, done_alias = 0, done_alias_filter = 0, done_over = 0;
+
+    for (int y0 = 0, y1; y0 < h; y0 = y1)
+    {
+        y1 = MIN(y0 + HDR_BAND, h);
+        int interp = MIN(y1 + 16, h);
+        int gray = MIN(interp + 3, h);
+        int chroma = MIN(y1 + 12, h);
+        int alias = chroma;
+        int alias_filter = MIN(y1 + 6, h);
+        int over = MIN(y1 + 1, h);
+
+        /* the filters look at most 8 rows back */
+        int lo = MAX(y0 - 8, 0);
+
+        ctx->raw = row_window_move(&st.raw, lo, st.raw.y1);
+        hdr_bands_raw_until(&st, MIN(interp + 2, h));
+
+        if (interp_method == 0)
+        {
+            for (int s = 0; s < h; s++)
+            {
+                if (ctx->red[s] && st.last_use[s] < lo)
+                {
+                    free(ctx->red[s]);   ctx->red[s] = 0;
+                    free(ctx->green[s]); ctx->green[s] = 0;
+                    free(ctx->blue[s]);  ctx->blue[s] = 0;
                 }
             }
+
+            for (int y = done_gray; y < gray; y++)
+                hdr_bands_amaze(&st, ctx->squeezed[y] / AMAZE_TILE_STEP);
+
+            ctx->gray = row_window_move(&gray_win, lo, gray);
+            parallel_rows(done_gray, gray, 1, hdr_gray_rows, ctx);
+
+            ctx->edge_direction = row_window_move(&edge_win, lo, interp);
+            parallel_rows(MAX(done_interp, 5), MIN(interp, h-5), 1, hdr_edge_search_rows, ctx);
+        }
+
+        ctx->dark = row_window_move(&dark_win, lo, interp);
+        ctx->bright = row_window_move(&bright_win, lo, interp);
+        parallel_rows(MAX(done_interp, 2), MIN(interp, h-2), 1, interp_method == 0 ? hdr_edge_interp_rows : hdr_mean23_rows, ctx);
+        parallel_rows(done_interp, interp, 1, hdr_border_rows, ctx);
+
+        if (use_stripe_fix)
+        {
+            int ya = MAX(done_interp, raw_info.active_area.y1);
+            int yb = MIN(interp, raw_info.active_area.y2);
+            parallel_rows(ya, yb, 1, hdr_stripe_fix_rows, ctx);
+
+            for (int y = ya; y < yb; y ++)
+                if (ctx->stripe_rejected[y])
+                    printf("%d: offset too large (%d)\n", y, ctx->stripe_rejected[y]);
+        }
+
+        ctx->fullres = ctx->fullres_smooth = row_window_move(&fullres_win, lo, interp);
+        if (use_fullres)
+            parallel_rows(done_interp, interp, 1, hdr_fullres_rows, ctx);
+
+        ctx->halfres = ctx->halfres_smooth = row_window_move(&halfres_win, lo, interp);
+        parallel_rows(done_interp, interp, 1, hdr_halfres_rows, ctx);
+
+        if (chroma_smooth_method)
+        {
+            ctx->halfres_smooth = row_window_move(&halfres_smooth_win, lo, interp);
+            memcpy(ctx->halfres_smooth + done_interp * w, ctx->halfres + done_interp * w, (interp - done_interp) * w * sizeof(uint32_t));
+            chroma_smooth_part(ctx->halfres, ctx->halfres_smooth, done_chroma, chroma, raw2ev, ev2raw);
+
+            if (use_fullres)
+            {
+                ctx->fullres_smooth = row_window_move(&fullres_smooth_win, lo, interp);
+                memcpy(ctx->fullres_smooth + done_interp * w, ctx->fullres + done_interp * w, (interp - done_interp) * w * sizeof(uint32_t));
+                chroma_smooth_part(ctx->fullres, ctx->fullres_smooth, done_chroma, chroma, raw2ev, ev2raw);
+            }
+        }
+
+        if (use_alias_map)
+        {
+            ctx->alias_map = row_window_move(&alias_win, lo, alias);
+            ctx->alias_aux = row_window_move(&alias_aux_win, lo, alias);
+            parallel_rows(done_alias, alias, 1, hdr_alias_build_rows, ctx);
+            memcpy(ctx->alias_aux + done_alias * w, ctx->alias_map + done_alias * w, (alias - done_alias) * w * sizeof(uint16_t));
+            parallel_rows(MAX(done_alias_filter, 6), MIN(alias_filter, h-6), 1, hdr_alias_filter_rows, ctx);
+            parallel_rows(MAX(y0, 6), MIN(y1, h-6), 1, hdr_alias_smooth_rows, ctx);
+            parallel_rows(MAX(y0, 2), MIN(y1, h-2), 2, hdr_alias_gray_rows, ctx);
+        }
+
+        ctx->overexposed = row_window_move(&over_win, lo, over);
+        ctx->over_aux = row_window_move(&over_aux_win, lo, over);
+        parallel_rows(done_over, over, 1, hdr_overexposed_rows, ctx);
+        memcpy(ctx->over_aux + done_over * w, ctx->overexposed + done_over * w, (over - done_over) * w * sizeof(uint16_t));
+        parallel_rows(MAX(y0, 3), MIN(y1, h-3), 1, hdr_overexposed_blur_rows, ctx);
+
+        ctx->out = row_window_move(&out_win, y0, y1);
+        parallel_rows(y0, y1, 1, hdr_final_blend_rows, ctx);
+
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = 0; x < mw; x++)
+            {
+                hdr_margin.bright[x + y * hdr_margin.w] = ctx->bright[x + y*w];
+                hdr_margin.out[x + y * hdr_margin.w] = ctx->out[x + y*w];
+            }
         }
+
+        /* these rows are final: back to 16 bits (same order as the full-image conversion, for the same dithering noise) */
+        for (int y = y0; y < y1; y++)
+            for (int x = 0; x < w; x++)
+                raw_set_pixel_20to16_rand(x, y, ctx->out[x + y*w]);
+
+        done_interp = interp;
+        done_gray = gray;
+        done_chroma = chroma;
+        done_alias = alias;
+        done_alias_filter = alias_filter;
+        done_over = over;
     }
 
-    /* apply the correction */
-    for (int y = 0; y < h; y ++)
-        for (int x = 0; x < w; x ++)
-            if (hotpixel[x + y*w])
-                raw_set_pixel20(x, y, debug_bad_pixels ? black : hotpixel[x + y*w]);
+    int hot_pixels = 0;
+    int cold_pixels = 0;
+    for (int i = 0; i < PARALLEL_MAX_BANDS; i++)
+    {
+        hot_pixels += st.bad.hot_pixels[i];
+        cold_pixels += st.bad.cold_pixels[i];
+    }
 
     if (hot_pixels)
         printf("Hot pixels      : %d\n", hot_pixels);
 
     if (cold_pixels)
         printf("Cold pixels     : %d\n", cold_pixels);
-    
-    free(hotpixel);
-}
 
-/* soft-film curve from ufraw-mod */
-static double soft_film(double raw, double exposure, int in_black, int in_white, int out_black, int out_white)
-{
-    double a = MAX(exposure - 1, 1e-5);
-    if (raw > in_black)
-    {
-        /* at low values, force the derivative equal to exposure (in linear units) */
-        /* at high values, map in_white to out_white (which normally happens at exposure=1) */
-        double x = (raw - in_black) / (in_white - in_black);
-        return (1.0 - 1.0/(1.0 + a*x)) / (1.0 - 1.0/(1.0 + a)) * (out_white - out_black) + out_black;
-    }
-    else
+    if (interp_method == 0)
     {
-        /* linear extrapolation below black */
-        return COERCE((raw - in_black) * exposure / (in_white - in_black) * (out_white - out_black) + out_black, 0, out_white);
+        hdr_edge_stats(ctx);
+
+        for (int s = 0; s < h; s++)
+        {
+            free(st.rawData[s]);
+            free(ctx->red[s]);
+            free(ctx->green[s]);
+            free(ctx->blue[s]);
+        }
+        free(st.rawData);
+        free(ctx->red); ctx->red = 0;
+        free(ctx->green); ctx->green = 0;
+        free(ctx->blue); ctx->blue = 0;
+        free(ctx->squeezed); ctx->squeezed = 0;
+        free(st.unsqueezed);
+        free(st.last_use);
+        free(st.tile_done);
     }
-}
 
-static int soft_film_bakedwb(double raw, double exposure, int in_black, int in_white, int out_black, int out_white, double wb, double max_wb)
-{
-    double raw_baked = (raw - in_black) * wb / max_wb + in_black;
-    double raw_soft = soft_film(raw_baked, exposure * max_wb, in_black, in_white, out_black, out_white);
-    double raw_adjusted = (raw_soft - out_black) / wb + out_black;
-    return round(raw_adjusted + fast_randn05());
+    free(ctx->stripe_rejected); ctx->stripe_rejected = 0;
+    free(st.raw.mem);
+    free(gray_win.mem);
+    free(edge_win.mem);
+    free(dark_win.mem);
+    free(bright_win.mem);
+    free(fullres_win.mem);
+    free(fullres_smooth_win.mem);
+    free(halfres_win.mem);
+    free(halfres_smooth_win.mem);
+    free(alias_win.mem);
+    free(alias_aux_win.mem);
+    free(over_win.mem);
+    free(over_aux_win.mem);
+    free(out_win.mem);
+
+    /* only the windows were pointing here */
+    ctx->raw = ctx->out = ctx->gray = ctx->dark = ctx->bright = 0;
+    ctx->fullres = ctx->fullres_smooth = ctx->halfres = ctx->halfres_smooth = 0;
+    ctx->alias_map = ctx->alias_aux = ctx->overexposed = ctx->over_aux = 0;
+    ctx->edge_direction = 0;
 }
 
 static int hdr_interpolate()
@@ -2030,6 +4436,8 @@ static int hdr_interpolate()
 
     int ret = 1;
 
+    profile_next_step("prepare", raw_info.frame_size);
+
     /* will use 20-bit processing and 16-bit output, instead of 14 */
     raw_info.black_level *= 64;
     raw_info.white_level *= 64;
@@ -2044,35 +4452,21 @@ static int hdr_interpolate()
     raw_info.white_level = white;
 
     /* for fast EV - raw conversion */
-    static int raw2ev[1<<20];   /* EV x EV_RESOLUTION */
+    signal_tables_prepare(black);
+    int* raw2ev = signal_tables.raw2ev + SIGNAL_RANGE - black;   /* EV x EV_RESOLUTION */
     static int ev2raw_0[24*EV_RESOLUTION];
     
     /* handle sub-black values (negative EV) */
     int* ev2raw = ev2raw_0 + 10*EV_RESOLUTION;
 
-    for (int i = 0; i < 1<<20; i++)
-    {
-        double signal = MAX(i/64.0 - black/64.0, -1023);
-        if (signal > 0)
-            raw2ev[i] = (int)round(log2(1+signal) * EV_RESOLUTION);
-        else
-            raw2ev[i] = -(int)round(log2(1-signal) * EV_RESOLUTION);
-    }
-
-    for (int i = -10*EV_RESOLUTION; i < 0; i++)
-    {
-        ev2raw[i] = COERCE(black+64 - round(64*pow(2, ((double)-i/EV_RESOLUTION))), 0, black);
-    }
+    /* the heavy steps below run on row bands, sharing this context */
+    struct hdr_ctx ctx = {
+        .w = w, .h = h,
+        .black = black, .white = white,
+        .raw2ev = raw2ev, .ev2raw = ev2raw,
+    };
 
-    for (int i = 0; i < 14*EV_RESOLUTION; i++)
-    {
-        ev2raw[i] = COERCE(black-64 + round(64*pow(2, ((double)i/EV_RESOLUTION))), black, (1<<20)-1);
-        
-        if (i >= raw2ev[white])
-        {
-            ev2raw[i] = MAX(ev2raw[i], white);
-        }
-    }
+    parallel_rows(-10*EV_RESOLUTION, 14*EV_RESOLUTION, 1, hdr_ev2raw_rows, &ctx);
     
     /* keep "bad" pixels, if any */
     ev2raw[raw2ev[0]] = 0;
@@ -2106,17 +4500,25 @@ static int hdr_interpolate()
     }
 
     /* promote from 14 to 20 bits (original raw buffer holds 14-bit values stored as uint16_t) */
+    /* (in low-memory mode, only a few rows at a time, see hdr_interpolate_bands) */
     void* raw_buffer_16 = raw_info.buffer;
-    uint32_t * raw_buffer_32 = malloc(w * h * sizeof(raw_buffer_32[0]));
+    uint32_t * raw_buffer_32 = 0;
     
-    for (int y = 0; y < h; y ++)
-        for (int x = 0; x < w; x ++)
-            raw_buffer_32[x + y*w] = raw_get_pixel_14to20(x, y);
+    if (!low_mem)
+    {
+        raw_buffer_32 = malloc(w * h * sizeof(raw_buffer_32[0]));
 
-    raw_info.buffer = raw_buffer_32;
-    for (int y = 0; y < h; y ++)
-        for (int x = 0; x < w; x ++)
-            raw_set_pixel32(x, y, raw_buffer_32[x + y*w]);
+        for (int y = 0; y < h; y ++)
+            for (int x = 0; x < w; x ++)
+                raw_buffer_32[x + y*w] = raw_get_pixel_14to20(x, y);
+
+        raw_info.buffer = raw_buffer_32;
+        for (int y = 0; y < h; y ++)
+            for (int x = 0; x < w; x ++)
+                raw_set_pixel32(x, y, raw_buffer_32[x + y*w]);
+    }
+
+    ctx.raw = ctx.out = raw_buffer_32;
 
     /* we have now switched to 20-bit, update noise numbers */
     dark_noise *= 64;
@@ -2124,43 +4526,34 @@ static int hdr_interpolate()
     dark_noise_ev += 6;
     bright_noise_ev += 6;
 
+    /* full-frame planes are allocated right before the stage that fills them, */
+    /* and freed as soon as the last stage reading them is done, to keep peak memory down */
+    /* (a 50-megapixel image would otherwise need over 2 GB) */
+
     /* dark and bright exposures, interpolated */
-    uint32_t* dark   = malloc(w * h * sizeof(uint32_t));
-    uint32_t* bright = malloc(w * h * sizeof(uint32_t));
-    memset(dark, 0, w * h * sizeof(uint32_t));
-    memset(bright, 0, w * h * sizeof(uint32_t));
-    
+    uint32_t* dark   = 0;
+    uint32_t* bright = 0;
+
     /* fullres image (minimizes aliasing) */
-    uint32_t* fullres = malloc(w * h * sizeof(uint32_t));
-    memset(fullres, 0, w * h * sizeof(uint32_t));
-    uint32_t* fullres_smooth = fullres;
+    uint32_t* fullres = 0;
+    uint32_t* fullres_smooth = 0;
 
     /* halfres image (minimizes noise and banding) */
-    uint32_t* halfres = malloc(w * h * sizeof(uint32_t));
-    memset(halfres, 0, w * h * sizeof(uint32_t));
-    uint32_t* halfres_smooth = halfres;
+    uint32_t* halfres = 0;
+    uint32_t* halfres_smooth = 0;
     
     /* overexposure map */
     uint16_t* overexposed = 0;
 
-    uint16_t* alias_map = malloc(w * h * sizeof(uint16_t));
-    memset(alias_map, 0, w * h * sizeof(uint16_t));
+    uint16_t* alias_map = 0;
 
-    /* fullres mixing curve */
-    static double fullres_curve[1<<20];
+    /* fullres mixing curve (see fullres_start and fullres_transition) */
+    double* fullres_curve = signal_tables.fullres_curve + SIGNAL_RANGE - black;
     
-    const double fullres_start = 4;
-    const double fullres_transition = 4;
     const double fullres_thr = 0.8;
     
-    for (int i = 0; i < (1<<20); i++)
-    {
-        double ev2 = log2(MAX(i/64.0 - black/64.0, 1));
-        double c2 = -cos(COERCE(ev2 - fullres_start, 0, fullres_transition)*M_PI/fullres_transition);
-        double f = (c2+1) / 2;
-        fullres_curve[i] = f;
-    }
-    
+    ctx.fullres_curve = fullres_curve;
+    ctx.fullres_thr = fullres_thr;
 
     if (plot_fullres_curve)
     {
@@ -2188,11 +4581,19 @@ static int hdr_interpolate()
     /* estimate ISO difference between bright and dark exposures */
     double corr_ev = 0;
     int white_darkened = white_bright;
-    int ok = match_exposures(&corr_ev, &white_darkened);
+    profile_next_step("exposure_match", raw_info.frame_size);
+    int ok = match_exposures(&corr_ev, &white_darkened, raw_buffer_32);
     if (!ok) goto err;
 
+    if (clip_calib.measure_only)
+    {
+        /* calibration frame from a video clip: we only needed the measurements */
+        raw_info.buffer = raw_buffer_16;
+        goto end;
+    }
+
     /* run a second black subtract pass, to fix whatever our funky processing may do to blacks */
-    black_subtract_simple(raw_info.active_area.x1, raw_info.active_area.y1);
+    black_subtract_simple(raw_info.active_area.x1, raw_info.active_area.y1, low_mem ? raw_get_pixel_matched20 : raw_get_pixel20);
 
     /* estimate dynamic range */
     double lowiso_dr = log2(white - black) - dark_noise_ev;
@@ -2205,17 +4606,45 @@ static int hdr_interpolate()
     /* update bright noise measurements, so they can be compared after scaling */
     bright_noise /= corr;
     bright_noise_ev -= corr_ev;
+
+    ctx.white_darkened = white_darkened;
+    ctx.dark_noise = dark_noise;
+
+    /* trial and error - too high = aliasing, too low = noisy */
+    int ALIAS_MAP_MAX = 15000;
+    ctx.alias_map_max = ALIAS_MAP_MAX;
+
+    double ideal_noise_std = 0;
+
+    if (low_mem)
+    {
+        /* the mixing curve is needed from the first band */
+        double overlap = hdr_iso_overlap(lowiso_dr, corr_ev);
+        if (overlap < 0.5)
+            goto err;
+        hdr_mix_curve(&ctx, corr_ev, overlap);
+
+        hdr_interpolate_bands(&ctx, dark_noise);
+
+        /* ideal noise level: see below */
+        compute_black_noise(8, raw_info.active_area.x1 - 8, raw_info.active_area.y1 + 20, raw_info.active_area.y2 - 20, 1, 1, &noise_avg, &noise_std[0], hdr_margin_bright);
+        ideal_noise_std = noise_std[0];
+        goto blended;
+    }
     
     if (fix_bad_pixels)
     {
         /* best done before interpolation */
-        find_and_fix_bad_pixels(dark_noise, bright_noise, raw2ev, ev2raw);
+        profile_next_step("bad_pixels", raw_info.frame_size);
+        find_and_fix_bad_pixels(raw_buffer_32, dark_noise, bright_noise, raw2ev, ev2raw);
     }
 
     if (interp_method == 0) /* amaze-edge */
     {
-        int* squeezed = malloc(h * sizeof(squeezed));
-        memset(squeezed, 0, h * sizeof(squeezed));
+        profile_next_step("amaze", raw_info.frame_size);
+        int* squeezed = malloc(h * sizeof(squeezed[0]));
+        int* unsqueezed = malloc(h * sizeof(unsqueezed[0]));
+        hdr_squeeze_map(h, squeezed, unsqueezed);
  
         float** rawData = malloc(h * sizeof(rawData[0]));
         float** red     = malloc(h * sizeof(red[0]));
@@ -2232,56 +4661,11 @@ static int hdr_interpolate()
             blue[i]    = malloc(wx * sizeof(blue[0][0]));
         }
         
-        /* squeeze the dark image by deleting fields from the bright exposure */
-        int yh = -1;
-        for (int y = 0; y < h; y ++)
-        {
-            if (BRIGHT_ROW)
-                continue;
-            
-            if (yh < 0) /* make sure we start at the same parity (RGGB cell) */
-                yh = y;
-            
-            for (int x = 0; x < w; x++)
-            {
-                int p = raw_get_pixel32(x, y);
-                
-                if (x%2 != y%2) /* divide green channel by 2 to approximate the final WB better */
-                    p = (p - black) / 2 + black;
-                
-                rawData[yh][x] = p;
-            }
-            
-            squeezed[y] = yh;
-            
-            yh++;
-        }
-
-        /* now the same for the bright exposure */
-        yh = -1;
-        for (int y = 0; y < h; y ++)
-        {
-            if (!BRIGHT_ROW)
-                continue;
+        for (int i = 0; i < h; i++)
+            if (unsqueezed[i] >= 0)
+                hdr_amaze_input_row(rawData[i], raw_buffer_32 + unsqueezed[i] * w, unsqueezed[i], w, black);
 
-            if (yh < 0) /* make sure we start with the same parity (RGGB cell) */
-                yh = h/4*2 + y;
-            
-            for (int x = 0; x < w; x++)
-            {
-                int p = raw_get_pixel32(x, y);
-                
-                if (x%2 != y%2) /* divide green channel by 2 to approximate the final WB better */
-                    p = (p - black) / 2 + black;
-                
-                rawData[yh][x] = p;
-            }
-            
-            squeezed[y] = yh;
-            
-            yh++;
-            if (yh >= h) break; /* just in case */
-        }
+        free(unsqueezed); unsqueezed = 0;
 
         if (debug_amaze)
         {
@@ -2302,16 +4686,16 @@ static int hdr_interpolate()
 
         amaze_demosaic_RT(rawData, red, green, blue, 0, 0, w, h);
 
-        /* undo green channel scaling and clamp the other channels */
-        for (int y = 0; y < h; y ++)
-        {
-            for (int x = 0; x < w; x ++)
-            {
-                green[y][x] = COERCE((green[y][x] - black) * 2 + black, 0, 0xFFFFF);
-                red[y][x] = COERCE(red[y][x], 0, 0xFFFFF);
-                blue[y][x] = COERCE(blue[y][x], 0, 0xFFFFF);
-            }
-        }
+        /* AMaZE input no longer needed */
+        for (int i = 0; i < h; i++)
+            free(rawData[i]);
+        free(rawData); rawData = 0;
+
+        ctx.red = red;
+        ctx.green = green;
+        ctx.blue = blue;
+        ctx.squeezed = squeezed;
+        parallel_rows(0, h, 1, hdr_amaze_output_rows, &ctx);
 
         if (debug_amaze)
         {
@@ -2336,13 +4720,13 @@ static int hdr_interpolate()
         }
 
         printf("Edge-directed interpolation...\n");
+        profile_next_step("edge_interp", raw_info.frame_size);
         
         //~ printf("Grayscale...\n");
         /* convert to grayscale and de-squeeze for easier processing */
         uint32_t * gray = malloc(w * h * sizeof(gray[0]));
-        for (int y = 0; y < h; y ++)
-            for (int x = 0; x < w; x ++)
-                gray[x + y*w] = green[squeezed[y]][x]/2 + red[squeezed[y]][x]/4 + blue[squeezed[y]][x]/4;
+        ctx.gray = gray;
+        parallel_rows(0, h, 1, hdr_gray_rows, &ctx);
 
         #if 0
         for (int y = 0; y < h; y ++)
@@ -2352,31 +4736,6 @@ static int hdr_interpolate()
         exit(1);
         #endif
 
-        /* define edge directions for interpolation */
-        struct xy { int x; int y; };
-        const struct
-        {
-            struct xy ack;      /* verification pixel near a */
-            struct xy a;        /* interpolation pixel from the nearby line: normally (0,s) but also (1,s) or (-1,s) */
-            struct xy b;        /* interpolation pixel from the other line: normally (0,-2s) but also (1,-2s), (-1,-2s), (2,-2s) or (-2,-2s) */
-            struct xy bck;      /* verification pixel near b */
-        }
-        edge_directions[] = {       /* note: all y coords should be multiplied by s */
-            //~ { {-6,2}, {-3,1}, { 6,-2}, { 9,-3} },     /* almost horizontal (little or no improvement) */
-            { {-4,2}, {-2,1}, { 4,-2}, { 6,-3} },
-            { {-3,2}, {-1,1}, { 3,-2}, { 4,-3} },
-            { {-2,2}, {-1,1}, { 2,-2}, { 3,-3} },     /* 45-degree diagonal */
-            { {-1,2}, {-1,1}, { 1,-2}, { 2,-3} },
-            { {-1,2}, { 0,1}, { 1,-2}, { 1,-3} },
-            { { 0,2}, { 0,1}, { 0,-2}, { 0,-3} },     /* vertical, preferred; no extra confirmations needed */
-            { { 1,2}, { 0,1}, {-1,-2}, {-1,-3} },
-            { { 1,2}, { 1,1}, {-1,-2}, {-2,-3} },
-            { { 2,2}, { 1,1}, {-2,-2}, {-3,-3} },     /* 45-degree diagonal */
-            { { 3,2}, { 1,1}, {-3,-2}, {-4,-3} },
-            { { 4,2}, { 2,1}, {-4,-2}, {-6,-3} },
-            //~ { { 6,2}, { 3,1}, {-6,-2}, {-9,-3} },     /* almost horizontal */
-        };
-
         uint8_t* edge_direction = malloc(w * h * sizeof(edge_direction[0]));
         int d0 = COUNT(edge_directions)/2;
         for (int y = 0; y < h; y ++)
@@ -2384,98 +4743,12 @@ static int hdr_interpolate()
                 edge_direction[x + y*w] = d0;
 
         //~ printf("Cross-correlation...\n");
-        int semi_overexposed = 0;
-        int not_overexposed = 0;
-        int deep_shadow = 0;
-        int not_shadow = 0;
-        
-        for (int y = 5; y < h-5; y ++)
-        {
-            int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
-            for (int x = 5; x < w-5; x ++)
-            {
-                int e_best = INT_MAX;
-                int d_best = d0;
-                int dmin = 0;
-                int dmax = COUNT(edge_directions)-1;
-                int search_area = 5;
-
-                /* only use high accuracy on the dark exposure where the bright ISO is overexposed */
-                if (!BRIGHT_ROW)
-                {
-                    /* interpolating bright exposure */
-                    if (fullres_curve[raw_get_pixel32(x, y)] > fullres_thr && !debug_edge)
-                    {
-                        /* no high accuracy needed, just interpolate vertically */
-                        not_shadow++;
-                        dmin = d0;
-                        dmax = d0;
-                    }
-                    else
-                    {
-                        /* deep shadows, unlikely to use fullres, so we need a good interpolation */
-                        deep_shadow++;
-                    }
-                }
-                else if (raw_get_pixel32(x, y) < white_darkened && !debug_edge)
-                {
-                    /* interpolating dark exposure, but we also have good data from the bright one */
-                    not_overexposed++;
-                    dmin = d0;
-                    dmax = d0;
-                }
-                else
-                {
-                    /* interpolating dark exposure, but the bright one is clipped */
-                    semi_overexposed++;
-                }
-
-                if (dmin == dmax)
-                {
-                    d_best = dmin;
-                }
-                else
-                {
-                    for (int d = dmin; d <= dmax; d++)
-                    {
-                        int e = 0;
-                        for (int j = -search_area; j <= search_area; j++)
-                        {
-                            int dx1 = edge_directions[d].ack.x + j;
-                            int dy1 = edge_directions[d].ack.y * s;
-                            int p1 = raw2ev[gray[x+dx1 + (y+dy1)*w]];
-                            int dx2 = edge_directions[d].a.x + j;
-                            int dy2 = edge_directions[d].a.y * s;
-                            int p2 = raw2ev[gray[x+dx2 + (y+dy2)*w]];
-                            int dx3 = edge_directions[d].b.x + j;
-                            int dy3 = edge_directions[d].b.y * s;
-                            int p3 = raw2ev[gray[x+dx3 + (y+dy3)*w]];
-                            int dx4 = edge_directions[d].bck.x + j;
-                            int dy4 = edge_directions[d].bck.y * s;
-                            int p4 = raw2ev[gray[x+dx4 + (y+dy4)*w]];
-                            e += ABS(p1-p2) + ABS(p2-p3) + ABS(p3-p4);
-                        }
-                        
-                        /* add a small penalty for diagonal directions */
-                        /* (the improvement should be significant in order to choose one of these) */
-                        e += ABS(d - d0) * EV_RESOLUTION/8;
-                        
-                        if (e < e_best)
-                        {
-                            e_best = e;
-                            d_best = d;
-                        }
-                    }
-                }
-                
-                edge_direction[x + y*w] = d_best;
-            }
-        }
+        ctx.edge_direction = edge_direction;
+        parallel_rows(5, h-5, 1, hdr_edge_search_rows, &ctx);
 
         if (!debug_edge)
         {
-            printf("Semi-overexposed: %.02f%%\n", semi_overexposed * 100.0 / (semi_overexposed + not_overexposed));
-            printf("Deep shadows    : %.02f%%\n", deep_shadow * 100.0 / (deep_shadow + not_shadow));
+            hdr_edge_stats(&ctx);
         }
 
         /* burn the interpolation directions into a test image */
@@ -2533,229 +4806,68 @@ static int hdr_interpolate()
             exit(1);
         }
         
-        //~ printf("Actual interpolation...\n");
+        free(gray); gray = 0; ctx.gray = 0;
 
-        for (int y = 2; y < h-2; y ++)
-        {
-            uint32_t* native = BRIGHT_ROW ? bright : dark;
-            uint32_t* interp = BRIGHT_ROW ? dark : bright;
-            int is_rg = (y % 2 == 0); /* RG or GB? */
-            int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
-
-            //~ printf("Interpolating %s line %d from [near] %d (squeezed %d) and [far] %d (squeezed %d)\n", BRIGHT_ROW ? "BRIGHT" : "DARK", y, y+s, yh_near, y-2*s, yh_far);
-            
-            for (int x = 2; x < w-2; x += 2)
-            {
-                for (int k = 0; k < 2; k++, x++)
-                {
-                    float** plane = is_rg ? (x%2 == 0 ? red   : green)
-                                          : (x%2 == 0 ? green : blue );
+        hdr_alloc_dark_bright(&ctx);
+        dark = ctx.dark;
+        bright = ctx.bright;
 
-                    int dir = edge_direction[x + y*w];
-                    
-                    int edge_interp(int dir)
-                    {
-                        
-                        int dxa = edge_directions[dir].a.x;
-                        int dya = edge_directions[dir].a.y * s;
-                        int pa = COERCE((int)plane[squeezed[y+dya]][x+dxa], 0, 0xFFFFF);
-                        int dxb = edge_directions[dir].b.x;
-                        int dyb = edge_directions[dir].b.y * s;
-                        int pb = COERCE((int)plane[squeezed[y+dyb]][x+dxb], 0, 0xFFFFF);
-                        int pi = (raw2ev[pa] * 2 + raw2ev[pb]) / 3;
-                        
-                        return pi;
-                    }
-                    
-                    /* vary the interpolation direction and average the result (reduces aliasing) */
-                    int pi0 = edge_interp(dir);
-                    int pip = edge_interp(MIN(dir+1, COUNT(edge_directions)-1));
-                    int pim = edge_interp(MAX(dir-1,0));
-                    
-                    interp[x   + y * w] = ev2raw[(2*pi0+pip+pim)/4];
-                    native[x   + y * w] = raw_get_pixel32(x, y);
-                }
-                x -= 2;
-            }
-        }
+        //~ printf("Actual interpolation...\n");
+        parallel_rows(2, h-2, 1, hdr_edge_interp_rows, &ctx);
 
         for (int i = 0; i < h; i++)
         {
-            free(rawData[i]);
             free(red[i]);
             free(green[i]);
             free(blue[i]);
         }
         
         free(squeezed); squeezed = 0;
-        free(rawData); rawData = 0;
         free(red); red = 0;
         free(green); green = 0;
         free(blue); blue = 0;
-        free(gray); gray = 0;
         free(edge_direction);
     }
     else /* mean23 */
     {
         printf("Interpolation   : mean23\n");
-        for (int y = 2; y < h-2; y ++)
-        {
-            uint32_t* native = BRIGHT_ROW ? bright : dark;
-            uint32_t* interp = BRIGHT_ROW ? dark : bright;
-            int is_rg = (y % 2 == 0); /* RG or GB? */
-            int white = !BRIGHT_ROW ? white_darkened : raw_info.white_level;
-            
-            for (int x = 2; x < w-3; x += 2)
-            {
-            
-                /* red/blue: interpolate from (x,y+2) and (x,y-2) */
-                /* green: interpolate from (x+1,y+1),(x-1,y+1),(x,y-2) or (x+1,y-1),(x-1,y-1),(x,y+2), whichever has the correct brightness */
-                
-                int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;
-                
-                if (is_rg)
-                {
-                    int ra = raw_get_pixel32(x, y-2);
-                    int rb = raw_get_pixel32(x, y+2);
-                    int ri = mean2(raw2ev[ra], raw2ev[rb], raw2ev[white], 0);
-                    
-                    int ga = raw_get_pixel32(x+1+1, y+s);
-                    int gb = raw_get_pixel32(x+1-1, y+s);
-                    int gc = raw_get_pixel32(x+1, y-2*s);
-                    int gi = mean3(raw2ev[ga], raw2ev[gb], raw2ev[gc], raw2ev[white], 0);
-
-                    interp[x   + y * w] = ev2raw[ri];
-                    interp[x+1 + y * w] = ev2raw[gi];
-                }
-                else
-                {
-                    int ba = raw_get_pixel32(x+1  , y-2);
-                    int bb = raw_get_pixel32(x+1  , y+2);
-                    int bi = mean2(raw2ev[ba], raw2ev[bb], raw2ev[white], 0);
-
-                    int ga = raw_get_pixel32(x+1, y+s);
-                    int gb = raw_get_pixel32(x-1, y+s);
-                    int gc = raw_get_pixel32(x, y-2*s);
-                    int gi = mean3(raw2ev[ga], raw2ev[gb], raw2ev[gc], raw2ev[white], 0);
-
-                    interp[x   + y * w] = ev2raw[gi];
-                    interp[x+1 + y * w] = ev2raw[bi];
-                }
-
-                native[x   + y * w] = raw_get_pixel32(x, y);
-                native[x+1 + y * w] = raw_get_pixel32(x+1, y);
-            }
-        }
-    }
-
-    /* border interpolation */
-    for (int y = 0; y < 3; y ++)
-    {
-        uint32_t* native = BRIGHT_ROW ? bright : dark;
-        uint32_t* interp = BRIGHT_ROW ? dark : bright;
-        
-        for (int x = 0; x < w; x ++)
-        {
-            interp[x + y * w] = raw_get_pixel32(x, y+2);
-            native[x + y * w] = raw_get_pixel32(x, y);
-        }
-    }
-
-    for (int y = h-4; y < h; y ++)
-    {
-        uint32_t* native = BRIGHT_ROW ? bright : dark;
-        uint32_t* interp = BRIGHT_ROW ? dark : bright;
-        
-        for (int x = 0; x < w; x ++)
-        {
-            interp[x + y * w] = raw_get_pixel32(x, y-2);
-            native[x + y * w] = raw_get_pixel32(x, y);
-        }
+        profile_next_step("mean23", raw_info.frame_size);
+        hdr_alloc_dark_bright(&ctx);
+        dark = ctx.dark;
+        bright = ctx.bright;
+        parallel_rows(2, h-2, 1, hdr_mean23_rows, &ctx);
     }
 
-    for (int y = 2; y < h; y ++)
-    {
-        uint32_t* native = BRIGHT_ROW ? bright : dark;
-        uint32_t* interp = BRIGHT_ROW ? dark : bright;
-        
-        for (int x = 0; x < 2; x ++)
-        {
-            interp[x + y * w] = raw_get_pixel32(x, y-2);
-            native[x + y * w] = raw_get_pixel32(x, y);
-        }
-
-        for (int x = w-3; x < w; x ++)
-        {
-            interp[x + y * w] = raw_get_pixel32(x-2, y-2);
-            native[x + y * w] = raw_get_pixel32(x-2, y);
-        }
-    }
+    /* border interpolation */
+    parallel_rows(0, h, 1, hdr_border_rows, &ctx);
     
     if (use_stripe_fix)
     {
         printf("Horizontal stripe fix...\n");
-        int* delta = malloc(w * sizeof(delta[0]));
-
-        /* adjust dark lines to match the bright ones */
-        for (int y = raw_info.active_area.y1; y < raw_info.active_area.y2; y ++)
-        {
-            /* apply a constant offset (estimated from unclipped areas) */
-            int delta_num = 0;
-            for (int x = raw_info.active_area.x1; x < raw_info.active_area.x2; x ++)
-            {
-                int b = bright[x + y*w];
-                int d = dark[x + y*w];
-                if (MAX(b,d) < white_darkened)
-                {
-                    delta[delta_num++] = b - d;
-                }
-            }
+        profile_next_step("stripe_fix", raw_info.frame_size);
+        ctx.stripe_rejected = malloc(h * sizeof(ctx.stripe_rejected[0]));
+        memset(ctx.stripe_rejected, 0, h * sizeof(ctx.stripe_rejected[0]));
 
-            if (delta_num < 200)
-            {
-                //~ printf("%d: too few points (%d)\n", y, delta_num);
-                continue;
-            }
-
-            /* compute median difference */
-            int med_delta = median_int_wirth(delta, delta_num);
+        parallel_rows(raw_info.active_area.y1, raw_info.active_area.y2, 1, hdr_stripe_fix_rows, &ctx);
 
-            if (ABS(med_delta) > 200*16)
-            {
-                printf("%d: offset too large (%d)\n", y, med_delta);
-                continue;
-            }
+        for (int y = raw_info.active_area.y1; y < raw_info.active_area.y2; y ++)
+            if (ctx.stripe_rejected[y])
+                printf("%d: offset too large (%d)\n", y, ctx.stripe_rejected[y]);
 
-            /* shift the dark lines */
-            for (int x = 0; x < w; x ++)
-            {
-                dark[x + y*w] = COERCE(dark[x + y*w] + med_delta, 0, 0xFFFFF);
-            }
-        }
-        free(delta);
+        free(ctx.stripe_rejected); ctx.stripe_rejected = 0;
     }
 
     /* reconstruct a full-resolution image (discard interpolated fields whenever possible) */
     /* this has full detail and lowest possible aliasing, but it has high shadow noise and color artifacts when high-iso starts clipping */
+    /* (also read by the final blend when disabled, so it's always allocated) */
+    profile_next_step("fullres", raw_info.frame_size);
+    fullres = fullres_smooth = ctx.fullres = malloc(w * h * sizeof(uint32_t));
+    memset(fullres, 0, w * h * sizeof(uint32_t));
+
     if (use_fullres)
     {
         printf("Full-res reconstruction...\n");
-        for (int y = 0; y < h; y ++)
-        {
-            for (int x = 0; x < w; x ++)
-            {
-                if (BRIGHT_ROW)
-                {
-                    int f = bright[x + y*w];
-                    /* if the brighter copy is overexposed, the guessed pixel for sure has higher brightness */
-                    fullres[x + y*w] = f < white_darkened ? f : MAX(f, dark[x + y*w]);
-                }
-                else
-                {
-                    fullres[x + y*w] = dark[x + y*w]; 
-                }
-            }
-        }
+        parallel_rows(0, h, 1, hdr_fullres_rows, &ctx);
     }
  
     /* mix the two images */
@@ -2763,107 +4875,45 @@ static int hdr_interpolate()
     /* shadows:     keep data from bright image only */
     /* midtones:    mix data from both, to bring back the resolution */
     
-    /* estimate ISO overlap */
-    /*
-      ISO 100:       ###...........  (11 stops)
-      ISO 1600:  ####..........      (10 stops)
-      Combined:  XX##..............  (14 stops)
-    */
-    double clipped_ev = corr_ev;
-    double overlap = lowiso_dr - clipped_ev;
-
-    /* you get better colors, less noise, but a little more jagged edges if we underestimate the overlap amount */
-    /* maybe expose a tuning factor? (preference towards resolution or colors) */
-    overlap -= MIN(3, overlap - 3);
-    
-    printf("ISO overlap     : %.1f EV (approx)\n", overlap);
-    
+    double overlap = hdr_iso_overlap(lowiso_dr, corr_ev);
     if (overlap < 0.5)
-    {
-        printf("Overlap error\n");
         goto err;
-    }
-    else if (overlap < 2)
-    {
-        printf("Overlap too small, use a smaller ISO difference for better results.\n");
-    }
 
     printf("Half-res blending...\n");
+    profile_next_step("halfres", raw_info.frame_size);
 
     /* mixing curve */
-    double max_ev = log2(white/64 - black/64);
-    static double mix_curve[1<<20];
-    
-    for (int i = 0; i < 1<<20; i++)
-    {
-        double ev = log2(MAX(i/64.0 - black/64.0, 1)) + corr_ev;
-        double c = -cos(MAX(MIN(ev-(max_ev-overlap),overlap),0)*M_PI/overlap);
-        double k = (c+1) / 2;
-        mix_curve[i] = k;
-    }
+    hdr_mix_curve(&ctx, corr_ev, overlap);
 
-    if (plot_mix_curve)
-    {
-        FILE* f = fopen("mix-curve.m", "w");
-        fprintf(f, "x = 0:65535; \n");
+    halfres = halfres_smooth = ctx.halfres = malloc(w * h * sizeof(uint32_t));
+    parallel_rows(0, h, 1, hdr_halfres_rows, &ctx);
 
-        fprintf(f, "ev = [");
-        for (int i = 0; i < 65536; i++)
-            fprintf(f, "%f ", log2(MAX(i/4.0 - black/4.0, 1)));
-        fprintf(f, "];\n");
-        
-        fprintf(f, "k = [");
-        for (int i = 0; i < 65536; i++)
-            fprintf(f, "%f ", mix_curve[i*16]);
-        fprintf(f, "];\n");
-        
-        fprintf(f, "plot(ev, k);\n");
-        fprintf(f, "print -dpng mix-curve.png\n");
-        fclose(f);
-        
-        if(system("octave --persist mix-curve.m"));
-    }
-    
-    for (int y = 0; y < h; y ++)
+    if (chroma_smooth_method)
     {
-        for (int x = 0; x < w; x ++)
-        {
-            /* bright and dark source pixels  */
-            /* they may be real or interpolated */
-            /* they both have the same brightness (they were adjusted before this loop), so we are ready to mix them */ 
-            int b = bright[x + y*w];
-            int d = dark[x + y*w];
+        printf("Chroma smoothing...\n");
+        profile_next_step("chroma_smooth", raw_info.frame_size);
 
-            /* go from linear to EV space */
-            int bev = raw2ev[b];
-            int dev = raw2ev[d];
+        /* halfres first: only its smoothed copy is used from now on (except for debugging) */
+        halfres_smooth = malloc(w * h * sizeof(uint32_t));
+        memcpy(halfres_smooth, halfres, w * h * sizeof(uint32_t));
+        chroma_smooth(halfres, halfres_smooth, raw2ev, ev2raw);
 
-            /* blending factor */
-            double k = COERCE(mix_curve[b & 0xFFFFF], 0, 1);
-            
-            /* mix bright and dark exposures */
-            int mixed = bev * (1-k) + dev * k;
-            halfres[x + y*w] = ev2raw[mixed];
+        if (!debug_blend)
+        {
+            free(halfres); halfres = 0; ctx.halfres = 0;
         }
-    }
-
-    if (chroma_smooth_method)
-    {
-        printf("Chroma smoothing...\n");
 
         if (use_fullres)
         {
             fullres_smooth = malloc(w * h * sizeof(uint32_t));
             memcpy(fullres_smooth, fullres, w * h * sizeof(uint32_t));
+            chroma_smooth(fullres, fullres_smooth, raw2ev, ev2raw);
         }
-
-        halfres_smooth = malloc(w * h * sizeof(uint32_t));
-        memcpy(halfres_smooth, halfres, w * h * sizeof(uint32_t));
-
-        chroma_smooth(fullres, fullres_smooth, raw2ev, ev2raw);
-        chroma_smooth(halfres, halfres_smooth, raw2ev, ev2raw);
     }
 
+    ctx.fullres_smooth = fullres_smooth;
+    ctx.halfres_smooth = halfres_smooth;
+
     if (debug_blend)
     {
         raw_info.buffer = raw_buffer_16;
@@ -2913,37 +4963,20 @@ static int hdr_interpolate()
         }
     }
 
-
-    /* trial and error - too high = aliasing, too low = noisy */
-    int ALIAS_MAP_MAX = 15000;
-    
     if (use_alias_map)
     {
         printf("Building alias map...\n");
+        profile_next_step("alias_map", raw_info.frame_size);
 
-        uint16_t* alias_aux = malloc(w * h * sizeof(uint16_t));
-        
-        /* build the aliasing maps (where it's likely to get aliasing) */
-        /* do this by comparing fullres and halfres images */
-        /* if the difference is small, we'll prefer halfres for less noise, otherwise fullres for less aliasing */
-        for (int y = 0; y < h; y ++)
-        {
-            for (int x = 0; x < w; x ++)
-            {
-                /* do not compute alias map where we'll use fullres detail anyway */
-                if (fullres_curve[bright[x + y*w]] > fullres_thr)
-                    continue;
+        alias_map = ctx.alias_map = malloc(w * h * sizeof(uint16_t));
+        memset(alias_map, 0, w * h * sizeof(uint16_t));
 
-                int f = fullres_smooth[x + y*w];
-                int h = halfres_smooth[x + y*w];
-                int fe = raw2ev[f];
-                int he = raw2ev[h];
-                int e_lin = ABS(f - h); /* error in linear space, for shadows (downweights noise) */
-                e_lin = MAX(e_lin - dark_noise*3/2, 0);
-                int e_log = ABS(fe - he); /* error in EV space, for highlights (highly sensitive to noise) */
-                alias_map[x + y*w] = MIN(MIN(e_lin/2, e_log/16), 65530);
-            }
-        }
+        /* the 20-bit raw buffer is only overwritten from here on (noise check, final blend), */
+        /* so it doubles as scratch space for the 16-bit blur buffers (unless we save debug images from it) */
+        uint16_t* alias_aux = debug_alias ? malloc(w * h * sizeof(uint16_t)) : (uint16_t*) raw_buffer_32;
+        
+        ctx.alias_aux = alias_aux;
+        parallel_rows(0, h, 1, hdr_alias_build_rows, &ctx);
 
         if (debug_alias)
         {
@@ -2956,45 +4989,7 @@ static int hdr_interpolate()
         memcpy(alias_aux, alias_map, w * h * sizeof(uint16_t));
 
         printf("Filtering alias map...\n");
-        for (int y = 6; y < h-6; y ++)
-        {
-            for (int x = 6; x < w-6; x ++)
-            {
-                /* do not compute alias map where we'll use fullres detail anyway */
-                if (fullres_curve[bright[x + y*w]] > fullres_thr)
-                    continue;
-                
-                /* use 5th max (out of 37) to filter isolated pixels */
-                
-                int neighbours[] = {
-                                                                              -alias_map[x-2 + (y-6) * w], -alias_map[x+0 + (y-6) * w], -alias_map[x+2 + (y-6) * w],
-                                                 -alias_map[x-4 + (y-4) * w], -alias_map[x-2 + (y-4) * w], -alias_map[x+0 + (y-4) * w], -alias_map[x+2 + (y-4) * w], -alias_map[x+4 + (y-4) * w],
-                    -alias_map[x-6 + (y-2) * w], -alias_map[x-4 + (y-2) * w], -alias_map[x-2 + (y-2) * w], -alias_map[x+0 + (y-2) * w], -alias_map[x+2 + (y-2) * w], -alias_map[x+4 + (y-2) * w], -alias_map[x+6 + (y-2) * w], 
-                    -alias_map[x-6 + (y+0) * w], -alias_map[x-4 + (y+0) * w], -alias_map[x-2 + (y+0) * w], -alias_map[x+0 + (y+0) * w], -alias_map[x+2 + (y+0) * w], -alias_map[x+4 + (y+0) * w], -alias_map[x+6 + (y+0) * w], 
-                    -alias_map[x-6 + (y+2) * w], -alias_map[x-4 + (y+2) * w], -alias_map[x-2 + (y+2) * w], -alias_map[x+0 + (y+2) * w], -alias_map[x+2 + (y+2) * w], -alias_map[x+4 + (y+2) * w], -alias_map[x+6 + (y+2) * w], 
-                                                 -alias_map[x-4 + (y+4) * w], -alias_map[x-2 + (y+4) * w], -alias_map[x+0 + (y+4) * w], -alias_map[x+2 + (y+4) * w], -alias_map[x+4 + (y+4) * w],
-                                                                              -alias_map[x-2 + (y+6) * w], -alias_map[x+0 + (y+6) * w], -alias_map[x+2 + (y+6) * w],
-                };
-                
-                /* code generation & unoptimized version */
-                /*
-                int neighbours[50];
-                int k = 0;
-                for (int i = -3; i <= 3; i++)
-                {
-                    for (int j = -3; j <= 3; j++)
-                    {
-                        //~ neighbours[k++] = -alias_map[x+j*2 + (y+i*2)*w];
-                        printf("-alias_map[x%+d + (y%+d) * w], ", j*2, i*2);
-                    }
-                    printf("\n");
-                }
-                exit(1);
-                */
-                
-                alias_aux[x + y * w] = -kth_smallest_int(neighbours, COUNT(neighbours), 5);
-            }
-        }
+        parallel_rows(6, h-6, 1, hdr_alias_filter_rows, &ctx);
 
         if (debug_alias)
         {
@@ -3005,55 +5000,7 @@ static int hdr_interpolate()
         }
 
         printf("Smoothing alias map...\n");
-        /* gaussian blur */
-        for (int y = 6; y < h-6; y ++)
-        {
-            for (int x = 6; x < w-6; x ++)
-            {
-                /* do not compute alias map where we'll use fullres detail anyway */
-                if (fullres_curve[bright[x + y*w]] > fullres_thr)
-                    continue;
-
-    /* code generation
-                const int blur[4][4] = {
-                    {1024,  820,  421,  139},
-                    { 820,  657,  337,  111},
-                    { 421,  337,  173,   57},
-                    { 139,  111,   57,    0},
-                };
-                const int blur_unique[] = {1024, 820, 657, 421, 337, 173, 139, 111, 57};
-
-                for (int k = 0; k < COUNT(blur_unique); k++)
-                {
-                    int c = 0;
-                    printf("(");
-                    for (int dy = -3; dy <= 3; dy++)
-                    {
-                        for (int dx = -3; dx <= 3; dx++)
-                        {
-                            c += alias_aux[x + dx + (y + dy) * w] * blur[ABS(dx)][ABS(dy)] / 1024;
-                            if (blur[ABS(dx)][ABS(dy)] == blur_unique[k])
-                                printf("alias_aux[x%+d + (y%+d) * w] + ", dx, dy);
-                        }
-                    }
-                    printf("\b\b\b) * %d / 1024 + \n", blur_unique[k]);
-                }
-                exit(1);
-    */
-                /* optimizing... the brute force way */
-                int c = 
-                    (alias_aux[x+0 + (y+0) * w])+ 
-                    (alias_aux[x+0 + (y-2) * w] + alias_aux[x-2 + (y+0) * w] + alias_aux[x+2 + (y+0) * w] + alias_aux[x+0 + (y+2) * w]) * 820 / 1024 + 
-                    (alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w]) * 657 / 1024 + 
-                    (alias_aux[x+0 + (y-2) * w] + alias_aux[x-2 + (y+0) * w] + alias_aux[x+2 + (y+0) * w] + alias_aux[x+0 + (y+2) * w]) * 421 / 1024 + 
-                    (alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w]) * 337 / 1024 + 
-                    (alias_aux[x-2 + (y-2) * w] + alias_aux[x+2 + (y-2) * w] + alias_aux[x-2 + (y+2) * w] + alias_aux[x+2 + (y+2) * w]) * 173 / 1024 + 
-                    (alias_aux[x+0 + (y-6) * w] + alias_aux[x-6 + (y+0) * w] + alias_aux[x+6 + (y+0) * w] + alias_aux[x+0 + (y+6) * w]) * 139 / 1024 + 
-                    (alias_aux[x-2 + (y-6) * w] + alias_aux[x+2 + (y-6) * w] + alias_aux[x-6 + (y-2) * w] + alias_aux[x+6 + (y-2) * w] + alias_aux[x-6 + (y+2) * w] + alias_aux[x+6 + (y+2) * w] + alias_aux[x-2 + (y+6) * w] + alias_aux[x+2 + (y+6) * w]) * 111 / 1024 + 
-                    (alias_aux[x-2 + (y-6) * w] + alias_aux[x+2 + (y-6) * w] + alias_aux[x-6 + (y-2) * w] + alias_aux[x+6 + (y-2) * w] + alias_aux[x-6 + (y+2) * w] + alias_aux[x+6 + (y+2) * w] + alias_aux[x-2 + (y+6) * w] + alias_aux[x+2 + (y+6) * w]) * 57 / 1024;
-                alias_map[x + y * w] = c;
-            }
-        }
+        parallel_rows(6, h-6, 1, hdr_alias_smooth_rows, &ctx);
 
         if (debug_alias)
         {
@@ -3064,24 +5011,7 @@ static int hdr_interpolate()
         }
 
         /* make it grayscale */
-        for (int y = 2; y < h-2; y += 2)
-        {
-            for (int x = 2; x < w-2; x += 2)
-            {
-                int a = alias_map[x   +     y * w];
-                int b = alias_map[x+1 +     y * w];
-                int c = alias_map[x   + (y+1) * w];
-                int d = alias_map[x+1 + (y+1) * w];
-                int C = MAX(MAX(a,b), MAX(c,d));
-                
-                C = MIN(C, ALIAS_MAP_MAX);
-
-                alias_map[x   +     y * w] = 
-                alias_map[x+1 +     y * w] = 
-                alias_map[x   + (y+1) * w] = 
-                alias_map[x+1 + (y+1) * w] = C;
-            }
-        }
+        parallel_rows(2, h-2, 2, hdr_alias_gray_rows, &ctx);
 
         if (debug_alias)
         {
@@ -3091,130 +5021,47 @@ static int hdr_interpolate()
             save_debug_dng("alias-filtered.dng");
         }
 
-        free(alias_aux);
+        if (debug_alias) free(alias_aux);
+        ctx.alias_aux = 0;
     }
 
     /* where the image is overexposed? */
+    profile_next_step("final_blend", raw_info.frame_size);
     overexposed = malloc(w * h * sizeof(uint16_t));
     memset(overexposed, 0, w * h * sizeof(uint16_t));
 
-    for (int y = 0; y < h; y ++)
-    {
-        for (int x = 0; x < w; x ++)
-        {
-            overexposed[x + y * w] = bright[x + y * w] >= white_darkened || dark[x + y * w] >= white ? 100 : 0;
-        }
-    }
+    ctx.overexposed = overexposed;
+    parallel_rows(0, h, 1, hdr_overexposed_rows, &ctx);
     
     /* "blur" the overexposed map */
-    uint16_t* over_aux = malloc(w * h * sizeof(uint16_t));
+    uint16_t* over_aux = (uint16_t*) raw_buffer_32 + w * h;
     memcpy(over_aux, overexposed, w * h * sizeof(uint16_t));
 
-    for (int y = 3; y < h-3; y ++)
-    {
-        for (int x = 3; x < w-3; x ++)
-        {
-            overexposed[x + y * w] = 
-                (over_aux[x+0 + (y+0) * w])+ 
-                (over_aux[x+0 + (y-1) * w] + over_aux[x-1 + (y+0) * w] + over_aux[x+1 + (y+0) * w] + over_aux[x+0 + (y+1) * w]) * 820 / 1024 + 
-                (over_aux[x-1 + (y-1) * w] + over_aux[x+1 + (y-1) * w] + over_aux[x-1 + (y+1) * w] + over_aux[x+1 + (y+1) * w]) * 657 / 1024 + 
-                //~ (over_aux[x+0 + (y-2) * w] + over_aux[x-2 + (y+0) * w] + over_aux[x+2 + (y+0) * w] + over_aux[x+0 + (y+2) * w]) * 421 / 1024 + 
-                //~ (over_aux[x-1 + (y-2) * w] + over_aux[x+1 + (y-2) * w] + over_aux[x-2 + (y-1) * w] + over_aux[x+2 + (y-1) * w] + over_aux[x-2 + (y+1) * w] + over_aux[x+2 + (y+1) * w] + over_aux[x-1 + (y+2) * w] + over_aux[x+1 + (y+2) * w]) * 337 / 1024 + 
-                //~ (over_aux[x-2 + (y-2) * w] + over_aux[x+2 + (y-2) * w] + over_aux[x-2 + (y+2) * w] + over_aux[x+2 + (y+2) * w]) * 173 / 1024 + 
-                //~ (over_aux[x+0 + (y-3) * w] + over_aux[x-3 + (y+0) * w] + over_aux[x+3 + (y+0) * w] + over_aux[x+0 + (y+3) * w]) * 139 / 1024 + 
-                //~ (over_aux[x-1 + (y-3) * w] + over_aux[x+1 + (y-3) * w] + over_aux[x-3 + (y-1) * w] + over_aux[x+3 + (y-1) * w] + over_aux[x-3 + (y+1) * w] + over_aux[x+3 + (y+1) * w] + over_aux[x-1 + (y+3) * w] + over_aux[x+1 + (y+3) * w]) * 111 / 1024 + 
-                //~ (over_aux[x-2 + (y-3) * w] + over_aux[x+2 + (y-3) * w] + over_aux[x-3 + (y-2) * w] + over_aux[x+3 + (y-2) * w] + over_aux[x-3 + (y+2) * w] + over_aux[x+3 + (y+2) * w] + over_aux[x-2 + (y+3) * w] + over_aux[x+2 + (y+3) * w]) * 57 / 1024;
-                0;
-        }
-    }
+    ctx.over_aux = over_aux;
+    parallel_rows(3, h-3, 1, hdr_overexposed_blur_rows, &ctx);
     
-    free(over_aux); over_aux = 0;
+    over_aux = 0; ctx.over_aux = 0;
 
     /* let's check the ideal noise levels (on the halfres image, which in black areas is identical to the bright one) */
     for (int y = 3; y < h-2; y ++)
         for (int x = 2; x < w-2; x ++)
             raw_set_pixel32(x, y, bright[x + y*w]);
     compute_black_noise(8, raw_info.active_area.x1 - 8, raw_info.active_area.y1 + 20, raw_info.active_area.y2 - 20, 1, 1, &noise_avg, &noise_std[0], raw_get_pixel32);
-    double ideal_noise_std = noise_std[0];
+    ideal_noise_std = noise_std[0];
 
     printf("Final blending...\n");
-    for (int y = 0; y < h; y ++)
-    {
-        for (int x = 0; x < w; x ++)
-        {
-            /* high-iso image (for measuring signal level) */
-            int b = bright[x + y*w];
-
-            /* half-res image (interpolated and chroma filtered, best for low-contrast shadows) */
-            int hr = halfres_smooth[x + y*w];
-            
-            /* full-res image (non-interpolated, except where one ISO is blown out) */
-            int fr = fullres[x + y*w];
-
-            /* full res with some smoothing applied to hide aliasing artifacts */
-            int frs = fullres_smooth[x + y*w];
-
-            /* go from linear to EV space */
-            int hrev = raw2ev[hr];
-            int frev = raw2ev[fr];
-            int frsev = raw2ev[frs];
-
-            int output = hrev;
-            
-            if (use_fullres)
-            {
-                /* blending factor */
-                double f = fullres_curve[b & 0xFFFFF];
-                
-                double c = 0;
-                if (use_alias_map)
-                {
-                    int co = alias_map[x + y*w];
-                    c = COERCE(co / (double) ALIAS_MAP_MAX, 0, 1);
-                }
-
-                double ovf = COERCE(overexposed[x + y*w] / 200.0, 0, 1);
-                c = MAX(c, ovf);
-
-                double noisy_or_overexposed = MAX(ovf, 1-f);
-
-                /* use data from both ISOs in high-detail areas, even if it's noisier (less aliasing) */
-                f = MAX(f, c);
-                
-                /* use smoothing in noisy near-overexposed areas to hide color artifacts */
-                double fev = noisy_or_overexposed * frsev + (1-noisy_or_overexposed) * frev;
-                
-                /* limit the use of fullres in dark areas (fixes some black spots, but may increase aliasing) */
-                int sig = (dark[x + y*w] + bright[x + y*w]) / 2;
-                f = MAX(0, MIN(f, (double)(sig - black) / (4*dark_noise)));
-                
-                /* blend "half-res" and "full-res" images smoothly to avoid banding*/
-                output = hrev * (1-f) + fev * f;
-
-                /* show full-res map (for debugging) */
-                //~ output = f * 14*EV_RESOLUTION;
-                
-                /* show alias map (for debugging) */
-                //~ output = c * 14*EV_RESOLUTION;
-
-                //~ output = hotpixel[x+y*w] ? 14*EV_RESOLUTION : 0;
-                //~ output = raw2ev[dark[x+y*w]];
-                /* safeguard */
-                output = COERCE(output, -10*EV_RESOLUTION, 14*EV_RESOLUTION-1);
-            }
-            
-            /* back to linear space and commit */
-            raw_set_pixel32(x, y, ev2raw[output]);
-        }
-    }
+    parallel_rows(0, h, 1, hdr_final_blend_rows, &ctx);
 
+blended:
     /* let's see how much dynamic range we actually got */
-    compute_black_noise(8, raw_info.active_area.x1 - 8, raw_info.active_area.y1 + 20, raw_info.active_area.y2 - 20, 1, 1, &noise_avg, &noise_std[0], raw_get_pixel32);
+    /* (in low-memory mode, the output is already converted to 16 bits, except the margin saved for these checks) */
+    compute_black_noise(8, raw_info.active_area.x1 - 8, raw_info.active_area.y1 + 20, raw_info.active_area.y2 - 20, 1, 1, &noise_avg, &noise_std[0], low_mem ? hdr_margin_out : raw_get_pixel32);
     printf("Noise level     : %.02f (20-bit), ideally %.02f\n", noise_std[0], ideal_noise_std);
     printf("Dynamic range   : %.02f EV (cooked)\n", log2(white - black) - log2(noise_std[0]));
 
     /* run a final black subtract pass, to fix whatever our funky processing may do to blacks */
-    black_subtract_simple(raw_info.active_area.x1, raw_info.active_area.y1);
+    profile_next_step("finish", raw_info.frame_size);
+    black_subtract_simple(raw_info.active_area.x1, raw_info.active_area.y1, low_mem ? hdr_margin_out : raw_get_pixel20);
     white = raw_info.white_level;
     black = raw_info.black_level;
 
@@ -3223,9 +5070,12 @@ static int hdr_interpolate()
     raw_info.black_level /= 16;
     raw_info.white_level /= 16;
 
-    for (int y = 0; y < h; y++)
-        for (int x = 0; x < w; x++)
-            raw_set_pixel_20to16_rand(x, y, raw_buffer_32[x + y*w]);
+    if (!low_mem)
+    {
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                raw_set_pixel_20to16_rand(x, y, raw_buffer_32[x + y*w]);
+    }
 
     char* AsShotNeutral_method = "default";
     if (exif_wb)
@@ -3313,7 +5163,9 @@ static int hdr_interpolate()
             for (int x = 0; x < w; x++)
             {
                 double wb = baked_wb[FC(x,y)];
-                int raw_compressed = soft_film_bakedwb(raw_buffer_32[x + y*w], exposure, black, white, black/16, white/16, wb, max_wb);
+                /* low-memory mode: from the 16-bit output (the 20-bit one is gone) */
+                int raw20 = raw_buffer_32 ? (int) raw_buffer_32[x + y*w] : raw_get_pixel16(x, y) * 16;
+                int raw_compressed = soft_film_bakedwb(raw20, exposure, black, white, black/16, white/16, wb, max_wb);
                 raw_set_pixel16(x, y, COERCE(raw_compressed, 0, 65535));
                 
                 /* with WB 1/1/1: */
@@ -3348,20 +5200,32 @@ cleanup:
     free(overexposed);
     free(alias_map);
     free(raw_buffer_32);
-    if (fullres_smooth && fullres_smooth != fullres) free(fullres_smooth);
-    if (halfres_smooth && halfres_smooth != halfres) free(halfres_smooth);
+    free(hdr_margin.bright); hdr_margin.bright = 0;
+    free(hdr_margin.out); hdr_margin.out = 0;
+    if (fullres_smooth != fullres) free(fullres_smooth);
+    if (halfres_smooth != halfres) free(halfres_smooth);
     return ret;
 }
 
-/* filters a monochrome image */
-/* kernel: a square with size = 2*radius+1 */
-/* complexity: O(w * h * radius) */
-static void box_blur(int* img, int* out, int w, int h, int radius)
+struct box_blur_ctx
+{
+    int* img;
+    int* out;
+    int w;
+    int radius;
+};
+
+static void box_blur_rows(void* arg, int band, int y0, int y1)
 {
+    struct box_blur_ctx * ctx = arg;
+    int* img = ctx->img;
+    int* out = ctx->out;
+    int w = ctx->w;
+    int radius = ctx->radius;
     int area = (2*radius+1) * (2*radius+1);
     
     /* for each row */
-    for (int y = radius; y < h-radius; y++)
+    for (int y = y0; y < y1; y++)
     {
         int acc = 0;
         int x0 = radius;
@@ -3384,6 +5248,15 @@ static void box_blur(int* img, int* out, int w, int h, int radius)
     }
 }
 
+/* filters a monochrome image */
+/* kernel: a square with size = 2*radius+1 */
+/* complexity: O(w * h * radius) */
+static void box_blur(int* img, int* out, int w, int h, int radius)
+{
+    struct box_blur_ctx ctx = { img, out, w, radius };
+    parallel_rows(radius, h-radius, 1, box_blur_rows, &ctx);
+}
+
 static void white_balance_gray(float* red_balance, float* blue_balance, int method)
 {
     int w = raw_info.width;
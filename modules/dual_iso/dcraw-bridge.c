@@ -4,7 +4,9 @@
 #include <string.h>
 #include <unistd.h>
 #include "../../src/raw.h"
+#include "../mlv_rec/lj92.h"
 #include "dcraw-bridge.h"
+#include "tiff-reader.h"
 #include "kelvin.h"
 
 /** Compute the number of entries in a static array */
@@ -121,6 +123,22 @@ static const struct {
     { 0x331, "EOS M" },
 };
 
+/* sensor crop for the output size, by raw size (from the "crop" table in identify(), dcraw.c) */
+/* output size = raw size - left/top margin - width/height decrease; only the Dual ISO cameras are listed */
+static const struct {
+    unsigned short raw_width, raw_height, left_margin, top_margin, width_decrease, height_decrease;
+} crop[] = {
+    { 4352, 2874,  62, 18,  0,  0 },    /* 1100D */
+    { 4832, 3204,  62, 26,  0,  0 },    /* 500D */
+    { 4832, 3228,  62, 51,  0,  0 },    /* 50D */
+    { 5280, 3528,  72, 52,  0,  0 },    /* 650D, 700D, 100D, EOS M */
+    { 5344, 3516, 142, 51,  0,  0 },    /* 550D, 600D, 60D */
+    { 5360, 3516, 158, 51,  0,  0 },    /* 7D */
+    { 5568, 3708,  72, 38,  0,  0 },    /* 6D */
+    { 5792, 3804, 158, 51,  0,  0 },    /* 5D Mark II */
+    { 5920, 3950, 122, 80,  2,  0 },    /* 5D Mark III */
+};
+
 static int* trans_to_calib(const short* trans)
 {
     int* calib = calloc(18, sizeof(int));
@@ -168,3 +186,99 @@ int get_raw_info(const char * model, struct raw_info * raw_info)
     
     return 0;
 }
+
+/* in-process equivalent of "dcraw -4 -E -t 0" for CR2 files: the raw data is a lossless JPEG stream */
+/* cut in vertical slices (see lossless_jpeg_load_raw in dcraw.c); other files return NULL (use dcraw) */
+uint16_t* load_cr2_raw(const char* filename, int* raw_width, int* raw_height, int* out_width, int* out_height)
+{
+    struct tiff t;
+    uint8_t* data = 0;
+    uint16_t* stream = 0;
+    uint16_t* image = 0;
+
+    if (!tiff_open(&t, filename, "rb"))
+        return 0;
+
+    /* "CR" signature after the TIFF header; the raw data is in IFD3 */
+    char sig[2] = {0, 0};
+    if (fseek(t.f, 8, SEEK_SET) || fread(sig, 1, 2, t.f) != 2 || sig[0] != 'C' || sig[1] != 'R')
+        goto err;
+
+    uint32_t ifd3 = tiff_ifd(&t, 3);
+    struct tiff_entry offset, size, slice;
+    if (!tiff_find(&t, ifd3, 0x111, &offset) || !tiff_find(&t, ifd3, 0x117, &size))
+        goto err;
+
+    int data_size = tiff_get_int(&t, &size, 0);
+    if (data_size <= 0)
+        goto err;
+
+    data = malloc(data_size);
+    if (!data)
+        goto err;
+
+    if (fseek(t.f, tiff_get_int(&t, &offset, 0), SEEK_SET) || fread(data, 1, data_size, t.f) != (size_t) data_size)
+        goto err;
+
+    int jwide, jhigh, bits, clrs;
+    if (lj92_info(data, data_size, &jwide, &jhigh, &bits, &clrs) != LJ92_ERR_NONE)
+        goto err;
+
+    /* slices: N slices of width W, then one of width W_last */
+    int slices[3] = {0, 0, 0};
+    if (tiff_find(&t, ifd3, 0xC640, &slice) && slice.count == 3)
+        for (int i = 0; i < 3; i++)
+            slices[i] = tiff_get_int(&t, &slice, i);
+
+    int total = jwide * jhigh;
+    int width = slices[0] ? slices[0] * slices[1] + slices[2] : jwide;
+    if (width <= 0 || total % width)
+        goto err;
+    int height = total / width;
+
+    int i;
+    for (i = 0; i < COUNT(crop); i++)
+        if (crop[i].raw_width == width && crop[i].raw_height == height)
+            break;
+    if (i == COUNT(crop))
+        goto err;
+
+    /* one extra line, like the PGM buffer in cr2hdr */
+    image = malloc(width * (height + 1) * sizeof(image[0]));
+    stream = slices[0] ? malloc(total * sizeof(stream[0])) : image;
+    if (!image || !stream)
+        goto err;
+
+    if (lj92_decode(data, data_size, stream, jwide, jhigh) != LJ92_ERR_NONE)
+        goto err;
+
+    if (slices[0])
+    {
+        /* the stream fills each slice top to bottom, then moves to the next one */
+        uint16_t* src = stream;
+        for (int s = 0; s <= slices[0]; s++)
+        {
+            int x0 = s * slices[1];
+            int w = (s < slices[0]) ? slices[1] : slices[2];
+            for (int y = 0; y < height; y++, src += w)
+                memcpy(image + y * width + x0, src, w * sizeof(image[0]));
+        }
+        free(stream);
+    }
+
+    free(data);
+    tiff_close(&t);
+
+    *raw_width = width;
+    *raw_height = height;
+    *out_width = width - crop[i].left_margin - crop[i].width_decrease;
+    *out_height = height - crop[i].top_margin - crop[i].height_decrease;
+    return image;
+
+err:
+    if (stream && stream != image) free(stream);
+    if (image) free(image);
+    if (data) free(data);
+    tiff_close(&t);
+    return 0;
+}
@@ -3,4 +3,8 @@
 
 int get_raw_info(const char * model, struct raw_info* orig);
 
+/* raw data from a CR2 file, decoded in-process (16-bit, raw_width x raw_height plus one spare row) */
+/* returns NULL if the file is not supported, e.g. unknown sensor size (then use dcraw) */
+uint16_t* load_cr2_raw(const char* filename, int* raw_width, int* raw_height, int* out_width, int* out_height);
+
 #endif
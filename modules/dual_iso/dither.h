@@ -1,2 +1,3 @@
 void fast_randn_init();
+void fast_randn_reset();
 float fast_randn05();
@@ -2,7 +2,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include "../../src/chdk-dng.h"
 #include "exiftool-bridge.h"
+#include "tiff-reader.h"
 
 #define DEFAULT_MODEL_ID 0x285
 
@@ -18,10 +20,100 @@ void copy_tags_from_source(const char* source, const char* dest)
     }
 }
 
+/* same tag as exiftool -xmp:subject=Dual-ISO */
+static const char dual_iso_xmp[] =
+    "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">"
+    "<rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">"
+    "<rdf:Description rdf:about=\"\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\">"
+    "<dc:subject><rdf:Bag><rdf:li>Dual-ISO</rdf:li></rdf:Bag></dc:subject>"
+    "</rdf:Description></rdf:RDF></x:xmpmeta>";
+
+/* copies the main TIFF/EXIF tags from the source file (CR2) into the DNG writer, before saving */
+/* unlike exiftool, maker notes and other tags the writer doesn't know about are not copied */
+int set_dng_tags_from_source(const char* source)
+{
+    struct tiff t;
+    struct tiff_entry e;
+    char str[64];
+    int num, den;
+
+    if (!tiff_open(&t, source, "rb"))
+        return 0;
+
+    uint32_t ifd0 = tiff_ifd(&t, 0);
+    uint32_t exif = tiff_find_ifd(&t, ifd0, 0x8769);
+
+    if (!tiff_find(&t, ifd0, 0x110, &e))
+    {
+        tiff_close(&t);
+        return 0;
+    }
+
+    tiff_get_string(&t, &e, str, sizeof(str));
+    dng_set_camname(str);
+
+    dng_set_orientation(tiff_find(&t, ifd0, 0x112, &e) ? tiff_get_int(&t, &e, 0) : 1);
+
+    str[0] = 0;
+    if (tiff_find(&t, ifd0, 0x13B, &e)) tiff_get_string(&t, &e, str, sizeof(str));
+    dng_set_artist(str);
+
+    str[0] = 0;
+    if (tiff_find(&t, ifd0, 0x8298, &e)) tiff_get_string(&t, &e, str, sizeof(str));
+    dng_set_copyright(str);
+
+    num = 0; den = 1;
+    if (tiff_find(&t, exif, 0x829A, &e)) tiff_get_rational(&t, &e, 0, &num, &den);
+    dng_set_shutter(num, den);
+
+    num = 0; den = 1;
+    if (tiff_find(&t, exif, 0x829D, &e)) tiff_get_rational(&t, &e, 0, &num, &den);
+    dng_set_aperture(num, den);
+
+    num = 0; den = 1;
+    if (tiff_find(&t, exif, 0x920A, &e)) tiff_get_rational(&t, &e, 0, &num, &den);
+    dng_set_focal(num, den);
+
+    dng_set_iso(tiff_find(&t, exif, 0x8827, &e) ? tiff_get_int(&t, &e, 0) : 0);
+
+    char datetime[20] = "";
+    char subsec[4] = "";
+    if (tiff_find(&t, exif, 0x9003, &e)) tiff_get_string(&t, &e, datetime, sizeof(datetime));
+    if (tiff_find(&t, exif, 0x9291, &e)) tiff_get_string(&t, &e, subsec, sizeof(subsec));
+    dng_set_datetime(datetime, subsec);
+
+    str[0] = 0;
+    if (tiff_find(&t, exif, 0xA434, &e)) tiff_get_string(&t, &e, str, sizeof(str));
+    dng_set_lensmodel(str);
+
+    str[0] = 0;
+    if (tiff_find(&t, exif, 0xA431, &e)) tiff_get_string(&t, &e, str, sizeof(str));
+    dng_set_camserial(str);
+
+    dng_set_xmp(dual_iso_xmp);
+
+    tiff_close(&t);
+    return 1;
+}
+
 const char * get_camera_model(const char* filename)
 {
     static char model[100];
     char exif_cmd[10000];
+
+    /* try the EXIF data first, without running exiftool */
+    struct tiff t;
+    struct tiff_entry e;
+    if (tiff_open(&t, filename, "rb"))
+    {
+        int found = tiff_find(&t, tiff_ifd(&t, 0), 0x110, &e);
+        if (found)
+            tiff_get_string(&t, &e, model, sizeof(model));
+        tiff_close(&t);
+
+        if (found && model[0])
+            return strncmp(model, "Canon ", 6) == 0 ? model + 6 : model;
+    }
     snprintf(exif_cmd, sizeof(exif_cmd), "exiftool -Model -b \"%s\"", filename);
     FILE* exif_file = popen(exif_cmd, "r");
     if(exif_file) 
@@ -125,8 +217,37 @@ err:
     if (error) printf("**WARNING** could not extract white balance information, exiftool may need to be updated\n");
 }
 
+/* our own DNGs have the WhiteLevel in a sub-IFD (or IFD0), as a single value we can overwrite in place */
+static int set_white_level_native(const char* file, int level)
+{
+    struct tiff t;
+    struct tiff_entry e;
+    if (!tiff_open(&t, file, "r+b"))
+        return 0;
+
+    uint32_t ifd0 = tiff_ifd(&t, 0);
+    uint32_t raw_ifd = tiff_find_ifd(&t, ifd0, 0x14A);
+    int found = tiff_find(&t, raw_ifd, 0xC61D, &e) || tiff_find(&t, ifd0, 0xC61D, &e);
+    int ok = 0;
+
+    if (found && e.count == 1 && (e.type == 4 || (e.type == 3 && level <= 0xFFFF)))
+    {
+        int size = (e.type == 4) ? 4 : 2;
+        unsigned char buf[4];
+        for (int i = 0; i < size; i++)
+            buf[i] = level >> (8 * (t.big_endian ? size - 1 - i : i));
+        ok = fseek(t.f, e.data, SEEK_SET) == 0 && fwrite(buf, 1, size, t.f) == (size_t) size;
+    }
+
+    tiff_close(&t);
+    return ok;
+}
+
 void set_white_level(const char* file, int level)
 {
+    if (set_white_level_native(file, level))
+        return;
+
     char exif_cmd[1000];
     snprintf(exif_cmd, sizeof(exif_cmd), "exiftool \"%s\" -WhiteLevel=%d -overwrite_original -q", file, level);
     int r = system(exif_cmd);
@@ -221,6 +342,16 @@ void embed_original_raw(const char* dng_file, const char* raw_file, int delete_o
 
 int dng_has_original_raw(const char* dng_file)
 {
+    /* OriginalRawFileData is in IFD0 */
+    struct tiff t;
+    struct tiff_entry e;
+    if (tiff_open(&t, dng_file, "rb"))
+    {
+        int found = tiff_find(&t, tiff_ifd(&t, 0), 0xC68C, &e);
+        tiff_close(&t);
+        return found;
+    }
+
     char exif_cmd[1000];
 
     snprintf(exif_cmd, sizeof(exif_cmd), "exiftool -OriginalRawFileData \"%s\"", dng_file);
@@ -2,6 +2,10 @@
 #define _EXIFTOOL_BRIDGE_H
 
 void copy_tags_from_source(const char* source, const char* dest);
+
+/* without exiftool: sets up the DNG writer with the main EXIF tags of the source, call before saving */
+/* returns 0 if the source could not be read (then use copy_tags_from_source after saving) */
+int set_dng_tags_from_source(const char* source);
 const char * get_camera_model(const char* filename);
 
 /*
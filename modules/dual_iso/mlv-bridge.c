@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../src/raw.h"
+#include "../../src/chdk-dng.h"
+#include "../mlv_rec/mlv.h"
+#include "../mlv_rec/mlv_reader.h"
+#include "../mlv_rec/bitpack.h"
+#include "../mlv_rec/lj92.h"
+#include "qsort.h"
+#include "mlv-bridge.h"
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+/* chunk n: n = 0 is the .MLV file itself, then .M00, .M01 ... */
+static void chunk_filename(const char* filename, int n, char* out, int size)
+{
+    snprintf(out, size, "%s", filename);
+    if (n > 0)
+    {
+        int len = strlen(out);
+        snprintf(out + len - 2, size - len + 2, "%02d", n - 1);
+    }
+}
+
+static int open_chunks(struct mlv_clip * clip)
+{
+    clip->chunks = malloc(101 * sizeof(clip->chunks[0]));
+    clip->num_chunks = 0;
+
+    int len = strlen(clip->filename);
+    int is_mlv = len > 4 && strcasecmp(clip->filename + len - 4, ".MLV") == 0;
+
+    for (int n = 0; n < (is_mlv ? 101 : 1); n++)
+    {
+        char name[1000];
+        chunk_filename(clip->filename, n, name, sizeof(name));
+        FILE* f = fopen(name, "rb");
+        if (!f)
+            break;
+
+        clip->chunks[clip->num_chunks++] = mlv_reader_open(f);
+    }
+
+    return clip->num_chunks > 0;
+}
+
+static void close_chunks(struct mlv_clip * clip)
+{
+    for (int i = 0; i < clip->num_chunks; i++)
+        mlv_reader_close(clip->chunks[i]);
+    free(clip->chunks);
+    clip->chunks = 0;
+    clip->num_chunks = 0;
+}
+
+static void copy_string(char* dst, const uint8_t* src, int size)
+{
+    memcpy(dst, src, size);
+    dst[size] = 0;
+}
+
+/* reads a whole block into 'hdr' (at most 'size' bytes, the rest is zeroed) */
+static int read_block(mlv_reader_t * reader, uint64_t pos, uint32_t block_size, void* hdr, int size)
+{
+    memset(hdr, 0, size);
+    return mlv_reader_set_pos(reader, pos, SEEK_SET) == 0 &&
+           mlv_reader_read(hdr, MIN(block_size, (uint32_t) size), reader) == 1;
+}
+
+static int scan_chunk(struct mlv_clip * clip, int chunk, int* got_rawi, int* frames_alloc)
+{
+    mlv_reader_t * reader = clip->chunks[chunk];
+
+    mlv_file_hdr_t file_hdr;
+    if (!read_block(reader, 0, sizeof(file_hdr), &file_hdr, sizeof(file_hdr)) || memcmp(file_hdr.fileMagic, "MLVI", 4))
+    {
+        printf("%s: not a MLV file\n", chunk ? "Chunk" : clip->filename);
+        return 0;
+    }
+
+    if (chunk == 0)
+    {
+        clip->video_class = file_hdr.videoClass;
+        clip->fps_nom = file_hdr.sourceFpsNom;
+        clip->fps_denom = file_hdr.sourceFpsDenom;
+    }
+
+    uint64_t pos = file_hdr.blockSize;
+    mlv_hdr_t hdr;
+    while (mlv_reader_set_pos(reader, pos, SEEK_SET) == 0 && mlv_reader_read(&hdr, sizeof(hdr), reader) == 1)
+    {
+        if (hdr.blockSize < sizeof(hdr))
+        {
+            printf("Invalid block at offset 0x%llx, ignoring the rest of the chunk\n", (unsigned long long) pos);
+            break;
+        }
+
+        if (!memcmp(hdr.blockType, "VIDF", 4))
+        {
+            mlv_vidf_hdr_t vidf;
+            if (read_block(reader, pos, hdr.blockSize, &vidf, sizeof(vidf)) && hdr.blockSize > sizeof(vidf) + vidf.frameSpace)
+            {
+                if (clip->num_frames >= *frames_alloc)
+                {
+                    *frames_alloc = MAX(*frames_alloc * 2, 256);
+                    clip->frames = realloc(clip->frames, *frames_alloc * sizeof(clip->frames[0]));
+                }
+
+                struct mlv_frame * f = &clip->frames[clip->num_frames++];
+                f->chunk = chunk;
+                f->offset = pos + sizeof(vidf) + vidf.frameSpace;
+                f->size = hdr.blockSize - sizeof(vidf) - vidf.frameSpace;
+                f->number = vidf.frameNumber;
+            }
+        }
+        else if (!memcmp(hdr.blockType, "RAWI", 4) && !*got_rawi)
+        {
+            mlv_rawi_hdr_t rawi;
+            if (read_block(reader, pos, hdr.blockSize, &rawi, sizeof(rawi)))
+            {
+                struct raw_info * ri = &rawi.raw_info;
+                int shift = MAX(14 - ri->bits_per_pixel, 0);
+                clip->width = rawi.xRes;
+                clip->height = rawi.yRes;
+                clip->bits_per_pixel = ri->bits_per_pixel;
+                clip->black_level = ri->black_level << shift;
+                clip->white_level = ri->white_level << shift;
+
+                /* same as mlv_dump: the active area is only valid if the resolution matches */
+                int same_w = (rawi.xRes == ri->width);
+                int same_h = (rawi.yRes == ri->height);
+                clip->x1 = same_w ? ri->active_area.x1 : 0;
+                clip->x2 = same_w ? ri->active_area.x2 : rawi.xRes;
+                clip->y1 = same_h ? ri->active_area.y1 : 0;
+                clip->y2 = same_h ? ri->active_area.y2 : rawi.yRes;
+                *got_rawi = 1;
+            }
+        }
+        else if (!memcmp(hdr.blockType, "IDNT", 4) && !clip->camera[0])
+        {
+            mlv_idnt_hdr_t idnt;
+            if (read_block(reader, pos, hdr.blockSize, &idnt, sizeof(idnt)))
+            {
+                copy_string(clip->camera, idnt.cameraName, 32);
+                copy_string(clip->serial, idnt.cameraSerial, 32);
+            }
+        }
+        else if (!memcmp(hdr.blockType, "EXPO", 4) && !clip->iso)
+        {
+            mlv_expo_hdr_t expo;
+            if (read_block(reader, pos, hdr.blockSize, &expo, sizeof(expo)))
+            {
+                clip->iso = expo.isoValue;
+                clip->shutter = expo.shutterValue;
+            }
+        }
+        else if (!memcmp(hdr.blockType, "LENS", 4) && !clip->lens[0])
+        {
+            mlv_lens_hdr_t lens;
+            if (read_block(reader, pos, hdr.blockSize, &lens, sizeof(lens)))
+            {
+                copy_string(clip->lens, lens.lensName, 32);
+                clip->aperture = lens.aperture;
+                clip->focal_length = lens.focalLength;
+            }
+        }
+        else if (!memcmp(hdr.blockType, "RTCI", 4) && !clip->datetime[0])
+        {
+            mlv_rtci_hdr_t rtci;
+            if (read_block(reader, pos, hdr.blockSize, &rtci, sizeof(rtci)))
+            {
+                /* out of range fields would not fit the EXIF format; leave the date out rather than truncate it */
+                int len = snprintf(clip->datetime, sizeof(clip->datetime), "%04d:%02d:%02d %02d:%02d:%02d",
+                    1900 + rtci.tm_year, rtci.tm_mon + 1, rtci.tm_mday, rtci.tm_hour, rtci.tm_min, rtci.tm_sec);
+                if (len < 0 || len >= (int)sizeof(clip->datetime))
+                {
+                    clip->datetime[0] = 0;
+                }
+            }
+        }
+        else if (!memcmp(hdr.blockType, "DISO", 4))
+        {
+            mlv_diso_hdr_t diso;
+            if (read_block(reader, pos, hdr.blockSize, &diso, sizeof(diso)))
+            {
+                clip->dual_iso = diso.dualMode;
+            }
+        }
+
+        pos += hdr.blockSize;
+    }
+
+    return 1;
+}
+
+int mlv_clip_open(struct mlv_clip * clip, const char* filename)
+{
+    memset(clip, 0, sizeof(*clip));
+    snprintf(clip->filename, sizeof(clip->filename), "%s", filename);
+
+    if (!open_chunks(clip))
+    {
+        printf("Could not open %s\n", filename);
+        return 0;
+    }
+
+    int got_rawi = 0;
+    int frames_alloc = 0;
+    for (int i = 0; i < clip->num_chunks; i++)
+        if (!scan_chunk(clip, i, &got_rawi, &frames_alloc))
+            goto err;
+
+    if ((clip->video_class & 0x0F) != MLV_VIDEO_CLASS_RAW || !got_rawi)
+    {
+        printf("%s: no raw video\n", filename);
+        goto err;
+    }
+
+    if (clip->video_class & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_DELTA))
+    {
+        printf("%s: LZMA/delta compressed, please decompress it with mlv_dump first\n", filename);
+        goto err;
+    }
+
+    if (clip->bits_per_pixel < 1 || clip->bits_per_pixel > 14 || clip->width <= 0 || clip->height <= 0)
+    {
+        printf("%s: unsupported raw format (%dx%d, %d bpp)\n", filename, clip->width, clip->height, clip->bits_per_pixel);
+        goto err;
+    }
+
+    if (!clip->num_frames)
+    {
+        printf("%s: no video frames\n", filename);
+        goto err;
+    }
+
+    /* frames may be out of order, especially across chunks */
+    #define frame_lt(a,b) ((a)->number < (b)->number)
+    QSORT(struct mlv_frame, clip->frames, clip->num_frames, frame_lt);
+    #undef frame_lt
+
+    return 1;
+
+err:
+    mlv_clip_close(clip);
+    return 0;
+}
+
+void mlv_clip_close(struct mlv_clip * clip)
+{
+    close_chunks(clip);
+    free(clip->frames);
+    clip->frames = 0;
+    clip->num_frames = 0;
+}
+
+int mlv_clip_reopen(struct mlv_clip * clip)
+{
+    close_chunks(clip);
+    return open_chunks(clip);
+}
+
+uint16_t* mlv_clip_read_frame(struct mlv_clip * clip, int index)
+{
+    if (index < 0 || index >= clip->num_frames)
+        return 0;
+
+    struct mlv_frame * f = &clip->frames[index];
+    int w = clip->width;
+    int h = clip->height;
+    int bpp = clip->bits_per_pixel;
+
+    uint8_t* data = malloc(f->size);
+    uint16_t* image = malloc(w * (h + 1) * sizeof(image[0]));
+    memset(image + w * h, 0, w * sizeof(image[0]));
+
+    mlv_reader_t * reader = clip->chunks[f->chunk];
+    if (mlv_reader_set_pos(reader, f->offset, SEEK_SET) || mlv_reader_read(data, f->size, reader) != 1)
+    {
+        printf("Frame %d: read error\n", f->number);
+        goto err;
+    }
+
+    if (clip->video_class & MLV_VIDEO_CLASS_FLAG_LJ92)
+    {
+        int lj92_width = 0, lj92_height = 0, lj92_depth = 0, lj92_components = 0;
+        int ret = lj92_info(data, f->size, &lj92_width, &lj92_height, &lj92_depth, &lj92_components);
+        if (ret != LJ92_ERR_NONE || lj92_width * lj92_height != w * h || lj92_depth > bpp)
+        {
+            printf("Frame %d: invalid LJ92 data (%d, %dx%d, %d bpp)\n", f->number, ret, lj92_width, lj92_height, lj92_depth);
+            goto err;
+        }
+
+        if (lj92_decode(data, f->size, image, lj92_width, lj92_height) != LJ92_ERR_NONE)
+        {
+            printf("Frame %d: LJ92 decoding failed\n", f->number);
+            goto err;
+        }
+    }
+    else
+    {
+        if ((uint64_t) w * h * bpp / 8 > f->size)
+        {
+            printf("Frame %d: too short (%d bytes)\n", f->number, f->size);
+            goto err;
+        }
+
+        /* the frame is one continuous bit stream, so it's unpacked as a single long row */
+        bitunpack_row(data, image, w * h, bpp);
+    }
+
+    /* the Dual ISO code expects 14-bit data */
+    if (bpp < 14)
+    {
+        int shift = 14 - bpp;
+        for (int i = 0; i < w * h; i++)
+            image[i] <<= shift;
+    }
+
+    free(data);
+    return image;
+
+err:
+    free(data);
+    free(image);
+    return 0;
+}
+
+void mlv_clip_set_dng_tags(struct mlv_clip * clip)
+{
+    dng_set_camname(clip->camera);
+    dng_set_camserial(clip->serial);
+    dng_set_lensmodel(clip->lens);
+    dng_set_orientation(1);
+    dng_set_artist("");
+    dng_set_copyright("");
+    dng_set_shutter(clip->shutter, 1000000);
+    dng_set_aperture(clip->aperture, 100);
+    dng_set_focal(clip->focal_length, 1);
+    dng_set_iso(clip->iso);
+    dng_set_datetime(clip->datetime, "");
+    dng_set_framerate_rational(clip->fps_nom, clip->fps_denom);
+    dng_set_xmp(0);
+}
@@ -0,0 +1,60 @@
+#ifndef _MLV_BRIDGE_H
+#define _MLV_BRIDGE_H
+
+/* reads the raw video frames of a MLV clip (.MLV plus .M00, .M01 ... chunks), for converting Dual ISO video */
+
+#include <stdint.h>
+#include "../mlv_rec/mlv_reader.h"
+
+struct mlv_frame
+{
+    int chunk;
+    uint64_t offset;            /* file offset of the frame data */
+    uint32_t size;
+    uint32_t number;
+};
+
+struct mlv_clip
+{
+    char filename[1000];
+    int num_chunks;
+    mlv_reader_t ** chunks;
+
+    struct mlv_frame * frames;  /* sorted by frame number */
+    int num_frames;
+
+    int video_class;            /* including the compression flags */
+    int fps_nom, fps_denom;
+    int dual_iso;               /* from the DISO block (0 if missing) */
+
+    /* raw format, from RAWI (levels scaled to 14 bits, like the frames returned by mlv_clip_read_frame) */
+    int width, height;
+    int bits_per_pixel;
+    int black_level, white_level;
+    int x1, y1, x2, y2;         /* active area */
+
+    /* metadata for the DNG files, from the first IDNT, EXPO, LENS and RTCI blocks */
+    char camera[33];
+    char serial[33];
+    char lens[33];
+    int iso;
+    int shutter;                /* microseconds */
+    int aperture;               /* f-number x 100 */
+    int focal_length;           /* mm */
+    char datetime[20];          /* EXIF format */
+};
+
+/* scans all the chunks of the clip; returns 1 if there are raw frames we can decode */
+int mlv_clip_open(struct mlv_clip * clip, const char* filename);
+void mlv_clip_close(struct mlv_clip * clip);
+
+/* open the chunks again, e.g. after fork() (the scan results are kept) */
+int mlv_clip_reopen(struct mlv_clip * clip);
+
+/* i-th frame as 14-bit values (width x height, plus one spare row), or NULL on error */
+uint16_t* mlv_clip_read_frame(struct mlv_clip * clip, int index);
+
+/* sets up the DNG writer with the clip metadata (camera, lens, exposure, date, frame rate) */
+void mlv_clip_set_dng_tags(struct mlv_clip * clip);
+
+#endif
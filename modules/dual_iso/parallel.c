@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#if defined(__WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "parallel.h"
+
+static int parallel_threads = 0;
+
+void parallel_set_threads(int threads)
+{
+    parallel_threads = threads;
+}
+
+int parallel_get_threads()
+{
+    int threads = parallel_threads;
+
+    if (threads <= 0)
+    {
+#if defined(__WIN32)
+        SYSTEM_INFO sys_info;
+        GetSystemInfo(&sys_info);
+        threads = sys_info.dwNumberOfProcessors;
+#else
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+
+    if (threads < 1) threads = 1;
+    if (threads > PARALLEL_MAX_BANDS) threads = PARALLEL_MAX_BANDS;
+    return threads;
+}
+
+struct band
+{
+    parallel_func func;
+    void* ctx;
+    int index;
+    int y0;
+    int y1;
+};
+
+static void* band_thread(void* arg)
+{
+    struct band * band = arg;
+    band->func(band->ctx, band->index, band->y0, band->y1);
+    return NULL;
+}
+
+/* each band only writes its own rows, so the output does not depend on the number of bands */
+/* (band functions that collect statistics keep them per band, to be summed by the caller) */
+int parallel_rows(int y0, int y1, int align, parallel_func func, void* ctx)
+{
+    if (y1 <= y0)
+        return 0;
+
+    if (align < 1)
+        align = 1;
+
+    int steps = (y1 - y0 + align - 1) / align;
+    int bands = parallel_get_threads();
+    if (bands > steps) bands = steps;
+
+    struct band band[PARALLEL_MAX_BANDS];
+    pthread_t thread[PARALLEL_MAX_BANDS];
+    int started[PARALLEL_MAX_BANDS];
+
+    for (int i = 0; i < bands; i++)
+    {
+        band[i].func = func;
+        band[i].ctx = ctx;
+        band[i].index = i;
+        band[i].y0 = y0 + align * (i * steps / bands);
+        band[i].y1 = (i == bands - 1) ? y1 : y0 + align * ((i + 1) * steps / bands);
+
+        /* the last band is done by the calling thread, and so is any band we could not start a thread for */
+        started[i] = (i < bands - 1) && !pthread_create(&thread[i], NULL, band_thread, &band[i]);
+        if (!started[i])
+            band_thread(&band[i]);
+    }
+
+    for (int i = 0; i < bands; i++)
+        if (started[i])
+            pthread_join(thread[i], NULL);
+
+    return bands;
+}
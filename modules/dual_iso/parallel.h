@@ -0,0 +1,14 @@
+/* split a range of rows into bands and process them on several threads */
+
+#define PARALLEL_MAX_BANDS 64
+
+/* processes rows y0 ... y1-1; 'band' is a unique index below PARALLEL_MAX_BANDS, for per-band scratch data */
+typedef void (*parallel_func)(void* ctx, int band, int y0, int y1);
+
+/* 0 = one thread per CPU */
+void parallel_set_threads(int threads);
+int parallel_get_threads();
+
+/* rows y0 ... y1-1, bands start at y0 + a multiple of 'align' */
+/* returns the number of bands used (band indices 0 ... n-1) */
+int parallel_rows(int y0, int y1, int align, parallel_func func, void* ctx);
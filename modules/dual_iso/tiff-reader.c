@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "tiff-reader.h"
+
+static uint32_t tiff_get(struct tiff * t, uint32_t offset, int size)
+{
+    uint8_t buf[4] = {0, 0, 0, 0};
+    if (fseek(t->f, offset, SEEK_SET) || fread(buf, 1, size, t->f) != (size_t) size)
+        return 0;
+
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++)
+        value |= buf[i] << (8 * (t->big_endian ? size - 1 - i : i));
+    return value;
+}
+
+static int type_size(int type)
+{
+    switch (type)
+    {
+        case 1: case 2: case 6: case 7:     return 1;   /* BYTE, ASCII, SBYTE, UNDEFINED */
+        case 3: case 8:                     return 2;   /* SHORT, SSHORT */
+        case 4: case 9: case 11: case 13:   return 4;   /* LONG, SLONG, FLOAT, IFD */
+        case 5: case 10: case 12:           return 8;   /* RATIONAL, SRATIONAL, DOUBLE */
+        default:                            return 0;
+    }
+}
+
+int tiff_open(struct tiff * t, const char* filename, const char* mode)
+{
+    t->f = fopen(filename, mode);
+    if (!t->f)
+        return 0;
+
+    uint8_t hdr[4];
+    if (fread(hdr, 1, 4, t->f) == 4)
+    {
+        t->big_endian = (hdr[0] == 'M');
+        if ((hdr[0] == 'I' || hdr[0] == 'M') && hdr[1] == hdr[0] && tiff_get(t, 2, 2) == 42)
+            return 1;
+    }
+
+    fclose(t->f);
+    t->f = 0;
+    return 0;
+}
+
+void tiff_close(struct tiff * t)
+{
+    if (t->f)
+        fclose(t->f);
+    t->f = 0;
+}
+
+uint32_t tiff_ifd(struct tiff * t, int n)
+{
+    uint32_t ifd = tiff_get(t, 4, 4);
+    for (int i = 0; i < n && ifd; i++)
+    {
+        int entries = tiff_get(t, ifd, 2);
+        ifd = tiff_get(t, ifd + 2 + entries * 12, 4);
+    }
+    return ifd;
+}
+
+int tiff_find(struct tiff * t, uint32_t ifd, int tag, struct tiff_entry * e)
+{
+    if (!ifd)
+        return 0;
+
+    int entries = tiff_get(t, ifd, 2);
+    for (int i = 0; i < entries; i++)
+    {
+        uint32_t pos = ifd + 2 + i * 12;
+        if ((int) tiff_get(t, pos, 2) != tag)
+            continue;
+
+        e->tag = tag;
+        e->type = tiff_get(t, pos + 2, 2);
+        e->count = tiff_get(t, pos + 4, 4);
+
+        /* values up to 4 bytes are stored in the entry itself */
+        uint32_t size = type_size(e->type) * e->count;
+        e->data = (size <= 4) ? pos + 8 : tiff_get(t, pos + 8, 4);
+        return 1;
+    }
+    return 0;
+}
+
+int tiff_get_int(struct tiff * t, struct tiff_entry * e, int i)
+{
+    int size = type_size(e->type);
+    if (i >= (int) e->count || size == 0 || size > 4)
+        return 0;
+
+    uint32_t value = tiff_get(t, e->data + i * size, size);
+    switch (e->type)
+    {
+        case 6: return (int8_t) value;
+        case 8: return (int16_t) value;
+        default: return value;
+    }
+}
+
+void tiff_get_rational(struct tiff * t, struct tiff_entry * e, int i, int* num, int* den)
+{
+    *num = 0;
+    *den = 1;
+    if ((e->type != 5 && e->type != 10) || i >= (int) e->count)
+        return;
+
+    *num = tiff_get(t, e->data + i * 8, 4);
+    *den = tiff_get(t, e->data + i * 8 + 4, 4);
+}
+
+void tiff_get_string(struct tiff * t, struct tiff_entry * e, char* buf, int size)
+{
+    int len = e->count < (uint32_t) size ? (int) e->count : size - 1;
+    buf[0] = 0;
+    if (fseek(t->f, e->data, SEEK_SET) || fread(buf, 1, len, t->f) != (size_t) len)
+        len = 0;
+    buf[len] = 0;
+}
+
+uint32_t tiff_find_ifd(struct tiff * t, uint32_t ifd, int tag)
+{
+    struct tiff_entry e;
+    if (!tiff_find(t, ifd, tag, &e))
+        return 0;
+    return tiff_get_int(t, &e, 0);
+}
@@ -0,0 +1,45 @@
+#ifndef _TIFF_READER_H
+#define _TIFF_READER_H
+
+/* minimal TIFF/EXIF reader, enough for CR2 raw data and the metadata cr2hdr copies into its DNGs */
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct tiff
+{
+    FILE* f;
+    int big_endian;
+};
+
+struct tiff_entry
+{
+    int tag;
+    int type;
+    uint32_t count;
+    uint32_t data;              /* file offset of the value(s) */
+};
+
+/* returns 1 if the file has a TIFF header (CR2 and DNG files do) */
+int tiff_open(struct tiff * t, const char* filename, const char* mode);
+void tiff_close(struct tiff * t);
+
+/* file offset of the n-th IFD in the main chain (0 = IFD0), or 0 if there is none */
+uint32_t tiff_ifd(struct tiff * t, int n);
+
+/* looks up a tag in the IFD at the given offset; returns 1 if found */
+int tiff_find(struct tiff * t, uint32_t ifd, int tag, struct tiff_entry * e);
+
+/* i-th value of an integer tag (BYTE, SHORT, LONG and signed variants) */
+int tiff_get_int(struct tiff * t, struct tiff_entry * e, int i);
+
+/* i-th value of a RATIONAL or SRATIONAL tag */
+void tiff_get_rational(struct tiff * t, struct tiff_entry * e, int i, int* num, int* den);
+
+/* ASCII tag, always null-terminated */
+void tiff_get_string(struct tiff * t, struct tiff_entry * e, char* buf, int size);
+
+/* offset of the sub-IFD a tag points to (e.g. EXIF IFD, SubIFDs), or 0 */
+uint32_t tiff_find_ifd(struct tiff * t, uint32_t ifd, int tag);
+
+#endif
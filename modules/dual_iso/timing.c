@@ -1,5 +1,16 @@
+/* clock_gettime with -std=c99 */
+#define _POSIX_C_SOURCE 200112L
+
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if !defined(__WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "timing.h"
 
 static int __t0;
 
@@ -13,3 +24,197 @@ void toc()
 {
     printf("Elapsed time: %.02f s\n", 1.0 * (clock() - __t0) / CLOCKS_PER_SEC);
 }
+
+static const char* profile_tool = 0;
+static clockid_t profile_cpu_clock = CLOCK_PROCESS_CPUTIME_ID;
+static double profile_wall0, profile_cpu0;
+
+/* totals for profile_summary, items may be reported from several threads */
+static struct profile profile_total;
+static int profile_items = 0;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double clock_seconds(clockid_t clock)
+{
+    struct timespec t;
+    if (clock_gettime(clock, &t))
+        return 0;
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static long peak_rss_kb()
+{
+#if defined(__WIN32)
+    /* not available without psapi */
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;  /* bytes on OSX */
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void profile_init(const char* tool, int thread_cpu)
+{
+    profile_tool = tool;
+    profile_cpu_clock = thread_cpu ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID;
+    profile_wall0 = clock_seconds(CLOCK_MONOTONIC);
+    profile_cpu0 = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    profile_start(&profile_total, 0, -1);
+}
+
+int profile_enabled()
+{
+    return profile_tool != 0;
+}
+
+void profile_start(struct profile * p, const char* file, int frame)
+{
+    if (!profile_tool)
+        return;
+
+    p->file = file;
+    p->frame = frame;
+    p->num_stages = 0;
+    p->wall0 = clock_seconds(CLOCK_MONOTONIC);
+}
+
+static struct profile_stage * profile_find(struct profile * p, const char* stage, int create)
+{
+    for (int i = 0; i < p->num_stages; i++)
+        if (p->stages[i].name == stage || strcmp(p->stages[i].name, stage) == 0)
+            return &p->stages[i];
+
+    if (!create || p->num_stages >= PROFILE_MAX_STAGES)
+        return 0;
+
+    struct profile_stage * s = &p->stages[p->num_stages++];
+    memset(s, 0, sizeof(*s));
+    s->name = stage;
+    s->wall0 = -1;
+    return s;
+}
+
+void profile_begin(struct profile * p, const char* stage)
+{
+    if (!profile_tool)
+        return;
+
+    struct profile_stage * s = profile_find(p, stage, 1);
+    if (!s)
+        return;
+
+    s->wall0 = clock_seconds(CLOCK_MONOTONIC);
+    s->cpu0 = clock_seconds(profile_cpu_clock);
+}
+
+static void profile_stop(struct profile_stage * s)
+{
+    s->wall += clock_seconds(CLOCK_MONOTONIC) - s->wall0;
+    s->cpu += clock_seconds(profile_cpu_clock) - s->cpu0;
+    s->wall0 = -1;
+    s->count++;
+}
+
+void profile_end(struct profile * p, const char* stage, int64_t bytes)
+{
+    if (!profile_tool)
+        return;
+
+    struct profile_stage * s = profile_find(p, stage, 0);
+    if (!s || s->wall0 < 0)
+        return;
+
+    profile_stop(s);
+    s->bytes += bytes;
+}
+
+static void profile_print(struct profile * p, int items, double wall, double cpu)
+{
+    /* the whole line is written at once, so the lines of worker threads or processes don't get mixed */
+    char line[4096];
+    int len = 0;
+
+    #define append(...) len += snprintf(line + len, len < (int) sizeof(line) ? sizeof(line) - len : 0, __VA_ARGS__)
+
+    append("{\"tool\":\"%s\"", profile_tool);
+    if (items < 0)
+    {
+        append(",\"file\":\"");
+        for (const char* c = p->file; c && *c; c++)
+            append((*c == '"' || *c == '\\') ? "\\%c" : "%c", *c);
+        append("\",\"frame\":%d", p->frame);
+    }
+    else
+    {
+        append(",\"summary\":true,\"items\":%d", items);
+    }
+    append(",\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"peak_rss_kb\":%ld,\"stages\":{", wall * 1000, cpu * 1000, peak_rss_kb());
+
+    for (int i = 0; i < p->num_stages; i++)
+    {
+        struct profile_stage * s = &p->stages[i];
+        append("%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"bytes\":%lld",
+            i ? "," : "", s->name, s->wall * 1000, s->cpu * 1000, (long long) s->bytes
+        );
+        if (s->count > 1)
+            append(",\"count\":%d", s->count);
+        append("}");
+    }
+    append("}}\n");
+
+    #undef append
+
+    if (len < (int) sizeof(line))
+        fputs(line, stderr);
+    fflush(stderr);
+}
+
+void profile_report(struct profile * p)
+{
+    if (!profile_tool)
+        return;
+
+    double cpu = 0;
+    for (int i = 0; i < p->num_stages; i++)
+    {
+        if (p->stages[i].wall0 >= 0)
+            profile_stop(&p->stages[i]);
+        cpu += p->stages[i].cpu;
+    }
+
+    profile_print(p, -1, clock_seconds(CLOCK_MONOTONIC) - p->wall0, cpu);
+
+    pthread_mutex_lock(&profile_lock);
+    profile_items++;
+    for (int i = 0; i < p->num_stages; i++)
+    {
+        struct profile_stage * s = &p->stages[i];
+        struct profile_stage * t = profile_find(&profile_total, s->name, 1);
+        if (!t)
+            continue;
+        t->wall += s->wall;
+        t->cpu += s->cpu;
+        t->bytes += s->bytes;
+        t->count += s->count;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void profile_summary()
+{
+    if (!profile_tool)
+        return;
+
+    pthread_mutex_lock(&profile_lock);
+    profile_print(&profile_total, profile_items,
+        clock_seconds(CLOCK_MONOTONIC) - profile_wall0,
+        clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - profile_cpu0
+    );
+    pthread_mutex_unlock(&profile_lock);
+}
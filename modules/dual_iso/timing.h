@@ -1,3 +1,45 @@
 /* for timing various routines */
 void tic();
 void toc();
+
+/* stage profiling (--profile=json): one JSON line per file or frame on stderr,
+ * with wall time, CPU time and bytes processed for each stage, and the peak RSS of the process;
+ * a summary line with the totals is printed by profile_summary.
+ * All functions do nothing unless profiling was enabled with profile_init. */
+
+#include <stdint.h>
+
+#define PROFILE_MAX_STAGES 24
+
+struct profile_stage
+{
+    const char* name;           /* static string, stages with the same name are added up */
+    double wall, cpu;           /* seconds */
+    double wall0, cpu0;         /* start of the current run (wall0 < 0: not running) */
+    int64_t bytes;
+    int count;
+};
+
+struct profile
+{
+    const char* file;
+    int frame;                  /* -1 for still images */
+    double wall0;
+    int num_stages;
+    struct profile_stage stages[PROFILE_MAX_STAGES];
+};
+
+/* thread_cpu: measure the CPU time of the thread running each stage (when several items are processed at once) */
+/* otherwise the CPU time of the whole process (including the helper threads of a stage) */
+void profile_init(const char* tool, int thread_cpu);
+int profile_enabled();
+
+void profile_start(struct profile * p, const char* file, int frame);
+void profile_begin(struct profile * p, const char* stage);
+void profile_end(struct profile * p, const char* stage, int64_t bytes);
+
+/* prints the JSON line of this item and adds it to the summary; stages still running are ended here */
+void profile_report(struct profile * p);
+
+/* totals of all the items reported so far */
+void profile_summary();
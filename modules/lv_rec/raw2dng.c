@@ -34,6 +34,7 @@
 #include "../dual_iso/optmed.h"
 #include "../dual_iso/wirth.h"
 #include "../mlv_rec/mlv.h"
+#include "../mlv_rec/bitpack.h"
 
 
 /* useful to clean pink dots, may also help with color aliasing, but it's best turned off if you don't have these problems */
@@ -817,34 +818,73 @@ uint32_t file_set_pos(FILE *stream, uint64_t offset, int whence)
 }
 #endif
 
+/* pixels are a MSB first bit stream in little endian 16 bit words (see bitpack.h), at the frame's bit depth */
+static int get_pixel(struct raw_info * info, int x, int y)
+{
+    int bpp = info->bits_per_pixel;
+    uint16_t * words = (void*)info->buffer + y * info->pitch;
+    int pos = x * bpp;
+    int shift = 32 - pos % 16 - bpp;
+
+    /* the pixel may continue into the next word */
+    uint32_t bits = (uint32_t)words[pos / 16] << 16;
+    if (shift < 16) bits |= words[pos / 16 + 1];
+
+    return (bits >> shift) & ((1u << bpp) - 1);
+}
+
+static void set_pixel(struct raw_info * info, int x, int y, int value)
+{
+    int bpp = info->bits_per_pixel;
+    uint16_t * words = (void*)info->buffer + y * info->pitch;
+    int pos = x * bpp;
+    int shift = 32 - pos % 16 - bpp;
+    uint32_t mask = ((1u << bpp) - 1) << shift;
+
+    uint32_t bits = (uint32_t)words[pos / 16] << 16;
+    if (shift < 16) bits |= words[pos / 16 + 1];
+
+    bits = (bits & ~mask) | (((uint32_t)value << shift) & mask);
+
+    words[pos / 16] = bits >> 16;
+    if (shift < 16) words[pos / 16 + 1] = bits;
+}
+
+/* whole rows, for the fixes that go through every pixel */
+static void get_row(struct raw_info * info, int y, uint16_t * row)
+{
+    bitunpack_row((void*)info->buffer + y * info->pitch, row, info->width, info->bits_per_pixel);
+}
+
+static void set_row(struct raw_info * info, int y, uint16_t * row)
+{
+    bitpack_row((void*)info->buffer + y * info->pitch, row, info->width, info->bits_per_pixel);
+}
+
+/* the thresholds of the fixes are raw levels at 14 bits, this converts them to the frame's bit depth */
+static int raw_level(struct raw_info * info, int level14)
+{
+    return info->bits_per_pixel >= 14 ? level14 << (info->bits_per_pixel - 14) : level14 >> (14 - info->bits_per_pixel);
+}
+
 int raw_get_pixel(int x, int y) {
-    struct raw_pixblock * p = (void*)raw_info.buffer + y * raw_info.pitch + (x/8)*14;
-    switch (x%8) {
-        case 0: return p->a;
-        case 1: return p->b_lo | (p->b_hi << 12);
-        case 2: return p->c_lo | (p->c_hi << 10);
-        case 3: return p->d_lo | (p->d_hi << 8);
-        case 4: return p->e_lo | (p->e_hi << 6);
-        case 5: return p->f_lo | (p->f_hi << 4);
-        case 6: return p->g_lo | (p->g_hi << 2);
-        case 7: return p->h;
-    }
-    return p->a;
+    return get_pixel(&raw_info, x, y);
 }
 
 void raw_set_pixel(int x, int y, int value)
 {
-    struct raw_pixblock * p = (void*)raw_info.buffer + y * raw_info.pitch + (x/8)*14;
-    switch (x%8) {
-        case 0: p->a = value; break;
-        case 1: p->b_lo = value; p->b_hi = value >> 12; break;
-        case 2: p->c_lo = value; p->c_hi = value >> 10; break;
-        case 3: p->d_lo = value; p->d_hi = value >> 8; break;
-        case 4: p->e_lo = value; p->e_hi = value >> 6; break;
-        case 5: p->f_lo = value; p->f_hi = value >> 4; break;
-        case 6: p->g_lo = value; p->g_hi = value >> 2; break;
-        case 7: p->h = value; break;
-    }
+    set_pixel(&raw_info, x, y, value);
+}
+
+/* same as above, but on a caller-supplied raw_info (so several frames can be processed at once) */
+int raw_get_pixel_info(struct raw_info * info, int x, int y)
+{
+    return get_pixel(info, x, y);
+}
+
+void raw_set_pixel_info(struct raw_info * info, int x, int y, int value)
+{
+    set_pixel(info, x, y, value);
 }
 
 /**
@@ -858,15 +898,64 @@ void raw_set_pixel(int x, int y, int value)
  * whether to apply the correction or not.
  * 
  * For speed reasons:
- * - Correction factors are computed from the first frame only.
+ * - Correction factors are computed from the first frame only
+ *   (or whenever the caller resets the analysis, see raw_fix_analysis_reset).
  * - Only channels with error greater than 0.2% are corrected.
  */
 
 #define FIXP_ONE 65536
 #define FIXP_RANGE 65536
 
-static int stripes_coeffs[8] = {0};
-static int stripes_correction_needed = 0;
+#define MAX_COLD_PIXELS 200000
+
+struct xy { int x; int y; };
+
+/**
+ * Results of the stripe and cold pixel analysis.
+ * 
+ * Both are computed from one frame and applied to the following ones, as long as
+ * the analysis is valid for them. raw2dng itself uses a single analysis for the whole clip,
+ * mlv_dump keeps its own and resets it when the frame geometry or levels change.
+ */
+struct raw_fix_analysis
+{
+    int stripes_analyzed;
+    int stripes_coeffs[8];
+    int stripes_correction_needed;
+
+    int cold_pixels;                    /* -1 if not analyzed yet */
+    struct xy * cold_pixel_list;
+};
+
+static struct raw_fix_analysis default_analysis = { .cold_pixels = -1 };
+
+struct raw_fix_analysis * raw_fix_analysis_new()
+{
+    struct raw_fix_analysis * analysis = calloc(1, sizeof(struct raw_fix_analysis));
+    if (analysis)
+    {
+        analysis->cold_pixels = -1;
+    }
+    return analysis;
+}
+
+/* the next frame passed to the fixes will be analyzed again */
+void raw_fix_analysis_reset(struct raw_fix_analysis * analysis)
+{
+    analysis->stripes_analyzed = 0;
+    analysis->stripes_correction_needed = 0;
+    memset(analysis->stripes_coeffs, 0, sizeof(analysis->stripes_coeffs));
+    analysis->cold_pixels = -1;
+}
+
+void raw_fix_analysis_free(struct raw_fix_analysis * analysis)
+{
+    if (analysis)
+    {
+        free(analysis->cold_pixel_list);
+        free(analysis);
+    }
+}
 
 /* do not use typeof in macros, use __typeof__ instead.
    see: http://gcc.gnu.org/onlinedocs/gcc-4.1.2/gcc/Alternate-Keywords.html#Alternate-Keywords
@@ -889,37 +978,19 @@ static int stripes_correction_needed = 0;
 
 #define STR_APPEND(orig,fmt,...) ({ int _len = strlen(orig); snprintf(orig + _len, sizeof(orig) - _len, fmt, ## __VA_ARGS__); });
 
-#define PA ((int)(p->a))
-#define PB ((int)(p->b_lo | (p->b_hi << 12)))
-#define PC ((int)(p->c_lo | (p->c_hi << 10)))
-#define PD ((int)(p->d_lo | (p->d_hi << 8)))
-#define PE ((int)(p->e_lo | (p->e_hi << 6)))
-#define PF ((int)(p->f_lo | (p->f_hi << 4)))
-#define PG ((int)(p->g_lo | (p->g_hi << 2)))
-#define PH ((int)(p->h))
-
-#define SET_PA(x) { int v = (x); p->a = v; }
-#define SET_PB(x) { int v = (x); p->b_lo = v; p->b_hi = v >> 12; }
-#define SET_PC(x) { int v = (x); p->c_lo = v; p->c_hi = v >> 10; }
-#define SET_PD(x) { int v = (x); p->d_lo = v; p->d_hi = v >> 8; }
-#define SET_PE(x) { int v = (x); p->e_lo = v; p->e_hi = v >> 6; }
-#define SET_PF(x) { int v = (x); p->f_lo = v; p->f_hi = v >> 4; }
-#define SET_PG(x) { int v = (x); p->g_lo = v; p->g_hi = v >> 2; }
-#define SET_PH(x) { int v = (x); p->h = v; }
-
-#define RAW_MUL(p, x) ((((int)(p) - raw_info.black_level) * (int)(x) / FIXP_ONE) + raw_info.black_level)
+#define RAW_MUL(p, x) ((((int)(p) - info->black_level) * (int)(x) / FIXP_ONE) + info->black_level)
 #define F2H(ev) COERCE((int)(FIXP_RANGE/2 + ev * FIXP_RANGE/2), 0, FIXP_RANGE-1)
 #define H2F(x) ((double)((x) - FIXP_RANGE/2) / (FIXP_RANGE/2))
 
-static void add_pixel(int hist[8][FIXP_RANGE], int num[8], int offset, int pa, int pb)
+static void add_pixel(int hist[8][FIXP_RANGE], int num[8], int offset, int pa, int pb, int white, int noise)
 {
     int a = pa;
     int b = pb;
     
-    if (MIN(a,b) < 32)
+    if (MIN(a,b) < noise)
         return; /* too noisy */
 
-    if (MAX(a,b) > raw_info.white_level / 1.1)
+    if (MAX(a,b) > white / 1.1)
         return; /* too bright */
         
     /**
@@ -946,7 +1017,7 @@ static void add_pixel(int hist[8][FIXP_RANGE], int num[8], int offset, int pa, i
 }
 
 
-static void detect_vertical_stripes_coeffs()
+static void detect_vertical_stripes_coeffs(struct raw_info * info, int stripes_coeffs[8], int * stripes_correction_needed)
 {
     static int hist[8][FIXP_RANGE];
     static int num[8];
@@ -954,39 +1025,49 @@ static void detect_vertical_stripes_coeffs()
     memset(hist, 0, sizeof(hist));
     memset(num, 0, sizeof(num));
 
+    int w = info->width;
+    int black = info->black_level;
+    int noise = raw_level(info, 32);
+    uint16_t * rg = malloc(2 * w * sizeof(uint16_t));
+    uint16_t * gb = rg + w;
+    if (!rg)
+    {
+        *stripes_correction_needed = 0;
+        return;
+    }
+
     /* compute 7 histograms: b./a, c./a ... h./a */
     /* that is, adjust all columns to make them as bright as a */
     /* process green pixels only, assuming the image is RGGB */
-    struct raw_pixblock * row;
-    for (row = raw_info.buffer; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.height; row += 2 * raw_info.pitch / sizeof(struct raw_pixblock))
+    for (int y = 0; y + 1 < info->height; y += 2)
     {
-        /* first line is RG */
-        struct raw_pixblock * rg;
-        for (rg = row; (void*)rg < (void*)row + raw_info.pitch - sizeof(struct raw_pixblock); rg++)
+        /* first line is RG, next line is GB */
+        get_row(info, y, rg);
+        get_row(info, y + 1, gb);
+
+        /* each pixel block is compared with the next one */
+        for (int x = 0; x + 16 <= w; x += 8)
         {
-            /* next line is GB */
-            struct raw_pixblock * gb = rg + raw_info.pitch / sizeof(struct raw_pixblock);
-
-            struct raw_pixblock * p = rg;
-            int pb = PB - raw_info.black_level;
-            int pd = PD - raw_info.black_level;
-            int pf = PF - raw_info.black_level;
-            int ph = PH - raw_info.black_level;
-            p++;
-            int pb2 = PB - raw_info.black_level;
-            int pd2 = PD - raw_info.black_level;
-            int pf2 = PF - raw_info.black_level;
-            int ph2 = PH - raw_info.black_level;
-            p = gb;
-            //int pa = PA - raw_info.black_level;
-            int pc = PC - raw_info.black_level;
-            int pe = PE - raw_info.black_level;
-            int pg = PG - raw_info.black_level;
-            p++;
-            int pa2 = PA - raw_info.black_level;
-            int pc2 = PC - raw_info.black_level;
-            int pe2 = PE - raw_info.black_level;
-            int pg2 = PG - raw_info.black_level;
+            uint16_t * p = rg + x;
+            int pb = p[1] - black;
+            int pd = p[3] - black;
+            int pf = p[5] - black;
+            int ph = p[7] - black;
+            p += 8;
+            int pb2 = p[1] - black;
+            int pd2 = p[3] - black;
+            int pf2 = p[5] - black;
+            int ph2 = p[7] - black;
+            p = gb + x;
+            //int pa = p[0] - black;
+            int pc = p[2] - black;
+            int pe = p[4] - black;
+            int pg = p[6] - black;
+            p += 8;
+            int pa2 = p[0] - black;
+            int pc2 = p[2] - black;
+            int pe2 = p[4] - black;
+            int pg2 = p[6] - black;
             
             /**
              * verification: introducing strong banding in one column
@@ -1004,16 +1085,18 @@ static void detect_vertical_stripes_coeffs()
              * and so on, to avoid getting tricked by smooth gradients.
              */
 
-            add_pixel(hist, num, 1, pa2, (pb * 1 + pb2 * 7) / 8);
-            add_pixel(hist, num, 2, pa2, (pc * 2 + pc2 * 6) / 8);
-            add_pixel(hist, num, 3, pa2, (pd * 3 + pd2 * 5) / 8);
-            add_pixel(hist, num, 4, pa2, (pe * 4 + pe2 * 4) / 8);
-            add_pixel(hist, num, 5, pa2, (pf * 5 + pf2 * 3) / 8);
-            add_pixel(hist, num, 6, pa2, (pg * 6 + pg2 * 2) / 8);
-            add_pixel(hist, num, 7, pa2, (ph * 7 + ph2 * 1) / 8);
+            add_pixel(hist, num, 1, pa2, (pb * 1 + pb2 * 7) / 8, info->white_level, noise);
+            add_pixel(hist, num, 2, pa2, (pc * 2 + pc2 * 6) / 8, info->white_level, noise);
+            add_pixel(hist, num, 3, pa2, (pd * 3 + pd2 * 5) / 8, info->white_level, noise);
+            add_pixel(hist, num, 4, pa2, (pe * 4 + pe2 * 4) / 8, info->white_level, noise);
+            add_pixel(hist, num, 5, pa2, (pf * 5 + pf2 * 3) / 8, info->white_level, noise);
+            add_pixel(hist, num, 6, pa2, (pg * 6 + pg2 * 2) / 8, info->white_level, noise);
+            add_pixel(hist, num, 7, pa2, (ph * 7 + ph2 * 1) / 8, info->white_level, noise);
         }
     }
 
+    free(rg);
+
     int j,k;
     
     int max[8] = {0};
@@ -1024,7 +1107,7 @@ static void detect_vertical_stripes_coeffs()
     /* compute the median correction factor (this will reject outliers) */
     for (j = 0; j < 8; j++)
     {
-        if (num[j] < raw_info.frame_size / 128) continue;
+        if (num[j] < info->frame_size / 128) continue;
         int t = 0;
         for (k = 0; k < FIXP_RANGE; k++)
         {
@@ -1068,15 +1151,15 @@ static void detect_vertical_stripes_coeffs()
     stripes_coeffs[0] = FIXP_ONE;
 
     /* do we really need stripe correction, or it won't be noticeable? or maybe it's just computation error? */
-    stripes_correction_needed = 0;
+    *stripes_correction_needed = 0;
     for (j = 0; j < 8; j++)
     {
         double c = (double)stripes_coeffs[j] / FIXP_ONE;
         if (c < 0.998 || c > 1.002)
-            stripes_correction_needed = 1;
+            *stripes_correction_needed = 1;
     }
     
-    if (stripes_correction_needed)
+    if (*stripes_correction_needed)
     {
         printf("\n\nVertical stripes correction:\n");
         for (j = 0; j < 8; j++)
@@ -1090,7 +1173,7 @@ static void detect_vertical_stripes_coeffs()
     }
 }
 
-static void apply_vertical_stripes_correction()
+static void apply_vertical_stripes_correction(struct raw_info * info, int stripes_coeffs[8])
 {
     /**
      * inexact white level will result in banding in highlights, especially if some channels are clipped
@@ -1104,40 +1187,33 @@ static void apply_vertical_stripes_correction()
      *   - if there are, we will choose the true white level
      */
      
-    int white = raw_info.white_level * 2 / 3;
-    
-    struct raw_pixblock * row;
+    int white = info->white_level * 2 / 3;
+    int w = info->width;
+    int h = info->height;
+    uint16_t * row = malloc(w * sizeof(uint16_t));
+    if (!row)
+    {
+        return;
+    }
     
-    for (row = raw_info.buffer; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.height; row += raw_info.pitch / sizeof(struct raw_pixblock))
+    for (int y = 0; y < h; y++)
     {
-        struct raw_pixblock * p;
-        for (p = row; (void*)p < (void*)row + raw_info.pitch; p++)
+        get_row(info, y, row);
+        for (int x = 0; x < w; x++)
         {
-            white = MAX(white, PA);
-            white = MAX(white, PB);
-            white = MAX(white, PC);
-            white = MAX(white, PD);
-            white = MAX(white, PE);
-            white = MAX(white, PF);
-            white = MAX(white, PG);
-            white = MAX(white, PH);
+            white = MAX(white, row[x]);
         }
     }
     
-    int black = raw_info.black_level;
-    for (row = raw_info.buffer; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.height; row += raw_info.pitch / sizeof(struct raw_pixblock))
+    int black = info->black_level;
+    int dark = black + raw_level(info, 64);
+    for (int y = 0; y < h; y++)
     {
-        struct raw_pixblock * p;
-        for (p = row; (void*)p < (void*)row + raw_info.pitch; p++)
+        get_row(info, y, row);
+        for (int x = 0; x + 8 <= w; x += 8)
         {
-            int pa = PA;
-            int pb = PB;
-            int pc = PC;
-            int pd = PD;
-            int pe = PE;
-            int pf = PF;
-            int pg = PG;
-            int ph = PH;
+            uint16_t * p = row + x;
+            int pa = p[0];
             
             /**
              * Thou shalt not exceed the white level (the exact one, not the exif one)
@@ -1146,33 +1222,48 @@ static void apply_vertical_stripes_correction()
              * At very dark levels, you will introduce roundoff errors, so don't correct there
              */
             
-            if (stripes_coeffs[0] && pa && pa < white && pa > black + 64) SET_PA(MIN(white, RAW_MUL(pa, stripes_coeffs[0])));
-            if (stripes_coeffs[1] && pb && pb < white && pa > black + 64) SET_PB(MIN(white, RAW_MUL(pb, stripes_coeffs[1])));
-            if (stripes_coeffs[2] && pc && pc < white && pa > black + 64) SET_PC(MIN(white, RAW_MUL(pc, stripes_coeffs[2])));
-            if (stripes_coeffs[3] && pd && pd < white && pa > black + 64) SET_PD(MIN(white, RAW_MUL(pd, stripes_coeffs[3])));
-            if (stripes_coeffs[4] && pe && pe < white && pa > black + 64) SET_PE(MIN(white, RAW_MUL(pe, stripes_coeffs[4])));
-            if (stripes_coeffs[5] && pf && pf < white && pa > black + 64) SET_PF(MIN(white, RAW_MUL(pf, stripes_coeffs[5])));
-            if (stripes_coeffs[6] && pg && pg < white && pa > black + 64) SET_PG(MIN(white, RAW_MUL(pg, stripes_coeffs[6])));
-            if (stripes_coeffs[7] && ph && ph < white && pa > black + 64) SET_PH(MIN(white, RAW_MUL(ph, stripes_coeffs[7])));
+            if (pa <= dark)
+                continue;
+
+            for (int k = 0; k < 8; k++)
+            {
+                if (stripes_coeffs[k] && p[k] && p[k] < white)
+                    p[k] = MIN(white, RAW_MUL(p[k], stripes_coeffs[k]));
+            }
         }
+        set_row(info, y, row);
     }
+
+    free(row);
 }
 
-void fix_vertical_stripes()
+/* returns nonzero if the frame was modified */
+int fix_vertical_stripes_analysis(struct raw_info * info, struct raw_fix_analysis * analysis)
 {
     /* for speed: only detect correction factors from the first frame */
-    static int first_time = 1;
-    if (first_time)
+    if (!analysis->stripes_analyzed)
     {
-        detect_vertical_stripes_coeffs();
-        first_time = 0;
+        detect_vertical_stripes_coeffs(info, analysis->stripes_coeffs, &analysis->stripes_correction_needed);
+        analysis->stripes_analyzed = 1;
     }
     
     /* only apply stripe correction if we need it, since it takes a little CPU time */
-    if (stripes_correction_needed)
+    if (analysis->stripes_correction_needed)
     {
-        apply_vertical_stripes_correction();
+        apply_vertical_stripes_correction(info, analysis->stripes_coeffs);
     }
+
+    return analysis->stripes_correction_needed;
+}
+
+int fix_vertical_stripes_ex(struct raw_info * info)
+{
+    return fix_vertical_stripes_analysis(info, &default_analysis);
+}
+
+void fix_vertical_stripes()
+{
+    fix_vertical_stripes_ex(&raw_info);
 }
 
 static inline int FC(int row, int col)
@@ -1192,45 +1283,50 @@ static inline int FC(int row, int col)
 }
 
 
-void find_and_fix_cold_pixels(int force_analysis)
+/* scan a frame for cold pixels, returns their number */
+static int find_cold_pixels(struct raw_info * info, struct xy * cold_pixel_list)
 {
-    #define MAX_COLD_PIXELS 200000
-  
-    struct xy { int x; int y; };
-    
-    static struct xy cold_pixel_list[MAX_COLD_PIXELS];
-    static int cold_pixels = -1;
+    int w = info->width;
+    int h = info->height;
+    int cold_pixels = 0;
     
-    int w = raw_info.width;
-    int h = raw_info.height;
-    
-    /* scan for bad pixels in the first frame only, or on request*/
-    if (cold_pixels < 0 || force_analysis)
+    /* at sane ISOs, noise stdev is well less than 50, so 200 should be enough */
+    int cold_thr = MAX(0, info->black_level - raw_level(info, 200));
+
+    uint16_t * row = malloc(w * sizeof(uint16_t));
+    if (!row)
     {
-        cold_pixels = 0;
-        
-        /* at sane ISOs, noise stdev is well less than 50, so 200 should be enough */
-        int cold_thr = MAX(0, raw_info.black_level - 200);
+        return 0;
+    }
 
-        /* analyse all pixels of the frame */
-        for (int y = 0; y < h; y++)
+    /* analyse all pixels of the frame */
+    for (int y = 0; y < h; y++)
+    {
+        get_row(info, y, row);
+        for (int x = 0; x < w; x++)
         {
-            for (int x = 0; x < w; x++)
-            {
-                int p = raw_get_pixel(x, y);
-                int is_cold = (p < cold_thr);
+            int p = row[x];
+            int is_cold = (p < cold_thr);
 
-                /* create a list containing the cold pixels */
-                if (is_cold && cold_pixels < MAX_COLD_PIXELS)
-                {
-                    cold_pixel_list[cold_pixels].x = x;
-                    cold_pixel_list[cold_pixels].y = y;
-                    cold_pixels++;
-                }
+            /* create a list containing the cold pixels */
+            if (is_cold && cold_pixels < MAX_COLD_PIXELS)
+            {
+                cold_pixel_list[cold_pixels].x = x;
+                cold_pixel_list[cold_pixels].y = y;
+                cold_pixels++;
             }
         }
-        printf("\rCold pixels : %d                             \n", (cold_pixels));
-    }  
+    }
+    free(row);
+    printf("\rCold pixels : %d                             \n", (cold_pixels));
+
+    return cold_pixels;
+}
+
+static void fix_cold_pixels(struct raw_info * info, struct xy * cold_pixel_list, int cold_pixels)
+{
+    int w = info->width;
+    int h = info->height;
 
     /* repair the cold pixels */
     for (int p = 0; p < cold_pixels; p++)
@@ -1265,15 +1361,62 @@ void find_and_fix_cold_pixels(int force_analysis)
                     continue;
                 }
 
-                int p = raw_get_pixel(x+j, y+i);
+                int p = get_pixel(info, x+j, y+i);
                 neighbours[k++] = -p;
             }
         }
         
         /* replace the cold pixel with the median of the neighbours */
-        raw_set_pixel(x, y, -median_int_wirth(neighbours, k));
+        set_pixel(info, x, y, -median_int_wirth(neighbours, k));
     }
-    
+}
+
+/* returns the number of repaired pixels */
+int find_and_fix_cold_pixels_analysis(struct raw_info * info, struct raw_fix_analysis * analysis, int force_analysis)
+{
+    /* per-frame analysis uses its own list, so other frames may be repaired at the same time */
+    if (force_analysis)
+    {
+        struct xy * cold_pixel_list = malloc(MAX_COLD_PIXELS * sizeof(struct xy));
+        if (!cold_pixel_list)
+        {
+            return 0;
+        }
+
+        int cold_pixels = find_cold_pixels(info, cold_pixel_list);
+        fix_cold_pixels(info, cold_pixel_list, cold_pixels);
+        free(cold_pixel_list);
+        return cold_pixels;
+    }
+
+    /* scan for bad pixels in the first frame only */
+    if (analysis->cold_pixels < 0)
+    {
+        if (!analysis->cold_pixel_list)
+        {
+            analysis->cold_pixel_list = malloc(MAX_COLD_PIXELS * sizeof(struct xy));
+            if (!analysis->cold_pixel_list)
+            {
+                return 0;
+            }
+        }
+
+        analysis->cold_pixels = find_cold_pixels(info, analysis->cold_pixel_list);
+    }
+
+    fix_cold_pixels(info, analysis->cold_pixel_list, analysis->cold_pixels);
+
+    return analysis->cold_pixels;
+}
+
+int find_and_fix_cold_pixels_ex(struct raw_info * info, int force_analysis)
+{
+    return find_and_fix_cold_pixels_analysis(info, &default_analysis, force_analysis);
+}
+
+void find_and_fix_cold_pixels(int force_analysis)
+{
+    find_and_fix_cold_pixels_ex(&raw_info, force_analysis);
 }
 
 #ifdef CHROMA_SMOOTH
@@ -0,0 +1,128 @@
+#!/bin/bash
+#
+# mlv_dump throughput benchmark on synthetic clips (see mlv_synth.py)
+#
+# For every clip size, bit depth and chunk count, a clip is generated and
+# converted with mlv_dump once per stage. Throughput is reported per stage
+# in MB/s (of the input clip) and frames/s, e.g. to compare releases:
+#
+#   parse      read all blocks, no output
+#   lzma/lj92  compress into an MLV (also creates the clips for the next stages)
+#   unlzma     decompress the LZMA clip into an uncompressed MLV
+#   unlj92     same for the LJ92 clip
+#   repack     reduce the bit depth by 2 bits
+#   darkframe  subtract an averaged dark frame
+#   dng        plain DNG export, no corrections
+#   stripes    DNG export with vertical stripe fix
+#   coldpix    DNG export with cold pixel fix
+#   chroma     DNG export with 3x3 chroma smoothing
+#
+# The DNG stages include writing the files, so the cost of a correction
+# is the difference to the "dng" line.
+#
+# Settings (environment):
+#   MLV_DUMP   binary to test (default: ./mlv_dump)
+#   SIZES      clip sizes (default: "1280x720 1920x1080")
+#   DEPTHS     bits per pixel (default: "14 12 10")
+#   CHUNKS     number of files per clip (default: "1 3")
+#   FRAMES     frames per clip (default: 20)
+#   THREADS    passed as --threads if set
+#   BENCH_DIR  scratch directory (default: a new one in /tmp, removed afterwards)
+#   PYTHON     python interpreter for mlv_synth.py (default: python)
+
+MLV_DUMP=${MLV_DUMP:-./mlv_dump}
+SIZES=${SIZES:-"1280x720 1920x1080"}
+DEPTHS=${DEPTHS:-"14 12 10"}
+CHUNKS=${CHUNKS:-"1 3"}
+FRAMES=${FRAMES:-20}
+PYTHON=${PYTHON:-python}
+SYNTH="$(cd "$(dirname "$0")" && pwd)/mlv_synth.py"
+
+if [ ! -x "$MLV_DUMP" ]; then
+    echo "Error: $MLV_DUMP not found, build it first (make mlv_dump) or set MLV_DUMP"
+    exit 1
+fi
+MLV_DUMP="$(cd "$(dirname "$MLV_DUMP")" && pwd)/$(basename "$MLV_DUMP")"
+
+if [ -z "$BENCH_DIR" ]; then
+    BENCH_DIR=$(mktemp -d /tmp/mlv_bench.XXXXXX) || exit 1
+    trap 'rm -rf "$BENCH_DIR"' EXIT
+fi
+mkdir -p "$BENCH_DIR" || exit 1
+cd "$BENCH_DIR" || exit 1
+
+THREAD_ARGS=""
+if [ -n "$THREADS" ]; then
+    THREAD_ARGS="--threads $THREADS"
+fi
+
+TIMEFORMAT=%R
+failed=0
+
+# size of a clip in bytes, all chunks
+clip_bytes()
+{
+    cat "${1%.*}".[Mm]* 2>/dev/null | wc -c
+}
+
+# run_stage <stage> <clip> <mlv_dump arguments>
+run_stage()
+{
+    local stage=$1
+    local clip=$2
+    shift 2
+
+    rm -rf out
+    mkdir out
+    local secs=$( { time ( "$MLV_DUMP" $THREAD_ARGS "$@" "$clip" > out.log 2>&1; echo $? > out.rc ) ; } 2>&1 )
+
+    if [ "$(cat out.rc)" != "0" ]; then
+        printf "%-10s %-24s FAILED\n" "$stage" "$NAME"
+        tail -n 5 out.log | sed 's/^/    /'
+        failed=1
+        return
+    fi
+
+    awk -v stage="$stage" -v name="$NAME" -v bytes="$(clip_bytes "$clip")" -v frames="$FRAMES" -v secs="$secs" 'BEGIN {
+        if (secs <= 0) secs = 0.001;
+        printf "%-10s %-24s %8.2f %9.1f %8.1f\n", stage, name, secs, bytes / 1048576 / secs, frames / secs
+    }'
+}
+
+echo "mlv_dump: $MLV_DUMP $THREAD_ARGS"
+printf "%-10s %-24s %8s %9s %8s\n" "stage" "clip" "seconds" "MB/s" "frames/s"
+
+for size in $SIZES; do
+    for bits in $DEPTHS; do
+        for chunks in $CHUNKS; do
+            rm -f clip.* lzma.* lj92.* dark.*
+            NAME="${size}/${bits}bit/${chunks}ch"
+
+            if ! "$PYTHON" "$SYNTH" -W "${size%x*}" -H "${size#*x}" -b "$bits" -n "$FRAMES" -c "$chunks" clip.MLV > /dev/null; then
+                echo "Error: failed to generate $NAME"
+                exit 1
+            fi
+
+            run_stage parse     clip.MLV
+            run_stage lzma      clip.MLV -c -o out/c.mlv
+            mv out/c.mlv lzma.MLV 2>/dev/null
+            run_stage lj92      clip.MLV --lj92 -o out/c.mlv
+            mv out/c.mlv lj92.MLV 2>/dev/null
+
+            run_stage unlzma    lzma.MLV -d -o out/d.mlv
+            run_stage unlj92    lj92.MLV -d -o out/d.mlv
+            run_stage repack    clip.MLV -b $((bits - 2)) -o out/r.mlv
+
+            "$MLV_DUMP" -a -o dark.mlv clip.MLV > /dev/null 2>&1
+            run_stage darkframe clip.MLV -s dark.mlv -o out/s.mlv
+
+            run_stage dng       clip.MLV --dng --no-fixcp --no-stripes -o out/
+            run_stage stripes   clip.MLV --dng --no-fixcp -o out/
+            run_stage coldpix   clip.MLV --dng --no-stripes -o out/
+            run_stage chroma    clip.MLV --dng --no-fixcp --no-stripes --cs3x3 -o out/
+        done
+    done
+done
+
+rm -rf out out.log out.rc clip.* lzma.* lj92.* dark.*
+exit $failed
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "bitpack.h"
+
+/*
+    vector kernels work on blocks of 8 pixels, which are exactly 'depth' bytes long.
+    every pixel is built from the word it starts in (a) and the word it ends in (c):
+
+        pixel = ((a * mul_a) | ((c * mul_c) >> 16)) & mask
+
+    mullo/mulhi with per-lane powers of two act as per-lane shifts, which SSE2 lacks.
+    a and c are gathered with word shuffles that only differ per bit depth.
+*/
+#if defined(__SSE2__)
+static const int16_t unpack_mul_a[3][8] =
+{
+    { 0,   16, 0,     256, 4,    0,    64, 1 },     /* 10 bit */
+    { 0,   256, 16,   1,   0,    256,  16, 1 },     /* 12 bit */
+    { 0,   4096, 1024, 256, 64,  16,   4,  1 },     /* 14 bit */
+};
+
+static const uint16_t unpack_mul_c[3][8] =
+{
+    { 1024,  16,   16384, 256, 4,    4096, 64, 0 }, /* 10 bit */
+    { 4096,  256,  16,    0,   4096, 256,  16, 0 }, /* 12 bit */
+    { 16384, 4096, 1024,  256, 64,   16,   4,  0 }, /* 14 bit */
+};
+
+static inline __m128i unpack8_sse2(__m128i w, int depth)
+{
+    __m128i a, c;
+
+    switch(depth)
+    {
+        case 10:
+        {
+            __m128i w2 = _mm_srli_si128(w, 4);
+            a = _mm_unpacklo_epi64(_mm_shufflelo_epi16(w, _MM_SHUFFLE(1,1,0,0)), _mm_shufflelo_epi16(w2, _MM_SHUFFLE(2,1,1,0)));
+            c = _mm_unpacklo_epi64(_mm_shufflelo_epi16(w, _MM_SHUFFLE(2,1,1,0)), _mm_shufflelo_epi16(w2, _MM_SHUFFLE(2,2,1,1)));
+            break;
+        }
+        case 12:
+        {
+            __m128i w3 = _mm_srli_si128(w, 6);
+            a = _mm_unpacklo_epi64(_mm_shufflelo_epi16(w, _MM_SHUFFLE(2,1,0,0)), _mm_shufflelo_epi16(w3, _MM_SHUFFLE(2,1,0,0)));
+            c = _mm_unpacklo_epi64(_mm_shufflelo_epi16(w, _MM_SHUFFLE(2,2,1,0)), _mm_shufflelo_epi16(w3, _MM_SHUFFLE(2,2,1,0)));
+            break;
+        }
+        default:
+            a = _mm_slli_si128(w, 2);
+            c = w;
+            break;
+    }
+
+    int idx = (depth - 10) / 2;
+    __m128i mul_a = _mm_loadu_si128((const __m128i *)unpack_mul_a[idx]);
+    __m128i mul_c = _mm_loadu_si128((const __m128i *)unpack_mul_c[idx]);
+    __m128i mask = _mm_set1_epi16((1 << depth) - 1);
+
+    return _mm_and_si128(_mm_or_si128(_mm_mullo_epi16(a, mul_a), _mm_mulhi_epu16(c, mul_c)), mask);
+}
+#endif
+
+#if defined(__AVX2__)
+/* same as unpack8_sse2, two blocks at once (one per 128 bit lane) */
+static inline __m256i unpack16_avx2(__m256i w, int depth)
+{
+    __m256i a, c;
+
+    switch(depth)
+    {
+        case 10:
+        {
+            __m256i w2 = _mm256_srli_si256(w, 4);
+            a = _mm256_unpacklo_epi64(_mm256_shufflelo_epi16(w, _MM_SHUFFLE(1,1,0,0)), _mm256_shufflelo_epi16(w2, _MM_SHUFFLE(2,1,1,0)));
+            c = _mm256_unpacklo_epi64(_mm256_shufflelo_epi16(w, _MM_SHUFFLE(2,1,1,0)), _mm256_shufflelo_epi16(w2, _MM_SHUFFLE(2,2,1,1)));
+            break;
+        }
+        case 12:
+        {
+            __m256i w3 = _mm256_srli_si256(w, 6);
+            a = _mm256_unpacklo_epi64(_mm256_shufflelo_epi16(w, _MM_SHUFFLE(2,1,0,0)), _mm256_shufflelo_epi16(w3, _MM_SHUFFLE(2,1,0,0)));
+            c = _mm256_unpacklo_epi64(_mm256_shufflelo_epi16(w, _MM_SHUFFLE(2,2,1,0)), _mm256_shufflelo_epi16(w3, _MM_SHUFFLE(2,2,1,0)));
+            break;
+        }
+        default:
+            a = _mm256_slli_si256(w, 2);
+            c = w;
+            break;
+    }
+
+    int idx = (depth - 10) / 2;
+    __m256i mul_a = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)unpack_mul_a[idx]));
+    __m256i mul_c = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)unpack_mul_c[idx]));
+    __m256i mask = _mm256_set1_epi16((1 << depth) - 1);
+
+    return _mm256_and_si256(_mm256_or_si256(_mm256_mullo_epi16(a, mul_a), _mm256_mulhi_epu16(c, mul_c)), mask);
+}
+#endif
+
+static void bitunpack_row_scalar(const uint8_t *src, uint16_t *dst, int count, int depth)
+{
+    uint32_t mask = (1 << depth) - 1;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for(int x = 0; x < count; x++)
+    {
+        if(bits < depth)
+        {
+            acc = (acc << 16) | src[0] | (src[1] << 8);
+            src += 2;
+            bits += 16;
+        }
+        bits -= depth;
+        dst[x] = (acc >> bits) & mask;
+    }
+}
+
+void bitunpack_row(const void *src, uint16_t *dst, int count, int depth)
+{
+    const uint8_t *in = src;
+    int x = 0;
+
+    if(depth == 16)
+    {
+        memcpy(dst, src, count * 2);
+        return;
+    }
+
+#if defined(__SSE2__)
+    if(depth == 10 || depth == 12 || depth == 14)
+    {
+        /* only read the words bitextract would have read, the vector loads are 16 bytes wide */
+        int row_bytes = ((count * depth + 15) / 16) * 2;
+
+#if defined(__AVX2__)
+        for(; x + 16 <= count && x / 8 * depth + depth + 16 <= row_bytes; x += 16)
+        {
+            const uint8_t *block = &in[x / 8 * depth];
+            __m256i w = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)block)), _mm_loadu_si128((const __m128i *)(block + depth)), 1);
+            _mm256_storeu_si256((__m256i *)&dst[x], unpack16_avx2(w, depth));
+        }
+#endif
+        for(; x + 8 <= count && x / 8 * depth + 16 <= row_bytes; x += 8)
+        {
+            __m128i w = _mm_loadu_si128((const __m128i *)&in[x / 8 * depth]);
+            _mm_storeu_si128((__m128i *)&dst[x], unpack8_sse2(w, depth));
+        }
+    }
+#endif
+
+    /* blocks of 8 pixels end on a word boundary, so the scalar loop can continue from there */
+    bitunpack_row_scalar(&in[(int64_t)x * depth / 8], &dst[x], count - x, depth);
+}
+
+static void bitpack_row_scalar(uint8_t *dst, const uint16_t *src, int count, int depth)
+{
+    uint32_t mask = (1 << depth) - 1;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for(int x = 0; x < count; x++)
+    {
+        acc = (acc << depth) | (src[x] & mask);
+        bits += depth;
+        if(bits >= 16)
+        {
+            bits -= 16;
+            uint16_t word = acc >> bits;
+            dst[0] = word;
+            dst[1] = word >> 8;
+            dst += 2;
+        }
+    }
+
+    /* the last word is shared with whatever follows, like bitinsert does */
+    if(bits)
+    {
+        uint16_t keep = (1 << (16 - bits)) - 1;
+        uint16_t word = (dst[0] | (dst[1] << 8)) & keep;
+
+        word |= (acc << (16 - bits)) & ~keep;
+        dst[0] = word;
+        dst[1] = word >> 8;
+    }
+}
+
+#if defined(__SSE2__)
+/* 8 pixels into 7 words: w[i] = (p[i] << (2 + 2i)) | (p[i+1] >> (12 - 2i)) */
+static inline __m128i pack8_14_sse2(__m128i p)
+{
+    __m128i next = _mm_srli_si128(p, 2);
+    __m128i hi = _mm_mullo_epi16(p, _mm_setr_epi16(4, 16, 64, 256, 1024, 4096, 16384, 0));
+    __m128i lo = _mm_mulhi_epu16(next, _mm_setr_epi16(16, 64, 256, 1024, 4096, 16384, 0, 0));
+
+    lo = _mm_or_si128(lo, _mm_and_si128(next, _mm_setr_epi16(0, 0, 0, 0, 0, 0, -1, 0)));
+    return _mm_or_si128(hi, lo);
+}
+
+/* 8 pixels into 6 words, two groups of: p0 << 4 | p1 >> 8, p1 << 8 | p2 >> 4, p2 << 12 | p3 */
+static inline __m128i pack8_12_sse2(__m128i p)
+{
+    __m128i first = _mm_setr_epi16(-1, -1, -1, 0, 0, 0, 0, 0);
+    __m128i second = _mm_setr_epi16(0, 0, 0, -1, -1, -1, 0, 0);
+    __m128i p1 = _mm_srli_si128(p, 2);
+    __m128i p2 = _mm_srli_si128(p, 4);
+
+    __m128i x = _mm_or_si128(_mm_and_si128(p, first), _mm_and_si128(p1, second));
+    __m128i y = _mm_or_si128(_mm_and_si128(p1, first), _mm_and_si128(p2, second));
+
+    __m128i hi = _mm_mullo_epi16(x, _mm_setr_epi16(16, 256, 4096, 16, 256, 4096, 0, 0));
+    __m128i lo = _mm_mulhi_epu16(y, _mm_setr_epi16(256, 4096, 0, 256, 4096, 0, 0, 0));
+
+    lo = _mm_or_si128(lo, _mm_and_si128(y, _mm_setr_epi16(0, 0, -1, 0, 0, -1, 0, 0)));
+    return _mm_or_si128(hi, lo);
+}
+#endif
+
+void bitpack_row(void *dst, const uint16_t *src, int count, int depth)
+{
+    uint8_t *out = dst;
+    int x = 0;
+
+    if(depth == 16)
+    {
+        memcpy(dst, src, count * 2);
+        return;
+    }
+
+#if defined(__SSE2__)
+    if(depth == 12 || depth == 14)
+    {
+        /* the 16 byte stores overlap into the next block, which gets written afterwards anyway */
+        int full_bytes = (count * depth / 16) * 2;
+        __m128i mask = _mm_set1_epi16((1 << depth) - 1);
+
+        for(; x + 8 <= count && x / 8 * depth + 16 <= full_bytes; x += 8)
+        {
+            __m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i *)&src[x]), mask);
+            __m128i w = (depth == 14) ? pack8_14_sse2(p) : pack8_12_sse2(p);
+            _mm_storeu_si128((__m128i *)&out[x / 8 * depth], w);
+        }
+    }
+#endif
+
+    bitpack_row_scalar(&out[(int64_t)x * depth / 8], &src[x], count - x, depth);
+}
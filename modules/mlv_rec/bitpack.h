@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _bitpack_h_
+#define _bitpack_h_
+
+#include <stdint.h>
+
+/*
+    row kernels for packed raw data, same layout as bitextract()/bitinsert():
+    the pixels form a MSB-first bit stream, stored in little endian 16 bit words.
+
+    10, 12 and 14 bit rows use SSE2 (or AVX2) when the compiler targets it,
+    other depths (1..16) go through a word-at-a-time scalar loop.
+*/
+
+/* unpack 'count' pixels of 'depth' bits from 'src' into 16 bit values */
+void bitunpack_row(const void *src, uint16_t *dst, int count, int depth);
+
+/* pack 'count' 16 bit values into 'depth' bits per pixel. bits following the last pixel are preserved */
+void bitpack_row(void *dst, const uint16_t *src, int count, int depth);
+
+#endif
@@ -0,0 +1,136 @@
+#!/bin/bash
+#
+# mlv_dump output checks on synthetic clips (see mlv_synth.py)
+#
+# The DNGs are either decoded with dng_unpack.py and compared pixel by pixel,
+# or compared as files:
+#
+#   dng16      a clip converted to 16 bit (-b 16) must give the same image as
+#              the original, shifted left, both as uncompressed and as tiled
+#              LJ92 DNG (corrections off, they work at the clip bit depth)
+#   threads    DNGs with the default corrections (vertical stripes, cold
+#              pixels) must be the same files with --threads as without
+#
+# Settings (environment):
+#   MLV_DUMP   binary to test (default: ./mlv_dump)
+#   SIZE       clip size (default: 256x128)
+#   DEPTHS     bits per pixel (default: "14 12 10")
+#   FRAMES     frames per clip (default: 3)
+#   THREADS    worker threads for the threads check (default: 3)
+#   CHECK_DIR  scratch directory (default: a new one in /tmp, removed afterwards)
+#   PYTHON     python interpreter for the helper scripts (default: python)
+
+MLV_DUMP=${MLV_DUMP:-./mlv_dump}
+SIZE=${SIZE:-256x128}
+DEPTHS=${DEPTHS:-"14 12 10"}
+FRAMES=${FRAMES:-3}
+THREADS=${THREADS:-3}
+PYTHON=${PYTHON:-python}
+SCRIPTS="$(cd "$(dirname "$0")" && pwd)"
+
+if [ ! -x "$MLV_DUMP" ]; then
+    echo "Error: $MLV_DUMP not found, build it first (make mlv_dump) or set MLV_DUMP"
+    exit 1
+fi
+MLV_DUMP="$(cd "$(dirname "$MLV_DUMP")" && pwd)/$(basename "$MLV_DUMP")"
+
+if [ -z "$CHECK_DIR" ]; then
+    CHECK_DIR=$(mktemp -d /tmp/mlv_check.XXXXXX) || exit 1
+    trap 'rm -rf "$CHECK_DIR"' EXIT
+fi
+mkdir -p "$CHECK_DIR" || exit 1
+cd "$CHECK_DIR" || exit 1
+
+failed=0
+
+# convert <output dir> <mlv_dump arguments>
+convert()
+{
+    local dir=$1
+    shift
+
+    rm -rf "$dir"
+    mkdir "$dir"
+    if ! "$MLV_DUMP" "$@" -o "$dir/" > "$dir.log" 2>&1; then
+        echo "    mlv_dump $* failed:"
+        tail -n 5 "$dir.log" | sed 's/^/    /'
+        return 1
+    fi
+}
+
+# compare <check> <expected dir> <shift> <dir> ...
+# decodes the DNGs of all directories, the expected ones shifted left, and compares every frame
+compare()
+{
+    local check=$1
+    local expected=$2
+    local shift=$3
+    shift 3
+
+    local frames=0
+    local dng
+    for dng in "$expected"/*.dng; do
+        local name=$(basename "$dng" .dng)
+        "$PYTHON" "$SCRIPTS/dng_unpack.py" -s "$shift" "$dng" expected.raw > /dev/null || return 1
+
+        local dir
+        for dir in "$@"; do
+            if ! "$PYTHON" "$SCRIPTS/dng_unpack.py" "$dir/$name.dng" actual.raw > /dev/null || ! cmp -s expected.raw actual.raw; then
+                printf "%-10s %-24s FAILED (%s/%s.dng)\n" "$check" "$NAME" "$dir" "$name"
+                failed=1
+                return 1
+            fi
+        done
+        frames=$((frames + 1))
+    done
+
+    if [ "$frames" != "$FRAMES" ]; then
+        printf "%-10s %-24s FAILED (%d of %d frames)\n" "$check" "$NAME" "$frames" "$FRAMES"
+        failed=1
+        return 1
+    fi
+    printf "%-10s %-24s OK\n" "$check" "$NAME"
+}
+
+# compare_files <check> <expected dir> <dir>
+# the DNG files must be identical
+compare_files()
+{
+    local check=$1
+    local expected=$2
+    local dir=$3
+
+    local frames=$(ls "$expected" | grep -c '\.dng$')
+    if [ "$frames" != "$FRAMES" ] || ! diff -r -q "$expected" "$dir" > /dev/null; then
+        printf "%-10s %-24s FAILED\n" "$check" "$NAME"
+        diff -r -q "$expected" "$dir" | head -n 5 | sed 's/^/    /'
+        failed=1
+        return 1
+    fi
+    printf "%-10s %-24s OK\n" "$check" "$NAME"
+}
+
+echo "mlv_dump: $MLV_DUMP"
+
+for bits in $DEPTHS; do
+    rm -rf clip.* c16.*
+    NAME="${SIZE}/${bits}bit"
+
+    if ! "$PYTHON" "$SCRIPTS/mlv_synth.py" -W "${SIZE%x*}" -H "${SIZE#*x}" -b "$bits" -n "$FRAMES" clip.MLV > /dev/null; then
+        echo "Error: failed to generate $NAME"
+        exit 1
+    fi
+
+    "$MLV_DUMP" -b 16 -o c16.MLV clip.MLV > /dev/null 2>&1
+    convert ref clip.MLV --dng --no-fixcp --no-stripes &&
+    convert u16 c16.MLV --dng --no-fixcp --no-stripes &&
+    convert t16 c16.MLV --dng --no-fixcp --no-stripes --lj92 &&
+    compare dng16 ref $((16 - bits)) u16 t16 || failed=1
+
+    convert serial clip.MLV --dng &&
+    convert threads clip.MLV --dng --threads "$THREADS" &&
+    compare_files threads serial threads || failed=1
+done
+
+rm -rf ref u16 t16 serial threads *.log expected.raw actual.raw clip.* c16.*
+exit $failed
@@ -0,0 +1,156 @@
+# Extracts the raw image of a DNG written by mlv_dump/chdk-dng as 16-bit little endian samples (see check.sh)
+#
+# Handles uncompressed images (16 bit or packed MSB first) and lossless JPEG ones (one strip or tiles),
+# so the output of the different DNG writers can be compared with cmp.
+#
+# usage: python dng_unpack.py [-s shift] input.dng output.raw
+
+from __future__ import division, print_function
+import argparse, struct, sys
+
+def tiff_value(data, entry, index=0):
+    tag_type, count = struct.unpack_from("<HI", data, entry + 2)
+    size = 2 if tag_type == 3 else 4
+    pos = entry + 8 if count * size <= 4 else struct.unpack_from("<I", data, entry + 8)[0]
+    return struct.unpack_from("<H" if size == 2 else "<I", data, pos + index * size)[0]
+
+def read_ifd(data, offset):
+    tags = {}
+    for i in range(struct.unpack_from("<H", data, offset)[0]):
+        entry = offset + 2 + i * 12
+        tag, count = struct.unpack_from("<HxxI", data, entry)
+        tags[tag] = (entry, count)
+    return tags
+
+def huffman_table(segment):
+    counts = bytearray(segment[1:17])
+    symbols = bytearray(segment[17:17 + sum(counts)])
+    table = {}
+    code = 0
+    pos = 0
+    for length in range(1, 17):
+        for i in range(counts[length - 1]):
+            table[(length, code)] = symbols[pos]
+            code += 1
+            pos += 1
+        code <<= 1
+    return segment[0] & 0x0F, table, 17 + sum(counts)
+
+def lj92_decode(data):
+    data = bytearray(data)
+    tables = {}
+    pos = 2
+    while True:
+        marker, length = struct.unpack_from(">HH", data, pos)
+        segment = data[pos + 4:pos + 2 + length]
+        pos += 2 + length
+        if marker == 0xFFC4:
+            while segment:
+                index, table, used = huffman_table(segment)
+                tables[index] = table
+                segment = segment[used:]
+        elif marker == 0xFFC3:
+            precision, height, width, components = struct.unpack_from(">BHHB", segment)
+        elif marker == 0xFFDA:
+            scan = segment[0]
+            selectors = [segment[2 + 2 * c] >> 4 for c in range(scan)]
+            predictor, point_transform = segment[1 + 2 * scan], segment[3 + 2 * scan] & 0x0F
+            break
+
+    # entropy coded data, without the stuffed zero bytes
+    stream = bytearray()
+    while not (data[pos] == 0xFF and data[pos + 1] != 0x00):
+        stream.append(data[pos])
+        pos += 2 if data[pos] == 0xFF else 1
+
+    bits = [(b >> (7 - i)) & 1 for b in stream for i in range(8)]
+    bit = [0]
+    def read(count):
+        v = 0
+        for i in range(count):
+            v = (v << 1) | bits[bit[0]]
+            bit[0] += 1
+        return v
+
+    line = width * components
+    out = []
+    for y in range(height):
+        for x in range(width):
+            for c in range(components):
+                table = tables[selectors[c]]
+                length, code = 1, read(1)
+                while (length, code) not in table:
+                    length, code = length + 1, (code << 1) | read(1)
+                ssss = table[(length, code)]
+                if ssss == 16:
+                    diff = 32768
+                else:
+                    diff = read(ssss)
+                    if ssss and diff < 1 << (ssss - 1):
+                        diff -= (1 << ssss) - 1
+
+                i = len(out)
+                if x == 0 and y == 0:
+                    pred = 1 << (precision - point_transform - 1)
+                elif y == 0:
+                    pred = out[i - components]
+                elif x == 0:
+                    pred = out[i - line]
+                else:
+                    ra, rb, rc = out[i - components], out[i - line], out[i - line - components]
+                    pred = [0, ra, rb, rc, ra + rb - rc, ra + ((rb - rc) >> 1), rb + ((ra - rc) >> 1), (ra + rb) >> 1][predictor]
+                out.append((pred + diff) & 0xFFFF)
+    return out
+
+def main():
+    parser = argparse.ArgumentParser(description="dump the raw image of a DNG as 16-bit samples")
+    parser.add_argument("input")
+    parser.add_argument("output")
+    parser.add_argument("-s", "--shift", type=int, default=0, help="shift the samples left, e.g. to compare with a 16 bit conversion")
+    args = parser.parse_args()
+
+    data = open(args.input, "rb").read()
+    root = read_ifd(data, struct.unpack_from("<I", data, 4)[0])
+    tags = read_ifd(data, tiff_value(data, root[0x14A][0]))
+    value = lambda tag, index=0: tiff_value(data, tags[tag][0], index)
+    width, height, bpp, compression = value(0x100), value(0x101), value(0x102), value(0x103)
+
+    image = [0] * (width * height)
+    if compression == 1:
+        offset = value(0x111)
+        if bpp == 16:
+            image = list(struct.unpack_from("<%dH" % len(image), data, offset))
+        else:
+            acc = 0
+            count = 0
+            pos = offset
+            for i in range(len(image)):
+                while count < bpp:
+                    acc = (acc << 8) | ord(data[pos:pos + 1])
+                    count += 8
+                    pos += 1
+                count -= bpp
+                image[i] = acc >> count
+                acc &= (1 << count) - 1
+    elif compression == 7 and 0x142 in tags:
+        tile_width, tile_height = value(0x142), value(0x143)
+        across = (width + tile_width - 1) // tile_width
+        for t in range(tags[0x144][1]):
+            offset = value(0x144, t)
+            tile = lj92_decode(data[offset:offset + value(0x145, t)])
+            x0, y0 = t % across * tile_width, t // across * tile_height
+            for y in range(min(tile_height, height - y0)):
+                for x in range(min(tile_width, width - x0)):
+                    image[(y0 + y) * width + x0 + x] = tile[y * tile_width + x]
+    elif compression == 7:
+        offset = value(0x111)
+        image = lj92_decode(data[offset:offset + value(0x117)])
+    else:
+        sys.exit("%s: unsupported compression %d" % (args.input, compression))
+
+    image = [(v << args.shift) & 0xFFFF for v in image]
+    open(args.output, "wb").write(struct.pack("<%dH" % len(image), *image))
+    print("%s: %dx%d, %d bits, compression %d" % (args.input, width, height, bpp, compression))
+
+if __name__ == "__main__":
+    main()
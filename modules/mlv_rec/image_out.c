@@ -0,0 +1,609 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_out.h"
+#include "bitpack.h"
+#include "../dual_iso/parallel.h"
+
+/* from ../dual_iso/amaze_demosaic_RT.c, expects RGGB and values in 0..65535 */
+int amaze_demosaic(float **rawData, float **red, float **green, float **blue, int winx, int winy, int winw, int winh);
+
+/* AMaZE may read and write a few pixels past the end of its rows */
+#define AMAZE_ROW_PAD 16
+
+/* sRGB D65 to XYZ, as in dcraw */
+static const double xyz_rgb[3][3] =
+{
+    { 0.412453, 0.357580, 0.180423 },
+    { 0.212671, 0.715160, 0.072169 },
+    { 0.019334, 0.119193, 0.950227 }
+};
+
+static int invert3x3(double in[3][3], double out[3][3])
+{
+    double det = in[0][0] * (in[1][1] * in[2][2] - in[1][2] * in[2][1])
+               - in[0][1] * (in[1][0] * in[2][2] - in[1][2] * in[2][0])
+               + in[0][2] * (in[1][0] * in[2][1] - in[1][1] * in[2][0]);
+
+    if(fabs(det) < 1e-9)
+    {
+        return 1;
+    }
+
+    for(int i = 0; i < 3; i++)
+    {
+        for(int j = 0; j < 3; j++)
+        {
+            /* cofactor of the transposed element */
+            int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+            int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+            out[i][j] = (in[r0][c0] * in[r1][c1] - in[r0][c1] * in[r1][c0]) / det;
+        }
+    }
+    return 0;
+}
+
+void image_setup(image_setup_t *setup, int method, const int32_t color_matrix[18], uint32_t wbgain_r, uint32_t wbgain_g, uint32_t wbgain_b)
+{
+    double cam_xyz[3][3];
+    double cam_rgb[3][3];
+    double rgb_cam[3][3];
+    double daylight[3] = { 1.0, 1.0, 1.0 };
+    int valid = 0;
+
+    setup->method = method;
+
+    for(int i = 0; i < 9; i++)
+    {
+        if(!color_matrix[2 * i + 1])
+        {
+            valid = 0;
+            break;
+        }
+        cam_xyz[i / 3][i % 3] = (double)color_matrix[2 * i] / color_matrix[2 * i + 1];
+        valid |= (color_matrix[2 * i] != 0);
+    }
+
+    if(valid)
+    {
+        /* same as dcraw's cam_xyz_coeff: rows are normalized so white stays white, the scale factors are the daylight multipliers */
+        for(int i = 0; i < 3; i++)
+        {
+            double sum = 0;
+            for(int j = 0; j < 3; j++)
+            {
+                cam_rgb[i][j] = 0;
+                for(int k = 0; k < 3; k++)
+                {
+                    cam_rgb[i][j] += cam_xyz[i][k] * xyz_rgb[k][j];
+                }
+                sum += cam_rgb[i][j];
+            }
+            if(sum <= 0)
+            {
+                valid = 0;
+                break;
+            }
+            for(int j = 0; j < 3; j++)
+            {
+                cam_rgb[i][j] /= sum;
+            }
+            daylight[i] = 1.0 / sum;
+        }
+    }
+
+    if(!valid || invert3x3(cam_rgb, rgb_cam))
+    {
+        /* unknown camera: no color conversion */
+        for(int i = 0; i < 3; i++)
+        {
+            for(int j = 0; j < 3; j++)
+            {
+                rgb_cam[i][j] = (i == j);
+            }
+            daylight[i] = 1.0;
+        }
+    }
+
+    for(int i = 0; i < 3; i++)
+    {
+        for(int j = 0; j < 3; j++)
+        {
+            setup->rgb_cam[i][j] = rgb_cam[i][j];
+        }
+    }
+
+    if(wbgain_r && wbgain_g && wbgain_b)
+    {
+        setup->wb[0] = (float)wbgain_r / wbgain_g;
+        setup->wb[1] = 1.0f;
+        setup->wb[2] = (float)wbgain_b / wbgain_g;
+    }
+    else
+    {
+        setup->wb[0] = daylight[0] / daylight[1];
+        setup->wb[1] = 1.0f;
+        setup->wb[2] = daylight[2] / daylight[1];
+    }
+
+    for(int i = 0; i < 0x10000; i++)
+    {
+        double v = i / 65535.0;
+        v = (v <= 0.0031308) ? v * 12.92 : 1.055 * pow(v, 1 / 2.4) - 0.055;
+        setup->gamma[i] = (uint16_t)(v * 65535 + 0.5);
+    }
+}
+
+/* color at a CFA position, 0 = red, 1 = green, 2 = blue */
+static int cfa_color(int32_t cfa_pattern, int x, int y)
+{
+    return (cfa_pattern >> (8 * (2 * (y & 1) + (x & 1)))) & 0xFF;
+}
+
+/* the part of the frame that gets converted: inside the active area, starting at a red pixel */
+static int image_crop(image_frame_t *frame, int *crop_x, int *crop_y, int *width, int *height)
+{
+    int32_t cfa_pattern = frame->cfa_pattern ? frame->cfa_pattern : 0x02010100;
+    int red_x = -1, red_y = -1;
+    int colors = 0;
+
+    for(int cell = 0; cell < 4; cell++)
+    {
+        int color = cfa_color(cfa_pattern, cell & 1, cell >> 1);
+        if(color > 2)
+        {
+            return 1;
+        }
+        colors |= 1 << color;
+        if(color == 0)
+        {
+            red_x = cell & 1;
+            red_y = cell >> 1;
+        }
+    }
+
+    /* anything but a Bayer pattern: red and blue diagonally, with two greens */
+    if(colors != 7 || cfa_color(cfa_pattern, red_x + 1, red_y + 1) != 2)
+    {
+        return 1;
+    }
+
+    int x1 = frame->x1, y1 = frame->y1, x2 = frame->x2, y2 = frame->y2;
+    if(x1 < 0 || x2 > frame->width || x2 <= x1)
+    {
+        x1 = 0;
+        x2 = frame->width;
+    }
+    if(y1 < 0 || y2 > frame->height || y2 <= y1)
+    {
+        y1 = 0;
+        y2 = frame->height;
+    }
+
+    *crop_x = x1 + ((red_x - x1) & 1);
+    *crop_y = y1 + ((red_y - y1) & 1);
+    *width = (x2 - *crop_x) & ~1;
+    *height = (y2 - *crop_y) & ~1;
+
+    return (*width < 2 || *height < 2);
+}
+
+int image_size(image_setup_t *setup, image_frame_t *frame, int *width, int *height)
+{
+    int crop_x, crop_y;
+
+    if(image_crop(frame, &crop_x, &crop_y, width, height))
+    {
+        return 1;
+    }
+
+    if(setup->method == DEMOSAIC_HALF)
+    {
+        *width /= 2;
+        *height /= 2;
+    }
+    return 0;
+}
+
+typedef struct
+{
+    image_setup_t *setup;
+    image_frame_t *frame;
+    const uint8_t *frame_buffer;
+    int crop_x, crop_y;
+    int width, height;
+
+    /* white balanced sensor values, 0..65535, RGGB starting at plane[0] */
+    float *plane;
+    int plane_pitch;
+
+    /* demosaiced planes (AMaZE) */
+    float **rows;
+    float **red;
+    float **green;
+    float **blue;
+
+    uint16_t *rgb;
+} image_ctx_t;
+
+/* unpack, subtract black, scale to 16 bits and white balance */
+static void image_unpack_rows(void *arg, int band, int y0, int y1)
+{
+    (void)band;
+    image_ctx_t *ctx = arg;
+    image_frame_t *frame = ctx->frame;
+    int pitch = frame->width * frame->depth / 8;
+    int black = frame->black_level;
+    float range = frame->white_level - black;
+    float scale[3];
+
+    if(range < 1)
+    {
+        range = 1;
+    }
+    for(int c = 0; c < 3; c++)
+    {
+        scale[c] = ctx->setup->wb[c] * 65535.0f / range;
+    }
+
+    uint16_t *raw = malloc((ctx->crop_x + ctx->width) * sizeof(uint16_t));
+    if(!raw)
+    {
+        return;
+    }
+
+    for(int y = y0; y < y1; y++)
+    {
+        float *row = &ctx->plane[y * ctx->plane_pitch];
+
+        bitunpack_row(&ctx->frame_buffer[(ctx->crop_y + y) * pitch], raw, ctx->crop_x + ctx->width, frame->depth);
+
+        for(int x = 0; x < ctx->width; x++)
+        {
+            /* RGGB: 0 = red, 1 = green, 2 = blue */
+            float value = (raw[ctx->crop_x + x] - black) * scale[(x & 1) + (y & 1)];
+            row[x] = (value < 0) ? 0 : (value > 65535) ? 65535 : value;
+        }
+    }
+
+    free(raw);
+}
+
+/* camera RGB to sRGB, clip and gamma */
+static inline void image_put_pixel(image_setup_t *setup, uint16_t *out, float r, float g, float b)
+{
+    for(int c = 0; c < 3; c++)
+    {
+        float value = setup->rgb_cam[c][0] * r + setup->rgb_cam[c][1] * g + setup->rgb_cam[c][2] * b;
+        int index = (value < 0) ? 0 : (value > 65535) ? 65535 : (int)(value + 0.5f);
+        out[c] = setup->gamma[index];
+    }
+}
+
+static void image_amaze_output_rows(void *arg, int band, int y0, int y1)
+{
+    (void)band;
+    image_ctx_t *ctx = arg;
+
+    for(int y = y0; y < y1; y++)
+    {
+        uint16_t *out = &ctx->rgb[y * ctx->width * 3];
+        for(int x = 0; x < ctx->width; x++)
+        {
+            image_put_pixel(ctx->setup, &out[x * 3], ctx->red[y][x], ctx->green[y][x], ctx->blue[y][x]);
+        }
+    }
+}
+
+/* bilinear: the plane has a border of one pixel, mirrored by two so it keeps the CFA layout */
+static void image_bilinear_rows(void *arg, int band, int y0, int y1)
+{
+    (void)band;
+    image_ctx_t *ctx = arg;
+    int pitch = ctx->plane_pitch;
+
+    for(int y = y0; y < y1; y++)
+    {
+        const float *p = &ctx->plane[(y + 1) * pitch + 1];
+        uint16_t *out = &ctx->rgb[y * ctx->width * 3];
+
+        for(int x = 0; x < ctx->width; x++, p++)
+        {
+            float cross = (p[-1] + p[1] + p[-pitch] + p[pitch]) * 0.25f;
+            float diagonal = (p[-pitch - 1] + p[-pitch + 1] + p[pitch - 1] + p[pitch + 1]) * 0.25f;
+            float horizontal = (p[-1] + p[1]) * 0.5f;
+            float vertical = (p[-pitch] + p[pitch]) * 0.5f;
+
+            switch((x & 1) + 2 * (y & 1))
+            {
+                case 0: /* red */
+                    image_put_pixel(ctx->setup, &out[x * 3], p[0], cross, diagonal);
+                    break;
+                case 1: /* green on a red row */
+                    image_put_pixel(ctx->setup, &out[x * 3], horizontal, p[0], vertical);
+                    break;
+                case 2: /* green on a blue row */
+                    image_put_pixel(ctx->setup, &out[x * 3], vertical, p[0], horizontal);
+                    break;
+                default: /* blue */
+                    image_put_pixel(ctx->setup, &out[x * 3], diagonal, cross, p[0]);
+                    break;
+            }
+        }
+    }
+}
+
+/* half size: one output pixel for every RGGB cell */
+static void image_half_rows(void *arg, int band, int y0, int y1)
+{
+    (void)band;
+    image_ctx_t *ctx = arg;
+    int pitch = ctx->plane_pitch;
+    int width = ctx->width / 2;
+
+    for(int y = y0; y < y1; y++)
+    {
+        const float *p = &ctx->plane[2 * y * pitch];
+        uint16_t *out = &ctx->rgb[y * width * 3];
+
+        for(int x = 0; x < width; x++, p += 2)
+        {
+            image_put_pixel(ctx->setup, &out[x * 3], p[0], (p[1] + p[pitch]) * 0.5f, p[pitch + 1]);
+        }
+    }
+}
+
+int image_convert(image_setup_t *setup, image_frame_t *frame, const uint8_t *frame_buffer, uint16_t *rgb)
+{
+    image_ctx_t ctx;
+    memset(&ctx, 0x00, sizeof(ctx));
+    ctx.setup = setup;
+    ctx.frame = frame;
+    ctx.frame_buffer = frame_buffer;
+    ctx.rgb = rgb;
+
+    if(image_crop(frame, &ctx.crop_x, &ctx.crop_y, &ctx.width, &ctx.height))
+    {
+        return 1;
+    }
+
+    int w = ctx.width;
+    int h = ctx.height;
+
+    /* AMaZE works on tiles of 160 pixels with a 16 pixel border, smaller frames get the bilinear method */
+    int method = setup->method;
+    if(method == DEMOSAIC_AMAZE && (w < 64 || h < 64))
+    {
+        method = DEMOSAIC_BILINEAR;
+    }
+
+    if(method == DEMOSAIC_BILINEAR)
+    {
+        ctx.plane_pitch = w + 2;
+        ctx.plane = malloc(ctx.plane_pitch * (h + 2) * sizeof(float));
+        if(!ctx.plane)
+        {
+            return 1;
+        }
+
+        /* unpack into the inner part, then mirror the border */
+        float *inner = ctx.plane;
+        ctx.plane = &inner[ctx.plane_pitch + 1];
+        parallel_rows(0, h, 2, image_unpack_rows, &ctx);
+        ctx.plane = inner;
+
+        for(int y = 1; y <= h; y++)
+        {
+            float *row = &inner[y * ctx.plane_pitch];
+            row[0] = row[2];
+            row[w + 1] = row[w - 1];
+        }
+        memcpy(&inner[0], &inner[2 * ctx.plane_pitch], ctx.plane_pitch * sizeof(float));
+        memcpy(&inner[(h + 1) * ctx.plane_pitch], &inner[(h - 1) * ctx.plane_pitch], ctx.plane_pitch * sizeof(float));
+
+        parallel_rows(0, h, 2, image_bilinear_rows, &ctx);
+        free(inner);
+        return 0;
+    }
+
+    if(method == DEMOSAIC_HALF)
+    {
+        ctx.plane_pitch = w;
+        ctx.plane = malloc(w * h * sizeof(float));
+        if(!ctx.plane)
+        {
+            return 1;
+        }
+        parallel_rows(0, h, 2, image_unpack_rows, &ctx);
+        parallel_rows(0, h / 2, 1, image_half_rows, &ctx);
+        free(ctx.plane);
+        return 0;
+    }
+
+    /* AMaZE: one block for the input and the three output planes */
+    ctx.plane_pitch = w + AMAZE_ROW_PAD;
+    int plane_size = ctx.plane_pitch * h;
+    float *planes = calloc(4 * plane_size, sizeof(float));
+    float **rows = malloc(4 * h * sizeof(float *));
+    if(!planes || !rows)
+    {
+        free(planes);
+        free(rows);
+        return 1;
+    }
+
+    ctx.plane = planes;
+    ctx.rows = &rows[0];
+    ctx.red = &rows[h];
+    ctx.green = &rows[2 * h];
+    ctx.blue = &rows[3 * h];
+    for(int y = 0; y < h; y++)
+    {
+        ctx.rows[y] = &planes[y * ctx.plane_pitch];
+        ctx.red[y] = &planes[plane_size + y * ctx.plane_pitch];
+        ctx.green[y] = &planes[2 * plane_size + y * ctx.plane_pitch];
+        ctx.blue[y] = &planes[3 * plane_size + y * ctx.plane_pitch];
+    }
+
+    parallel_rows(0, h, 2, image_unpack_rows, &ctx);
+    amaze_demosaic(ctx.rows, ctx.red, ctx.green, ctx.blue, 0, 0, w, h);
+    parallel_rows(0, h, 2, image_amaze_output_rows, &ctx);
+
+    free(planes);
+    free(rows);
+    return 0;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xFFFF);
+    put_le16(p + 2, v >> 16);
+}
+
+/* baseline TIFF, one strip, the IFD and its data in front of the image */
+static int image_save_tiff(FILE *file, const uint16_t *rgb, int width, int height)
+{
+    enum { ENTRIES = 12 };
+    uint8_t header[8 + 2 + ENTRIES * 12 + 4 + 6 + 16];
+    uint32_t ifd_end = 8 + 2 + ENTRIES * 12 + 4;
+    uint32_t bits_offset = ifd_end;
+    uint32_t resolution_offset = ifd_end + 6;
+    uint32_t data_offset = sizeof(header);
+    uint32_t data_size = (uint32_t)width * height * 3 * sizeof(uint16_t);
+
+    static const struct { uint16_t tag, type; } tags[ENTRIES] =
+    {
+        { 256, 4 },     /* ImageWidth */
+        { 257, 4 },     /* ImageLength */
+        { 258, 3 },     /* BitsPerSample */
+        { 259, 3 },     /* Compression: none */
+        { 262, 3 },     /* PhotometricInterpretation: RGB */
+        { 273, 4 },     /* StripOffsets */
+        { 277, 3 },     /* SamplesPerPixel */
+        { 278, 4 },     /* RowsPerStrip */
+        { 279, 4 },     /* StripByteCounts */
+        { 282, 5 },     /* XResolution */
+        { 283, 5 },     /* YResolution */
+        { 284, 3 },     /* PlanarConfiguration: interleaved */
+    };
+    uint32_t values[ENTRIES] = { width, height, bits_offset, 1, 2, data_offset, 3, height, data_size, resolution_offset, resolution_offset + 8, 1 };
+    uint32_t counts[ENTRIES] = { 1, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+    memset(header, 0x00, sizeof(header));
+    memcpy(header, "II*\0", 4);
+    put_le32(&header[4], 8);
+    put_le16(&header[8], ENTRIES);
+
+    for(int i = 0; i < ENTRIES; i++)
+    {
+        uint8_t *entry = &header[10 + i * 12];
+        put_le16(&entry[0], tags[i].tag);
+        put_le16(&entry[2], tags[i].type);
+        put_le32(&entry[4], counts[i]);
+
+        /* short values are left aligned in the value field */
+        if(tags[i].type == 3 && counts[i] == 1)
+        {
+            put_le16(&entry[8], values[i]);
+        }
+        else
+        {
+            put_le32(&entry[8], values[i]);
+        }
+    }
+
+    for(int c = 0; c < 3; c++)
+    {
+        put_le16(&header[bits_offset + 2 * c], 16);
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        put_le32(&header[resolution_offset + 8 * i], 72);
+        put_le32(&header[resolution_offset + 8 * i + 4], 1);
+    }
+
+    if(fwrite(header, sizeof(header), 1, file) != 1)
+    {
+        return 1;
+    }
+
+    /* samples are in host order, which is little endian on all platforms we build for */
+    return fwrite(rgb, data_size, 1, file) != 1;
+}
+
+static int image_save_ppm(FILE *file, const uint16_t *rgb, int width, int height)
+{
+    int row_values = width * 3;
+    uint8_t *row = malloc(row_values * 2);
+    if(!row)
+    {
+        return 1;
+    }
+
+    int ret = fprintf(file, "P6\n%d %d\n65535\n", width, height) < 0;
+
+    for(int y = 0; y < height && !ret; y++)
+    {
+        const uint16_t *in = &rgb[y * row_values];
+        for(int i = 0; i < row_values; i++)
+        {
+            row[2 * i] = in[i] >> 8;
+            row[2 * i + 1] = in[i] & 0xFF;
+        }
+        ret = fwrite(row, row_values * 2, 1, file) != 1;
+    }
+
+    free(row);
+    return ret;
+}
+
+int image_save(const char *filename, int format, const uint16_t *rgb, int width, int height)
+{
+    FILE *file = fopen(filename, "wb");
+    if(!file)
+    {
+        return 1;
+    }
+
+    int ret = (format == IMAGE_PPM) ? image_save_ppm(file, rgb, width, height) : image_save_tiff(file, rgb, width, height);
+
+    if(fclose(file))
+    {
+        ret = 1;
+    }
+    return ret;
+}
+
+const char *image_extension(int format)
+{
+    return (format == IMAGE_PPM) ? "ppm" : "tiff";
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _image_out_h_
+#define _image_out_h_
+
+#include <stdint.h>
+
+/*
+    demosaiced 16 bit RGB images from raw frames (--tiff, --ppm), for previews and dailies.
+
+    the frame is white balanced, demosaiced, converted from camera RGB to sRGB with
+    the DNG color matrix and gamma encoded. AMaZE runs on tiles spread over the threads
+    set with parallel_set_threads(), the other steps are split into bands of rows the same way.
+*/
+
+/* demosaic methods */
+#define DEMOSAIC_AMAZE      1   /* AMaZE from cr2hdr, best quality */
+#define DEMOSAIC_BILINEAR   2   /* fast, full resolution */
+#define DEMOSAIC_HALF       3   /* fastest, one pixel for every 2x2 Bayer cell */
+
+/* file formats */
+#define IMAGE_TIFF          1
+#define IMAGE_PPM           2
+
+typedef struct
+{
+    int method;
+    float wb[3];                /* channel multipliers, green = 1.0 */
+    float rgb_cam[3][3];        /* white balanced camera RGB to linear sRGB */
+    uint16_t gamma[0x10000];    /* linear to sRGB transfer curve */
+} image_setup_t;
+
+/* geometry and levels of the raw frames */
+typedef struct
+{
+    int width;
+    int height;
+    int depth;                  /* bits per pixel of the packed frame */
+    int black_level;            /* levels in 'depth' bits */
+    int white_level;
+    int32_t cfa_pattern;        /* like the DNG CFAPattern tag, 0 means RGGB */
+    int x1, y1, x2, y2;         /* active area, the image is cropped to it */
+} image_frame_t;
+
+/* color_matrix: XYZ to camera as 9 rationals, like the DNG ColorMatrix1 tag in RAWI.
+   wbgain: from the WBAL block, 1024 = 1.0. daylight white balance is used if any of them is 0 */
+void image_setup(image_setup_t *setup, int method, const int32_t color_matrix[18], uint32_t wbgain_r, uint32_t wbgain_g, uint32_t wbgain_b);
+
+/* size of the image made from a frame. returns nonzero if the frame is too small or not a Bayer frame */
+int image_size(image_setup_t *setup, image_frame_t *frame, int *width, int *height);
+
+/* convert the packed frame into interleaved RGB, 'rgb' must hold width * height * 3 values from image_size() */
+int image_convert(image_setup_t *setup, image_frame_t *frame, const uint8_t *frame_buffer, uint16_t *rgb);
+
+/* save as 16 bit TIFF (little endian) or PPM (binary, big endian). returns nonzero on error */
+int image_save(const char *filename, int format, const uint16_t *rgb, int width, int height);
+
+/* file name extension for the format, without the dot */
+const char *image_extension(int format);
+
+#endif
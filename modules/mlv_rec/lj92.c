@@ -0,0 +1,826 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lj92.h"
+
+#define LJ92_SOI    0xD8
+#define LJ92_EOI    0xD9
+#define LJ92_SOF3   0xC3
+#define LJ92_DHT    0xC4
+#define LJ92_SOS    0xDA
+#define LJ92_DRI    0xDD
+
+/* codes up to this length are decoded with a single table lookup */
+#define LJ92_LOOKUP_BITS    12
+
+typedef struct
+{
+    int present;
+    uint8_t lookup_len[1 << LJ92_LOOKUP_BITS];
+    uint8_t lookup_sym[1 << LJ92_LOOKUP_BITS];
+
+    /* canonical decoding of the longer codes (T.81 F.2.2.3) */
+    int32_t maxcode[17];
+    int32_t mincode[17];
+    int32_t valptr[17];
+    uint8_t huffval[256];
+} lj92_table_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    int size;
+    int pos;
+    uint64_t bits;
+    int count;
+} lj92_reader_t;
+
+typedef struct
+{
+    uint8_t *out;
+    int pos;
+    uint64_t bits;
+    int count;
+} lj92_writer_t;
+
+static int lj92_category(int diff)
+{
+    uint32_t value = diff < 0 ? -diff : diff;
+
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+/* difference of a sample to its prediction, modulo 2^16 as in T.81 H.1.2.1 */
+static inline int lj92_wrap(int diff)
+{
+    diff = ((diff + 32768) & 0xFFFF) - 32768;
+
+    return (diff == -32768) ? 32768 : diff;
+}
+
+/* left neighbor of the same component, the row above for the first column */
+static inline int lj92_predict(const uint16_t *row, const uint16_t *prev, int pos, int components, int bitdepth)
+{
+    if(pos >= components)
+    {
+        return row[pos - components];
+    }
+
+    return prev ? prev[pos] : (1 << (bitdepth - 1));
+}
+
+/* build code lengths for the 17 difference categories, limited to 16 bits (T.81 K.2, as in libjpeg) */
+static void lj92_optimal_table(const uint32_t *histogram, uint8_t *bits, uint8_t *huffval, int *values)
+{
+    uint32_t freq[18];
+    int codesize[18];
+    int others[18];
+    int length_count[33];
+
+    memcpy(freq, histogram, 17 * sizeof(uint32_t));
+    memset(codesize, 0, sizeof(codesize));
+    memset(length_count, 0, sizeof(length_count));
+    for(int i = 0; i < 18; i++)
+    {
+        others[i] = -1;
+    }
+
+    /* reserve one code point, so no code consists of 1-bits only */
+    freq[17] = 1;
+
+    while(1)
+    {
+        int c1 = -1;
+        int c2 = -1;
+
+        for(int i = 0; i < 18; i++)
+        {
+            if(freq[i] && (c1 < 0 || freq[i] <= freq[c1]))
+            {
+                c1 = i;
+            }
+        }
+        for(int i = 0; i < 18; i++)
+        {
+            if(freq[i] && i != c1 && (c2 < 0 || freq[i] <= freq[c2]))
+            {
+                c2 = i;
+            }
+        }
+
+        if(c2 < 0)
+        {
+            break;
+        }
+
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+
+        codesize[c1]++;
+        while(others[c1] >= 0)
+        {
+            c1 = others[c1];
+            codesize[c1]++;
+        }
+        others[c1] = c2;
+
+        codesize[c2]++;
+        while(others[c2] >= 0)
+        {
+            c2 = others[c2];
+            codesize[c2]++;
+        }
+    }
+
+    for(int i = 0; i < 18; i++)
+    {
+        if(codesize[i])
+        {
+            length_count[codesize[i]]++;
+        }
+    }
+
+    /* move codes longer than 16 bits up in the tree */
+    for(int i = 32; i > 16; i--)
+    {
+        while(length_count[i] > 0)
+        {
+            int j = i - 2;
+            while(length_count[j] == 0)
+            {
+                j--;
+            }
+
+            length_count[i] -= 2;
+            length_count[i - 1]++;
+            length_count[j + 1] += 2;
+            length_count[j]--;
+        }
+    }
+
+    /* drop the reserved code again, it is the longest one */
+    int longest = 16;
+    while(length_count[longest] == 0)
+    {
+        longest--;
+    }
+    length_count[longest]--;
+
+    *values = 0;
+    for(int length = 1; length <= 32; length++)
+    {
+        for(int sym = 0; sym < 17; sym++)
+        {
+            if(codesize[sym] == length)
+            {
+                huffval[(*values)++] = sym;
+            }
+        }
+    }
+
+    for(int length = 1; length <= 16; length++)
+    {
+        bits[length - 1] = length_count[length];
+    }
+}
+
+/* assign canonical codes to the table (T.81 C.2) */
+static void lj92_generate_codes(const uint8_t *bits, const uint8_t *huffval, uint16_t *code, uint8_t *size)
+{
+    uint32_t next = 0;
+    int index = 0;
+
+    for(int length = 1; length <= 16; length++)
+    {
+        for(int count = 0; count < bits[length - 1]; count++)
+        {
+            code[huffval[index]] = next++;
+            size[huffval[index]] = length;
+            index++;
+        }
+        next <<= 1;
+    }
+}
+
+static inline void lj92_put(lj92_writer_t *writer, uint32_t value, int length)
+{
+    writer->bits = (writer->bits << length) | (value & ((1ULL << length) - 1));
+    writer->count += length;
+
+    while(writer->count >= 8)
+    {
+        writer->count -= 8;
+
+        uint8_t byte = writer->bits >> writer->count;
+        writer->out[writer->pos++] = byte;
+
+        /* byte stuffing, so the data can't be taken for a marker */
+        if(byte == 0xFF)
+        {
+            writer->out[writer->pos++] = 0x00;
+        }
+    }
+}
+
+static void lj92_put_marker(uint8_t *out, int *pos, int marker, int length)
+{
+    out[(*pos)++] = 0xFF;
+    out[(*pos)++] = marker;
+
+    if(length)
+    {
+        out[(*pos)++] = length >> 8;
+        out[(*pos)++] = length;
+    }
+}
+
+int lj92_encode(const uint16_t *image, int width, int height, int bitdepth, int components, uint8_t **encoded, int *encoded_size)
+{
+    if(components < 1 || components > 4 || width <= 0 || height <= 0 || width % components || width / components > 0xFFFF || height > 0xFFFF || bitdepth < 2 || bitdepth > 16)
+    {
+        return LJ92_ERR_PARAM;
+    }
+
+    uint32_t histogram[17];
+    memset(histogram, 0, sizeof(histogram));
+
+    /* first pass: statistics of the differences for the Huffman table */
+    for(int y = 0; y < height; y++)
+    {
+        const uint16_t *row = &image[y * width];
+        const uint16_t *prev = y ? &image[(y - 1) * width] : NULL;
+
+        for(int x = 0; x < width; x++)
+        {
+            int diff = lj92_wrap(row[x] - lj92_predict(row, prev, x, components, bitdepth));
+            histogram[lj92_category(diff)]++;
+        }
+    }
+
+    uint8_t bits[16];
+    uint8_t huffval[17];
+    uint16_t code[17];
+    uint8_t size[17];
+    int values = 0;
+
+    lj92_optimal_table(histogram, bits, huffval, &values);
+    lj92_generate_codes(bits, huffval, code, size);
+
+    /* exact size of the entropy coded data, byte stuffing may double it */
+    uint64_t payload_bits = 0;
+    for(int sym = 0; sym < 17; sym++)
+    {
+        payload_bits += (uint64_t)histogram[sym] * (size[sym] + (sym < 16 ? sym : 0));
+    }
+
+    uint64_t capacity = 2 * (payload_bits / 8 + 1) + 128;
+    if(capacity > 0x7FFFFFFF)
+    {
+        return LJ92_ERR_PARAM;
+    }
+
+    uint8_t *out = malloc(capacity);
+    if(!out)
+    {
+        return LJ92_ERR_MEMORY;
+    }
+
+    int pos = 0;
+    lj92_put_marker(out, &pos, LJ92_SOI, 0);
+
+    /* frame header */
+    lj92_put_marker(out, &pos, LJ92_SOF3, 8 + 3 * components);
+    out[pos++] = bitdepth;
+    out[pos++] = height >> 8;
+    out[pos++] = height;
+    out[pos++] = (width / components) >> 8;
+    out[pos++] = width / components;
+    out[pos++] = components;
+    for(int comp = 0; comp < components; comp++)
+    {
+        out[pos++] = comp + 1;
+        out[pos++] = 0x11;
+        out[pos++] = 0;
+    }
+
+    /* one table for all components */
+    lj92_put_marker(out, &pos, LJ92_DHT, 2 + 1 + 16 + values);
+    out[pos++] = 0x00;
+    memcpy(&out[pos], bits, 16);
+    pos += 16;
+    memcpy(&out[pos], huffval, values);
+    pos += values;
+
+    /* scan header, predictor 1 */
+    lj92_put_marker(out, &pos, LJ92_SOS, 6 + 2 * components);
+    out[pos++] = components;
+    for(int comp = 0; comp < components; comp++)
+    {
+        out[pos++] = comp + 1;
+        out[pos++] = 0x00;
+    }
+    out[pos++] = 1;
+    out[pos++] = 0;
+    out[pos++] = 0;
+
+    /* second pass: entropy coding */
+    lj92_writer_t writer = { out, pos, 0, 0 };
+
+    for(int y = 0; y < height; y++)
+    {
+        const uint16_t *row = &image[y * width];
+        const uint16_t *prev = y ? &image[(y - 1) * width] : NULL;
+
+        for(int x = 0; x < width; x++)
+        {
+            int diff = lj92_wrap(row[x] - lj92_predict(row, prev, x, components, bitdepth));
+            int category = lj92_category(diff);
+
+            lj92_put(&writer, code[category], size[category]);
+
+            /* negative differences are stored as one's complement */
+            if(category && category < 16)
+            {
+                lj92_put(&writer, diff < 0 ? diff - 1 : diff, category);
+            }
+        }
+    }
+
+    /* pad the last byte with 1-bits */
+    if(writer.count)
+    {
+        lj92_put(&writer, 0xFF, 8 - writer.count);
+    }
+
+    pos = writer.pos;
+    lj92_put_marker(out, &pos, LJ92_EOI, 0);
+
+    uint8_t *shrunk = realloc(out, pos);
+    *encoded = shrunk ? shrunk : out;
+    *encoded_size = pos;
+
+    return LJ92_ERR_NONE;
+}
+
+/*
+    decoder
+*/
+typedef struct
+{
+    int width;
+    int height;
+    int bitdepth;
+    int components;
+    int predictor;
+    int point_transform;
+    int scan_table[4];
+    lj92_table_t *tables[4];
+    int scan_start;
+} lj92_stream_t;
+
+static int lj92_build_table(lj92_table_t *table, const uint8_t *bits, const uint8_t *huffval, int values)
+{
+    uint16_t huffcode[256];
+    uint8_t huffsize[256];
+    uint32_t code = 0;
+    int index = 0;
+
+    memset(table, 0, sizeof(lj92_table_t));
+    memcpy(table->huffval, huffval, values);
+
+    for(int length = 1; length <= 16; length++)
+    {
+        table->valptr[length] = index;
+        table->mincode[length] = code;
+        table->maxcode[length] = -1;
+
+        for(int count = 0; count < bits[length - 1]; count++)
+        {
+            huffsize[index] = length;
+            huffcode[index] = code;
+            code++;
+            index++;
+        }
+
+        if(index > table->valptr[length])
+        {
+            table->maxcode[length] = code - 1;
+        }
+
+        /* codes must fit into 'length' bits */
+        if(code > (1u << length))
+        {
+            return LJ92_ERR_CORRUPT;
+        }
+        code <<= 1;
+    }
+
+    for(int pos = 0; pos < index; pos++)
+    {
+        if(huffsize[pos] <= LJ92_LOOKUP_BITS)
+        {
+            int shift = LJ92_LOOKUP_BITS - huffsize[pos];
+            int first = huffcode[pos] << shift;
+
+            for(int entry = 0; entry < (1 << shift); entry++)
+            {
+                table->lookup_len[first + entry] = huffsize[pos];
+                table->lookup_sym[first + entry] = huffval[pos];
+            }
+        }
+    }
+
+    table->present = 1;
+    return LJ92_ERR_NONE;
+}
+
+static inline void lj92_fill(lj92_reader_t *reader)
+{
+    while(reader->count <= 56)
+    {
+        uint32_t byte = 0;
+
+        if(reader->pos < reader->size)
+        {
+            byte = reader->data[reader->pos];
+
+            if(byte != 0xFF)
+            {
+                reader->pos++;
+            }
+            else if(reader->pos + 1 < reader->size && reader->data[reader->pos + 1] == 0x00)
+            {
+                reader->pos += 2;
+            }
+            else
+            {
+                /* reached a marker, the scan is over. feed zeros from now on */
+                byte = 0;
+            }
+        }
+
+        reader->bits |= (uint64_t)byte << (56 - reader->count);
+        reader->count += 8;
+    }
+}
+
+static inline uint32_t lj92_get(lj92_reader_t *reader, int length)
+{
+    uint32_t value = reader->bits >> (64 - length);
+
+    reader->bits <<= length;
+    reader->count -= length;
+
+    return value;
+}
+
+/* read one difference, the reader has to be filled before */
+static inline int lj92_decode_diff(lj92_reader_t *reader, const lj92_table_t *table)
+{
+    int index = reader->bits >> (64 - LJ92_LOOKUP_BITS);
+    int length = table->lookup_len[index];
+    int category = -1;
+
+    if(length)
+    {
+        category = table->lookup_sym[index];
+        lj92_get(reader, length);
+    }
+    else
+    {
+        for(length = LJ92_LOOKUP_BITS + 1; length <= 16; length++)
+        {
+            int32_t code = reader->bits >> (64 - length);
+
+            if(code <= table->maxcode[length])
+            {
+                category = table->huffval[table->valptr[length] + code - table->mincode[length]];
+                lj92_get(reader, length);
+                break;
+            }
+        }
+    }
+
+    /* invalid code or category, out of range of any valid difference */
+    if(category < 0 || category > 16)
+    {
+        return 0x10000;
+    }
+
+    if(category == 0)
+    {
+        return 0;
+    }
+
+    if(category == 16)
+    {
+        return 32768;
+    }
+
+    int value = lj92_get(reader, category);
+
+    /* values with the top bit cleared are negative */
+    if(value < (1 << (category - 1)))
+    {
+        value -= (1 << category) - 1;
+    }
+
+    return value;
+}
+
+/* walk through the markers up to the scan. with 'tables' NULL, stop at the frame header */
+static int lj92_parse(const uint8_t *data, int size, lj92_stream_t *stream, lj92_table_t *tables)
+{
+    int pos = 2;
+    int have_frame = 0;
+
+    memset(stream, 0, sizeof(lj92_stream_t));
+
+    if(size < 4 || data[0] != 0xFF || data[1] != LJ92_SOI)
+    {
+        return LJ92_ERR_CORRUPT;
+    }
+
+    while(pos + 4 <= size)
+    {
+        if(data[pos] != 0xFF)
+        {
+            return LJ92_ERR_CORRUPT;
+        }
+
+        int marker = data[pos + 1];
+
+        /* fill bytes */
+        if(marker == 0xFF)
+        {
+            pos++;
+            continue;
+        }
+
+        int length = (data[pos + 2] << 8) | data[pos + 3];
+        const uint8_t *segment = &data[pos + 4];
+
+        if(length < 2 || pos + 2 + length > size)
+        {
+            return LJ92_ERR_CORRUPT;
+        }
+        length -= 2;
+
+        switch(marker)
+        {
+            case LJ92_SOF3:
+            {
+                if(length < 6)
+                {
+                    return LJ92_ERR_CORRUPT;
+                }
+
+                stream->bitdepth = segment[0];
+                stream->height = (segment[1] << 8) | segment[2];
+                stream->width = (segment[3] << 8) | segment[4];
+                stream->components = segment[5];
+
+                if(stream->components < 1 || stream->components > 4 || length < 6 + 3 * stream->components)
+                {
+                    return LJ92_ERR_CORRUPT;
+                }
+
+                for(int comp = 0; comp < stream->components; comp++)
+                {
+                    if(segment[6 + 3 * comp + 1] != 0x11)
+                    {
+                        return LJ92_ERR_UNSUPPORTED;
+                    }
+                }
+
+                if(stream->bitdepth < 2 || stream->bitdepth > 16 || !stream->width || !stream->height)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+
+                have_frame = 1;
+                if(!tables)
+                {
+                    return LJ92_ERR_NONE;
+                }
+                break;
+            }
+
+            case LJ92_DHT:
+            {
+                int offset = 0;
+
+                while(tables && offset + 17 <= length)
+                {
+                    int class_id = segment[offset];
+                    const uint8_t *bits = &segment[offset + 1];
+                    int values = 0;
+
+                    for(int bit = 0; bit < 16; bit++)
+                    {
+                        values += bits[bit];
+                    }
+
+                    if((class_id >> 4) != 0 || (class_id & 0x0F) > 3 || values > 256 || offset + 17 + values > length)
+                    {
+                        return LJ92_ERR_CORRUPT;
+                    }
+
+                    if(lj92_build_table(&tables[class_id & 0x0F], bits, &segment[offset + 17], values))
+                    {
+                        return LJ92_ERR_CORRUPT;
+                    }
+                    offset += 17 + values;
+                }
+                break;
+            }
+
+            case LJ92_DRI:
+            {
+                if(length >= 2 && ((segment[0] << 8) | segment[1]))
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+                break;
+            }
+
+            case LJ92_SOS:
+            {
+                if(!have_frame || !tables || length < 1)
+                {
+                    return LJ92_ERR_CORRUPT;
+                }
+
+                int scan_components = segment[0];
+                if(scan_components != stream->components || length < 4 + 2 * scan_components)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+
+                for(int comp = 0; comp < scan_components; comp++)
+                {
+                    int table = segment[1 + 2 * comp + 1] >> 4;
+
+                    if(table > 3 || !tables[table].present)
+                    {
+                        return LJ92_ERR_CORRUPT;
+                    }
+                    stream->tables[comp] = &tables[table];
+                }
+
+                stream->predictor = segment[1 + 2 * scan_components];
+                stream->point_transform = segment[3 + 2 * scan_components] & 0x0F;
+                stream->scan_start = pos + 4 + length;
+
+                if(stream->predictor < 1 || stream->predictor > 7 || stream->point_transform >= stream->bitdepth)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+                return LJ92_ERR_NONE;
+            }
+
+            default:
+            {
+                /* other frame types are not lossless JPEG */
+                if(marker >= 0xC0 && marker <= 0xCF && marker != LJ92_DHT && marker != 0xC8 && marker != 0xCC)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+                break;
+            }
+        }
+
+        pos += 4 + length;
+    }
+
+    return LJ92_ERR_CORRUPT;
+}
+
+int lj92_info(const uint8_t *data, int size, int *width, int *height, int *bitdepth, int *components)
+{
+    lj92_stream_t stream;
+    int ret = lj92_parse(data, size, &stream, NULL);
+
+    if(ret)
+    {
+        return ret;
+    }
+
+    *width = stream.width * stream.components;
+    *height = stream.height;
+    *bitdepth = stream.bitdepth;
+    *components = stream.components;
+
+    return LJ92_ERR_NONE;
+}
+
+int lj92_decode(const uint8_t *data, int size, uint16_t *image, int width, int height)
+{
+    lj92_stream_t stream;
+    lj92_table_t *tables = malloc(4 * sizeof(lj92_table_t));
+
+    if(!tables)
+    {
+        return LJ92_ERR_MEMORY;
+    }
+
+    memset(tables, 0, 4 * sizeof(lj92_table_t));
+
+    int ret = lj92_parse(data, size, &stream, tables);
+    if(ret)
+    {
+        free(tables);
+        return ret;
+    }
+
+    int components = stream.components;
+    if(stream.width * components != width || stream.height != height)
+    {
+        free(tables);
+        return LJ92_ERR_PARAM;
+    }
+
+    lj92_reader_t reader = { data, size, stream.scan_start, 0, 0 };
+    int initial = 1 << (stream.bitdepth - stream.point_transform - 1);
+
+    for(int y = 0; y < height; y++)
+    {
+        uint16_t *row = &image[y * width];
+        const uint16_t *prev = y ? &image[(y - 1) * width] : NULL;
+
+        for(int x = 0; x < width; x++)
+        {
+            int comp = x % components;
+            int pred;
+
+            if(x < components)
+            {
+                pred = prev ? prev[x] : initial;
+            }
+            else if(!prev)
+            {
+                pred = row[x - components];
+            }
+            else
+            {
+                int ra = row[x - components];
+                int rb = prev[x];
+                int rc = prev[x - components];
+
+                switch(stream.predictor)
+                {
+                    case 1: pred = ra; break;
+                    case 2: pred = rb; break;
+                    case 3: pred = rc; break;
+                    case 4: pred = ra + rb - rc; break;
+                    case 5: pred = ra + ((rb - rc) >> 1); break;
+                    case 6: pred = rb + ((ra - rc) >> 1); break;
+                    default: pred = (ra + rb) >> 1; break;
+                }
+            }
+
+            lj92_fill(&reader);
+
+            int diff = lj92_decode_diff(&reader, stream.tables[comp]);
+            if(diff == 0x10000)
+            {
+                free(tables);
+                return LJ92_ERR_CORRUPT;
+            }
+
+            row[x] = pred + diff;
+        }
+    }
+
+    if(stream.point_transform)
+    {
+        for(int pos = 0; pos < width * height; pos++)
+        {
+            image[pos] <<= stream.point_transform;
+        }
+    }
+
+    free(tables);
+    return LJ92_ERR_NONE;
+}
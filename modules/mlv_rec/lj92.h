@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _lj92_h_
+#define _lj92_h_
+
+#include <stdint.h>
+
+/*
+    lossless JPEG (ITU T.81 process 14, "LJ92") as used in compressed DNG files.
+
+    images are handled as 'width' x 'height' samples of up to 16 bits. the JPEG frame
+    interleaves 'components' components, so it is (width / components) x height.
+    for Bayer data, two components put each color into its own predictor, which
+    is also the layout DNG readers expect.
+
+    the encoder uses predictor 1 (left neighbor) and one optimized Huffman table.
+    the decoder handles predictors 1-7, up to four components and tables, but no
+    restart intervals or subsampled components.
+*/
+
+#define LJ92_ERR_NONE       0
+#define LJ92_ERR_CORRUPT    -1
+#define LJ92_ERR_MEMORY     -2
+#define LJ92_ERR_PARAM      -3
+#define LJ92_ERR_UNSUPPORTED -4
+
+/* encode an image. the returned buffer has to be freed by the caller */
+int lj92_encode(const uint16_t *image, int width, int height, int bitdepth, int components, uint8_t **encoded, int *encoded_size);
+
+/* read the frame header. width is in samples, i.e. JPEG width * components */
+int lj92_info(const uint8_t *data, int size, int *width, int *height, int *bitdepth, int *components);
+
+/* decode into a 'width' x 'height' image, the dimensions must match the stream */
+int lj92_decode(const uint8_t *data, int size, uint16_t *image, int width, int height);
+
+#endif
@@ -29,6 +29,7 @@
 
 #define MLV_VIDEO_CLASS_FLAG_LZMA    0x80
 #define MLV_VIDEO_CLASS_FLAG_DELTA   0x40
+#define MLV_VIDEO_CLASS_FLAG_LJ92    0x20
 
 #define MLV_AUDIO_CLASS_FLAG_LZMA    0x80
 
@@ -280,6 +281,15 @@ typedef struct {
 */
 }  mlv_vers_hdr_t;
 
+typedef struct {
+    uint8_t     blockType[4];    /* DELT - delta coding of the video frames, when videoClass has MLV_VIDEO_CLASS_FLAG_DELTA */
+    uint32_t    blockSize;
+    uint64_t    timestamp;
+    uint32_t    keyInterval;    /* frames are coded against the previous frame, except for the first frame whose frameNumber / keyInterval */
+                                /* differs from the previous frame's. those keyframes are coded against black and can be decoded alone. */
+                                /* 0 (or no DELT block) means only the very first frame is a keyframe */
+}  mlv_delt_hdr_t;
+
 #pragma pack(pop)
 
 /* helper routines for filling structures from generic camera information */
@@ -29,13 +29,26 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <time.h>
+#include <pthread.h>
 
 /* dng related headers */
 #include <chdk-dng.h>
+#include "pipeline.h"
+#include "mlv_reader.h"
+#include "bitpack.h"
+#include "lj92.h"
+#include "stream_out.h"
+#include "image_out.h"
+#include "reflib.h"
+#include "mlv_scan.h"
 #include "../dual_iso/wirth.h"  /* fast median, generic implementation (also kth_smallest) */
 #include "../dual_iso/optmed.h" /* fast median for small common array sizes (3, 7, 9...) */
+#include "../dual_iso/timing.h" /* stage profiling (--profile=json) */
+#include "../dual_iso/parallel.h" /* thread count for AMaZE (--tiff, --ppm) */
 
 #ifdef __WIN32
+#include <io.h>
+#include <fcntl.h>
 #define FMT_SIZE "%u"
 #else
 #define FMT_SIZE "%zd"
@@ -47,6 +60,10 @@
 #define ERR_FILE            3
 #define ERR_INDEX_REQ       4
 #define ERR_MALLOC          5
+#define ERR_DAMAGED         6
+
+/* tile size of lossless JPEG compressed DNG files */
+#define DNG_TILE_SIZE       256
 
 #if defined(USE_LUA)
 #define LUA_LIB
@@ -94,6 +111,7 @@ char *strdup(const char *s);
 /* project includes */
 #include "../lv_rec/lv_rec.h"
 #include "../../src/raw.h"
+#include "../../src/crc32.h"
 #include "mlv.h"
 #include "camera_id.h"
 
@@ -116,24 +134,28 @@ enum bug_id
 
 int batch_mode = 0;
 
+/* messages go to stderr while the frames are streamed to stdout */
+FILE *msg_file = NULL;
+
 void print_msg(uint32_t type, const char* format, ... )
 {
     va_list args;
     va_start( args, format );
     char *fmt_str = malloc(strlen(format) + 32);
+    FILE *out = msg_file ? msg_file : stdout;
 
     switch(type)
     {
         case MSG_INFO:
             if(!batch_mode)
             {
-                vfprintf(stdout, format, args);
+                vfprintf(out, format, args);
             }
             else
             {
                 strcpy(fmt_str, "[I] ");
                 strcat(fmt_str, format);
-                vfprintf(stdout, fmt_str, args);
+                vfprintf(out, fmt_str, args);
             }
             break;
 
@@ -148,8 +170,8 @@ void print_msg(uint32_t type, const char* format, ... )
             {
                 strcpy(fmt_str, "[E] ");
                 strcat(fmt_str, format);
-                vfprintf(stdout, fmt_str, args);
-                fflush(stdout);
+                vfprintf(out, fmt_str, args);
+                fflush(out);
             }
             break;
 
@@ -161,7 +183,7 @@ void print_msg(uint32_t type, const char* format, ... )
             {
                 strcpy(fmt_str, "[P] ");
                 strcat(fmt_str, format);
-                vfprintf(stdout, fmt_str, args);
+                vfprintf(out, fmt_str, args);
             }
             break;
     }
@@ -485,24 +507,78 @@ void xref_dump(mlv_xref_hdr_t *xref)
 }
 
 
+/* stable merge sort by timestamp, blocks with equal timestamps keep their order */
 void xref_sort(frame_xref_t *table, int entries)
 {
-    int n = entries;
-    do
+    int sorted = 1;
+
+    /* single chunk recordings are usually in order already */
+    for(int i = 1; i < entries && sorted; i++)
+    {
+        if(table[i-1].frameTime > table[i].frameTime)
+        {
+            sorted = 0;
+        }
+    }
+
+    if(sorted)
+    {
+        return;
+    }
+
+    frame_xref_t *buffer = malloc(entries * sizeof(frame_xref_t));
+    if(!buffer)
+    {
+        print_msg(MSG_ERROR, "Failed to alloc mem\n");
+        return;
+    }
+
+    frame_xref_t *src = table;
+    frame_xref_t *dst = buffer;
+
+    /* merge runs of 'width' entries until the whole table is one run */
+    for(int width = 1; width < entries; width *= 2)
     {
-        int newn = 1;
-        for (int i = 0; i < n-1; ++i)
+        for(int start = 0; start < entries; start += 2 * width)
         {
-            if (table[i].frameTime > table[i+1].frameTime)
+            int mid = MIN(start + width, entries);
+            int end = MIN(start + 2 * width, entries);
+            int left = start;
+            int right = mid;
+            int pos = start;
+
+            while(left < mid && right < end)
+            {
+                /* take from the left run unless the right one is strictly earlier */
+                if(src[right].frameTime < src[left].frameTime)
+                {
+                    dst[pos++] = src[right++];
+                }
+                else
+                {
+                    dst[pos++] = src[left++];
+                }
+            }
+            while(left < mid)
+            {
+                dst[pos++] = src[left++];
+            }
+            while(right < end)
             {
-                frame_xref_t tmp = table[i+1];
-                table[i+1] = table[i];
-                table[i] = tmp;
-                newn = i + 1;
+                dst[pos++] = src[right++];
             }
         }
-        n = newn;
-    } while (n > 1);
+
+        frame_xref_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if(src != table)
+    {
+        memcpy(table, src, entries * sizeof(frame_xref_t));
+    }
+    free(buffer);
 }
 
 void bitinsert(uint16_t *dst, int position, int depth, uint16_t new_value)
@@ -619,7 +695,7 @@ int load_frame(char *filename, uint8_t **frame_buffer, uint32_t *frame_buffer_si
             }
             file_set_pos(in_file, position + file_hdr.blockSize, SEEK_SET);
 
-            if(file_hdr.videoClass & MLV_VIDEO_CLASS_FLAG_LZMA)
+            if(file_hdr.videoClass & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92))
             {
                 print_msg(MSG_ERROR, "Compressed formats not supported for frame extraction\n");
                 ret = 5;
@@ -669,7 +745,7 @@ load_frame_finish:
     return ret;
 }
 
-mlv_xref_hdr_t *load_index(char *base_filename)
+mlv_xref_hdr_t *load_index(char *base_filename, uint64_t *guid)
 {
     mlv_xref_hdr_t *block_hdr = NULL;
     int max_name_len = strlen(base_filename) + 16;
@@ -706,8 +782,20 @@ mlv_xref_hdr_t *load_index(char *base_filename)
 
         position = file_get_pos(in_file);
 
-        /* we should check the MLVI header for matching UID value to make sure its the right index... */
-        if(!memcmp(buf.blockType, "XREF", 4))
+        /* the GUID tells the caller if this index belongs to the files */
+        if(!memcmp(buf.blockType, "MLVI", 4))
+        {
+            mlv_file_hdr_t file_hdr;
+
+            if(fread(&file_hdr, MIN(sizeof(mlv_file_hdr_t), buf.blockSize), 1, in_file) != 1)
+            {
+                print_msg(MSG_ERROR, "File '%s' ends in the middle of a block\n", filename);
+                break;
+            }
+            *guid = file_hdr.fileGuid;
+            file_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+        }
+        else if(!memcmp(buf.blockType, "XREF", 4))
         {
             block_hdr = malloc(buf.blockSize);
 
@@ -818,227 +906,2425 @@ void save_index(char *base_filename, mlv_file_hdr_t *ref_file_hdr, int fileCount
 }
 
 
-FILE **load_all_chunks(char *base_filename, int *entries)
+/* walk through the block headers of all chunks and collect the same entries as -x does */
+frame_xref_t *build_index(mlv_reader_t **in_files, int in_file_count, int *entries)
 {
-    int seq_number = 0;
-    int max_name_len = strlen(base_filename) + 16;
-    char *filename = malloc(max_name_len);
+    frame_xref_t *table = NULL;
+    int allocated = 0;
 
-    strncpy(filename, base_filename, max_name_len - 1);
-    FILE **files = malloc(sizeof(FILE*));
+    *entries = 0;
 
-    files[0] = fopen(filename, "rb");
-    if(!files[0])
+    for(int file_num = 0; file_num < in_file_count; file_num++)
     {
-        free(filename);
-        free(files);
-        return NULL;
-    }
+        mlv_reader_t *in_file = in_files[file_num];
 
-    print_msg(MSG_INFO, "File %s opened\n", filename);
+        mlv_reader_set_pos(in_file, 0, SEEK_SET);
 
-    /* get extension and check if it is a .MLV */
-    char *dot = strrchr(filename, '.');
-    if(dot)
-    {
-        dot++;
-        if(strcasecmp(dot, "mlv"))
+        while(1)
         {
-            seq_number = 100;
+            mlv_hdr_t buf;
+            uint64_t position = mlv_reader_get_pos(in_file);
+
+            if(mlv_reader_read(&buf, sizeof(mlv_hdr_t), in_file) != 1)
+            {
+                break;
+            }
+
+            if(buf.blockSize < sizeof(mlv_hdr_t) || buf.blockSize > 50 * 1024 * 1024)
+            {
+                print_msg(MSG_ERROR, "Invalid block size at position 0x%08" PRIx64 " in chunk %d\n", position, file_num);
+                free(table);
+                return NULL;
+            }
+
+            if(memcmp(buf.blockType, "NULL", 4) && memcmp(buf.blockType, "BKUP", 4))
+            {
+                xref_resize(&table, *entries + 1, &allocated);
+
+                /* MLVI has no timestamp, its header must come first anyway */
+                table[*entries].frameTime = memcmp(buf.blockType, "MLVI", 4) ? buf.timestamp : 0;
+                table[*entries].frameOffset = position;
+                table[*entries].fileNumber = file_num;
+                table[*entries].frameType =
+                    !memcmp(buf.blockType, "VIDF", 4) ? MLV_FRAME_VIDF :
+                    !memcmp(buf.blockType, "AUDF", 4) ? MLV_FRAME_AUDF :
+                    MLV_FRAME_UNSPECIFIED;
+
+                (*entries)++;
+            }
+
+            mlv_reader_set_pos(in_file, position + buf.blockSize, SEEK_SET);
         }
+
+        mlv_reader_set_pos(in_file, 0, SEEK_SET);
     }
-    
-    (*entries)++;
-    while(seq_number < 99)
-    {
-        FILE **realloc_files = realloc(files, (*entries + 1) * sizeof(FILE*));
 
-        if(!realloc_files)
-        {
-            free(filename);
-            free(files);
-            return NULL;
-        }
+    return table;
+}
 
-        files = realloc_files;
+/* a stale index from an earlier recording with the same name would send us to random offsets */
+int check_index(mlv_xref_hdr_t *block_xref, uint64_t guid, mlv_file_hdr_t *ref_file_hdr, mlv_reader_t **in_files, int in_file_count)
+{
+    mlv_xref_t *xrefs = (mlv_xref_t *)&(((uint8_t *)block_xref)[sizeof(mlv_xref_hdr_t)]);
+    uint32_t check_pos[2] = { 0, block_xref->entryCount - 1 };
 
-        /* check for the next file M00, M01 etc */
-        char seq_name[8];
+    if(!block_xref->entryCount || guid != ref_file_hdr->fileGuid)
+    {
+        return 0;
+    }
 
-        sprintf(seq_name, "%02d", seq_number);
-        seq_number++;
+    for(uint32_t entry = 0; entry < block_xref->entryCount; entry++)
+    {
+        if(xrefs[entry].fileNumber >= in_file_count)
+        {
+            return 0;
+        }
+    }
 
-        strcpy(&filename[strlen(filename) - 2], seq_name);
+    /* the first and the last entry must point to blocks of the expected type */
+    for(int check = 0; check < 2; check++)
+    {
+        mlv_xref_t *xref = &xrefs[check_pos[check]];
+        mlv_reader_t *in_file = in_files[xref->fileNumber];
+        mlv_hdr_t buf;
+        int valid = 0;
 
-        /* try to open */
-        files[*entries] = fopen(filename, "rb");
-        if(files[*entries])
+        mlv_reader_set_pos(in_file, xref->frameOffset, SEEK_SET);
+        if(mlv_reader_read(&buf, sizeof(mlv_hdr_t), in_file) == 1 && buf.blockSize >= sizeof(mlv_hdr_t))
         {
-            print_msg(MSG_INFO, "File %s opened\n", filename);
-            (*entries)++;
+            switch(xref->frameType)
+            {
+                case MLV_FRAME_VIDF:
+                    valid = !memcmp(buf.blockType, "VIDF", 4);
+                    break;
+                case MLV_FRAME_AUDF:
+                    valid = !memcmp(buf.blockType, "AUDF", 4);
+                    break;
+                default:
+                    valid = memcmp(buf.blockType, "VIDF", 4) && memcmp(buf.blockType, "AUDF", 4);
+                    break;
+            }
         }
-        else
+        mlv_reader_set_pos(in_file, 0, SEEK_SET);
+
+        if(!valid)
         {
-            print_msg(MSG_INFO, "File %s not existing.\n", filename);
-            break;
+            return 0;
         }
     }
 
-    free(filename);
-    return files;
+    return 1;
 }
 
+/* the scan reads the file in windows, with enough overlap to check a header at the window end */
+#define RECOVER_WINDOW (4 * 1024 * 1024)
 
-#define EV_RESOLUTION 32768
-
-#define CHROMA_SMOOTH_2X2
-#include "../dual_iso/chroma_smooth.c"
-#undef CHROMA_SMOOTH_2X2
-
-#define CHROMA_SMOOTH_3X3
-#include "../dual_iso/chroma_smooth.c"
-#undef CHROMA_SMOOTH_3X3
+/* one line of the .CRC file */
+typedef struct
+{
+    char type[5];
+    uint32_t number;
+    uint32_t size;
+    uint32_t crc;
+} frame_crc_t;
+
+/* offset of the next valid block header at or after 'start', 'size' if there is none */
+static uint64_t recover_find_block(mlv_reader_t *in_file, uint64_t start, uint64_t size, uint8_t *window)
+{
+    for(uint64_t offset = start; offset < size; offset += RECOVER_WINDOW)
+    {
+        uint32_t len = (uint32_t)MIN(size - offset, (uint64_t)(RECOVER_WINDOW + MLV_SCAN_HDR_SIZE));
 
-#define CHROMA_SMOOTH_5X5
-#include "../dual_iso/chroma_smooth.c"
-#undef CHROMA_SMOOTH_5X5
+        mlv_reader_set_pos(in_file, offset, SEEK_SET);
+        if(mlv_reader_read(window, len, in_file) != 1)
+        {
+            break;
+        }
 
+        /* headers close to the window end are checked again at the start of the next window */
+        uint32_t found = mlv_scan_next(window, len, 0);
+        if(found < RECOVER_WINDOW || (found < len && offset + len == size))
+        {
+            return offset + found;
+        }
+    }
+    return size;
+}
 
-void chroma_smooth(int method, struct raw_info *info)
+/* read a .CRC file written by an earlier --crc run, NULL if there is none */
+static frame_crc_t *recover_load_crc(char *filename, int *entries)
 {
-    int black = info->black_level;
-    static int raw2ev[16384];
-    static int _ev2raw[24*EV_RESOLUTION];
-    int* ev2raw = _ev2raw + 10*EV_RESOLUTION;
-    
-    if(!method)
+    FILE *file = fopen(filename, "r");
+    frame_crc_t *table = NULL;
+    int allocated = 0;
+    frame_crc_t entry;
+
+    *entries = 0;
+    if(!file)
     {
-        return;
+        return NULL;
     }
 
-    for(int i = 0; i < 16384; i++)
+    while(fscanf(file, "%4s %u %u %x", entry.type, &entry.number, &entry.size, &entry.crc) == 4)
     {
-        raw2ev[i] = log2(MAX(1, i - black)) * EV_RESOLUTION;
+        if(*entries >= allocated)
+        {
+            allocated = allocated ? 2 * allocated : 1024;
+            frame_crc_t *new_table = realloc(table, allocated * sizeof(frame_crc_t));
+            if(!new_table)
+            {
+                break;
+            }
+            table = new_table;
+        }
+        table[(*entries)++] = entry;
     }
 
-    for(int i = -10*EV_RESOLUTION; i < 14*EV_RESOLUTION; i++)
+    fclose(file);
+    return table;
+}
+
+/* walk through the chunks block by block. where the chain of block sizes breaks (card error, power loss),
+   search for the next valid block header instead of giving up. intact blocks are copied into 'out_filename'
+   with a new index, if given. with 'crc_mode', the frames are checked against the .CRC file made by an earlier
+   run, or a new .CRC file is written */
+static int recover_mlv(mlv_reader_t **in_files, int in_file_count, char *in_filename, char *out_filename, int crc_mode)
+{
+    int ret = ERR_OK;
+    FILE *out_file = NULL;
+    FILE *crc_file = NULL;
+    char *crc_filename = NULL;
+    frame_crc_t *crc_table = NULL;
+    int crc_entries = 0;
+    int crc_pos = 0;
+    frame_xref_t *xref_table = NULL;
+    int xref_entries = 0;
+    int xref_allocated = 0;
+    mlv_file_hdr_t file_hdr;
+    int have_file_hdr = 0;
+    uint8_t *block = NULL;
+    uint32_t block_alloc = 0;
+    uint64_t out_pos = 0;
+
+    /* statistics */
+    uint32_t blocks = 0;
+    uint32_t vidf_count = 0;
+    uint32_t audf_count = 0;
+    uint32_t vidf_first = UINT32_MAX;
+    uint32_t vidf_last = 0;
+    uint32_t damaged_ranges = 0;
+    uint64_t damaged_bytes = 0;
+    uint32_t crc_checked = 0;
+    uint32_t crc_failed = 0;
+
+    uint8_t *window = malloc(RECOVER_WINDOW + MLV_SCAN_HDR_SIZE);
+    if(!window)
     {
-        ev2raw[i] = black + pow(2, (float)i / EV_RESOLUTION);
+        print_msg(MSG_ERROR, "Failed to alloc mem\n");
+        return ERR_MALLOC;
     }
 
-    int w = info->width;
-    int h = info->height;
-
-    uint32_t * aux = malloc(w * h * sizeof(uint32_t));
-    uint32_t * aux2 = malloc(w * h * sizeof(uint32_t));
+    memset(&file_hdr, 0x00, sizeof(mlv_file_hdr_t));
 
-    int x,y;
-    for (y = 0; y < h; y++)
+    if(crc_mode)
     {
-        for (x = 0; x < w; x++)
+        crc32_init();
+
+        crc_filename = strdup(in_filename);
+        strcpy(&crc_filename[strlen(crc_filename) - 3], "CRC");
+        crc_table = recover_load_crc(crc_filename, &crc_entries);
+
+        if(crc_table)
+        {
+            print_msg(MSG_INFO, "Checking frames against '%s' (%d entries)\n", crc_filename, crc_entries);
+        }
+        else
         {
-            aux[x + y*w] = aux2[x + y*w] = raw_get_pixel(x, y);
+            crc_file = fopen(crc_filename, "w");
+            if(!crc_file)
+            {
+                print_msg(MSG_ERROR, "Failed to open file '%s'\n", crc_filename);
+                ret = ERR_FILE;
+                goto abort;
+            }
+            print_msg(MSG_INFO, "Writing frame checksums into '%s'\n", crc_filename);
         }
     }
 
-    switch(method)
+    if(out_filename)
     {
-        case 2:
-            chroma_smooth_2x2(aux, aux2, raw2ev, ev2raw);
-            break;
-        case 3:
-            chroma_smooth_3x3(aux, aux2, raw2ev, ev2raw);
-            break;
-        case 5:
-            chroma_smooth_5x5(aux, aux2, raw2ev, ev2raw);
-            break;
-    }
+        out_file = fopen(out_filename, "wb+");
+        if(!out_file)
+        {
+            print_msg(MSG_ERROR, "Failed to open file '%s'\n", out_filename);
+            ret = ERR_FILE;
+            goto abort;
+        }
 
-    for (y = 0; y < h; y++)
-    {
-        for (x = 0; x < w; x++)
+        /* room for the file header, it gets updated with the recovered frame counts at the end */
+        if(fwrite(&file_hdr, sizeof(mlv_file_hdr_t), 1, out_file) != 1)
         {
-            raw_set_pixel(x, y, aux2[x + y*w]);
+            print_msg(MSG_ERROR, "Failed writing into .MLV file\n");
+            ret = ERR_FILE;
+            goto abort;
         }
+        out_pos = sizeof(mlv_file_hdr_t);
     }
 
-    free(aux);
-    free(aux2);
-}
+    for(int file_num = 0; file_num < in_file_count; file_num++)
+    {
+        mlv_reader_t *in_file = in_files[file_num];
+        uint64_t pos = 0;
 
-void show_usage(char *executable)
-{
-    print_msg(MSG_INFO, "Usage: %s [-o output_file] [-rscd] [-l compression_level(0-9)] <inputfile>\n", executable);
-    print_msg(MSG_INFO, "Parameters:\n");
-    print_msg(MSG_INFO, " -o output_file      set the filename to write into\n");
-    print_msg(MSG_INFO, " -v                  verbose output\n");
-    print_msg(MSG_INFO, " --batch             output message suitable for batch processing\n");
-    
-    print_msg(MSG_INFO, "\n");
-    print_msg(MSG_INFO, "-- DNG output --\n");
-    print_msg(MSG_INFO, " --dng               output frames into separate .dng files. set prefix with -o\n");
-    print_msg(MSG_INFO, " --no-cs             no chroma smoothing (default)\n");
-    print_msg(MSG_INFO, " --cs2x2             2x2 chroma smoothing\n");
-    print_msg(MSG_INFO, " --cs3x3             3x3 chroma smoothing\n");
-    print_msg(MSG_INFO, " --cs5x5             5x5 chroma smoothing\n");
-    print_msg(MSG_INFO, " --no-fixcp          do not fix cold pixels\n");
-    print_msg(MSG_INFO, " --fixcp2            fix non-static (moving) cold pixels (slow)\n");
-    print_msg(MSG_INFO, " --no-stripes        do not fix vertical stripes in highlights\n");
+        mlv_reader_set_pos(in_file, 0, SEEK_END);
+        uint64_t size = mlv_reader_get_pos(in_file);
 
-    print_msg(MSG_INFO, "\n");
-    print_msg(MSG_INFO, "-- RAW output --\n");
-    print_msg(MSG_INFO, " -r                  output into a legacy raw file for e.g. raw2dng\n");
+        while(pos < size)
+        {
+            uint32_t hdr_len = (uint32_t)MIN(size - pos, (uint64_t)MLV_SCAN_HDR_SIZE);
+            uint32_t block_size = 0;
 
-    print_msg(MSG_INFO, "\n");
-    print_msg(MSG_INFO, "-- MLV output --\n");
-    print_msg(MSG_INFO, " -b bits             convert image data to given bit depth per channel (1-16)\n");
-    print_msg(MSG_INFO, " -z bits             zero the lowest bits, so we have only specified number of bits containing data (1-16) (improves compression rate)\n");
-    print_msg(MSG_INFO, " -f frames           frames to save. e.g. '12' saves frames 0 to 12, '12-40' saves frames 12 to 40.\n");
-    print_msg(MSG_INFO, " -A fpsx1000         Alter the video file's FPS metadata\n");
-    print_msg(MSG_INFO, " -x                  build xref file (indexing)\n");
-    print_msg(MSG_INFO, " -m                  write only metadata, no audio or video frames\n");
-    print_msg(MSG_INFO, " -n                  write no metadata, only audio and video frames\n");
+            mlv_reader_set_pos(in_file, pos, SEEK_SET);
+            if(mlv_reader_read(window, hdr_len, in_file) == 1)
+            {
+                block_size = mlv_scan_block(window, hdr_len);
+            }
 
-    print_msg(MSG_INFO, "\n");
-    print_msg(MSG_INFO, "-- Image manipulation --\n");
-    print_msg(MSG_INFO, " -a                  average all frames in <inputfile> and output a single-frame MLV from it\n");
-    print_msg(MSG_INFO, " --avg-vertical      [DARKFRAME ONLY] average the resulting frame in vertical direction, so we will extract vertical banding\n");
-    print_msg(MSG_INFO, " --avg-horizontal    [DARKFRAME ONLY] average the resulting frame in horizontal direction, so we will extract horizontal banding\n");
-    print_msg(MSG_INFO, " -s mlv_file         subtract the reference frame in given file from every single frame during processing\n");
-    print_msg(MSG_INFO, " -t mlv_file         use the reference frame in given file as flat field (gain correction)\n");
+            int intact = block_size && pos + block_size <= size;
 
-    print_msg(MSG_INFO, "\n");
-    print_msg(MSG_INFO, "-- Processing --\n");
-    print_msg(MSG_INFO, " -e                  delta-encode frames to improve compression, but lose random access capabilities\n");
-    print_msg(MSG_INFO, " -X type             extract only block type\n");
-    print_msg(MSG_INFO, " -I mlv_file         inject data from given MLV file right after MLVI header\n");
+            /* a block is trusted if the next one follows right behind it, or if no other header starts within it */
+            if(intact && pos + block_size < size)
+            {
+                uint32_t next_len = (uint32_t)MIN(size - pos - block_size, (uint64_t)MLV_SCAN_HDR_SIZE);
 
-    /* yet unclear which format to choose, so keep that as reminder */
-    //print_msg(MSG_INFO, " -u lut_file         look-up table with 4 * xRes * yRes 16-bit words that is applied before bit depth conversion\n");
-#ifdef MLV_USE_LZMA
-    print_msg(MSG_INFO, " -c                  (re-)compress video and audio frames using LZMA (set bpp to 16 to improve compression rate)\n");
-    print_msg(MSG_INFO, " -d                  decompress compressed video and audio frames using LZMA\n");
-    print_msg(MSG_INFO, " -l level            set compression level from 0=fastest to 9=best compression\n");
-#else
-    print_msg(MSG_INFO, " -c, -d, -l          NOT AVAILABLE: compression support was not compiled into this release\n");
-#endif
-    print_msg(MSG_INFO, "\n");
+                mlv_reader_set_pos(in_file, pos + block_size, SEEK_SET);
+                if(mlv_reader_read(window, next_len, in_file) != 1 || !mlv_scan_block(window, next_len))
+                {
+                    intact = recover_find_block(in_file, pos + 1, size, window) >= pos + block_size;
+                }
+            }
 
-    print_msg(MSG_INFO, "-- bugfixes --\n");
-    print_msg(MSG_INFO, " --black-fix=value   set black level to <value> (fix green/magenta cast)\n");
-    print_msg(MSG_INFO, " --fix-bug=id        fix some special bugs. *only* to be used if given instruction by developers.\n");
-    print_msg(MSG_INFO, "\n");
-}
+            if(!intact)
+            {
+                uint64_t next = recover_find_block(in_file, pos + 1, size, window);
 
-void print_sampling_info(int bin, int skip, char * what)
-{
-    if (bin + skip == 1) {
-        print_msg(MSG_INFO, "read every %s", what);
-    } else if (skip == 0) {
-        print_msg(MSG_INFO, "bin %d %s%s", bin, what, bin == 1 ? "" : "s");
-    } else {
-        print_msg(MSG_INFO, "%s %d %s%s", bin == 1 ? "read" : "bin", bin, what, bin == 1 ? "" : "s");
-        if (skip) {
+                if(block_size && pos + block_size > size)
+                {
+                    print_msg(MSG_INFO, "Chunk %d: block at 0x%08" PRIx64 " is cut off by the end of the file\n", file_num, pos);
+                }
+                print_msg(MSG_INFO, "Chunk %d: skipping %" PRIu64 " damaged bytes at 0x%08" PRIx64 "\n", file_num, next - pos, pos);
+
+                damaged_ranges++;
+                damaged_bytes += next - pos;
+                pos = next;
+                continue;
+            }
+
+            if(block_size > block_alloc)
+            {
+                uint8_t *new_block = realloc(block, block_size);
+                if(!new_block)
+                {
+                    print_msg(MSG_ERROR, "Failed to alloc mem\n");
+                    ret = ERR_MALLOC;
+                    goto abort;
+                }
+                block = new_block;
+                block_alloc = block_size;
+            }
+
+            mlv_reader_set_pos(in_file, pos, SEEK_SET);
+            if(mlv_reader_read(block, block_size, in_file) != 1)
+            {
+                print_msg(MSG_ERROR, "Chunk %d: failed reading block at 0x%08" PRIx64 "\n", file_num, pos);
+                ret = ERR_FILE;
+                goto abort;
+            }
+
+            mlv_hdr_t *hdr = (mlv_hdr_t *)block;
+            int is_vidf = !memcmp(hdr->blockType, "VIDF", 4);
+            int is_audf = !memcmp(hdr->blockType, "AUDF", 4);
+
+            blocks++;
+            pos += block_size;
+
+            if(is_vidf || is_audf)
+            {
+                uint32_t number = is_vidf ? ((mlv_vidf_hdr_t *)block)->frameNumber : ((mlv_audf_hdr_t *)block)->frameNumber;
+
+                if(is_vidf)
+                {
+                    vidf_count++;
+                    vidf_first = MIN(vidf_first, number);
+                    vidf_last = MAX(vidf_last, number);
+                }
+                else
+                {
+                    audf_count++;
+                }
+
+                if(crc_mode)
+                {
+                    uint32_t crc = crc32(block, block_size, CRC32_DEFAULT_SEED) ^ 0xFFFFFFFF;
+
+                    if(crc_file)
+                    {
+                        fprintf(crc_file, "%.4s %u %u %08x\n", hdr->blockType, number, block_size, crc);
+                    }
+                    else
+                    {
+                        /* the entries are in file order, so usually the next one matches */
+                        int found = -1;
+                        for(int entry = 0; entry < crc_entries && found < 0; entry++)
+                        {
+                            frame_crc_t *check = &crc_table[(crc_pos + entry) % crc_entries];
+                            if(!memcmp(check->type, hdr->blockType, 4) && check->number == number)
+                            {
+                                found = (crc_pos + entry) % crc_entries;
+                            }
+                        }
+
+                        if(found < 0)
+                        {
+                            print_msg(MSG_INFO, "%.4s %u: not in the checksum list\n", hdr->blockType, number);
+                        }
+                        else
+                        {
+                            crc_checked++;
+                            crc_pos = found + 1;
+                            if(crc_table[found].size != block_size || crc_table[found].crc != crc)
+                            {
+                                print_msg(MSG_INFO, "%.4s %u: checksum mismatch (%08x, expected %08x)\n", hdr->blockType, number, crc, crc_table[found].crc);
+                                crc_failed++;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if(!out_file)
+            {
+                continue;
+            }
+
+            /* the first file header is written at the end, other chunks' headers, stale indexes and padding are dropped */
+            if(!memcmp(hdr->blockType, "MLVI", 4))
+            {
+                if(!have_file_hdr)
+                {
+                    memcpy(&file_hdr, block, sizeof(mlv_file_hdr_t));
+                    have_file_hdr = 1;
+                }
+                continue;
+            }
+            if(!memcmp(hdr->blockType, "XREF", 4) || !memcmp(hdr->blockType, "NULL", 4) || !memcmp(hdr->blockType, "BKUP", 4))
+            {
+                continue;
+            }
+
+            xref_resize(&xref_table, xref_entries + 1, &xref_allocated);
+            xref_table[xref_entries].frameTime = hdr->timestamp;
+            xref_table[xref_entries].frameOffset = out_pos;
+            xref_table[xref_entries].fileNumber = 0;
+            xref_table[xref_entries].frameType = is_vidf ? MLV_FRAME_VIDF : is_audf ? MLV_FRAME_AUDF : MLV_FRAME_UNSPECIFIED;
+            xref_entries++;
+
+            if(fwrite(block, block_size, 1, out_file) != 1)
+            {
+                print_msg(MSG_ERROR, "Failed writing into .MLV file\n");
+                ret = ERR_FILE;
+                goto abort;
+            }
+            out_pos += block_size;
+        }
+    }
+
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "Intact blocks:   %d (%d video frames, %d audio frames)\n", blocks, vidf_count, audf_count);
+    if(vidf_count && vidf_last - vidf_first + 1 > vidf_count)
+    {
+        print_msg(MSG_INFO, "Missing frames:  %d between #%d and #%d\n", vidf_last - vidf_first + 1 - vidf_count, vidf_first, vidf_last);
+    }
+    print_msg(MSG_INFO, "Damaged data:    %" PRIu64 " bytes in %d ranges\n", damaged_bytes, damaged_ranges);
+    if(crc_table)
+    {
+        print_msg(MSG_INFO, "Checksums:       %d checked, %d failed, %d not found\n", crc_checked, crc_failed, crc_entries - crc_checked);
+    }
+
+    if(damaged_ranges || crc_failed || (crc_table && (int)crc_checked != crc_entries))
+    {
+        ret = ERR_DAMAGED;
+    }
+
+    if(out_file)
+    {
+        if(!have_file_hdr)
+        {
+            print_msg(MSG_ERROR, "No intact file header (MLVI) found, '%s' is incomplete\n", out_filename);
+            ret = ERR_FILE;
+            goto abort;
+        }
+
+        file_hdr.blockSize = sizeof(mlv_file_hdr_t);
+        file_hdr.fileNum = 0;
+        file_hdr.fileCount = 1;
+        file_hdr.videoFrameCount = vidf_count;
+        file_hdr.audioFrameCount = audf_count;
+
+        file_set_pos(out_file, 0, SEEK_SET);
+        if(fwrite(&file_hdr, sizeof(mlv_file_hdr_t), 1, out_file) != 1)
+        {
+            print_msg(MSG_ERROR, "Failed writing into .MLV file\n");
+            ret = ERR_FILE;
+            goto abort;
+        }
+
+        /* the file header entry goes first, it has no timestamp */
+        xref_resize(&xref_table, xref_entries + 1, &xref_allocated);
+        memmove(&xref_table[1], &xref_table[0], xref_entries * sizeof(frame_xref_t));
+        xref_table[0].frameTime = 0;
+        xref_table[0].frameOffset = 0;
+        xref_table[0].fileNumber = 0;
+        xref_table[0].frameType = MLV_FRAME_UNSPECIFIED;
+        xref_entries++;
+
+        xref_sort(xref_table, xref_entries);
+        save_index(out_filename, &file_hdr, 0, xref_table, xref_entries);
+        print_msg(MSG_INFO, "Recovered into:  '%s'\n", out_filename);
+    }
+
+abort:
+    if(out_file)
+    {
+        fclose(out_file);
+    }
+    if(crc_file)
+    {
+        fclose(crc_file);
+    }
+    free(crc_filename);
+    free(crc_table);
+    free(xref_table);
+    free(block);
+    free(window);
+
+    return ret;
+}
+
+static int64_t xref_frame_number(mlv_xref_t *xref, mlv_reader_t **in_files)
+{
+    mlv_reader_t *in_file = in_files[xref->fileNumber];
+    mlv_vidf_hdr_t block_hdr;
+
+    mlv_reader_set_pos(in_file, xref->frameOffset, SEEK_SET);
+    if(mlv_reader_read(&block_hdr, sizeof(mlv_vidf_hdr_t), in_file) != 1 || memcmp(block_hdr.blockType, "VIDF", 4))
+    {
+        return -1;
+    }
+
+    return block_hdr.frameNumber;
+}
+
+/* the index is sorted by time, so the VIDF entries have ascending frame numbers. search the entries of the
+   first and the last frame in range, so all VIDF entries outside of [first, last] can be skipped without reading */
+int find_index_frames(mlv_xref_hdr_t *block_xref, mlv_reader_t **in_files, uint32_t frame_start, uint32_t frame_end, uint32_t *first, uint32_t *last)
+{
+    mlv_xref_t *xrefs = (mlv_xref_t *)&(((uint8_t *)block_xref)[sizeof(mlv_xref_hdr_t)]);
+    uint32_t *vidf_pos = malloc(block_xref->entryCount * sizeof(uint32_t));
+    uint32_t vidf_count = 0;
+    int ret = 1;
+
+    if(!vidf_pos)
+    {
+        return 0;
+    }
+
+    for(uint32_t entry = 0; entry < block_xref->entryCount; entry++)
+    {
+        if(xrefs[entry].frameType == MLV_FRAME_VIDF)
+        {
+            vidf_pos[vidf_count++] = entry;
+        }
+    }
+
+    /* first frame with a number >= frame_start */
+    uint32_t low = 0;
+    uint32_t high = vidf_count;
+    while(low < high && ret)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int64_t number = xref_frame_number(&xrefs[vidf_pos[mid]], in_files);
+
+        if(number < 0)
+        {
+            ret = 0;
+        }
+        else if(number < frame_start)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    uint32_t range_start = low;
+
+    /* first frame with a number > frame_end */
+    high = vidf_count;
+    while(low < high && ret)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        int64_t number = xref_frame_number(&xrefs[vidf_pos[mid]], in_files);
+
+        if(number < 0)
+        {
+            ret = 0;
+        }
+        else if(number <= frame_end)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    uint32_t range_end = low;
+
+    if(range_start < range_end)
+    {
+        *first = vidf_pos[range_start];
+        *last = vidf_pos[range_end - 1];
+    }
+    else
+    {
+        /* no frame in range, skip them all */
+        *first = 1;
+        *last = 0;
+    }
+
+    free(vidf_pos);
+    return ret;
+}
+
+FILE **load_all_chunks(char *base_filename, int *entries)
+{
+    int seq_number = 0;
+    int max_name_len = strlen(base_filename) + 16;
+    char *filename = malloc(max_name_len);
+
+    strncpy(filename, base_filename, max_name_len - 1);
+    FILE **files = malloc(sizeof(FILE*));
+
+    files[0] = fopen(filename, "rb");
+    if(!files[0])
+    {
+        free(filename);
+        free(files);
+        return NULL;
+    }
+
+    print_msg(MSG_INFO, "File %s opened\n", filename);
+
+    /* get extension and check if it is a .MLV */
+    char *dot = strrchr(filename, '.');
+    if(dot)
+    {
+        dot++;
+        if(strcasecmp(dot, "mlv"))
+        {
+            seq_number = 100;
+        }
+    }
+    
+    (*entries)++;
+    while(seq_number < 99)
+    {
+        FILE **realloc_files = realloc(files, (*entries + 1) * sizeof(FILE*));
+
+        if(!realloc_files)
+        {
+            free(filename);
+            free(files);
+            return NULL;
+        }
+
+        files = realloc_files;
+
+        /* check for the next file M00, M01 etc */
+        char seq_name[8];
+
+        sprintf(seq_name, "%02d", seq_number);
+        seq_number++;
+
+        strcpy(&filename[strlen(filename) - 2], seq_name);
+
+        /* try to open */
+        files[*entries] = fopen(filename, "rb");
+        if(files[*entries])
+        {
+            print_msg(MSG_INFO, "File %s opened\n", filename);
+            (*entries)++;
+        }
+        else
+        {
+            print_msg(MSG_INFO, "File %s not existing.\n", filename);
+            break;
+        }
+    }
+
+    free(filename);
+    return files;
+}
+
+
+#define EV_RESOLUTION 32768
+
+#define CHROMA_SMOOTH_2X2
+#include "../dual_iso/chroma_smooth.c"
+#undef CHROMA_SMOOTH_2X2
+
+#define CHROMA_SMOOTH_3X3
+#include "../dual_iso/chroma_smooth.c"
+#undef CHROMA_SMOOTH_3X3
+
+#define CHROMA_SMOOTH_5X5
+#include "../dual_iso/chroma_smooth.c"
+#undef CHROMA_SMOOTH_5X5
+
+
+/* raw2dng.c helpers that work on a caller-supplied raw_info instead of the global one */
+extern struct raw_info raw_info;
+struct raw_fix_analysis * raw_fix_analysis_new();
+void raw_fix_analysis_reset(struct raw_fix_analysis * analysis);
+void raw_fix_analysis_free(struct raw_fix_analysis * analysis);
+int fix_vertical_stripes_analysis(struct raw_info * info, struct raw_fix_analysis * analysis);
+int find_and_fix_cold_pixels_analysis(struct raw_info * info, struct raw_fix_analysis * analysis, int force_analysis);
+int raw_get_pixel_info(struct raw_info * info, int x, int y);
+void raw_set_pixel_info(struct raw_info * info, int x, int y, int value);
+
+/* raw <-> EV tables for chroma smoothing. they only depend on the black level, so they are built once
+   and shared by all threads. entries are never freed while running, a clip rarely has more than one */
+typedef struct chroma_tables
+{
+    int black;
+    int *raw2ev;
+    int *ev2raw_buffer;
+    int *ev2raw;
+    struct chroma_tables *next;
+} chroma_tables_t;
+
+static chroma_tables_t *chroma_tables_list = NULL;
+static pthread_mutex_t chroma_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static chroma_tables_t *chroma_get_tables(int black)
+{
+    chroma_tables_t *tables = NULL;
+
+    pthread_mutex_lock(&chroma_tables_lock);
+
+    for(tables = chroma_tables_list; tables; tables = tables->next)
+    {
+        if(tables->black == black)
+        {
+            break;
+        }
+    }
+
+    if(!tables)
+    {
+        tables = calloc(1, sizeof(chroma_tables_t));
+        if(tables)
+        {
+            tables->raw2ev = malloc(16384 * sizeof(int));
+            tables->ev2raw_buffer = malloc(24*EV_RESOLUTION * sizeof(int));
+            if(!tables->raw2ev || !tables->ev2raw_buffer)
+            {
+                free(tables->raw2ev);
+                free(tables->ev2raw_buffer);
+                free(tables);
+                tables = NULL;
+            }
+        }
+
+        if(tables)
+        {
+            tables->black = black;
+            tables->ev2raw = tables->ev2raw_buffer + 10*EV_RESOLUTION;
+
+            for(int i = 0; i < 16384; i++)
+            {
+                tables->raw2ev[i] = log2(MAX(1, i - black)) * EV_RESOLUTION;
+            }
+
+            for(int i = -10*EV_RESOLUTION; i < 14*EV_RESOLUTION; i++)
+            {
+                tables->ev2raw[i] = black + pow(2, (float)i / EV_RESOLUTION);
+            }
+
+            tables->next = chroma_tables_list;
+            chroma_tables_list = tables;
+        }
+    }
+
+    pthread_mutex_unlock(&chroma_tables_lock);
+
+    return tables;
+}
+
+static void chroma_free_tables()
+{
+    while(chroma_tables_list)
+    {
+        chroma_tables_t *next = chroma_tables_list->next;
+
+        free(chroma_tables_list->raw2ev);
+        free(chroma_tables_list->ev2raw_buffer);
+        free(chroma_tables_list);
+        chroma_tables_list = next;
+    }
+}
+
+/* the unpacked planes are kept by the caller, so they are not allocated for every frame */
+typedef struct
+{
+    uint32_t *inp;
+    uint32_t *out;
+    uint16_t *row;
+    int pixels;
+    int width;
+} chroma_planes_t;
+
+static void chroma_free_planes(chroma_planes_t *planes)
+{
+    free(planes->inp);
+    free(planes->out);
+    free(planes->row);
+    memset(planes, 0x00, sizeof(chroma_planes_t));
+}
+
+/* one horizontal band of the image. the kernels read up to 4 rows above and 5 rows below, so
+   each band gets a view that starts 4 rows before its first output row. as long as the bands
+   start at even rows, they write disjoint pixels and only read the unmodified input plane */
+typedef struct
+{
+    int method;
+    uint32_t *inp;
+    uint32_t *out;
+    int w;
+    int h;
+    int *raw2ev;
+    int *ev2raw;
+} chroma_band_t;
+
+static void *chroma_smooth_band(void *arg)
+{
+    chroma_band_t *band = arg;
+
+    switch(band->method)
+    {
+        case 2:
+            chroma_smooth_2x2(band->inp, band->out, band->w, band->h, band->raw2ev, band->ev2raw);
+            break;
+        case 3:
+            chroma_smooth_3x3(band->inp, band->out, band->w, band->h, band->raw2ev, band->ev2raw);
+            break;
+        case 5:
+            chroma_smooth_5x5(band->inp, band->out, band->w, band->h, band->raw2ev, band->ev2raw);
+            break;
+    }
+
+    return NULL;
+}
+
+/* 'threads' bands are smoothed in parallel, use 1 if the frames themselves are already processed in parallel */
+void chroma_smooth(int method, struct raw_info *info, int threads, chroma_planes_t *planes)
+{
+    if(!method)
+    {
+        return;
+    }
+
+    /* the tables cover 14 bit raw values */
+    static int depth_warned = 0;
+    int depth = info->bits_per_pixel;
+    if(depth > 14)
+    {
+        if(!depth_warned)
+        {
+            print_msg(MSG_ERROR, "Chroma smoothing needs 14 bit frames or less, skipped\n");
+            depth_warned = 1;
+        }
+        return;
+    }
+
+    chroma_tables_t *tables = chroma_get_tables(info->black_level);
+    if(!tables)
+    {
+        print_msg(MSG_ERROR, "Failed to alloc mem\n");
+        return;
+    }
+
+    int w = info->width;
+    int h = info->height;
+
+    if(w * h > planes->pixels || w > planes->width)
+    {
+        chroma_free_planes(planes);
+        planes->inp = malloc(w * h * sizeof(uint32_t));
+        planes->out = malloc(w * h * sizeof(uint32_t));
+        planes->row = malloc(w * sizeof(uint16_t));
+        if(!planes->inp || !planes->out || !planes->row)
+        {
+            print_msg(MSG_ERROR, "Failed to alloc mem\n");
+            chroma_free_planes(planes);
+            return;
+        }
+        planes->pixels = w * h;
+        planes->width = w;
+    }
+
+    uint32_t *aux = planes->inp;
+    uint32_t *aux2 = planes->out;
+
+    for(int y = 0; y < h; y++)
+    {
+        bitunpack_row((uint8_t *)info->buffer + y * info->pitch, planes->row, w, depth);
+
+        for(int x = 0; x < w; x++)
+        {
+            aux[x + y*w] = aux2[x + y*w] = planes->row[x];
+        }
+    }
+
+    /* the kernels produce output rows 4 ... h-6, in steps of two */
+    int steps = (h - 9 + 1) / 2;
+    int bands = MAX(1, MIN(threads, steps / 16));
+    chroma_band_t band[64];
+    pthread_t band_thread[64];
+    int band_started[64];
+
+    bands = MIN(bands, COUNT(band));
+
+    for(int pos = 0; pos < bands; pos++)
+    {
+        int y0 = 4 + 2 * (pos * steps / bands);
+        int y1 = (pos == bands - 1) ? (h - 5) : (4 + 2 * ((pos + 1) * steps / bands));
+
+        band[pos].method = method;
+        band[pos].inp = &aux[(y0 - 4) * w];
+        band[pos].out = &aux2[(y0 - 4) * w];
+        band[pos].w = w;
+        band[pos].h = y1 - y0 + 9;
+        band[pos].raw2ev = tables->raw2ev;
+        band[pos].ev2raw = tables->ev2raw;
+
+        /* the last band is done by the calling thread */
+        band_started[pos] = (pos < bands - 1) && !pthread_create(&band_thread[pos], NULL, chroma_smooth_band, &band[pos]);
+        if(!band_started[pos])
+        {
+            chroma_smooth_band(&band[pos]);
+        }
+    }
+
+    for(int pos = 0; pos < bands; pos++)
+    {
+        if(band_started[pos])
+        {
+            pthread_join(band_thread[pos], NULL);
+        }
+    }
+
+    for(int y = 0; y < h; y++)
+    {
+        for(int x = 0; x < w; x++)
+        {
+            planes->row[x] = aux2[x + y*w];
+        }
+
+        bitpack_row((uint8_t *)info->buffer + y * info->pitch, planes->row, w, depth);
+    }
+}
+
+#ifdef MLV_USE_LZMA
+/* unpack a LZMA compressed frame in place, the buffer is enlarged if the unpacked frame does not fit */
+static int frame_lzma_decompress(uint8_t **frame_buffer, uint32_t *frame_buffer_size, int *frame_size, int verbose)
+{
+    size_t lzma_out_size = *(uint32_t *)*frame_buffer;
+    size_t lzma_in_size = *frame_size - LZMA_PROPS_SIZE - 4;
+    size_t lzma_props_size = LZMA_PROPS_SIZE;
+    unsigned char *lzma_out = malloc(lzma_out_size);
+
+    if(!lzma_out)
+    {
+        print_msg(MSG_ERROR, "    LZMA: Failed to allocate "FMT_SIZE" byte\n", lzma_out_size);
+        return ERR_MALLOC;
+    }
+
+    int ret = LzmaUncompress(
+        lzma_out, &lzma_out_size,
+        (unsigned char *)&(*frame_buffer)[4 + LZMA_PROPS_SIZE], &lzma_in_size,
+        (unsigned char *)&(*frame_buffer)[4], lzma_props_size
+        );
+
+    if(ret != SZ_OK)
+    {
+        print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
+        free(lzma_out);
+        return ERR_FILE;
+    }
+
+    if(lzma_out_size > *frame_buffer_size)
+    {
+        uint8_t *new_buffer = realloc(*frame_buffer, lzma_out_size);
+        if(!new_buffer)
+        {
+            print_msg(MSG_ERROR, "    LZMA: Failed to allocate "FMT_SIZE" byte\n", lzma_out_size);
+            free(lzma_out);
+            return ERR_MALLOC;
+        }
+        *frame_buffer = new_buffer;
+        *frame_buffer_size = lzma_out_size;
+    }
+
+    *frame_size = lzma_out_size;
+    memcpy(*frame_buffer, lzma_out, *frame_size);
+    free(lzma_out);
+
+    if(verbose)
+    {
+        print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, lzma_out_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
+    }
+
+    return ERR_OK;
+}
+
+/* LZMA compress a frame in place. the uncompressed size is stored in front of the LZMA properties */
+static int frame_lzma_compress(uint8_t **frame_buffer, uint32_t *frame_buffer_size, int *frame_size, int level, int dict, int lc, int lp, int pb, int fb, int threads, int verbose)
+{
+    size_t lzma_out_size = 2 * *frame_size;
+    size_t lzma_in_size = *frame_size;
+    size_t lzma_props_size = LZMA_PROPS_SIZE;
+    unsigned char *lzma_out = malloc(lzma_out_size + LZMA_PROPS_SIZE);
+
+    if(!lzma_out)
+    {
+        print_msg(MSG_ERROR, "    LZMA: Failed to allocate "FMT_SIZE" byte\n", lzma_out_size);
+        return ERR_MALLOC;
+    }
+
+    int ret = LzmaCompress(
+        &lzma_out[LZMA_PROPS_SIZE], &lzma_out_size,
+        (unsigned char *)*frame_buffer, lzma_in_size,
+        &lzma_out[0], &lzma_props_size,
+        level, dict, lc, lp, pb, fb, threads
+        );
+
+    if(ret != SZ_OK)
+    {
+        print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
+        free(lzma_out);
+        return ERR_FILE;
+    }
+
+    /* incompressible frames may end up larger than before */
+    uint32_t new_size = lzma_out_size + LZMA_PROPS_SIZE + 4;
+    if(new_size > *frame_buffer_size)
+    {
+        uint8_t *new_buffer = realloc(*frame_buffer, new_size);
+        if(!new_buffer)
+        {
+            print_msg(MSG_ERROR, "    LZMA: Failed to allocate %d byte\n", new_size);
+            free(lzma_out);
+            return ERR_MALLOC;
+        }
+        *frame_buffer = new_buffer;
+        *frame_buffer_size = new_size;
+    }
+
+    /* store original frame size */
+    *(uint32_t *)*frame_buffer = *frame_size;
+
+    /* set new compressed size and copy buffers */
+    *frame_size = new_size;
+    memcpy(&(*frame_buffer)[4], lzma_out, new_size - 4);
+    free(lzma_out);
+
+    if(verbose)
+    {
+        print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, (size_t)new_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
+    }
+
+    return ERR_OK;
+}
+#endif
+
+/* unpack a LJ92 compressed frame in place into the bit packed format of the given depth */
+static int frame_lj92_decompress(uint8_t **frame_buffer, uint32_t *frame_buffer_size, int *frame_size, int xRes, int yRes, int depth, int verbose)
+{
+    int lj92_width = 0;
+    int lj92_height = 0;
+    int lj92_depth = 0;
+    int lj92_components = 0;
+
+    int ret = lj92_info(*frame_buffer, *frame_size, &lj92_width, &lj92_height, &lj92_depth, &lj92_components);
+    if(ret != LJ92_ERR_NONE || lj92_width != xRes || lj92_height != yRes || lj92_depth > depth)
+    {
+        print_msg(MSG_ERROR, "    LJ92: Invalid frame (%d, %dx%d, %d bpp)\n", ret, lj92_width, lj92_height, lj92_depth);
+        return ERR_FILE;
+    }
+
+    int image_size = xRes * yRes * sizeof(uint16_t);
+    uint16_t *image = malloc(image_size);
+    if(!image)
+    {
+        print_msg(MSG_ERROR, "    LJ92: Failed to allocate %d byte\n", image_size);
+        return ERR_MALLOC;
+    }
+
+    ret = lj92_decode(*frame_buffer, *frame_size, image, xRes, yRes);
+    if(ret != LJ92_ERR_NONE)
+    {
+        print_msg(MSG_INFO, "    LJ92: Failed (%d)\n", ret);
+        free(image);
+        return ERR_FILE;
+    }
+
+    uint32_t new_size = (xRes * yRes * depth + 7) / 8;
+    if(new_size > *frame_buffer_size)
+    {
+        uint8_t *new_buffer = realloc(*frame_buffer, new_size);
+        if(!new_buffer)
+        {
+            print_msg(MSG_ERROR, "    LJ92: Failed to allocate %d byte\n", new_size);
+            free(image);
+            return ERR_MALLOC;
+        }
+        *frame_buffer = new_buffer;
+        *frame_buffer_size = new_size;
+    }
+
+    if(verbose)
+    {
+        print_msg(MSG_INFO, "    LJ92: %d -> %d  (%2.2f%%)\n", *frame_size, new_size, ((float)new_size * 100.0f) / (float)*frame_size);
+    }
+
+    int pitch = xRes * depth / 8;
+    for(int y = 0; y < yRes; y++)
+    {
+        bitpack_row(&(*frame_buffer)[y * pitch], &image[y * xRes], xRes, depth);
+    }
+    free(image);
+
+    *frame_size = new_size;
+
+    return ERR_OK;
+}
+
+/* LJ92 compress a frame in place. every color of a Bayer row gets its own component and predictor */
+static int frame_lj92_compress(uint8_t **frame_buffer, uint32_t *frame_buffer_size, int *frame_size, int xRes, int yRes, int depth, int verbose)
+{
+    int image_size = xRes * yRes * sizeof(uint16_t);
+    uint16_t *image = malloc(image_size);
+    if(!image)
+    {
+        print_msg(MSG_ERROR, "    LJ92: Failed to allocate %d byte\n", image_size);
+        return ERR_MALLOC;
+    }
+
+    int pitch = xRes * depth / 8;
+    for(int y = 0; y < yRes; y++)
+    {
+        bitunpack_row(&(*frame_buffer)[y * pitch], &image[y * xRes], xRes, depth);
+    }
+
+    uint8_t *encoded = NULL;
+    int encoded_size = 0;
+    int ret = lj92_encode(image, xRes, yRes, depth, (xRes % 2) ? 1 : 2, &encoded, &encoded_size);
+    free(image);
+
+    if(ret != LJ92_ERR_NONE)
+    {
+        print_msg(MSG_INFO, "    LJ92: Failed (%d)\n", ret);
+        return (ret == LJ92_ERR_MEMORY) ? ERR_MALLOC : ERR_FILE;
+    }
+
+    if(verbose)
+    {
+        print_msg(MSG_INFO, "    LJ92: %d -> %d  (%2.2f%%)\n", *frame_size, encoded_size, ((float)encoded_size * 100.0f) / (float)*frame_size);
+    }
+
+    /* the encoded frame is the new frame buffer, unless it is smaller than before */
+    if((uint32_t)encoded_size > *frame_buffer_size)
+    {
+        free(*frame_buffer);
+        *frame_buffer = encoded;
+        *frame_buffer_size = encoded_size;
+    }
+    else
+    {
+        memcpy(*frame_buffer, encoded, encoded_size);
+        free(encoded);
+    }
+    *frame_size = encoded_size;
+
+    return ERR_OK;
+}
+
+/* unpack a frame that was compressed with any of the video class compression flags */
+static int frame_decompress(uint8_t **frame_buffer, uint32_t *frame_buffer_size, int *frame_size, int video_class, int xRes, int yRes, int depth, int verbose)
+{
+    if(video_class & MLV_VIDEO_CLASS_FLAG_LJ92)
+    {
+        return frame_lj92_decompress(frame_buffer, frame_buffer_size, frame_size, xRes, yRes, depth, verbose);
+    }
+
+#ifdef MLV_USE_LZMA
+    return frame_lzma_decompress(frame_buffer, frame_buffer_size, frame_size, verbose);
+#else
+    print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
+    return ERR_PARAM;
+#endif
+}
+
+/* subtract the reference (dark) frame */
+static void frame_subtract(uint8_t *frame_buffer, uint8_t *sub_buffer, int xRes, int yRes, int depth, int black)
+{
+    int pitch = xRes * depth / 8;
+    uint16_t *src_row = malloc(xRes * sizeof(uint16_t));
+    uint16_t *sub_row = malloc(xRes * sizeof(uint16_t));
+
+    for(int y = 0; y < yRes; y++)
+    {
+        bitunpack_row(&frame_buffer[y * pitch], src_row, xRes, depth);
+        bitunpack_row(&sub_buffer[y * pitch], sub_row, xRes, depth);
+
+        for(int x = 0; x < xRes; x++)
+        {
+            int32_t value = src_row[x];
+
+            value -= sub_row[x];
+            value += black; /* should we really add it here? or better subtract it from averaged frame? */
+            src_row[x] = COERCE(value, 0, (1<<depth)-1);
+        }
+
+        bitpack_row(&frame_buffer[y * pitch], src_row, xRes, depth);
+    }
+
+    free(src_row);
+    free(sub_row);
+}
+
+/* divide the image by the normalized reference frame.
+   the normalization is computed on the first call only, the flat frame is the same for all frames */
+static void frame_flatfield(uint8_t *frame_buffer, uint8_t *flat_buffer, int xRes, int yRes, int depth, int black)
+{
+    int pitch = xRes * depth / 8;
+
+    /* normalize flat frame on each Bayer channel (median) */
+    /* and adjust all medians using green's 5th percentile to prevent whites from clipping */
+    static int32_t med[2][2] = {{0,0},{0,0}};
+    static int32_t pr5[2][2] = {{0,0},{0,0}};
+    static int32_t adj_num = 0;
+    static int32_t adj_den = 0;
+
+    if (!med[0][0])
+    {
+        /* normalize using frame center only
+         * (also works on lenses with heavy vignetting) */
+        
+        int* hist[2][2];
+        int total[2][2] = {{0,0},{0,0}};
+        
+        hist[0][0] = calloc(1 << depth, sizeof(int));
+        hist[0][1] = calloc(1 << depth, sizeof(int));
+        hist[1][0] = calloc(1 << depth, sizeof(int));
+        hist[1][1] = calloc(1 << depth, sizeof(int));
+        
+        uint16_t *flat_row = malloc(xRes * sizeof(uint16_t));
+        for(int y = yRes/4; y < yRes*3/4; y++)
+        {
+            bitunpack_row(&flat_buffer[y * pitch], flat_row, xRes, depth);
+            for(int x = xRes/4; x < xRes*3/4; x++)
+            {
+                uint32_t value = flat_row[x];
+                hist[y%2][x%2][value]++;
+                total[y%2][x%2]++;
+            }
+        }
+        free(flat_row);
+        
+        for (int dy = 0; dy < 2; dy++)
+        {
+            for (int dx = 0; dx < 2; dx++)
+            {
+                int acc = 0;
+                for (int i = 0; i < (1 << depth); i++)
+                {
+                    acc += hist[dy][dx][i];
+                    
+                    if (acc < total[dy][dx]/20)
+                    {
+                        /* 5th percentile */
+                        pr5[dy][dx] = i - black;
+                    }
+                    
+                    if (acc < total[dy][dx]/2)
+                    {
+                        /* median */
+                        med[dy][dx] = i - black;
+                    }
+                }
+            }
+        }
+        
+        free(hist[0][0]);
+        free(hist[0][1]);
+        free(hist[1][0]);
+        free(hist[1][1]);
+        
+        adj_num = (pr5[0][1] + pr5[1][0]) / 2;
+        adj_den = (med[0][1] + med[1][0]) / 2;
+
+        print_msg(MSG_INFO, "Flat-field median: [%d %d; %d %d], adjusted by %d/%d\n", 
+            med[0][0], med[0][1],
+            med[1][0], med[1][1],
+            adj_num, adj_den
+        );
+    }
+    
+    uint16_t *src_row = malloc(xRes * sizeof(uint16_t));
+    uint16_t *flat_row = malloc(xRes * sizeof(uint16_t));
+
+    for(int y = 0; y < yRes; y++)
+    {
+        bitunpack_row(&frame_buffer[y * pitch], src_row, xRes, depth);
+        bitunpack_row(&flat_buffer[y * pitch], flat_row, xRes, depth);
+
+        for(int x = 0; x < xRes; x++)
+        {
+            int32_t value = src_row[x];
+            int32_t flat_value = flat_row[x];
+            
+            if (flat_value - black <= 0)
+            {
+                int left  = flat_row[MAX(x-1,0)];
+                int right = flat_row[MIN(x+1,xRes-1)];
+                flat_value = MAX(left, right);
+            }
+
+            if (flat_value - black > 0)
+            {
+                value -= black;
+                value = (int64_t) value * med[y%2][x%2] * adj_num / adj_den / (flat_value - black);
+                value += black;
+                value = COERCE(value, 0, (1<<depth)-1);
+            }
+
+            src_row[x] = value;
+        }
+
+        bitpack_row(&frame_buffer[y * pitch], src_row, xRes, depth);
+    }
+
+    free(src_row);
+    free(flat_row);
+}
+
+/* convert the frame at 'src' to another bit depth into the frame buffer. 'src' may be the frame buffer itself
+   or e.g. a memory mapped frame. the buffer is enlarged if the new frame does not fit */
+static int frame_resample(uint8_t *src, uint8_t **frame_buffer, uint32_t *frame_buffer_size, int *frame_size, int xRes, int yRes, int old_depth, int new_depth, int verbose)
+{
+    int new_size = (xRes * yRes * new_depth + 7) / 8;
+
+    if(verbose)
+    {
+        print_msg(MSG_INFO, "   depth: %d -> %d, size: %d -> %d (%2.2f%%)\n", old_depth, new_depth, *frame_size, new_size, ((float)new_depth * 100.0f) / (float)old_depth);
+    }
+
+    int calced_size = ((xRes * yRes * old_depth + 7) / 8);
+    if(calced_size > *frame_size)
+    {
+        print_msg(MSG_INFO, "Error: old frame size is too small for %dx%d at %d bpp. Input data corrupt. (%d < %d)\n", xRes, yRes, old_depth, *frame_size, calced_size);
+        return ERR_FILE;
+    }
+
+    /* need a separate buffer when converting in place or when the current one is too small */
+    uint8_t *new_buffer = *frame_buffer;
+    uint32_t new_buffer_size = MAX((uint32_t)new_size, *frame_buffer_size);
+
+    if(src == *frame_buffer || new_buffer_size > *frame_buffer_size)
+    {
+        new_buffer = malloc(new_buffer_size);
+        if(!new_buffer)
+        {
+            print_msg(MSG_ERROR, "Failed to allocate %d byte\n", new_buffer_size);
+            return ERR_MALLOC;
+        }
+    }
+
+    int old_pitch = xRes * old_depth / 8;
+    int new_pitch = xRes * new_depth / 8;
+    uint16_t *row = malloc(xRes * sizeof(uint16_t));
+
+    for(int y = 0; y < yRes; y++)
+    {
+        bitunpack_row(&src[y * old_pitch], row, xRes, old_depth);
+
+        for(int x = 0; x < xRes; x++)
+        {
+            uint16_t value = row[x];
+
+            /* normalize the old value to 16 bits */
+            value <<= (16-old_depth);
+
+            /* convert the old value to destination depth */
+            value >>= (16-new_depth);
+
+            row[x] = value;
+        }
+
+        bitpack_row(&new_buffer[y * new_pitch], row, xRes, new_depth);
+    }
+
+    free(row);
+
+    if(new_buffer != *frame_buffer)
+    {
+        free(*frame_buffer);
+        *frame_buffer = new_buffer;
+        *frame_buffer_size = new_buffer_size;
+    }
+    *frame_size = new_size;
+
+    return ERR_OK;
+}
+
+/* zero the lowest bits, so only 'bit_zap' bits contain data */
+static void frame_zap(uint8_t *frame_buffer, int xRes, int yRes, int depth, int bit_zap)
+{
+    int pitch = xRes * depth / 8;
+    uint32_t mask = ~((1 << (16 - bit_zap)) - 1);
+
+    uint16_t *row = malloc(xRes * sizeof(uint16_t));
+
+    for(int y = 0; y < yRes; y++)
+    {
+        bitunpack_row(&frame_buffer[y * pitch], row, xRes, depth);
+
+        for(int x = 0; x < xRes; x++)
+        {
+            int32_t value = row[x];
+
+            /* normalize the old value to 16 bits */
+            value <<= (16-depth);
+
+            value &= mask;
+
+            /* convert the old value to destination depth */
+            value >>= (16-depth);
+
+            row[x] = value;
+        }
+
+        bitpack_row(&frame_buffer[y * pitch], row, xRes, depth);
+    }
+
+    free(row);
+}
+
+/* pixel formats for streaming to stdout (--stdout) */
+#define STREAM_BAYER16      1
+#define STREAM_RGB48        2
+#define STREAM_YUV444P16    3
+
+static int frame_stream_size(int format, int xRes, int yRes)
+{
+    return xRes * yRes * ((format == STREAM_BAYER16) ? 1 : 3) * sizeof(uint16_t);
+}
+
+/* color at a CFA position, 0 = red, 1 = green, 2 = blue. the pattern is stored like the DNG CFAPattern tag */
+static int cfa_color(int32_t cfa_pattern, int x, int y)
+{
+    int color = (cfa_pattern >> (8 * (2 * (y & 1) + (x & 1)))) & 0xFF;
+
+    return (color > 2) ? 1 : color;
+}
+
+/* pixel format name as used by ffmpeg, so the stream can be described on its command line */
+static const char *stream_pixel_format(int format, int32_t cfa_pattern)
+{
+    switch(format)
+    {
+        case STREAM_RGB48:
+            return "rgb48le";
+        case STREAM_YUV444P16:
+            return "yuv444p16le";
+        default:
+            switch(cfa_pattern)
+            {
+                case 0x02010100:
+                    return "bayer_rggb16le";
+                case 0x00010102:
+                    return "bayer_bggr16le";
+                case 0x01020001:
+                    return "bayer_grbg16le";
+                case 0x01000201:
+                    return "bayer_gbrg16le";
+                default:
+                    return "gray16le";
+            }
+    }
+}
+
+/* convert a packed raw frame into the stream format:
+     - bayer16: the unpacked sensor values, untouched
+     - rgb48, yuv444p16: bilinear demosaic, black..white level scaled to 16 bits, linear, no white balance
+   yuv444p16 is planar full range BT.709, the others are interleaved 16 bit little endian words */
+static int frame_stream_convert(uint16_t *out, uint8_t *frame, int xRes, int yRes, int depth, struct raw_info *info, int format)
+{
+    int pitch = xRes * depth / 8;
+
+    if(format == STREAM_BAYER16)
+    {
+        for(int y = 0; y < yRes; y++)
+        {
+            bitunpack_row(&frame[y * pitch], &out[y * xRes], xRes, depth);
+        }
+        return ERR_OK;
+    }
+
+    if(xRes < 2 || yRes < 2)
+    {
+        return ERR_PARAM;
+    }
+
+    /* unpacked and scaled frame with a border of one pixel */
+    int pad_pitch = xRes + 2;
+    uint16_t *padded = malloc(pad_pitch * (yRes + 2) * sizeof(uint16_t));
+    uint16_t *lut = malloc((1 << depth) * sizeof(uint16_t));
+
+    if(!padded || !lut)
+    {
+        free(padded);
+        free(lut);
+        return ERR_MALLOC;
+    }
+
+    int black = info->black_level;
+    int range = MAX(1, info->white_level - black);
+
+    for(int value = 0; value < (1 << depth); value++)
+    {
+        int64_t scaled = ((int64_t)(value - black) * 65535 + range / 2) / range;
+        lut[value] = COERCE(scaled, 0, 65535);
+    }
+
+    for(int y = 0; y < yRes; y++)
+    {
+        uint16_t *row = &padded[(y + 1) * pad_pitch + 1];
+
+        bitunpack_row(&frame[y * pitch], row, xRes, depth);
+
+        for(int x = 0; x < xRes; x++)
+        {
+            row[x] = lut[row[x]];
+        }
+
+        /* mirror by two pixels, so the border has the same CFA layout */
+        row[-1] = row[1];
+        row[xRes] = row[xRes - 2];
+    }
+    memcpy(&padded[0], &padded[2 * pad_pitch], pad_pitch * sizeof(uint16_t));
+    memcpy(&padded[(yRes + 1) * pad_pitch], &padded[(yRes - 1) * pad_pitch], pad_pitch * sizeof(uint16_t));
+
+    /* for each position in the 2x2 CFA cell, the neighbors that are averaged for each color */
+    int offsets[4][3][9];
+    int counts[4][3];
+
+    for(int cell = 0; cell < 4; cell++)
+    {
+        int cell_x = cell & 1;
+        int cell_y = cell >> 1;
+        int own = cfa_color(info->cfa_pattern, cell_x, cell_y);
+
+        memset(counts[cell], 0x00, sizeof(counts[cell]));
+
+        for(int dy = -1; dy <= 1; dy++)
+        {
+            for(int dx = -1; dx <= 1; dx++)
+            {
+                int color = cfa_color(info->cfa_pattern, cell_x + dx, cell_y + dy);
+
+                if(color != own)
+                {
+                    offsets[cell][color][counts[cell][color]++] = dy * pad_pitch + dx;
+                }
+            }
+        }
+
+        offsets[cell][own][0] = 0;
+        counts[cell][own] = 1;
+    }
+
+    int plane = xRes * yRes;
+
+    for(int y = 0; y < yRes; y++)
+    {
+        uint16_t *row = &padded[(y + 1) * pad_pitch + 1];
+
+        for(int x = 0; x < xRes; x++)
+        {
+            int cell = ((y & 1) << 1) | (x & 1);
+            uint32_t rgb[3];
+
+            for(int color = 0; color < 3; color++)
+            {
+                int count = counts[cell][color];
+                uint32_t sum = 0;
+
+                for(int pos = 0; pos < count; pos++)
+                {
+                    sum += row[x + offsets[cell][color][pos]];
+                }
+                rgb[color] = count ? (sum + count / 2) / count : 0;
+            }
+
+            int pixel = y * xRes + x;
+
+            if(format == STREAM_RGB48)
+            {
+                out[3 * pixel + 0] = rgb[0];
+                out[3 * pixel + 1] = rgb[1];
+                out[3 * pixel + 2] = rgb[2];
+            }
+            else
+            {
+                /* BT.709 coefficients in 1/65536 and 1/32768 */
+                int32_t luma = (13933 * rgb[0] + 46871 * rgb[1] + 4732 * rgb[2] + 32768) >> 16;
+                int32_t cb = 32768 + ((((int32_t)rgb[2] - luma) * 17659 + 16384) >> 15);
+                int32_t cr = 32768 + ((((int32_t)rgb[0] - luma) * 20808 + 16384) >> 15);
+
+                out[pixel] = COERCE(luma, 0, 65535);
+                out[plane + pixel] = COERCE(cb, 0, 65535);
+                out[2 * plane + pixel] = COERCE(cr, 0, 65535);
+            }
+        }
+    }
+
+    free(padded);
+    free(lut);
+
+    return ERR_OK;
+}
+
+/* delta encode the frame against the reference frame, or decode it again */
+static void frame_delta(uint8_t *frame_buffer, uint8_t *ref_buffer, int xRes, int yRes, int depth, int decode)
+{
+    int pitch = xRes * depth / 8;
+    int32_t offset = 1 << (depth - 1);
+    int32_t max_val = (1 << depth) - 1;
+    uint16_t *src_row = malloc(xRes * sizeof(uint16_t));
+    uint16_t *ref_row = malloc(xRes * sizeof(uint16_t));
+
+    for(int y = 0; y < yRes; y++)
+    {
+        bitunpack_row(&frame_buffer[y * pitch], src_row, xRes, depth);
+        bitunpack_row(&ref_buffer[y * pitch], ref_row, xRes, depth);
+
+        for(int x = 0; x < xRes; x++)
+        {
+            /* when e.g. using 16 bit values:
+                   delta =  1      -> encode to 0x8001
+                   delta =  0      -> encode to 0x8000
+                   delta = -1      -> encode to 0x7FFF
+                   delta = -0xFFFF -> encode to 0x0001
+                   delta =  0xFFFF -> encode to 0x7FFF
+               so this is basically a signed int with overflow and a max/2 offset.
+               this offset makes the frames uniform grey when viewing non-decoded frames and improves compression rate a bit.
+            */
+            int32_t delta = decode ? (offset + src_row[x] + ref_row[x]) : (offset + src_row[x] - ref_row[x]);
+
+            src_row[x] = (uint16_t)(delta & max_val);
+        }
+
+        bitpack_row(&frame_buffer[y * pitch], src_row, xRes, depth);
+    }
+
+    free(src_row);
+    free(ref_row);
+}
+
+/* the first frame of every 'interval' frame numbers is a keyframe, coded against black instead of the previous frame.
+   decoding can start at any keyframe. without interval, only the very first frame is one */
+static int delta_keyframe(uint32_t frame_number, uint32_t interval, int64_t *group)
+{
+    int64_t current = interval ? frame_number / interval : 0;
+    int keyframe = (current != *group);
+
+    *group = current;
+    return keyframe;
+}
+
+/* keyframe interval from the DELT block, which is written behind the file header */
+static uint32_t delta_read_interval(mlv_reader_t *in_file)
+{
+    uint32_t interval = 0;
+
+    mlv_reader_set_pos(in_file, 0, SEEK_SET);
+
+    /* only the header blocks in front of the first frame are searched */
+    for(int block = 0; block < 64; block++)
+    {
+        mlv_hdr_t buf;
+        uint64_t position = mlv_reader_get_pos(in_file);
+
+        if(mlv_reader_read(&buf, sizeof(mlv_hdr_t), in_file) != 1 || buf.blockSize < sizeof(mlv_hdr_t) ||
+           !memcmp(buf.blockType, "VIDF", 4) || !memcmp(buf.blockType, "AUDF", 4))
+        {
+            break;
+        }
+
+        if(!memcmp(buf.blockType, "DELT", 4) && buf.blockSize >= sizeof(mlv_delt_hdr_t))
+        {
+            mlv_delt_hdr_t delt;
+
+            mlv_reader_set_pos(in_file, position, SEEK_SET);
+            if(mlv_reader_read(&delt, sizeof(mlv_delt_hdr_t), in_file) == 1)
+            {
+                interval = delt.keyInterval;
+            }
+            break;
+        }
+
+        mlv_reader_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+    }
+
+    mlv_reader_set_pos(in_file, 0, SEEK_SET);
+    return interval;
+}
+
+/* set up the raw_info of a frame for the raw2dng and DNG code */
+static void dng_init_raw_info(struct raw_info *info, struct raw_info *clip_info, uint8_t *frame_buffer, int frame_size, int xRes, int yRes)
+{
+    *info = *clip_info;
+    info->frame_size = frame_size;
+    info->buffer = frame_buffer;
+
+    /* override the resolution from raw_info with the one from lv_rec_footer, if they don't match */
+    if (xRes != info->width)
+    {
+        info->width = xRes;
+        info->pitch = info->width * info->bits_per_pixel / 8;
+        info->active_area.x1 = 0;
+        info->active_area.x2 = info->width;
+        info->jpeg.x = 0;
+        info->jpeg.width = info->width;
+    }
+
+    if (yRes != info->height)
+    {
+        info->height = yRes;
+        info->active_area.y1 = 0;
+        info->active_area.y2 = info->height;
+        info->jpeg.y = 0;
+        info->jpeg.height = info->height;
+    }
+}
+
+/* geometry and levels for image output (--tiff, --ppm). the levels in raw_info stay at the recorded bit depth, so scale them like frame_resample() scales the pixels */
+static void image_init_frame(image_frame_t *frame, struct raw_info *info, int depth)
+{
+    int recorded_depth = info->bits_per_pixel ? info->bits_per_pixel : 14;
+
+    frame->width = info->width;
+    frame->height = info->height;
+    frame->depth = depth;
+    frame->black_level = (info->black_level << (16 - recorded_depth)) >> (16 - depth);
+    frame->white_level = (info->white_level << (16 - recorded_depth)) >> (16 - depth);
+    frame->cfa_pattern = info->cfa_pattern;
+    frame->x1 = info->active_area.x1;
+    frame->y1 = info->active_area.y1;
+    frame->x2 = info->active_area.x2;
+    frame->y2 = info->active_area.y2;
+}
+
+/* 
+    the stripe and cold pixel analysis is made on one frame and applied to the following ones.
+    it is only valid for frames with the same geometry and levels, so these are remembered
+    and the next frame gets analyzed again when they change or every 'refresh' frames (--fix-refresh)
+*/
+typedef struct
+{
+    struct raw_fix_analysis *analysis;
+    int analyzed;
+    int width;
+    int height;
+    int crop_x;
+    int crop_y;
+    int black_level;
+    int white_level;
+    uint32_t frame_number;
+} dng_fix_cache_t;
+
+/* returns nonzero if the frame can not use the current analysis */
+static int dng_fix_cache_stale(dng_fix_cache_t *cache, struct raw_info *info, int width, int height, int crop_x, int crop_y, uint32_t frame_number, int refresh)
+{
+    if(!cache->analyzed)
+    {
+        return 1;
+    }
+
+    if(cache->width != width || cache->height != height || cache->crop_x != crop_x || cache->crop_y != crop_y ||
+       cache->black_level != info->black_level || cache->white_level != info->white_level)
+    {
+        return 1;
+    }
+
+    /* also refresh when seeking backwards */
+    return refresh > 0 && (frame_number < cache->frame_number || frame_number - cache->frame_number >= (uint32_t)refresh);
+}
+
+/* the next frame passed to dng_fix_frame() will be analyzed */
+static void dng_fix_cache_renew(dng_fix_cache_t *cache, struct raw_info *info, int width, int height, int crop_x, int crop_y, uint32_t frame_number)
+{
+    raw_fix_analysis_reset(cache->analysis);
+    cache->analyzed = 1;
+    cache->width = width;
+    cache->height = height;
+    cache->crop_x = crop_x;
+    cache->crop_y = crop_y;
+    cache->black_level = info->black_level;
+    cache->white_level = info->white_level;
+    cache->frame_number = frame_number;
+}
+
+/* raw2dng style corrections of a frame before saving it as DNG. returns nonzero if the image data was changed */
+static int dng_fix_frame(struct raw_info *info, struct raw_fix_analysis *analysis, int fix_vert_stripes, int fix_cold_pixels, int chroma_smooth_method, int threads, chroma_planes_t *chroma_planes)
+{
+    int modified = 0;
+
+    /* call raw2dng code */
+    if (fix_vert_stripes)
+    {
+        modified |= fix_vertical_stripes_analysis(info, analysis);
+    }
+    
+    if (fix_cold_pixels)
+    {
+        modified |= (find_and_fix_cold_pixels_analysis(info, analysis, fix_cold_pixels == 2) > 0);
+    }
+
+    /* this is internal again */
+    chroma_smooth(chroma_smooth_method, info, threads, chroma_planes);
+    modified |= (chroma_smooth_method != 0);
+
+    return modified;
+}
+
+/* chdk-dng takes 16 bit frames as big endian words (see raw_to_8bit), the way cr2hdr hands them over.
+   MLV frames are little endian, so they are swapped once the corrections are done, right before saving or encoding */
+static void dng_frame_byte_order(struct raw_info *info, uint8_t *frame_buffer, int frame_size)
+{
+    if(info->bits_per_pixel != 16)
+    {
+        return;
+    }
+
+    uint16_t *words = (uint16_t *)frame_buffer;
+    for(int i = 0; i < frame_size / 2; i++)
+    {
+        words[i] = (words[i] >> 8) | (words[i] << 8);
+    }
+}
+
+/* set MLV metadata into DNG tags */
+static void dng_set_metadata(mlv_file_hdr_t *main_header, mlv_expo_hdr_t *expo_info, mlv_lens_hdr_t *lens_info, mlv_rtci_hdr_t *rtci_info, mlv_idnt_hdr_t *idnt_info, const char *camname, char *info_string, uint64_t timestamp)
+{
+    dng_set_framerate_rational(main_header->sourceFpsNom, main_header->sourceFpsDenom);
+    dng_set_shutter(1, (int)(1000000.0f/(float)expo_info->shutterValue));
+    dng_set_aperture(lens_info->aperture, 100);
+    dng_set_camname((char*)camname);
+    dng_set_description(info_string);
+    dng_set_lensmodel((char*)lens_info->lensName);
+    dng_set_focal(lens_info->focalLength, 1);
+    dng_set_iso(expo_info->isoValue);
+
+    //dng_set_wbgain(1024, wbal_info.wbgain_r, 1024, wbal_info.wbgain_g, 1024, wbal_info.wbgain_b);
+
+    /* calculate the time this frame was taken at, i.e., the start time + the current timestamp. this can be off by a second but it's better than nothing */
+    int ms = 0.5 + timestamp / 1000.0;
+    int sec = ms / 1000;
+    ms %= 1000;
+    // FIXME: the struct tm doesn't have tm_gmtoff on Linux so the result might be wrong?
+    struct tm tm;
+    tm.tm_sec = rtci_info->tm_sec + sec;
+    tm.tm_min = rtci_info->tm_min;
+    tm.tm_hour = rtci_info->tm_hour;
+    tm.tm_mday = rtci_info->tm_mday;
+    tm.tm_mon = rtci_info->tm_mon;
+    tm.tm_year = rtci_info->tm_year;
+    tm.tm_wday = rtci_info->tm_wday;
+    tm.tm_yday = rtci_info->tm_yday;
+    tm.tm_isdst = rtci_info->tm_isdst;
+
+    if(mktime(&tm) != -1)
+    {
+        char datetime_str[32];
+        char subsec_str[8];
+        strftime(datetime_str, 20, "%Y:%m:%d %H:%M:%S", &tm);
+        snprintf(subsec_str, sizeof(subsec_str), "%03d", ms);
+        dng_set_datetime(datetime_str, subsec_str);
+    }
+    else
+    {
+        // soemthing went wrong. let's proceed anyway
+        print_msg(MSG_ERROR, "VIDF: [W] Failed calculating the DateTime from the timestamp\n");
+        dng_set_datetime("", "");
+    }
+
+
+    uint64_t serial = 0;
+    char *end;
+    serial = strtoull((char *)idnt_info->cameraSerial, &end, 16);
+    if (serial && !*end)
+    {
+        char serial_str[64];
+
+        sprintf(serial_str, "%"PRIu64, serial);
+        dng_set_camserial((char*)serial_str);
+    }
+}
+
+/* 
+    threaded frame processing (--threads):
+    the main loop only reads the frames, decompression, arithmetics, raw2dng corrections,
+    chroma smoothing, LZMA/LJ92 compression and stream conversion run on the worker threads.
+    a single thread writes the DNG files in frame order, as the DNG writer uses global state,
+    the MLV blocks in the order they were read or the frames into the stdout stream.
+*/
+typedef struct
+{
+    /* settings, constant while the pipeline is running */
+    char *output_filename;
+    FILE *out_file;
+    int dng_output;
+    int stream_output;
+    int image_output;
+    image_setup_t *image_setup;
+    int verbose;
+    int bit_depth;
+    int bit_zap;
+    int fix_vert_stripes;
+    int fix_cold_pixels;
+    struct raw_fix_analysis *fix_analysis;
+    int chroma_smooth_method;
+    uint8_t *frame_sub_buffer;
+    uint32_t subtract_frame_buffer_size;
+    uint8_t *frame_flat_buffer;
+    uint32_t flatfield_frame_buffer_size;
+    reflib_calib_t *ref_calib;
+    int compress_output;
+    int compress_format;
+    int lj92_passthrough;
+    int dng_compress;
+    int lzma_level;
+    int lzma_dict;
+    int lzma_lc;
+    int lzma_lp;
+    int lzma_pb;
+    int lzma_fb;
+    int lzma_threads;
+} frame_pipeline_ctx_t;
+
+typedef struct
+{
+    /* the frame buffer is kept when the job slot gets reused */
+    uint8_t *frame_buffer;
+    uint32_t frame_buffer_size;
+    int frame_size;
+    int read_size;
+    int compressed;
+
+    /* DNG output: copy of the LJ92 frame, saved as it is if the image data was not changed */
+    uint8_t *lj92_buffer;
+    uint32_t lj92_buffer_size;
+    int lj92_size;
+
+    /* DNG output with --lj92: the other frames, encoded in tiles */
+    struct dng_tiles dng_tiles;
+
+    /* DNG output: unpacked planes for chroma smoothing */
+    chroma_planes_t chroma_planes;
+
+    /* stream or image output: the converted frame */
+    uint8_t *stream_buffer;
+    uint32_t stream_buffer_size;
+    int stream_size;
+    int image_width;
+    int image_height;
+
+    /* MLV output: header of the block, audio blocks are passed through unchanged */
+    mlv_vidf_hdr_t vidf_hdr;
+    mlv_audf_hdr_t audf_hdr;
+    int audio;
+
+    /* metadata valid at the time this frame was read */
+    uint32_t frame_number;
+    uint64_t timestamp;
+    int xRes;
+    int yRes;
+    struct raw_info clip_info;
+    struct raw_info raw_info;
+    mlv_file_hdr_t main_header;
+    mlv_expo_hdr_t expo_info;
+    mlv_lens_hdr_t lens_info;
+    mlv_rtci_hdr_t rtci_info;
+    mlv_idnt_hdr_t idnt_info;
+    const char *camname;
+    char info_string[256];
+
+    /* --profile=json: stages of this frame, from reading to writing */
+    struct profile prof;
+} frame_job_t;
+
+/* make sure the job buffer can hold 'size' bytes */
+static int frame_job_reserve(frame_job_t *job, uint32_t size)
+{
+    if(size > job->frame_buffer_size)
+    {
+        uint8_t *new_buffer = realloc(job->frame_buffer, size);
+        if(!new_buffer)
+        {
+            return ERR_MALLOC;
+        }
+        memset(new_buffer, 0x00, size);
+        job->frame_buffer = new_buffer;
+        job->frame_buffer_size = size;
+    }
+
+    return ERR_OK;
+}
+
+static int frame_pipeline_process(void *ctx, void *job_ptr)
+{
+    frame_pipeline_ctx_t *pipe_ctx = ctx;
+    frame_job_t *job = job_ptr;
+
+    int old_depth = job->clip_info.bits_per_pixel;
+
+    job->lj92_size = 0;
+    if(pipe_ctx->lj92_passthrough && (job->compressed & MLV_VIDEO_CLASS_FLAG_LJ92))
+    {
+        if((uint32_t)job->frame_size > job->lj92_buffer_size)
+        {
+            uint8_t *new_buffer = realloc(job->lj92_buffer, job->frame_size);
+            if(!new_buffer)
+            {
+                return ERR_MALLOC;
+            }
+            job->lj92_buffer = new_buffer;
+            job->lj92_buffer_size = job->frame_size;
+        }
+        memcpy(job->lj92_buffer, job->frame_buffer, job->frame_size);
+        job->lj92_size = job->frame_size;
+    }
+
+    if(job->compressed)
+    {
+        profile_begin(&job->prof, "decompress");
+        int ret = frame_decompress(&job->frame_buffer, &job->frame_buffer_size, &job->frame_size, job->compressed, job->xRes, job->yRes, old_depth, pipe_ctx->verbose);
+        if(ret)
+        {
+            return ret;
+        }
+        profile_end(&job->prof, "decompress", job->frame_size);
+    }
+
+    int new_depth = pipe_ctx->bit_depth;
+    int current_depth = old_depth;
+
+    if(pipe_ctx->frame_sub_buffer)
+    {
+        if((int)pipe_ctx->subtract_frame_buffer_size != job->frame_size)
+        {
+            print_msg(MSG_ERROR, "Error: Frame sizes of footage and subtract frame differ (%d, %d)", job->frame_size, pipe_ctx->subtract_frame_buffer_size);
+            return ERR_PARAM;
+        }
+        profile_begin(&job->prof, "subtract");
+        frame_subtract(job->frame_buffer, pipe_ctx->frame_sub_buffer, job->xRes, job->yRes, current_depth, job->clip_info.black_level);
+        profile_end(&job->prof, "subtract", job->frame_size);
+    }
+
+    if(pipe_ctx->frame_flat_buffer)
+    {
+        if((int)pipe_ctx->flatfield_frame_buffer_size != job->frame_size)
+        {
+            print_msg(MSG_ERROR, "Error: Frame sizes of footage and flat-field frame differ (%d, %d)", job->frame_size, pipe_ctx->flatfield_frame_buffer_size);
+            return ERR_PARAM;
+        }
+        profile_begin(&job->prof, "flatfield");
+        frame_flatfield(job->frame_buffer, pipe_ctx->frame_flat_buffer, job->xRes, job->yRes, current_depth, job->clip_info.black_level);
+        profile_end(&job->prof, "flatfield", job->frame_size);
+    }
+
+    if(pipe_ctx->ref_calib)
+    {
+        profile_begin(&job->prof, "reflib");
+        reflib_apply(pipe_ctx->ref_calib, job->frame_buffer, current_depth);
+        profile_end(&job->prof, "reflib", job->frame_size);
+    }
+
+    if(new_depth && (old_depth != new_depth))
+    {
+        profile_begin(&job->prof, "resample");
+        int ret = frame_resample(job->frame_buffer, &job->frame_buffer, &job->frame_buffer_size, &job->frame_size, job->xRes, job->yRes, old_depth, new_depth, pipe_ctx->verbose);
+        if(ret)
+        {
+            return ret;
+        }
+        profile_end(&job->prof, "resample", job->frame_size);
+        current_depth = new_depth;
+    }
+
+    if(pipe_ctx->bit_zap)
+    {
+        profile_begin(&job->prof, "zap");
+        frame_zap(job->frame_buffer, job->xRes, job->yRes, current_depth, pipe_ctx->bit_zap);
+        profile_end(&job->prof, "zap", job->frame_size);
+    }
+
+    if(pipe_ctx->stream_output)
+    {
+        job->stream_size = frame_stream_size(pipe_ctx->stream_output, job->xRes, job->yRes);
+        if((uint32_t)job->stream_size > job->stream_buffer_size)
+        {
+            uint8_t *new_buffer = realloc(job->stream_buffer, job->stream_size);
+            if(!new_buffer)
+            {
+                return ERR_MALLOC;
+            }
+            job->stream_buffer = new_buffer;
+            job->stream_buffer_size = job->stream_size;
+        }
+        profile_begin(&job->prof, "stream_convert");
+        int ret = frame_stream_convert((uint16_t *)job->stream_buffer, job->frame_buffer, job->xRes, job->yRes, current_depth, &job->clip_info, pipe_ctx->stream_output);
+        profile_end(&job->prof, "stream_convert", job->frame_size);
+        return ret;
+    }
+
+    if(!pipe_ctx->dng_output)
+    {
+        if(pipe_ctx->compress_output)
+        {
+            int ret = 0;
+            profile_begin(&job->prof, "compress");
+            if(pipe_ctx->compress_format == MLV_VIDEO_CLASS_FLAG_LJ92)
+            {
+                ret = frame_lj92_compress(&job->frame_buffer, &job->frame_buffer_size, &job->frame_size, job->xRes, job->yRes, current_depth, pipe_ctx->verbose);
+                profile_end(&job->prof, "compress", job->read_size);
+                return ret;
+            }
+#ifdef MLV_USE_LZMA
+            ret = frame_lzma_compress(&job->frame_buffer, &job->frame_buffer_size, &job->frame_size, pipe_ctx->lzma_level, pipe_ctx->lzma_dict, pipe_ctx->lzma_lc, pipe_ctx->lzma_lp, pipe_ctx->lzma_pb, pipe_ctx->lzma_fb, pipe_ctx->lzma_threads, pipe_ctx->verbose);
+            profile_end(&job->prof, "compress", job->read_size);
+            return ret;
+#else
+            print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
+            return ERR_PARAM;
+#endif
+        }
+        return ERR_OK;
+    }
+
+    profile_begin(&job->prof, "dng_fix");
+    dng_init_raw_info(&job->raw_info, &job->clip_info, job->frame_buffer, job->frame_size, job->xRes, job->yRes);
+    if(dng_fix_frame(&job->raw_info, pipe_ctx->fix_analysis, pipe_ctx->fix_vert_stripes, pipe_ctx->fix_cold_pixels, pipe_ctx->chroma_smooth_method, 1, &job->chroma_planes))
+    {
+        job->lj92_size = 0;
+    }
+    profile_end(&job->prof, "dng_fix", job->frame_size);
+
+    if(!pipe_ctx->image_output)
+    {
+        dng_frame_byte_order(&job->raw_info, job->frame_buffer, job->frame_size);
+    }
+
+    /* frames that are not passed through are encoded here, the writer only saves the tiles */
+    if(pipe_ctx->dng_compress && !pipe_ctx->image_output && !job->lj92_size)
+    {
+        profile_begin(&job->prof, "compress");
+        int ok = dng_encode_tiles(&job->raw_info, &lj92_encode, DNG_TILE_SIZE, DNG_TILE_SIZE, &job->dng_tiles);
+        profile_end(&job->prof, "compress", job->frame_size);
+
+        if(!ok)
+        {
+            print_msg(MSG_ERROR, "VIDF: Failed to encode the DNG tiles\n");
+            dng_free_tiles(&job->dng_tiles);
+            return ERR_MALLOC;
+        }
+    }
+
+    if(pipe_ctx->image_output)
+    {
+        image_frame_t frame;
+        image_init_frame(&frame, &job->raw_info, current_depth);
+
+        if(image_size(pipe_ctx->image_setup, &frame, &job->image_width, &job->image_height))
+        {
+            print_msg(MSG_ERROR, "VIDF: Cannot demosaic a %dx%d frame with CFA pattern 0x%08X\n", frame.width, frame.height, frame.cfa_pattern);
+            return ERR_PARAM;
+        }
+
+        job->stream_size = job->image_width * job->image_height * 3 * sizeof(uint16_t);
+        if((uint32_t)job->stream_size > job->stream_buffer_size)
+        {
+            uint8_t *new_buffer = realloc(job->stream_buffer, job->stream_size);
+            if(!new_buffer)
+            {
+                return ERR_MALLOC;
+            }
+            job->stream_buffer = new_buffer;
+            job->stream_buffer_size = job->stream_size;
+        }
+
+        profile_begin(&job->prof, "demosaic");
+        if(image_convert(pipe_ctx->image_setup, &frame, job->frame_buffer, (uint16_t *)job->stream_buffer))
+        {
+            return ERR_MALLOC;
+        }
+        profile_end(&job->prof, "demosaic", job->frame_size);
+    }
+
+    return ERR_OK;
+}
+
+static int dng_pipeline_write(void *ctx, void *job_ptr)
+{
+    frame_pipeline_ctx_t *pipe_ctx = ctx;
+    frame_job_t *job = job_ptr;
+
+    int frame_filename_len = strlen(pipe_ctx->output_filename) + 32;
+    char *frame_filename = malloc(frame_filename_len);
+
+    if(pipe_ctx->image_output)
+    {
+        snprintf(frame_filename, frame_filename_len, "%s%06d.%s", pipe_ctx->output_filename, job->frame_number, image_extension(pipe_ctx->image_output));
+
+        profile_begin(&job->prof, "write_image");
+        int ret = image_save(frame_filename, pipe_ctx->image_output, (uint16_t *)job->stream_buffer, job->image_width, job->image_height);
+        profile_end(&job->prof, "write_image", job->stream_size);
+        free(frame_filename);
+
+        if(ret)
+        {
+            print_msg(MSG_ERROR, "VIDF: Failed writing into .%s file\n", image_extension(pipe_ctx->image_output));
+            return ERR_FILE;
+        }
+
+        profile_report(&job->prof);
+        return ERR_OK;
+    }
+
+    snprintf(frame_filename, frame_filename_len, "%s%06d.dng", pipe_ctx->output_filename, job->frame_number);
+
+    /* the DNG writer and its thumbnail code use the global raw_info */
+    raw_info = job->raw_info;
+
+    dng_set_metadata(&job->main_header, &job->expo_info, &job->lens_info, &job->rtci_info, &job->idnt_info, job->camname, job->info_string, job->timestamp);
+
+    profile_begin(&job->prof, "write_dng");
+    int ret = 0;
+    if(job->dng_tiles.count)
+    {
+        ret = save_dng_tiles(frame_filename, &raw_info, &job->dng_tiles);
+        dng_free_tiles(&job->dng_tiles);
+    }
+    else
+    {
+        ret = job->lj92_size ? save_dng_lj92(frame_filename, &raw_info, job->lj92_buffer, job->lj92_size) : save_dng(frame_filename, &raw_info);
+    }
+    profile_end(&job->prof, "write_dng", job->lj92_size ? job->lj92_size : raw_info.frame_size);
+    free(frame_filename);
+
+    if(!ret)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed writing into .DNG file\n");
+        return ERR_FILE;
+    }
+
+    profile_report(&job->prof);
+    return ERR_OK;
+}
+
+static int mlv_pipeline_write(void *ctx, void *job_ptr)
+{
+    frame_pipeline_ctx_t *pipe_ctx = ctx;
+    frame_job_t *job = job_ptr;
+
+    if(job->audio)
+    {
+        if(fwrite(&job->audf_hdr, sizeof(mlv_audf_hdr_t), 1, pipe_ctx->out_file) != 1 || fwrite(job->frame_buffer, job->frame_size, 1, pipe_ctx->out_file) != 1)
+        {
+            print_msg(MSG_ERROR, "AUDF: Failed writing into .MLV file\n");
+            return ERR_FILE;
+        }
+        return ERR_OK;
+    }
+
+    if(job->frame_size != job->read_size)
+    {
+        print_msg(MSG_INFO, "  saving: %d -> %d  (%2.2f%%)\n", job->read_size, job->frame_size, ((float)job->frame_size * 100.0f) / (float)job->read_size);
+    }
+
+    /* delete free space and correct header size if needed */
+    job->vidf_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + job->frame_size;
+    job->vidf_hdr.frameSpace = 0;
+
+    profile_begin(&job->prof, "write_mlv");
+    if(fwrite(&job->vidf_hdr, sizeof(mlv_vidf_hdr_t), 1, pipe_ctx->out_file) != 1 || fwrite(job->frame_buffer, job->frame_size, 1, pipe_ctx->out_file) != 1)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
+        return ERR_FILE;
+    }
+    profile_end(&job->prof, "write_mlv", job->vidf_hdr.blockSize);
+
+    profile_report(&job->prof);
+    return ERR_OK;
+}
+
+static int stream_pipeline_write(void *ctx, void *job_ptr)
+{
+    frame_pipeline_ctx_t *pipe_ctx = ctx;
+    frame_job_t *job = job_ptr;
+
+    profile_begin(&job->prof, "write_stream");
+    if(fwrite(job->stream_buffer, job->stream_size, 1, pipe_ctx->out_file) != 1)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed writing into stream\n");
+        return ERR_FILE;
+    }
+    profile_end(&job->prof, "write_stream", job->stream_size);
+
+    profile_report(&job->prof);
+    return ERR_OK;
+}
+
+static void frame_pipeline_free_job(void *job_ptr)
+{
+    frame_job_t *job = job_ptr;
+
+    free(job->frame_buffer);
+    free(job->lj92_buffer);
+    free(job->stream_buffer);
+    dng_free_tiles(&job->dng_tiles);
+    chroma_free_planes(&job->chroma_planes);
+}
+
+void show_usage(char *executable)
+{
+    print_msg(MSG_INFO, "Usage: %s [-o output_file] [-rscd] [-l compression_level(0-9)] <inputfile>\n", executable);
+    print_msg(MSG_INFO, "Parameters:\n");
+    print_msg(MSG_INFO, " -o output_file      set the filename to write into\n");
+    print_msg(MSG_INFO, " -v                  verbose output\n");
+    print_msg(MSG_INFO, " --batch             output message suitable for batch processing\n");
+    print_msg(MSG_INFO, " --threads N         process N frames in parallel (DNG export, MLV arithmetics and compression)\n");
+    print_msg(MSG_INFO, " --profile=json      print wall time, CPU time, bytes and peak memory of each processing stage,\n");
+    print_msg(MSG_INFO, "                     one JSON line per video frame on stderr, plus a summary at the end\n");
+    
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- DNG output --\n");
+    print_msg(MSG_INFO, " --dng               output frames into separate .dng files. set prefix with -o\n");
+    print_msg(MSG_INFO, " --no-cs             no chroma smoothing (default)\n");
+    print_msg(MSG_INFO, " --cs2x2             2x2 chroma smoothing\n");
+    print_msg(MSG_INFO, " --cs3x3             3x3 chroma smoothing\n");
+    print_msg(MSG_INFO, " --cs5x5             5x5 chroma smoothing\n");
+    print_msg(MSG_INFO, " --no-fixcp          do not fix cold pixels\n");
+    print_msg(MSG_INFO, " --fixcp2            fix non-static (moving) cold pixels (slow)\n");
+    print_msg(MSG_INFO, " --no-stripes        do not fix vertical stripes in highlights\n");
+    print_msg(MSG_INFO, " --fix-refresh N     analyze stripes and cold pixels again every N frames (default: first frame only)\n");
+
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- Image output --\n");
+    print_msg(MSG_INFO, " --tiff, --ppm       output demosaiced frames into separate 16 bit .tiff or .ppm files, sRGB. set prefix with -o\n");
+    print_msg(MSG_INFO, "                     white balance from the WBAL block (daylight if missing), colors from the RAWI color matrix\n");
+    print_msg(MSG_INFO, "                     the DNG output options for chroma smoothing, cold pixels and stripes apply as well\n");
+    print_msg(MSG_INFO, " --demosaic=method   amaze (default): best quality, split into tiles on all CPUs (one per frame with --threads)\n");
+    print_msg(MSG_INFO, "                     bilinear: fast, half: fastest, half resolution\n");
+
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- RAW output --\n");
+    print_msg(MSG_INFO, " -r                  output into a legacy raw file for e.g. raw2dng\n");
+
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- Stream output --\n");
+    print_msg(MSG_INFO, " --stdout[=format]   write the video frames to stdout for piping into an encoder, messages go to stderr\n");
+    print_msg(MSG_INFO, "                     bayer16 (default): unpacked 16 bit raw data as recorded\n");
+    print_msg(MSG_INFO, "                     rgb48, yuv444p16 : simple demosaic, linear, black to white level scaled to 16 bits\n");
+    print_msg(MSG_INFO, "                     with -o name, audio is saved into name.wav\n");
+
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- MLV output --\n");
+    print_msg(MSG_INFO, " -b bits             convert image data to given bit depth per channel (1-16)\n");
+    print_msg(MSG_INFO, " -z bits             zero the lowest bits, so we have only specified number of bits containing data (1-16) (improves compression rate)\n");
+    print_msg(MSG_INFO, " -f frames           frames to save. e.g. '12' saves frames 0 to 12, '12-40' saves frames 12 to 40.\n");
+    print_msg(MSG_INFO, " -A fpsx1000         Alter the video file's FPS metadata\n");
+    print_msg(MSG_INFO, " -x                  build xref file (indexing)\n");
+    print_msg(MSG_INFO, " -m                  write only metadata, no audio or video frames\n");
+    print_msg(MSG_INFO, " -n                  write no metadata, only audio and video frames\n");
+
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- Image manipulation --\n");
+    print_msg(MSG_INFO, " -a                  average all frames in <inputfile> and output a single-frame MLV from it\n");
+    print_msg(MSG_INFO, " --avg-vertical      [DARKFRAME ONLY] average the resulting frame in vertical direction, so we will extract vertical banding\n");
+    print_msg(MSG_INFO, " --avg-horizontal    [DARKFRAME ONLY] average the resulting frame in horizontal direction, so we will extract horizontal banding\n");
+    print_msg(MSG_INFO, " -s mlv_file         subtract the reference frame in given file from every single frame during processing\n");
+    print_msg(MSG_INFO, " -t mlv_file         use the reference frame in given file as flat field (gain correction)\n");
+    print_msg(MSG_INFO, " --dark-lib=dir      use the darkframe matching camera, ISO, resolution, crop and bit depth from this library.\n");
+    print_msg(MSG_INFO, "                     with -a, also store the averaged frame in the library\n");
+    print_msg(MSG_INFO, " --flat-lib=dir      same for flat-field frames\n");
+
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, "-- Processing --\n");
+    print_msg(MSG_INFO, " -e                  delta-encode frames to improve compression, but lose random access capabilities\n");
+    print_msg(MSG_INFO, " --keyframes=N       with -e, code every N-th frame on its own, so decoding can start there (random access)\n");
+    print_msg(MSG_INFO, " -X type             extract only block type\n");
+    print_msg(MSG_INFO, " -I mlv_file         inject data from given MLV file right after MLVI header\n");
+
+    /* yet unclear which format to choose, so keep that as reminder */
+    //print_msg(MSG_INFO, " -u lut_file         look-up table with 4 * xRes * yRes 16-bit words that is applied before bit depth conversion\n");
+#ifdef MLV_USE_LZMA
+    print_msg(MSG_INFO, " -c                  (re-)compress video and audio frames using LZMA (set bpp to 16 to improve compression rate)\n");
+    print_msg(MSG_INFO, " -l level            set compression level from 0=fastest to 9=best compression\n");
+#else
+    print_msg(MSG_INFO, " -c, -l              NOT AVAILABLE: LZMA compression support was not compiled into this release\n");
+#endif
+    print_msg(MSG_INFO, " --lj92              (re-)compress video frames using lossless JPEG (LJ92), DNG export writes compressed DNG files\n");
+    print_msg(MSG_INFO, " -d                  decompress LZMA or LJ92 compressed video and audio frames\n");
+    print_msg(MSG_INFO, "\n");
+
+    print_msg(MSG_INFO, "-- Recovery --\n");
+    print_msg(MSG_INFO, " --verify            check the block structure of all chunks, report damaged ranges and missing frames\n");
+    print_msg(MSG_INFO, " --recover           same, and copy all intact blocks into the file given with -o, plus a new .IDX\n");
+    print_msg(MSG_INFO, " --crc               check every frame against the .CRC file next to <inputfile>, or create it if missing (implies --verify)\n");
+    print_msg(MSG_INFO, "\n");
+
+    print_msg(MSG_INFO, "-- bugfixes --\n");
+    print_msg(MSG_INFO, " --black-fix=value   set black level to <value> (fix green/magenta cast)\n");
+    print_msg(MSG_INFO, " --fix-bug=id        fix some special bugs. *only* to be used if given instruction by developers.\n");
+    print_msg(MSG_INFO, "\n");
+}
+
+void print_sampling_info(int bin, int skip, char * what)
+{
+    if (bin + skip == 1) {
+        print_msg(MSG_INFO, "read every %s", what);
+    } else if (skip == 0) {
+        print_msg(MSG_INFO, "bin %d %s%s", bin, what, bin == 1 ? "" : "s");
+    } else {
+        print_msg(MSG_INFO, "%s %d %s%s", bin == 1 ? "read" : "bin", bin, what, bin == 1 ? "" : "s");
+        if (skip) {
             print_msg(MSG_INFO, ", skip %d", skip);
         }
     }
@@ -1099,6 +3385,8 @@ int main (int argc, char *argv[])
     char *output_filename = NULL;
     char *subtract_filename = NULL;
     char *flatfield_filename = NULL;
+    char *dark_lib = NULL;
+    char *flat_lib = NULL;
     char *lut_filename = NULL;
     char *extract_block = NULL;
     char *inject_filename = NULL;
@@ -1109,10 +3397,12 @@ int main (int argc, char *argv[])
     uint32_t frame_end = 0;
     uint32_t audf_frames_processed = 0;
     uint32_t vidf_frames_processed = 0;
+    uint32_t vidf_frames_selected = 0;
     uint32_t vidf_max_number = 0;
 
     int delta_encode_mode = 0;
     int xref_mode = 0;
+    int keyframe_interval = 0;
     int average_mode = 0;
     int average_vert = 0;
     int average_hor = 0;
@@ -1127,10 +3417,13 @@ int main (int argc, char *argv[])
     int bit_depth = 0;
     int bit_zap = 0;
     int compress_output = 0;
+    int compress_format = MLV_VIDEO_CLASS_FLAG_LZMA;
+    int lj92_output = 0;
     int decompress_output = 0;
     int verbose = 0;
     int lzma_level = 5;
     int alter_fps = 0;
+    int threads = 1;
     char opt = ' ';
 
     int video_xRes = 0;
@@ -1150,14 +3443,24 @@ int main (int argc, char *argv[])
 
     /* long options */
     int chroma_smooth_method = 0;
+    chroma_planes_t chroma_planes;
     int black_fix = 0;
     enum bug_id fix_bug = BUG_ID_NONE;
     int fix_bug_1_offset = 0;
     int fix_bug_2_offset = 0;
     int dng_output = 0;
+    int stream_output = 0;
+    stream_out_t *stream = NULL;
+    int image_output = 0;
+    int demosaic_method = DEMOSAIC_AMAZE;
     int dump_xrefs = 0;
+    int verify_mode = 0;
+    int recover_mode = 0;
+    int crc_mode = 0;
     int fix_cold_pixels = 1;
     int fix_vert_stripes = 1;
+    int fix_refresh = 0;
+    dng_fix_cache_t fix_cache;
     
     const char * unique_camname = "(unknown)";
 
@@ -1165,9 +3468,23 @@ int main (int argc, char *argv[])
         {"lua",    required_argument, NULL,  'L' },
         {"black-fix",  optional_argument, NULL,  'B' },
         {"fix-bug",  required_argument, NULL,  'F' },
+        {"threads",  required_argument, NULL,  'T' },
+        {"profile",  required_argument, NULL,  'P' },
+        {"stdout",  optional_argument, NULL,  'S' },
+        {"demosaic",  required_argument, NULL,  'M' },
+        {"fix-refresh",  required_argument, NULL,  'R' },
+        {"keyframes",  required_argument, NULL,  'K' },
+        {"dark-lib",  required_argument, NULL,  'D' },
+        {"flat-lib",  required_argument, NULL,  'W' },
         {"batch",  no_argument, &batch_mode,  1 },
         {"dump-xrefs",   no_argument, &dump_xrefs,  1 },
+        {"verify",   no_argument, &verify_mode,  1 },
+        {"recover",  no_argument, &recover_mode,  1 },
+        {"crc",      no_argument, &crc_mode,  1 },
         {"dng",    no_argument, &dng_output,  1 },
+        {"tiff",   no_argument, &image_output,  IMAGE_TIFF },
+        {"ppm",    no_argument, &image_output,  IMAGE_PPM },
+        {"lj92",   no_argument, &lj92_output,  1 },
         {"no-cs",  no_argument, &chroma_smooth_method,  0 },
         {"cs2x2",  no_argument, &chroma_smooth_method,  2 },
         {"cs3x3",  no_argument, &chroma_smooth_method,  3 },
@@ -1190,8 +3507,17 @@ int main (int argc, char *argv[])
         return ERR_STRUCT_ALIGN;
     }
 
+    /* the frames go to stdout when streaming, so even the messages while parsing options must not */
+    for(int arg = 1; arg < argc; arg++)
+    {
+        if(!strncmp(argv[arg], "--stdout", 8))
+        {
+            msg_file = stderr;
+        }
+    }
+
     int index = 0;
-    while ((opt = getopt_long(argc, argv, "A:F:B:L:t:xz:emnas:X:I:uvrcdo:l:b:f:", long_options, &index)) != -1)
+    while ((opt = getopt_long(argc, argv, "A:F:B:L:T:t:xz:emnas:X:I:uvrcdo:l:b:f:", long_options, &index)) != -1)
     {
         switch (opt)
         {
@@ -1243,6 +3569,80 @@ int main (int argc, char *argv[])
                 }
                 break;
                 
+            case 'T':
+                if(!optarg)
+                {
+                    print_msg(MSG_ERROR, "Error: Missing number of threads\n");
+                    return ERR_PARAM;
+                }
+                else
+                {
+                    threads = MIN(64, MAX(1, atoi(optarg)));
+                }
+                break;
+                
+            case 'P':
+                if(!optarg || strcasecmp(optarg, "json"))
+                {
+                    print_msg(MSG_ERROR, "Error: Unknown profile format '%s' (only json is supported)\n", optarg ? optarg : "");
+                    return ERR_PARAM;
+                }
+                /* frames are processed on several threads at once, so each stage is measured on its own thread */
+                profile_init("mlv_dump", 1);
+                break;
+
+            case 'R':
+                if(!optarg)
+                {
+                    print_msg(MSG_ERROR, "Error: Missing number of frames\n");
+                    return ERR_PARAM;
+                }
+                else
+                {
+                    fix_refresh = MAX(0, atoi(optarg));
+                }
+                break;
+                
+            case 'S':
+                if(!optarg || !strcasecmp(optarg, "bayer16"))
+                {
+                    stream_output = STREAM_BAYER16;
+                }
+                else if(!strcasecmp(optarg, "rgb48"))
+                {
+                    stream_output = STREAM_RGB48;
+                }
+                else if(!strcasecmp(optarg, "yuv444p16"))
+                {
+                    stream_output = STREAM_YUV444P16;
+                }
+                else
+                {
+                    print_msg(MSG_ERROR, "Error: Unknown stream format '%s'\n", optarg);
+                    return ERR_PARAM;
+                }
+                break;
+
+            case 'M':
+                if(!strcasecmp(optarg, "amaze"))
+                {
+                    demosaic_method = DEMOSAIC_AMAZE;
+                }
+                else if(!strcasecmp(optarg, "bilinear"))
+                {
+                    demosaic_method = DEMOSAIC_BILINEAR;
+                }
+                else if(!strcasecmp(optarg, "half"))
+                {
+                    demosaic_method = DEMOSAIC_HALF;
+                }
+                else
+                {
+                    print_msg(MSG_ERROR, "Error: Unknown demosaic method '%s'\n", optarg);
+                    return ERR_PARAM;
+                }
+                break;
+
             case 'L':
 #ifdef USE_LUA
                 if(!optarg)
@@ -1290,6 +3690,10 @@ int main (int argc, char *argv[])
                 delta_encode_mode = 1;
                 break;
 
+            case 'K':
+                keyframe_interval = MAX(0, atoi(optarg));
+                break;
+
             case 'a':
                 average_mode = 1;
                 decompress_output = 1;
@@ -1318,6 +3722,16 @@ int main (int argc, char *argv[])
                 decompress_output = 1;
                 break;
 
+            case 'D':
+                dark_lib = strdup(optarg);
+                decompress_output = 1;
+                break;
+
+            case 'W':
+                flat_lib = strdup(optarg);
+                decompress_output = 1;
+                break;
+
             case 'X':
                 if(!optarg || strlen(optarg) != 4)
                 {
@@ -1364,12 +3778,7 @@ int main (int argc, char *argv[])
                 break;
 
             case 'd':
-#ifdef MLV_USE_LZMA
                 decompress_output = 1;
-#else
-                print_msg(MSG_ERROR, "Error: Compression support was not compiled into this release\n");
-                return ERR_PARAM;
-#endif
                 break;
 
             case 'o':
@@ -1441,7 +3850,12 @@ int main (int argc, char *argv[])
         return ERR_PARAM;
     }
 
-
+    /* LJ92 is used instead of LZMA when compressing */
+    if(lj92_output)
+    {
+        compress_output = 1;
+        compress_format = MLV_VIDEO_CLASS_FLAG_LJ92;
+    }
 
     print_msg(MSG_INFO, "\n");
     print_msg(MSG_INFO, " MLV Dumper v1.0\n");
@@ -1454,19 +3868,53 @@ int main (int argc, char *argv[])
     print_msg(MSG_INFO, "Mode of operation:\n");
     print_msg(MSG_INFO, "   - Input MLV file: '%s'\n", input_filename);
 
-    if(verbose)
+    if(verbose)
+    {
+        print_msg(MSG_INFO, "   - Verbose messages\n");
+    }
+    
+    if(black_fix)
+    {
+        print_msg(MSG_INFO, "   - Setting black level to %d\n", black_fix);
+    }
+
+    if(alter_fps)
+    {
+        print_msg(MSG_INFO, "   - altering FPS metadata for %d/1000 fps\n", alter_fps);
+    }
+
+    /* frame checksums are checked while scanning the blocks */
+    if(crc_mode && !recover_mode)
+    {
+        verify_mode = 1;
+    }
+
+    /* damaged recordings are only scanned, the conversions below do not apply */
+    if(recover_mode && !output_filename)
     {
-        print_msg(MSG_INFO, "   - Verbose messages\n");
+        print_msg(MSG_ERROR, "Error: Missing output filename for --recover\n");
+        return ERR_PARAM;
     }
-    
-    if(black_fix)
+    if(verify_mode || recover_mode)
     {
-        print_msg(MSG_INFO, "   - Setting black level to %d\n", black_fix);
+        if(recover_mode)
+        {
+            print_msg(MSG_INFO, "   - Recover intact blocks into '%s'\n", output_filename);
+        }
+        else
+        {
+            print_msg(MSG_INFO, "   - Verify block structure\n");
+        }
+        if(crc_mode)
+        {
+            print_msg(MSG_INFO, "   - Check frame checksums\n");
+        }
     }
 
-    if(alter_fps)
+    /* images go through the DNG code path, up to the point where the file gets written */
+    if(image_output)
     {
-        print_msg(MSG_INFO, "   - altering FPS metadata for %d/1000 fps\n", alter_fps);
+        dng_output = 1;
     }
 
     /* special case - splitting into frames doesnt require a specific output file */
@@ -1487,12 +3935,45 @@ int main (int argc, char *argv[])
     }
 
     /* display and set/unset variables according to parameters to have a consistent state */
-    if(output_filename)
+    if((output_filename || stream_output) && !verify_mode && !recover_mode)
     {
-        if(dng_output)
+        if(stream_output)
+        {
+            print_msg(MSG_INFO, "   - Stream %s frames to stdout\n", stream_pixel_format(stream_output, 0));
+
+            /* the stream is always 16 bits per value */
+            delta_encode_mode = 0;
+            compress_output = 0;
+            average_mode = 0;
+            bit_depth = 0;
+            mlv_output = 0;
+            raw_output = 0;
+            dng_output = 0;
+            image_output = 0;
+        }
+        else if(image_output)
+        {
+            const char *methods[] = { "", "AMaZE", "bilinear", "half size" };
+            print_msg(MSG_INFO, "   - Convert to %s images (%s demosaic)\n", image_output == IMAGE_PPM ? "PPM" : "TIFF", methods[demosaic_method]);
+
+            delta_encode_mode = 0;
+            compress_output = 0;
+            mlv_output = 0;
+            raw_output = 0;
+        }
+        else if(dng_output)
         {
             print_msg(MSG_INFO, "   - Convert to DNG frames\n");
 
+            /* all frames get the same header layout, only the values change */
+            dng_set_sequence(1);
+            if(lj92_output)
+            {
+                /* frames that are not LJ92 compressed already get encoded in tiles */
+                print_msg(MSG_INFO, "   - Lossless JPEG compressed, %dx%d tiles\n", DNG_TILE_SIZE, DNG_TILE_SIZE);
+                dng_set_compression(&lj92_encode, DNG_TILE_SIZE, DNG_TILE_SIZE);
+            }
+
             delta_encode_mode = 0;
             compress_output = 0;
             mlv_output = 0;
@@ -1530,10 +4011,14 @@ int main (int argc, char *argv[])
             if(delta_encode_mode)
             {
                 print_msg(MSG_INFO, "   - Only store changes to previous frame\n");
+                if(keyframe_interval)
+                {
+                    print_msg(MSG_INFO, "   - Keyframe every %d frames\n", keyframe_interval);
+                }
             }
             if(compress_output)
             {
-                print_msg(MSG_INFO, "   - Compress frame data\n");
+                print_msg(MSG_INFO, "   - Compress frame data%s\n", (compress_format == MLV_VIDEO_CLASS_FLAG_LJ92) ? " (LJ92)" : "");
             }
             if(average_mode)
             {
@@ -1566,7 +4051,36 @@ int main (int argc, char *argv[])
             print_msg(MSG_INFO, "   - Flat-field reference frame '%s'\n", flatfield_filename);
         }
 
-        print_msg(MSG_INFO, "   - Output into '%s'\n", output_filename);
+        if(average_mode && dark_lib && flat_lib)
+        {
+            print_msg(MSG_ERROR, "Error: An averaged frame can be stored either as darkframe or as flat-field, not both\n");
+            return ERR_PARAM;
+        }
+        if(dark_lib && (average_mode || !subtract_mode))
+        {
+            print_msg(MSG_INFO, "   - %s darkframe library '%s'\n", average_mode ? "Store averaged frame in" : "Use matching frame from", dark_lib);
+        }
+        if(flat_lib && (average_mode || !flatfield_mode))
+        {
+            print_msg(MSG_INFO, "   - %s flat-field library '%s'\n", average_mode ? "Store averaged frame in" : "Use matching frame from", flat_lib);
+        }
+
+        if(threads > 1 && !raw_output)
+        {
+            print_msg(MSG_INFO, "   - Use %d threads\n", threads);
+        }
+
+        if(stream_output)
+        {
+            if(output_filename)
+            {
+                print_msg(MSG_INFO, "   - Audio into '%s.wav'\n", output_filename);
+            }
+        }
+        else
+        {
+            print_msg(MSG_INFO, "   - Output into '%s'\n", output_filename);
+        }
     }
     else
     {
@@ -1599,6 +4113,7 @@ int main (int argc, char *argv[])
 
     /* initialize stuff */
     memset(&lv_rec_footer, 0x00, sizeof(lv_rec_file_footer_t));
+    memset(&chroma_planes, 0x00, sizeof(chroma_planes_t));
     memset(&lens_info, 0x00, sizeof(mlv_lens_hdr_t));
     memset(&expo_info, 0x00, sizeof(mlv_expo_hdr_t));
     memset(&idnt_info, 0x00, sizeof(mlv_idnt_hdr_t));
@@ -1606,6 +4121,14 @@ int main (int argc, char *argv[])
     memset(&wavi_info, 0x00, sizeof(mlv_wavi_hdr_t));
     memset(&rtci_info, 0x00, sizeof(mlv_rtci_hdr_t));
     memset(&main_header, 0x00, sizeof(mlv_file_hdr_t));
+    memset(&fix_cache, 0x00, sizeof(dng_fix_cache_t));
+
+    fix_cache.analysis = raw_fix_analysis_new();
+    if(!fix_cache.analysis)
+    {
+        print_msg(MSG_ERROR, "Failed to alloc mem\n");
+        return ERR_MALLOC;
+    }
 
     char info_string[256] = "(MLV Video without INFO blocks)";
 
@@ -1613,6 +4136,18 @@ int main (int argc, char *argv[])
     mlv_xref_hdr_t *block_xref = NULL;
     mlv_xref_t *xrefs = NULL;
     uint32_t block_xref_pos = 0;
+    uint32_t xref_seek = 0;
+    uint32_t xref_vidf_first = 0;
+    uint32_t xref_vidf_last = 0;
+    uint16_t output_video_class = 0;
+    /* delta coding: keyframe interval of the input clip, keyframe group of the last frame */
+    uint32_t delta_key_interval = 0;
+    int64_t delta_group = -1;
+    uint8_t *lj92_buffer = NULL;
+    uint32_t lj92_buffer_size = 0;
+    image_setup_t *image_setup_data = NULL;
+    uint16_t *image_buffer = NULL;
+    uint32_t image_buffer_size = 0;
 
     uint32_t frame_buffer_size = 1*1024*1024;
     uint32_t subtract_frame_buffer_size = 0;
@@ -1621,13 +4156,15 @@ int main (int argc, char *argv[])
     uint32_t *frame_arith_buffer = NULL;
     uint8_t *frame_sub_buffer = NULL;
     uint8_t *frame_flat_buffer = NULL;
+    reflib_calib_t *ref_calib = NULL;
+    int ref_lookup_done = 0;
     uint8_t *frame_buffer = NULL;
     uint8_t *prev_frame_buffer = NULL;
 
     FILE *out_file = NULL;
     FILE *out_file_wav = NULL;
-    FILE **in_files = NULL;
-    FILE *in_file = NULL;
+    mlv_reader_t **in_files = NULL;
+    mlv_reader_t *in_file = NULL;
 
     int in_file_count = 0;
     int in_file_num = 0;
@@ -1643,22 +4180,98 @@ int main (int argc, char *argv[])
     int total_vidf_count = 0;
     int total_audf_count = 0;
 
+    /* threaded DNG export, set up when the first frame arrives */
+    pipeline_t *frame_pipe = NULL;
+    int frame_pipe_primed = 0;
+    frame_pipeline_ctx_t frame_pipe_ctx;
+
     /* open files */
-    in_files = load_all_chunks(input_filename, &in_file_count);
-    if(!in_files || !in_file_count)
+    FILE **chunk_files = load_all_chunks(input_filename, &in_file_count);
+    if(!chunk_files || !in_file_count)
     {
         print_msg(MSG_ERROR, "Failed to open file '%s'\n", input_filename);
         return ERR_FILE;
     }
     else
     {
+        /* all chunks are read through memory mapping, block data is used in place where possible */
+        in_files = malloc(in_file_count * sizeof(mlv_reader_t *));
+        if(!in_files)
+        {
+            print_msg(MSG_ERROR, "Failed to alloc mem\n");
+            return ERR_MALLOC;
+        }
+
+        for(in_file_num = 0; in_file_num < in_file_count; in_file_num++)
+        {
+            in_files[in_file_num] = mlv_reader_open(chunk_files[in_file_num]);
+            if(!in_files[in_file_num])
+            {
+                print_msg(MSG_ERROR, "Failed to open file '%s'\n", input_filename);
+                return ERR_FILE;
+            }
+        }
+        free(chunk_files);
+
         in_file_num = 0;
         in_file = in_files[in_file_num];
     }
 
+    if(verify_mode || recover_mode)
+    {
+        int ret = recover_mlv(in_files, in_file_count, input_filename, recover_mode ? output_filename : NULL, crc_mode);
+
+        for(in_file_num = 0; in_file_num < in_file_count; in_file_num++)
+        {
+            mlv_reader_close(in_files[in_file_num]);
+        }
+        free(in_files);
+        free(output_filename);
+        return ret;
+    }
+
+    /* only used if the clip is delta coded, 0 if it has no keyframes */
+    delta_key_interval = delta_read_interval(in_files[0]);
+
     if(!xref_mode)
     {
-        block_xref = load_index(input_filename);
+        mlv_file_hdr_t ref_file_hdr;
+        uint64_t index_guid = 0;
+
+        /* the first chunk's header tells which index belongs to these files */
+        memset(&ref_file_hdr, 0x00, sizeof(mlv_file_hdr_t));
+        mlv_reader_read(&ref_file_hdr, sizeof(mlv_file_hdr_t), in_files[0]);
+        mlv_reader_set_pos(in_files[0], 0, SEEK_SET);
+
+        /* frames can only be skipped if no other frame depends on them, delta coded clips can start at a keyframe */
+        int seek_frames = extract_frames && !average_mode && !delta_encode_mode && !lua_state &&
+                          (!(ref_file_hdr.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA) || delta_key_interval);
+
+        block_xref = load_index(input_filename, &index_guid);
+
+        if(block_xref && !check_index(block_xref, index_guid, &ref_file_hdr, in_files, in_file_count))
+        {
+            print_msg(MSG_INFO, "XREF table does not match the input files, ignoring it\n");
+            free(block_xref);
+            block_xref = NULL;
+        }
+
+        /* building the index once costs a walk over the block headers, later frame range requests can seek directly */
+        if(!block_xref && seek_frames)
+        {
+            int entries = 0;
+            frame_xref_t *table = build_index(in_files, in_file_count, &entries);
+
+            if(table)
+            {
+                print_msg(MSG_INFO, "XREF table built with %d entries\n", entries);
+                xref_sort(table, entries);
+                save_index(input_filename, &ref_file_hdr, in_file_count, table, entries);
+                free(table);
+
+                block_xref = load_index(input_filename, &index_guid);
+            }
+        }
 
         if(block_xref)
         {
@@ -1669,6 +4282,13 @@ int main (int argc, char *argv[])
             {
                 xref_dump(block_xref);
             }
+
+            if(seek_frames)
+            {
+                uint32_t seek_start = delta_key_interval ? frame_start - frame_start % delta_key_interval : frame_start;
+                xref_seek = find_index_frames(block_xref, in_files, seek_start, frame_end, &xref_vidf_first, &xref_vidf_last);
+                mlv_reader_set_pos(in_files[0], 0, SEEK_SET);
+            }
         }
         else
         {
@@ -1683,7 +4303,7 @@ int main (int argc, char *argv[])
     /* this block will load an image from a MLV file, so use its reported frame size for future use */
     if(subtract_mode)
     {
-        printf("Loading subtract (dark) frame '%s'\n", flatfield_filename);
+        print_msg(MSG_INFO, "Loading subtract (dark) frame '%s'\n", flatfield_filename);
         int ret = load_frame(subtract_filename, &frame_sub_buffer, &subtract_frame_buffer_size);
 
         if(ret)
@@ -1697,7 +4317,7 @@ int main (int argc, char *argv[])
 
     if(flatfield_mode)
     {
-        printf("Loading flat-field frame '%s'\n", flatfield_filename);
+        print_msg(MSG_INFO, "Loading flat-field frame '%s'\n", flatfield_filename);
         int ret = load_frame(flatfield_filename, &frame_flat_buffer, &flatfield_frame_buffer_size);
 
         if(ret)
@@ -1731,7 +4351,7 @@ int main (int argc, char *argv[])
         memset(prev_frame_buffer, 0x00, frame_buffer_size);
     }
 
-    if(output_filename || lua_state)
+    if(output_filename || lua_state || stream_output)
     {
         frame_buffer = malloc(frame_buffer_size);
         if(!frame_buffer)
@@ -1741,7 +4361,19 @@ int main (int argc, char *argv[])
         }
         memset(frame_buffer, 0x00, frame_buffer_size);
 
-        if(!dng_output && output_filename)
+        if(stream_output)
+        {
+#if defined(__WIN32)
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            stream = stream_out_open(stdout);
+            if(!stream)
+            {
+                print_msg(MSG_ERROR, "Failed to start stream writer\n");
+                return ERR_FILE;
+            }
+        }
+        else if(!dng_output && output_filename)
         {
             out_file = fopen(output_filename, "wb+");
             if(!out_file)
@@ -1771,12 +4403,12 @@ read_headers:
 
             /* select file and seek to the right position */
             in_file = in_files[in_file_num];
-            file_set_pos(in_file, position, SEEK_SET);
+            mlv_reader_set_pos(in_file, position, SEEK_SET);
         }
 
-        position = file_get_pos(in_file);
+        position = mlv_reader_get_pos(in_file);
 
-        if(fread(&buf, sizeof(mlv_hdr_t), 1, in_file) != 1)
+        if(mlv_reader_read(&buf, sizeof(mlv_hdr_t), in_file) != 1)
         {
             if(block_xref)
             {
@@ -1801,9 +4433,9 @@ read_headers:
         }
 
         /* jump back to the beginning of the block just read */
-        file_set_pos(in_file, position, SEEK_SET);
+        mlv_reader_set_pos(in_file, position, SEEK_SET);
 
-        position = file_get_pos(in_file);
+        position = mlv_reader_get_pos(in_file);
 
         /* unexpected block header size? */
         if(buf.blockSize < sizeof(mlv_hdr_t) || buf.blockSize > 50 * 1024 * 1024)
@@ -1815,6 +4447,15 @@ read_headers:
             }
         }
 
+        /* all other blocks are written by this thread, so the frames in the pipeline have to be written first */
+        if(frame_pipe && mlv_output && memcmp(buf.blockType, "VIDF", 4) && memcmp(buf.blockType, "AUDF", 4) && memcmp(buf.blockType, "NULL", 4) && memcmp(buf.blockType, "BKUP", 4))
+        {
+            if(pipeline_flush(frame_pipe))
+            {
+                goto abort;
+            }
+        }
+
         /* file header */
         if(!memcmp(buf.blockType, "MLVI", 4))
         {
@@ -1822,12 +4463,12 @@ read_headers:
             uint32_t hdr_size = MIN(sizeof(mlv_file_hdr_t), buf.blockSize);
 
             /* read the whole header block, but limit size to either our local type size or the written block size */
-            if(fread(&file_hdr, hdr_size, 1, in_file) != 1)
+            if(mlv_reader_read(&file_hdr, hdr_size, in_file) != 1)
             {
                 print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                 goto abort;
             }
-            file_set_pos(in_file, position + file_hdr.blockSize, SEEK_SET);
+            mlv_reader_set_pos(in_file, position + file_hdr.blockSize, SEEK_SET);
 
             lua_handle_hdr(lua_state, buf.blockType, &file_hdr, sizeof(file_hdr));
 
@@ -1881,14 +4522,14 @@ read_headers:
                         file_hdr.videoFrameCount = 1;
                     }
 
-                    /* set the output compression flag */
-                    if(compress_output)
+                    /* set the output compression flag, frames that are not (de)compressed keep their format */
+                    if(compress_output || decompress_output)
                     {
-                        file_hdr.videoClass |= MLV_VIDEO_CLASS_FLAG_LZMA;
+                        file_hdr.videoClass &= ~(MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92);
                     }
-                    else
+                    if(compress_output)
                     {
-                        file_hdr.videoClass &= ~MLV_VIDEO_CLASS_FLAG_LZMA;
+                        file_hdr.videoClass |= compress_format;
                     }
 
                     if(delta_encode_mode)
@@ -1899,6 +4540,7 @@ read_headers:
                     {
                         file_hdr.videoClass &= ~MLV_VIDEO_CLASS_FLAG_DELTA;
                     }
+                    output_video_class = file_hdr.videoClass;
 
                     if(!extract_block || !strncasecmp(extract_block, (char*)file_hdr.fileMagic, 4))
                     {
@@ -1908,6 +4550,24 @@ read_headers:
                             goto abort;
                         }
                     }
+
+                    /* delta coded output tells where decoding can start. already coded frames keep their keyframes */
+                    uint32_t key_interval = (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA) ? delta_key_interval : (uint32_t)keyframe_interval;
+                    if(delta_encode_mode && key_interval && (!extract_block || !strncasecmp(extract_block, "DELT", 4)))
+                    {
+                        mlv_delt_hdr_t delt;
+
+                        memset(&delt, 0x00, sizeof(mlv_delt_hdr_t));
+                        memcpy(delt.blockType, "DELT", 4);
+                        delt.blockSize = sizeof(mlv_delt_hdr_t);
+                        delt.keyInterval = key_interval;
+
+                        if(fwrite(&delt, delt.blockSize, 1, out_file) != 1)
+                        {
+                            print_msg(MSG_ERROR, "Failed writing into .MLV file\n");
+                            goto abort;
+                        }
+                    }
                     
                     if(inject_filename)
                     {
@@ -2011,7 +4671,7 @@ read_headers:
                 mlv_audf_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_audf_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "AUDF: File ends in the middle of a block\n");
                     goto abort;
@@ -2035,22 +4695,30 @@ read_headers:
                 if(!skip_block)
                 {
                     /* skip frame space */
-                    file_set_pos(in_file, block_hdr.frameSpace, SEEK_CUR);
+                    mlv_reader_set_pos(in_file, block_hdr.frameSpace, SEEK_CUR);
 
                     int frame_size = block_hdr.blockSize - sizeof(mlv_audf_hdr_t) - block_hdr.frameSpace;
-                    void *buf = malloc(frame_size);
+
+                    /* audio data is written as it is, so use it straight from the mapped file if possible */
+                    void *mapped = mlv_reader_map(in_file, frame_size);
+                    void *buf = mapped;
 
                     if(!buf)
                     {
-                        print_msg(MSG_ERROR, "AUDF: Failed to allocate buffer\n");
-                        goto abort;
-                    }
-                    
-                    if(fread(buf, frame_size, 1, in_file) != 1)
-                    {
-                        free(buf);
-                        print_msg(MSG_ERROR, "AUDF: File ends in the middle of a block\n");
-                        goto abort;
+                        buf = malloc(frame_size);
+
+                        if(!buf)
+                        {
+                            print_msg(MSG_ERROR, "AUDF: Failed to allocate buffer\n");
+                            goto abort;
+                        }
+                        
+                        if(mlv_reader_read(buf, frame_size, in_file) != 1)
+                        {
+                            free(buf);
+                            print_msg(MSG_ERROR, "AUDF: File ends in the middle of a block\n");
+                            goto abort;
+                        }
                     }
 
 
@@ -2059,16 +4727,40 @@ read_headers:
                         /* correct header size */
                         block_hdr.blockSize = sizeof(mlv_audf_hdr_t) + frame_size;
                         
-                        if(fwrite(&block_hdr, sizeof(mlv_audf_hdr_t), 1, out_file) != 1)
+                        /* frames may still be in the pipeline, so audio has to queue up behind them */
+                        if(frame_pipe)
                         {
-                            print_msg(MSG_ERROR, "AUDF: Failed writing into .MLV file\n");
-                            print_msg(MSG_ERROR, "ptr: 0x%08X type: %s\n", &block_hdr, block_hdr.blockType);
-                            goto abort;
+                            frame_job_t *job = pipeline_get_job(frame_pipe);
+
+                            if(!job || frame_job_reserve(job, frame_size))
+                            {
+                                print_msg(MSG_ERROR, "AUDF: Failed to queue audio data\n");
+                                if(buf != mapped)
+                                {
+                                    free(buf);
+                                }
+                                goto abort;
+                            }
+
+                            memcpy(job->frame_buffer, buf, frame_size);
+                            job->frame_size = frame_size;
+                            job->audf_hdr = block_hdr;
+                            job->audio = 1;
+                            pipeline_submit_passthrough(frame_pipe, job);
                         }
-                        if(fwrite(buf, frame_size, 1, out_file) != 1)
+                        else
                         {
-                            print_msg(MSG_ERROR, "AUDF: Failed writing into .MLV file\n");
-                            goto abort;
+                            if(fwrite(&block_hdr, sizeof(mlv_audf_hdr_t), 1, out_file) != 1)
+                            {
+                                print_msg(MSG_ERROR, "AUDF: Failed writing into .MLV file\n");
+                                print_msg(MSG_ERROR, "ptr: 0x%08X type: %s\n", &block_hdr, block_hdr.blockType);
+                                goto abort;
+                            }
+                            if(fwrite(buf, frame_size, 1, out_file) != 1)
+                            {
+                                print_msg(MSG_ERROR, "AUDF: Failed writing into .MLV file\n");
+                                goto abort;
+                            }
                         }
                     }
                 
@@ -2091,7 +4783,11 @@ read_headers:
                         
                         wav_file_size += frame_size;
                     }
-                    free(buf);
+                    
+                    if(!mapped)
+                    {
+                        free(buf);
+                    }
                 }
                 audf_frames_processed++;
             }
@@ -2100,42 +4796,276 @@ read_headers:
                 mlv_vidf_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_vidf_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
-                {
-                    print_msg(MSG_ERROR, "VIDF: File ends in the middle of a block\n");
-                    goto abort;
-                }
+                /* --profile=json, frames processed serially */
+                struct profile frame_prof;
+
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
+                {
+                    print_msg(MSG_ERROR, "VIDF: File ends in the middle of a block\n");
+                    goto abort;
+                }
+
+                /* store last VIDF for reference */
+                last_vidf = block_hdr;
+
+                lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
+
+                if(verbose)
+                {
+                    print_msg(MSG_INFO, "   Frame: #%04d\n", block_hdr.frameNumber);
+                    print_msg(MSG_INFO, "    Crop: %dx%d\n", block_hdr.cropPosX, block_hdr.cropPosY);
+                    print_msg(MSG_INFO, "     Pan: %dx%d\n", block_hdr.panPosX, block_hdr.panPosY);
+                    print_msg(MSG_INFO, "   Space: %d\n", block_hdr.frameSpace);
+                }
+                
+                if(alter_fps)
+                {
+                    block_hdr.timestamp = (((uint64_t)block_hdr.frameNumber * 10000000ULL) / alter_fps) * 1000;
+                }
+                
+                uint32_t skip_block = 0;
+                
+                if(block_hdr.frameSpace > block_hdr.blockSize - sizeof(mlv_vidf_hdr_t))
+                {
+                    print_msg(MSG_ERROR, "VIDF: Frame space is larger than block size. Skipping\n");
+                    skip_block = 1;
+                }
+
+                /* the reference frames are picked from the libraries with the metadata read before the first frame */
+                if((dark_lib || flat_lib) && !average_mode && !ref_lookup_done)
+                {
+                    reflib_key_t key;
+                    char *dark_file = NULL;
+                    char *flat_file = NULL;
+
+                    ref_lookup_done = 1;
+
+                    memset(&key, 0x00, sizeof(key));
+                    key.camera_model = idnt_info.cameraModel;
+                    key.iso = expo_info.isoValue;
+                    key.xRes = video_xRes;
+                    key.yRes = video_yRes;
+                    key.crop_x = block_hdr.cropPosX;
+                    key.crop_y = block_hdr.cropPosY;
+                    key.bits_per_pixel = lv_rec_footer.raw_info.bits_per_pixel;
+
+                    /* a missing reference is not an error, the clip is just left uncorrected */
+                    if(dark_lib && !subtract_mode)
+                    {
+                        dark_file = reflib_find(dark_lib, REFLIB_DARK, &key);
+                        if(!dark_file)
+                        {
+                            print_msg(MSG_INFO, "No darkframe for this clip in '%s', not subtracting\n", dark_lib);
+                        }
+                    }
+                    if(flat_lib && !flatfield_mode)
+                    {
+                        flat_file = reflib_find(flat_lib, REFLIB_FLAT, &key);
+                        if(!flat_file)
+                        {
+                            print_msg(MSG_INFO, "No flat-field for this clip in '%s', not correcting\n", flat_lib);
+                        }
+                    }
+
+                    if(dark_file || flat_file)
+                    {
+                        int ret = reflib_calib_load(&ref_calib, dark_file, flat_file, &key, lv_rec_footer.raw_info.black_level);
+                        if(ret)
+                        {
+                            print_msg(MSG_ERROR, "VIDF: Failed to load reference frames '%s' '%s' (error %d)\n", dark_file ? dark_file : "", flat_file ? flat_file : "", ret);
+                            free(dark_file);
+                            free(flat_file);
+                            goto abort;
+                        }
+                        if(dark_file)
+                        {
+                            print_msg(MSG_INFO, "Using darkframe '%s'\n", dark_file);
+                        }
+                        if(flat_file)
+                        {
+                            print_msg(MSG_INFO, "Using flat-field '%s'\n", flat_file);
+                        }
+                    }
+                    free(dark_file);
+                    free(flat_file);
+                }
+
+                /* LJ92 frames can go into the DNG files as they are, if nothing but the raw2dng fixes may change them */
+                int lj92_passthrough = dng_output && !image_output && (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_LJ92) && !(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA) && 
+                                       !subtract_mode && !flatfield_mode && !ref_calib && !bit_zap && !lua_state && (!bit_depth || bit_depth == lv_rec_footer.raw_info.bits_per_pixel);
+
+                /* the color conversion of the image output is set up with the metadata read before the first frame */
+                if(image_output && !image_setup_data)
+                {
+                    image_setup_data = malloc(sizeof(image_setup_t));
+                    if(!image_setup_data)
+                    {
+                        print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", (int)sizeof(image_setup_t));
+                        goto abort;
+                    }
+                    image_setup(image_setup_data, demosaic_method, lv_rec_footer.raw_info.color_matrix1, wbal_info.wbgain_r, wbal_info.wbgain_g, wbal_info.wbgain_b);
+                    if(verbose)
+                    {
+                        print_msg(MSG_INFO, "    WB multipliers: %.3f %.3f %.3f\n", image_setup_data->wb[0], image_setup_data->wb[1], image_setup_data->wb[2]);
+                    }
+                }
+
+                /* MLV output only gains from threads if there is something to do with the frames */
+                int mlv_pipe_output = mlv_output && !only_metadata_mode && !delta_encode_mode && (!extract_block || !strncasecmp(extract_block, "VIDF", 4)) && 
+                                      (compress_output || decompress_output || subtract_mode || flatfield_mode || ref_calib || bit_depth || bit_zap);
+
+                /* frames can be processed in parallel unless they depend on each other (averaging, delta coding) or on scripts */
+                if(!frame_pipe && (dng_output || mlv_pipe_output || stream_output) && threads > 1 && !skip_block && !lua_state && !average_mode && fix_bug == BUG_ID_NONE && !(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA))
+                {
+                    memset(&frame_pipe_ctx, 0x00, sizeof(frame_pipeline_ctx_t));
+                    frame_pipe_ctx.output_filename = output_filename;
+                    frame_pipe_ctx.out_file = stream_output ? stdout : out_file;
+                    frame_pipe_ctx.dng_output = dng_output;
+                    frame_pipe_ctx.stream_output = stream_output;
+                    frame_pipe_ctx.image_output = image_output;
+                    frame_pipe_ctx.image_setup = image_setup_data;
+                    frame_pipe_ctx.verbose = verbose;
+                    frame_pipe_ctx.bit_depth = bit_depth;
+                    frame_pipe_ctx.bit_zap = bit_zap;
+                    frame_pipe_ctx.fix_vert_stripes = fix_vert_stripes;
+                    frame_pipe_ctx.fix_cold_pixels = fix_cold_pixels;
+                    frame_pipe_ctx.fix_analysis = fix_cache.analysis;
+                    frame_pipe_ctx.chroma_smooth_method = chroma_smooth_method;
+                    if(subtract_mode)
+                    {
+                        frame_pipe_ctx.frame_sub_buffer = frame_sub_buffer;
+                        frame_pipe_ctx.subtract_frame_buffer_size = subtract_frame_buffer_size;
+                    }
+                    if(flatfield_mode)
+                    {
+                        frame_pipe_ctx.frame_flat_buffer = frame_flat_buffer;
+                        frame_pipe_ctx.flatfield_frame_buffer_size = flatfield_frame_buffer_size;
+                    }
+                    frame_pipe_ctx.ref_calib = ref_calib;
+                    frame_pipe_ctx.compress_output = compress_output;
+                    frame_pipe_ctx.compress_format = compress_format;
+                    frame_pipe_ctx.lj92_passthrough = lj92_passthrough;
+                    frame_pipe_ctx.dng_compress = dng_output && lj92_output;
+                    frame_pipe_ctx.lzma_level = lzma_level;
+                    frame_pipe_ctx.lzma_dict = lzma_dict;
+                    frame_pipe_ctx.lzma_lc = lzma_lc;
+                    frame_pipe_ctx.lzma_lp = lzma_lp;
+                    frame_pipe_ctx.lzma_pb = lzma_pb;
+                    frame_pipe_ctx.lzma_fb = lzma_fb;
+                    frame_pipe_ctx.lzma_threads = lzma_threads;
+
+                    frame_pipe = pipeline_create(threads, 2 * threads, sizeof(frame_job_t), &frame_pipeline_process, 
+                                                dng_output ? &dng_pipeline_write : stream_output ? &stream_pipeline_write : &mlv_pipeline_write, &frame_pipe_ctx);
+                    if(!frame_pipe)
+                    {
+                        print_msg(MSG_ERROR, "VIDF: Failed to start %d threads, processing frames serially\n", threads);
+                        threads = 1;
+                    }
+                    else
+                    {
+                        /* frames are already processed in parallel, so AMaZE uses one thread per frame */
+                        parallel_set_threads(1);
+                    }
+                }
+
+                if(frame_pipe && !skip_block)
+                {
+                    /* when no end was specified, save all frames */
+                    uint32_t frame_selected = (!extract_frames) || ((block_hdr.frameNumber >= frame_start) && (block_hdr.frameNumber <= frame_end));
+
+                    if(frame_selected)
+                    {
+                        vidf_frames_selected++;
+
+                        frame_job_t *job = pipeline_get_job(frame_pipe);
+                        if(!job)
+                        {
+                            print_msg(MSG_ERROR, "VIDF: Processing previous frames failed\n");
+                            goto abort;
+                        }
+
+                        int frame_size = block_hdr.blockSize - sizeof(mlv_vidf_hdr_t) - block_hdr.frameSpace;
+
+                        /* raw2dng code always works on a full 14 bit frame, so use the same minimum size as the serial frame buffer */
+                        uint32_t job_buffer_size = MAX((uint32_t)frame_size, frame_buffer_size);
+
+                        if(frame_job_reserve(job, job_buffer_size))
+                        {
+                            print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", job_buffer_size);
+                            goto abort;
+                        }
+
+                        profile_start(&job->prof, input_filename, block_hdr.frameNumber);
+                        profile_begin(&job->prof, "read");
+                        mlv_reader_set_pos(in_file, block_hdr.frameSpace, SEEK_CUR);
+                        if(mlv_reader_read(job->frame_buffer, frame_size, in_file) != 1)
+                        {
+                            print_msg(MSG_ERROR, "VIDF: File ends in the middle of a block\n");
+                            goto abort;
+                        }
+                        profile_end(&job->prof, "read", frame_size);
+
+                        /* the worker threads must not see metadata blocks that are read later */
+                        job->frame_size = frame_size;
+                        job->read_size = frame_size;
+                        job->audio = 0;
+                        job->frame_number = block_hdr.frameNumber;
+                        job->timestamp = buf.timestamp;
+                        job->xRes = video_xRes;
+                        job->yRes = video_yRes;
+                        job->clip_info = lv_rec_footer.raw_info;
+                        job->main_header = main_header;
+                        job->expo_info = expo_info;
+                        job->lens_info = lens_info;
+                        job->rtci_info = rtci_info;
+                        job->idnt_info = idnt_info;
+                        job->camname = unique_camname;
+                        strncpy(job->info_string, info_string, sizeof(job->info_string));
+
+                        /* a frame that gets analyzed for stripes and cold pixels must wait for the frames using the previous analysis */
+                        int fix_analyze = dng_output && (fix_vert_stripes || fix_cold_pixels) &&
+                                          dng_fix_cache_stale(&fix_cache, &job->clip_info, video_xRes, video_yRes, block_hdr.cropPosX, block_hdr.cropPosY, block_hdr.frameNumber, fix_refresh);
+                        if(fix_analyze)
+                        {
+                            if(pipeline_flush(frame_pipe))
+                            {
+                                goto abort;
+                            }
+                            dng_fix_cache_renew(&fix_cache, &job->clip_info, video_xRes, video_yRes, block_hdr.cropPosX, block_hdr.cropPosY, block_hdr.frameNumber);
+                        }
+
+                        /* MLV output leaves compressed frames alone, unless asked to (re)compress them */
+                        job->compressed = main_header.videoClass & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92);
+                        if(mlv_output)
+                        {
+                            if(!compress_output && !decompress_output)
+                            {
+                                job->compressed = 0;
+                            }
 
-                /* store last VIDF for reference */
-                last_vidf = block_hdr;
+                            block_hdr.frameNumber -= frame_start;
+                            job->vidf_hdr = block_hdr;
+                        }
 
-                lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
+                        pipeline_submit(frame_pipe, job);
 
-                if(verbose)
-                {
-                    print_msg(MSG_INFO, "   Frame: #%04d\n", block_hdr.frameNumber);
-                    print_msg(MSG_INFO, "    Crop: %dx%d\n", block_hdr.cropPosX, block_hdr.cropPosY);
-                    print_msg(MSG_INFO, "     Pan: %dx%d\n", block_hdr.panPosX, block_hdr.panPosY);
-                    print_msg(MSG_INFO, "   Space: %d\n", block_hdr.frameSpace);
-                }
-                
-                if(alter_fps)
-                {
-                    block_hdr.timestamp = (((uint64_t)block_hdr.frameNumber * 10000000ULL) / alter_fps) * 1000;
-                }
-                
-                uint32_t skip_block = 0;
-                
-                if(block_hdr.frameSpace > block_hdr.blockSize - sizeof(mlv_vidf_hdr_t))
-                {
-                    print_msg(MSG_ERROR, "VIDF: Frame space is larger than block size. Skipping\n");
-                    skip_block = 1;
-                }
+                        /* the first frame is used for stripe, cold pixel and flat-field analysis, all others have to wait for that */
+                        if(!frame_pipe_primed || fix_analyze)
+                        {
+                            if(pipeline_flush(frame_pipe))
+                            {
+                                goto abort;
+                            }
+                            frame_pipe_primed = 1;
+                        }
+                    }
 
-                if((raw_output || mlv_output || dng_output || lua_state) && !skip_block)
+                    mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                }
+                else if((raw_output || mlv_output || dng_output || stream_output || lua_state) && !skip_block)
                 {
                     /* if already compressed, we have to decompress it first */
-                    int compressed = main_header.videoClass & MLV_VIDEO_CLASS_FLAG_LZMA;
+                    int compressed = main_header.videoClass & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92);
                     int recompress = compressed && compress_output;
                     int decompress = compressed && decompress_output;
 
@@ -2148,13 +5078,13 @@ read_headers:
                         print_msg(MSG_INFO, "BUG_ID_FRAMEDATA_MISALIGN: Offset frame data by %d byte\n", fix_bug_2_offset);
                         skipSize -= fix_bug_2_offset;
                     }
-                    file_set_pos(in_file, skipSize, SEEK_CUR);
+                    mlv_reader_set_pos(in_file, skipSize, SEEK_CUR);
                     
                     /* we can correct that frame by fixing frame space */
                     if(fix_bug == BUG_ID_BLOCKSIZE_WRONG && fix_bug_1_offset != 0)
                     {
                         print_msg(MSG_INFO, "BUG_ID_BLOCKSIZE_WRONG: Seeking %d byte\n", fix_bug_1_offset);
-                        file_set_pos(in_file, fix_bug_1_offset, SEEK_CUR);
+                        mlv_reader_set_pos(in_file, fix_bug_1_offset, SEEK_CUR);
                         block_hdr.frameSpace += fix_bug_1_offset;
                         fix_bug_1_offset = 0;
                     }
@@ -2205,54 +5135,70 @@ read_headers:
                         }
                     }
                     
-                    if(fread(frame_buffer, frame_size, 1, in_file) != 1)
+                    /* frames that are passed through or only repacked are used straight from the mapped file */
+                    int modify_in_place = recompress || decompress || ((raw_output || dng_output || stream_output) && compressed) || 
+                                          subtract_mode || flatfield_mode || ref_calib || average_mode || bit_zap || compress_output || 
+                                          delta_encode_mode || (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA) || 
+                                          dng_output || lua_state;
+                    uint8_t *frame_data = NULL;
+
+                    profile_start(&frame_prof, input_filename, block_hdr.frameNumber);
+                    profile_begin(&frame_prof, "read");
+
+                    if(!modify_in_place)
                     {
-                        print_msg(MSG_ERROR, "VIDF: File ends in the middle of a block\n");
-                        goto abort;
+                        frame_data = mlv_reader_map(in_file, frame_size);
+                    }
+
+                    if(!frame_data)
+                    {
+                        if(mlv_reader_read(frame_buffer, frame_size, in_file) != 1)
+                        {
+                            print_msg(MSG_ERROR, "VIDF: File ends in the middle of a block\n");
+                            goto abort;
+                        }
+                        frame_data = frame_buffer;
                     }
 
+                    profile_end(&frame_prof, "read", frame_size);
+
                     if(fix_bug == BUG_ID_FRAMEDATA_MISALIGN && (int)block_hdr.frameSpace >= fix_bug_2_offset)
                     {
-                        file_set_pos(in_file, fix_bug_2_offset, SEEK_CUR);
+                        mlv_reader_set_pos(in_file, fix_bug_2_offset, SEEK_CUR);
                     }
                     
                     lua_handle_hdr_data(lua_state, buf.blockType, "_data_read", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                    if(recompress || decompress || ((raw_output || dng_output) && compressed))
+                    int old_depth = lv_rec_footer.raw_info.bits_per_pixel;
+
+                    /* keep the LJ92 stream for the DNG, the frame buffer gets decompressed for the thumbnail and raw2dng fixes */
+                    int lj92_size = 0;
+                    if(lj92_passthrough)
                     {
-#ifdef MLV_USE_LZMA
-                        size_t lzma_out_size = *(uint32_t *)frame_buffer;
-                        size_t lzma_in_size = frame_size - LZMA_PROPS_SIZE - 4;
-                        size_t lzma_props_size = LZMA_PROPS_SIZE;
-                        unsigned char *lzma_out = malloc(lzma_out_size);
-
-                        int ret = LzmaUncompress(
-                            lzma_out, &lzma_out_size,
-                            (unsigned char *)&frame_buffer[4 + LZMA_PROPS_SIZE], &lzma_in_size,
-                            (unsigned char *)&frame_buffer[4], lzma_props_size
-                            );
-
-                        if(ret == SZ_OK)
+                        if(frame_size > (int)lj92_buffer_size)
                         {
-                            frame_size = lzma_out_size;
-                            memcpy(frame_buffer, lzma_out, frame_size);
-                            if(verbose)
+                            lj92_buffer_size = frame_size;
+                            lj92_buffer = realloc(lj92_buffer, lj92_buffer_size);
+                            if(!lj92_buffer)
                             {
-                                print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, lzma_out_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
+                                print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", lj92_buffer_size);
+                                goto abort;
                             }
                         }
-                        else
+                        memcpy(lj92_buffer, frame_buffer, frame_size);
+                        lj92_size = frame_size;
+                    }
+
+                    if(recompress || decompress || ((raw_output || dng_output || stream_output) && compressed))
+                    {
+                        profile_begin(&frame_prof, "decompress");
+                        if(frame_decompress(&frame_buffer, &frame_buffer_size, &frame_size, compressed, video_xRes, video_yRes, old_depth, verbose))
                         {
-                            print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
                             goto abort;
                         }
-#else
-                        print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
-                        goto abort;
-#endif
+                        profile_end(&frame_prof, "decompress", frame_size);
                     }
 
-                    int old_depth = lv_rec_footer.raw_info.bits_per_pixel;
                     int new_depth = bit_depth;
 
                     /* this value changes in this context */
@@ -2267,25 +5213,9 @@ read_headers:
                             break;
                         }
                         
-                        int pitch = video_xRes * current_depth / 8;
-
-                        for(int y = 0; y < video_yRes; y++)
-                        {
-                            uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
-                            uint16_t *sub_line = (uint16_t *)&frame_sub_buffer[y * pitch];
-
-                            for(int x = 0; x < video_xRes; x++)
-                            {
-                                int32_t value = bitextract(src_line, x, current_depth);
-                                int32_t sub_value = bitextract(sub_line, x, current_depth);
-
-                                value -= sub_value;
-                                value += lv_rec_footer.raw_info.black_level; /* should we really add it here? or better subtract it from averaged frame? */
-                                value = COERCE(value, 0, (1<<current_depth)-1);
-
-                                bitinsert(src_line, x, current_depth, value);
-                            }
-                        }
+                        profile_begin(&frame_prof, "subtract");
+                        frame_subtract(frame_buffer, frame_sub_buffer, video_xRes, video_yRes, current_depth, lv_rec_footer.raw_info.black_level);
+                        profile_end(&frame_prof, "subtract", frame_size);
                     }
 
                     /* in flat-field mode, divide each image by the normalized reference frame */
@@ -2297,201 +5227,73 @@ read_headers:
                             break;
                         }
                         
-                        int pitch = video_xRes * current_depth / 8;
-
-                        /* normalize flat frame on each Bayer channel (median) */
-                        /* and adjust all medians using green's 5th percentile to prevent whites from clipping */
-                        static int32_t med[2][2] = {{0,0},{0,0}};
-                        static int32_t pr5[2][2] = {{0,0},{0,0}};
-                        static int32_t adj_num = 0;
-                        static int32_t adj_den = 0;
-
-                        int black = lv_rec_footer.raw_info.black_level;
-                        
-                        if (!med[0][0])
-                        {
-                            /* normalize using frame center only
-                             * (also works on lenses with heavy vignetting) */
-                            
-                            int* hist[2][2];
-                            int total[2][2] = {{0,0},{0,0}};
-                            
-                            hist[0][0] = calloc(1 << current_depth, sizeof(int));
-                            hist[0][1] = calloc(1 << current_depth, sizeof(int));
-                            hist[1][0] = calloc(1 << current_depth, sizeof(int));
-                            hist[1][1] = calloc(1 << current_depth, sizeof(int));
-                            
-                            for(int y = video_yRes/4; y < video_yRes*3/4; y++)
-                            {
-                                uint16_t *flat_line = (uint16_t *)&frame_flat_buffer[y * pitch];
-                                for(int x = video_xRes/4; x < video_xRes*3/4; x++)
-                                {
-                                    uint32_t value = bitextract(flat_line, x, current_depth);
-                                    hist[y%2][x%2][value]++;
-                                    total[y%2][x%2]++;
-                                }
-                            }
-                            
-                            for (int dy = 0; dy < 2; dy++)
-                            {
-                                for (int dx = 0; dx < 2; dx++)
-                                {
-                                    int acc = 0;
-                                    for (int i = 0; i < (1 << current_depth); i++)
-                                    {
-                                        acc += hist[dy][dx][i];
-                                        
-                                        if (acc < total[dy][dx]/20)
-                                        {
-                                            /* 5th percentile */
-                                            pr5[dy][dx] = i - black;
-                                        }
-                                        
-                                        if (acc < total[dy][dx]/2)
-                                        {
-                                            /* median */
-                                            med[dy][dx] = i - black;
-                                        }
-                                    }
-                                }
-                            }
-                            
-                            free(hist[0][0]);
-                            free(hist[0][1]);
-                            free(hist[1][0]);
-                            free(hist[1][1]);
-                            
-                            adj_num = (pr5[0][1] + pr5[1][0]) / 2;
-                            adj_den = (med[0][1] + med[1][0]) / 2;
-
-                            printf("Flat-field median: [%d %d; %d %d], adjusted by %d/%d\n", 
-                                med[0][0], med[0][1],
-                                med[1][0], med[1][1],
-                                adj_num, adj_den
-                            );
-                        }
-                        
-                        for(int y = 0; y < video_yRes; y++)
-                        {
-                            uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
-                            uint16_t *flat_line = (uint16_t *)&frame_flat_buffer[y * pitch];
-
-                            for(int x = 0; x < video_xRes; x++)
-                            {
-                                int32_t value = bitextract(src_line, x, current_depth);
-                                int32_t flat_value = bitextract(flat_line, x, current_depth);
-                                
-                                if (flat_value - black <= 0)
-                                {
-                                    int left  = bitextract(flat_line, MAX(x-1,0), current_depth);
-                                    int right = bitextract(flat_line, MIN(x+1,video_xRes-1), current_depth);
-                                    flat_value = MAX(left, right);
-                                }
-
-                                if (flat_value - black > 0)
-                                {
-                                    value -= black;
-                                    value = (int64_t) value * med[y%2][x%2] * adj_num / adj_den / (flat_value - black);
-                                    value += black;
-                                    value = COERCE(value, 0, (1<<current_depth)-1);
-                                }
+                        profile_begin(&frame_prof, "flatfield");
+                        frame_flatfield(frame_buffer, frame_flat_buffer, video_xRes, video_yRes, current_depth, lv_rec_footer.raw_info.black_level);
+                        profile_end(&frame_prof, "flatfield", frame_size);
+                    }
 
-                                bitinsert(src_line, x, current_depth, value);
-                            }
-                        }
+                    /* darkframe and flat-field picked from the libraries */
+                    if(ref_calib)
+                    {
+                        profile_begin(&frame_prof, "reflib");
+                        reflib_apply(ref_calib, frame_buffer, current_depth);
+                        profile_end(&frame_prof, "reflib", frame_size);
                     }
 
                     /* in average mode, sum up all pixel values of a pixel position */
                     if(average_mode)
                     {
+                        profile_begin(&frame_prof, "average");
                         int pitch = video_xRes * current_depth / 8;
+                        uint16_t *row = malloc(video_xRes * sizeof(uint16_t));
 
                         for(int y = 0; y < video_yRes; y++)
                         {
-                            uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
+                            uint32_t *sum_line = &frame_arith_buffer[y * video_xRes];
+
+                            bitunpack_row(&frame_buffer[y * pitch], row, video_xRes, current_depth);
 
                             for(int x = 0; x < video_xRes; x++)
                             {
-                                uint16_t value = bitextract(src_line, x, current_depth);
-
-                                frame_arith_buffer[y * video_xRes + x] += value;
+                                sum_line[x] += row[x];
                             }
                         }
+                        free(row);
 
                         average_samples++;
+                        profile_end(&frame_prof, "average", frame_size);
                     }
 
                     /* now resample bit depth if requested */
                     if(new_depth && (old_depth != new_depth))
                     {
-                        int new_size = (video_xRes * video_yRes * new_depth + 7) / 8;
-                        unsigned char *new_buffer = malloc(new_size);
-
-                        if(verbose)
-                        {
-                            print_msg(MSG_INFO, "   depth: %d -> %d, size: %d -> %d (%2.2f%%)\n", old_depth, new_depth, frame_size, new_size, ((float)new_depth * 100.0f) / (float)old_depth);
-                        }
-
-                        int calced_size = ((video_xRes * video_yRes * old_depth + 7) / 8);
-                        if(calced_size > frame_size)
+                        profile_begin(&frame_prof, "resample");
+                        if(frame_resample(frame_data, &frame_buffer, &frame_buffer_size, &frame_size, video_xRes, video_yRes, old_depth, new_depth, verbose))
                         {
-                            print_msg(MSG_INFO, "Error: old frame size is too small for %dx%d at %d bpp. Input data corrupt. (%d < %d)\n", video_xRes, video_yRes, old_depth, frame_size, calced_size);
                             break;
                         }
-
-                        int old_pitch = video_xRes * old_depth / 8;
-                        int new_pitch = video_xRes * new_depth / 8;
-
-                        for(int y = 0; y < video_yRes; y++)
-                        {
-                            uint16_t *src_line = (uint16_t *)&frame_buffer[y * old_pitch];
-                            uint16_t *dst_line = (uint16_t *)&new_buffer[y * new_pitch];
-
-                            for(int x = 0; x < video_xRes; x++)
-                            {
-                                uint16_t value = bitextract(src_line, x, old_depth);
-
-                                /* normalize the old value to 16 bits */
-                                value <<= (16-old_depth);
-
-                                /* convert the old value to destination depth */
-                                value >>= (16-new_depth);
-
-                                bitinsert(dst_line, x, new_depth, value);
-                            }
-                        }
-
-                        frame_size = new_size;
+                        profile_end(&frame_prof, "resample", frame_size);
+                        frame_data = frame_buffer;
                         current_depth = new_depth;
-
-                        memcpy(frame_buffer, new_buffer, frame_size);
-                        free(new_buffer);
                     }
 
                     if(bit_zap)
                     {
-                        int pitch = video_xRes * current_depth / 8;
-                        uint32_t mask = ~((1 << (16 - bit_zap)) - 1);
-
-                        for(int y = 0; y < video_yRes; y++)
-                        {
-                            uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
-
-                            for(int x = 0; x < video_xRes; x++)
-                            {
-                                int32_t value = bitextract(src_line, x, current_depth);
-
-                                /* normalize the old value to 16 bits */
-                                value <<= (16-current_depth);
-
-                                value &= mask;
-
-                                /* convert the old value to destination depth */
-                                value >>= (16-current_depth);
+                        profile_begin(&frame_prof, "zap");
+                        frame_zap(frame_buffer, video_xRes, video_yRes, current_depth, bit_zap);
+                        profile_end(&frame_prof, "zap", frame_size);
+                    }
 
+                    int delta_coded = delta_encode_mode || (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA);
+                    if(delta_coded)
+                    {
+                        profile_begin(&frame_prof, "delta");
 
-                                bitinsert(src_line, x, current_depth, value);
-                            }
+                        /* keyframes are coded against black */
+                        uint32_t key_interval = (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA) ? delta_key_interval : (uint32_t)keyframe_interval;
+                        if(delta_keyframe(block_hdr.frameNumber, key_interval, &delta_group))
+                        {
+                            memset(prev_frame_buffer, 0x00, frame_size);
                         }
                     }
 
@@ -2501,39 +5303,11 @@ read_headers:
                         if(!(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA))
                         {
                             uint8_t *current_frame_buffer = malloc(frame_size);
-                            int pitch = video_xRes * current_depth / 8;
 
                             /* backup current frame for later */
                             memcpy(current_frame_buffer, frame_buffer, frame_size);
 
-                            for(int y = 0; y < video_yRes; y++)
-                            {
-                                uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
-                                uint16_t *ref_line = (uint16_t *)&prev_frame_buffer[y * pitch];
-                                int32_t offset = 1 << (current_depth - 1);
-                                int32_t max_val = (1 << current_depth) - 1;
-
-                                for(int x = 0; x < video_xRes; x++)
-                                {
-                                    int32_t value = bitextract(src_line, x, current_depth);
-                                    int32_t ref_value = bitextract(ref_line, x, current_depth);
-
-                                    /* when e.g. using 16 bit values:
-                                           delta =  1      -> encode to 0x8001
-                                           delta =  0      -> encode to 0x8000
-                                           delta = -1      -> encode to 0x7FFF
-                                           delta = -0xFFFF -> encode to 0x0001
-                                           delta =  0xFFFF -> encode to 0x7FFF
-                                       so this is basically a signed int with overflow and a max/2 offset.
-                                       this offset makes the frames uniform grey when viewing non-decoded frames and improves compression rate a bit.
-                                    */
-                                    int32_t delta = offset + value - ref_value;
-
-                                    uint16_t new_value = (uint16_t)(delta & max_val);
-
-                                    bitinsert(src_line, x, current_depth, new_value);
-                                }
-                            }
+                            frame_delta(frame_buffer, prev_frame_buffer, video_xRes, video_yRes, current_depth, 0);
 
                             /* save current original frame to prev buffer */
                             memcpy(prev_frame_buffer, current_frame_buffer, frame_size);
@@ -2545,48 +5319,22 @@ read_headers:
                         /* delta decode, if input data is encoded */
                         if(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA)
                         {
-                            int pitch = video_xRes * current_depth / 8;
-
-                            for(int y = 0; y < video_yRes; y++)
-                            {
-                                uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
-                                uint16_t *ref_line = (uint16_t *)&prev_frame_buffer[y * pitch];
-                                int32_t offset = 1 << (current_depth - 1);
-                                int32_t max_val = (1 << current_depth) - 1;
-
-                                for(int x = 0; x < video_xRes; x++)
-                                {
-                                    int32_t value = bitextract(src_line, x, current_depth);
-                                    int32_t ref_value = bitextract(ref_line, x, current_depth);
-
-                                    /* when e.g. using 16 bit values:
-                                           delta =  1      -> encode to 0x8001
-                                           delta =  0      -> encode to 0x8000
-                                           delta = -1      -> encode to 0x7FFF
-                                           delta = -0xFFFF -> encode to 0x0001
-                                           delta =  0xFFFF -> encode to 0x7FFF
-                                       so this is basically a signed int with overflow and a max/2 offset.
-                                       this offset makes the frames uniform grey when viewing non-decoded frames and improves compression rate a bit.
-                                    */
-                                    int32_t delta = offset + value + ref_value;
-
-                                    uint16_t new_value = (uint16_t)(delta & max_val);
-
-                                    bitinsert(src_line, x, current_depth, new_value);
-                                }
-                            }
+                            frame_delta(frame_buffer, prev_frame_buffer, video_xRes, video_yRes, current_depth, 1);
 
                             /* save current original frame to prev buffer */
                             memcpy(prev_frame_buffer, frame_buffer, frame_size);
                         }
                     }
+                    profile_end(&frame_prof, "delta", frame_size);
 
                     /* when no end was specified, save all frames */
                     uint32_t frame_selected = (!extract_frames) || ((block_hdr.frameNumber >= frame_start) && (block_hdr.frameNumber <= frame_end));
 
                     if(frame_selected)
                     {
-                        lua_handle_hdr_data(lua_state, buf.blockType, "_data_write", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
+                        vidf_frames_selected++;
+
+                        lua_handle_hdr_data(lua_state, buf.blockType, "_data_write", &block_hdr, sizeof(block_hdr), frame_data, frame_size);
 
                         if(raw_output)
                         {
@@ -2595,171 +5343,149 @@ read_headers:
                                 lv_rec_footer.frameSize = frame_size;
                             }
 
-                            lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_raw", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
+                            lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_raw", &block_hdr, sizeof(block_hdr), frame_data, frame_size);
 
+                            profile_begin(&frame_prof, "write_raw");
                             file_set_pos(out_file, (uint64_t)block_hdr.frameNumber * (uint64_t)frame_size, SEEK_SET);
-                            if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
+                            if(fwrite(frame_data, frame_size, 1, out_file) != 1)
                             {
                                 print_msg(MSG_ERROR, "VIDF: Failed writing into .RAW file\n");
                                 goto abort;
                             }
+                            profile_end(&frame_prof, "write_raw", frame_size);
                         }
 
-                        if(dng_output)
+                        if(stream_output)
                         {
-                            void fix_vertical_stripes();
-                            void find_and_fix_cold_pixels(int force_analysis);
-                            extern struct raw_info raw_info;
+                            profile_begin(&frame_prof, "stream_convert");
+                            int stream_size = frame_stream_size(stream_output, video_xRes, video_yRes);
+                            uint16_t *stream_data = stream_out_get(stream, stream_size);
+
+                            if(!stream_data)
+                            {
+                                print_msg(MSG_ERROR, "VIDF: Failed writing into stream\n");
+                                goto abort;
+                            }
+                            if(frame_stream_convert(stream_data, frame_data, video_xRes, video_yRes, current_depth, &lv_rec_footer.raw_info, stream_output))
+                            {
+                                print_msg(MSG_ERROR, "VIDF: Failed to convert frame for the stream\n");
+                                goto abort;
+                            }
+                            stream_out_put(stream, stream_size);
+                            profile_end(&frame_prof, "stream_convert", stream_size);
+                        }
 
+                        if(dng_output)
+                        {
                             int frame_filename_len = strlen(output_filename) + 32;
                             char *frame_filename = malloc(frame_filename_len);
-                            snprintf(frame_filename, frame_filename_len, "%s%06d.dng", output_filename, block_hdr.frameNumber);
+                            snprintf(frame_filename, frame_filename_len, "%s%06d.%s", output_filename, block_hdr.frameNumber, image_output ? image_extension(image_output) : "dng");
 
                             lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_dng", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                            raw_info = lv_rec_footer.raw_info;
-                            raw_info.frame_size = frame_size;
-                            raw_info.buffer = frame_buffer;
-
-                            /* override the resolution from raw_info with the one from lv_rec_footer, if they don't match */
-                            if (lv_rec_footer.xRes != raw_info.width)
+                            if(dng_fix_cache_stale(&fix_cache, &lv_rec_footer.raw_info, video_xRes, video_yRes, block_hdr.cropPosX, block_hdr.cropPosY, block_hdr.frameNumber, fix_refresh))
                             {
-                                raw_info.width = lv_rec_footer.xRes;
-                                raw_info.pitch = raw_info.width * 14/8;
-                                raw_info.active_area.x1 = 0;
-                                raw_info.active_area.x2 = raw_info.width;
-                                raw_info.jpeg.x = 0;
-                                raw_info.jpeg.width = raw_info.width;
+                                dng_fix_cache_renew(&fix_cache, &lv_rec_footer.raw_info, video_xRes, video_yRes, block_hdr.cropPosX, block_hdr.cropPosY, block_hdr.frameNumber);
                             }
 
-                            if (lv_rec_footer.yRes != raw_info.height)
+                            profile_begin(&frame_prof, "dng_fix");
+                            dng_init_raw_info(&raw_info, &lv_rec_footer.raw_info, frame_buffer, frame_size, lv_rec_footer.xRes, lv_rec_footer.yRes);
+                            if(dng_fix_frame(&raw_info, fix_cache.analysis, fix_vert_stripes, fix_cold_pixels, chroma_smooth_method, threads, &chroma_planes))
                             {
-                                raw_info.height = lv_rec_footer.yRes;
-                                raw_info.active_area.y1 = 0;
-                                raw_info.active_area.y2 = raw_info.height;
-                                raw_info.jpeg.y = 0;
-                                raw_info.jpeg.height = raw_info.height;
+                                lj92_size = 0;
                             }
+                            profile_end(&frame_prof, "dng_fix", frame_size);
 
-                            /* call raw2dng code */
-                            if (fix_vert_stripes)
-                            {
-                                fix_vertical_stripes();
-                            }
-                            
-                            if (fix_cold_pixels)
+                            if(image_output)
                             {
-                                find_and_fix_cold_pixels(fix_cold_pixels == 2);
-                            }
+                                image_frame_t frame;
+                                int image_width = 0;
+                                int image_height = 0;
 
-                            /* this is internal again */
-                            chroma_smooth(chroma_smooth_method, &raw_info);
-
-                            /* set MLV metadata into DNG tags */
-                            dng_set_framerate_rational(main_header.sourceFpsNom, main_header.sourceFpsDenom);
-                            dng_set_shutter(1, (int)(1000000.0f/(float)expo_info.shutterValue));
-                            dng_set_aperture(lens_info.aperture, 100);
-                            dng_set_camname((char*)unique_camname);
-                            dng_set_description((char*)info_string);
-                            dng_set_lensmodel((char*)lens_info.lensName);
-                            dng_set_focal(lens_info.focalLength, 1);
-                            dng_set_iso(expo_info.isoValue);
-
-                            //dng_set_wbgain(1024, wbal_info.wbgain_r, 1024, wbal_info.wbgain_g, 1024, wbal_info.wbgain_b);
-
-                            /* calculate the time this frame was taken at, i.e., the start time + the current timestamp. this can be off by a second but it's better than nothing */
-                            int ms = 0.5 + buf.timestamp / 1000.0;
-                            int sec = ms / 1000;
-                            ms %= 1000;
-                            // FIXME: the struct tm doesn't have tm_gmtoff on Linux so the result might be wrong?
-                            struct tm tm;
-                            tm.tm_sec = rtci_info.tm_sec + sec;
-                            tm.tm_min = rtci_info.tm_min;
-                            tm.tm_hour = rtci_info.tm_hour;
-                            tm.tm_mday = rtci_info.tm_mday;
-                            tm.tm_mon = rtci_info.tm_mon;
-                            tm.tm_year = rtci_info.tm_year;
-                            tm.tm_wday = rtci_info.tm_wday;
-                            tm.tm_yday = rtci_info.tm_yday;
-                            tm.tm_isdst = rtci_info.tm_isdst;
-
-                            if(mktime(&tm) != -1)
-                            {
-                                char datetime_str[32];
-                                char subsec_str[8];
-                                strftime(datetime_str, 20, "%Y:%m:%d %H:%M:%S", &tm);
-                                snprintf(subsec_str, sizeof(subsec_str), "%03d", ms);
-                                dng_set_datetime(datetime_str, subsec_str);
-                            }
-                            else
-                            {
-                                // soemthing went wrong. let's proceed anyway
-                                print_msg(MSG_ERROR, "VIDF: [W] Failed calculating the DateTime from the timestamp\n");
-                                dng_set_datetime("", "");
-                            }
+                                image_init_frame(&frame, &raw_info, current_depth);
+                                if(image_size(image_setup_data, &frame, &image_width, &image_height))
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Cannot demosaic a %dx%d frame with CFA pattern 0x%08X\n", frame.width, frame.height, frame.cfa_pattern);
+                                    goto abort;
+                                }
 
+                                uint32_t image_size_needed = image_width * image_height * 3 * sizeof(uint16_t);
+                                if(image_size_needed > image_buffer_size)
+                                {
+                                    free(image_buffer);
+                                    image_buffer = malloc(image_size_needed);
+                                    image_buffer_size = image_buffer ? image_size_needed : 0;
+                                    if(!image_buffer)
+                                    {
+                                        print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", image_size_needed);
+                                        goto abort;
+                                    }
+                                }
 
-                            uint64_t serial = 0;
-                            char *end;
-                            serial = strtoull((char *)idnt_info.cameraSerial, &end, 16);
-                            if (serial && !*end)
-                            {
-                                char serial_str[64];
+                                profile_begin(&frame_prof, "demosaic");
+                                if(image_convert(image_setup_data, &frame, frame_buffer, image_buffer))
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed to demosaic frame\n");
+                                    goto abort;
+                                }
+                                profile_end(&frame_prof, "demosaic", frame_size);
 
-                                sprintf(serial_str, "%"PRIu64, serial);
-                                dng_set_camserial((char*)serial_str);
-                            }
+                                profile_begin(&frame_prof, "write_image");
+                                if(image_save(frame_filename, image_output, image_buffer, image_width, image_height))
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed writing into .%s file\n", image_extension(image_output));
+                                    goto abort;
+                                }
+                                profile_end(&frame_prof, "write_image", image_size_needed);
 
-                            /* finally save the DNG */
-                            if(!save_dng(frame_filename, &raw_info))
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed writing into .DNG file\n");
-                                goto abort;
+                                free(frame_filename);
                             }
+                            else
+                            {
+                                dng_set_metadata(&main_header, &expo_info, &lens_info, &rtci_info, &idnt_info, unique_camname, info_string, buf.timestamp);
+
+                                /* finally save the DNG, unchanged LJ92 frames are saved without re-encoding */
+                                dng_frame_byte_order(&raw_info, frame_buffer, frame_size);
+                                profile_begin(&frame_prof, "write_dng");
+                                int saved = lj92_size ? save_dng_lj92(frame_filename, &raw_info, lj92_buffer, lj92_size) : save_dng(frame_filename, &raw_info);
+                                if(!saved)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed writing into .DNG file\n");
+                                    goto abort;
+                                }
+                                profile_end(&frame_prof, "write_dng", lj92_size ? lj92_size : raw_info.frame_size);
 
-                            /* callout for a saved dng file */
-                            lua_call_va(lua_state, "dng_saved", "si", frame_filename, block_hdr.frameNumber);
+                                /* callout for a saved dng file */
+                                lua_call_va(lua_state, "dng_saved", "si", frame_filename, block_hdr.frameNumber);
 
-                            free(frame_filename);
+                                free(frame_filename);
+                            }
                         }
 
                         if(mlv_output && !only_metadata_mode && !average_mode && (!extract_block || !strncasecmp(extract_block, (char*)block_hdr.blockType, 4)))
                         {
-                            if(compress_output)
+                            if(compress_output && compress_format == MLV_VIDEO_CLASS_FLAG_LJ92)
                             {
-#ifdef MLV_USE_LZMA
-                                size_t lzma_out_size = 2 * frame_size;
-                                size_t lzma_in_size = frame_size;
-                                size_t lzma_props_size = LZMA_PROPS_SIZE;
-                                unsigned char *lzma_out = malloc(lzma_out_size + LZMA_PROPS_SIZE);
-
-                                int ret = LzmaCompress(
-                                    &lzma_out[LZMA_PROPS_SIZE], &lzma_out_size,
-                                    (unsigned char *)frame_buffer, lzma_in_size,
-                                    &lzma_out[0], &lzma_props_size,
-                                    lzma_level, lzma_dict, lzma_lc, lzma_lp, lzma_pb, lzma_fb, lzma_threads
-                                    );
-
-                                if(ret == SZ_OK)
+                                profile_begin(&frame_prof, "compress");
+                                int raw_size = frame_size;
+                                if(frame_lj92_compress(&frame_buffer, &frame_buffer_size, &frame_size, video_xRes, video_yRes, current_depth, verbose))
                                 {
-                                    /* store original frame size */
-                                    *(uint32_t *)frame_buffer = frame_size;
-
-                                    /* set new compressed size and copy buffers */
-                                    frame_size = lzma_out_size + LZMA_PROPS_SIZE + 4;
-                                    memcpy(&frame_buffer[4], lzma_out, frame_size - 4);
-
-                                    if(verbose)
-                                    {
-                                        print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, frame_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
-                                    }
+                                    goto abort;
                                 }
-                                else
+                                profile_end(&frame_prof, "compress", raw_size);
+                                frame_data = frame_buffer;
+                            }
+                            else if(compress_output)
+                            {
+#ifdef MLV_USE_LZMA
+                                profile_begin(&frame_prof, "compress");
+                                int raw_size = frame_size;
+                                if(frame_lzma_compress(&frame_buffer, &frame_buffer_size, &frame_size, lzma_level, lzma_dict, lzma_lc, lzma_lp, lzma_pb, lzma_fb, lzma_threads, verbose))
                                 {
-                                    print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
                                     goto abort;
                                 }
-                                free(lzma_out);
+                                profile_end(&frame_prof, "compress", raw_size);
+                                frame_data = frame_buffer;
 #else
                                 print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
                                 goto abort;
@@ -2771,35 +5497,39 @@ read_headers:
                                 print_msg(MSG_INFO, "  saving: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", prev_frame_size, frame_size, ((float)frame_size * 100.0f) / (float)prev_frame_size);
                             }
 
-                            lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_mlv", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
+                            lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_mlv", &block_hdr, sizeof(block_hdr), frame_data, frame_size);
 
                             /* delete free space and correct header size if needed */
                             block_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
                             block_hdr.frameSpace = 0;
                             block_hdr.frameNumber -= frame_start;
 
+                            profile_begin(&frame_prof, "write_mlv");
                             if(fwrite(&block_hdr, sizeof(mlv_vidf_hdr_t), 1, out_file) != 1)
                             {
                                 print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
                                 goto abort;
                             }
-                            if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
+                            if(fwrite(frame_data, frame_size, 1, out_file) != 1)
                             {
                                 print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
                                 goto abort;
                             }
+                            profile_end(&frame_prof, "write_mlv", block_hdr.blockSize);
                         }
+
+                        profile_report(&frame_prof);
                     }
                 }
                 else
                 {
-                    file_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                    mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
                     
                     /* we can correct that frame by fixing frame space */
                     if(fix_bug == BUG_ID_BLOCKSIZE_WRONG && fix_bug_1_offset != 0)
                     {
                         print_msg(MSG_INFO, "BUG_ID_BLOCKSIZE_WRONG: Seeking %d byte\n", fix_bug_1_offset);
-                        file_set_pos(in_file, fix_bug_1_offset, SEEK_CUR);
+                        mlv_reader_set_pos(in_file, fix_bug_1_offset, SEEK_CUR);
                         fix_bug_1_offset = 0;
                     }
                 }
@@ -2812,14 +5542,14 @@ read_headers:
             {
                 uint32_t hdr_size = MIN(sizeof(mlv_lens_hdr_t), buf.blockSize);
 
-                if(fread(&lens_info, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&lens_info, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + lens_info.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + lens_info.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &lens_info, sizeof(lens_info));
 
@@ -2852,7 +5582,7 @@ read_headers:
                 mlv_info_hdr_t block_hdr;
                 int32_t hdr_size = MIN(sizeof(mlv_info_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
@@ -2867,7 +5597,7 @@ read_headers:
                 {
                     char *buf = malloc(str_length + 1);
 
-                    if(fread(buf, str_length, 1, in_file) != 1)
+                    if(mlv_reader_read(buf, str_length, in_file) != 1)
                     {
                         free(buf);
                         print_msg(MSG_ERROR, "File ends in the middle of a block\n");
@@ -2909,7 +5639,7 @@ read_headers:
                 mlv_debg_hdr_t block_hdr;
                 int32_t hdr_size = MIN(sizeof(mlv_debg_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
@@ -2924,7 +5654,7 @@ read_headers:
                 {
                     char *buf = malloc(str_length + 1);
 
-                    if(fread(buf, str_length, 1, in_file) != 1)
+                    if(mlv_reader_read(buf, str_length, in_file) != 1)
                     {
                         free(buf);
                         print_msg(MSG_ERROR, "File ends in the middle of a block\n");
@@ -2972,7 +5702,7 @@ read_headers:
                 mlv_vers_hdr_t block_hdr;
                 int32_t hdr_size = MIN(sizeof(mlv_vers_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
@@ -2987,7 +5717,7 @@ read_headers:
                 {
                     char *buf = malloc(str_length + 1);
 
-                    if(fread(buf, str_length, 1, in_file) != 1)
+                    if(mlv_reader_read(buf, str_length, in_file) != 1)
                     {
                         free(buf);
                         print_msg(MSG_ERROR, "File ends in the middle of a block\n");
@@ -3027,14 +5757,14 @@ read_headers:
                 mlv_elvl_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_elvl_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
 
@@ -3060,14 +5790,14 @@ read_headers:
                 mlv_styl_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_styl_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
 
@@ -3095,14 +5825,14 @@ read_headers:
             {
                 uint32_t hdr_size = MIN(sizeof(mlv_wbal_hdr_t), buf.blockSize);
 
-                if(fread(&wbal_info, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&wbal_info, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + wbal_info.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + wbal_info.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &wbal_info, sizeof(wbal_info));
 
@@ -3132,14 +5862,14 @@ read_headers:
             {
                 uint32_t hdr_size = MIN(sizeof(mlv_idnt_hdr_t), buf.blockSize);
 
-                if(fread(&idnt_info, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&idnt_info, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + idnt_info.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + idnt_info.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &idnt_info, sizeof(idnt_info));
 
@@ -3171,14 +5901,14 @@ read_headers:
             {
                 uint32_t hdr_size = MIN(sizeof(mlv_rtci_hdr_t), buf.blockSize);
 
-                if(fread(&rtci_info, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&rtci_info, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + rtci_info.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + rtci_info.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &rtci_info, sizeof(rtci_info));
 
@@ -3208,14 +5938,14 @@ read_headers:
                 mlv_mark_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_mark_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
 
@@ -3239,14 +5969,14 @@ read_headers:
             {
                 uint32_t hdr_size = MIN(sizeof(mlv_expo_hdr_t), buf.blockSize);
 
-                if(fread(&expo_info, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&expo_info, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + expo_info.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + expo_info.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &expo_info, sizeof(expo_info));
 
@@ -3275,14 +6005,14 @@ read_headers:
                 mlv_rawi_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_rawi_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
                 
                 if(black_fix)
                 {
@@ -3323,6 +6053,16 @@ read_headers:
                     lv_rec_footer.raw_info = block_hdr.raw_info;
                 }
 
+                /* the stream has no header, so tell how to read it */
+                if(stream_output && !vidf_frames_processed)
+                {
+                    const char *pixel_format = stream_pixel_format(stream_output, block_hdr.raw_info.cfa_pattern);
+
+                    print_msg(MSG_INFO, "Streaming %dx%d %s frames, e.g. into:\n", video_xRes, video_yRes, pixel_format);
+                    print_msg(MSG_INFO, "    ffmpeg -f rawvideo -pixel_format %s -video_size %dx%d -framerate %d/%d -i - <output>\n", 
+                              pixel_format, video_xRes, video_yRes, main_header.sourceFpsNom, main_header.sourceFpsDenom);
+                }
+
                 /* always output RAWI blocks, its not just metadata, but important frame format data */
                 if(mlv_output && (!extract_block || !strncasecmp(extract_block, (char*)&block_hdr.blockType, 4)))
                 {
@@ -3346,14 +6086,14 @@ read_headers:
                 mlv_rawc_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_rawc_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
                 
                 lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
 
@@ -3367,14 +6107,14 @@ read_headers:
                 mlv_wavi_hdr_t block_hdr;
                 uint32_t hdr_size = MIN(sizeof(mlv_wavi_hdr_t), buf.blockSize);
 
-                if(fread(&block_hdr, hdr_size, 1, in_file) != 1)
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
                 {
                     print_msg(MSG_ERROR, "File ends in the middle of a block\n");
                     goto abort;
                 }
 
                 /* skip remaining data, if there is any */
-                file_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
 
                 lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
 
@@ -3458,13 +6198,37 @@ read_headers:
                     }
                 }
             }
+            else if(!memcmp(buf.blockType, "DELT", 4))
+            {
+                mlv_delt_hdr_t block_hdr;
+                uint32_t hdr_size = MIN(sizeof(mlv_delt_hdr_t), buf.blockSize);
+
+                memset(&block_hdr, 0x00, sizeof(mlv_delt_hdr_t));
+                if(mlv_reader_read(&block_hdr, hdr_size, in_file) != 1)
+                {
+                    print_msg(MSG_ERROR, "File ends in the middle of a block\n");
+                    goto abort;
+                }
+
+                /* skip remaining data, if there is any */
+                mlv_reader_set_pos(in_file, position + block_hdr.blockSize, SEEK_SET);
+
+                lua_handle_hdr(lua_state, buf.blockType, &block_hdr, sizeof(block_hdr));
+
+                if(verbose)
+                {
+                    print_msg(MSG_INFO, "     Keyframes: every %d frames\n", block_hdr.keyInterval);
+                }
+
+                /* the interval was read before the first frame already, delta coded output gets its own DELT block */
+            }
             else if(!memcmp(buf.blockType, "NULL", 4))
             {
-                file_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + buf.blockSize, SEEK_SET);
             }
             else if(!memcmp(buf.blockType, "BKUP", 4))
             {
-                file_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+                mlv_reader_set_pos(in_file, position + buf.blockSize, SEEK_SET);
             }
             else
             {
@@ -3481,9 +6245,9 @@ read_headers:
                     
                     for(uint32_t offset = 0; offset < range; offset++)
                     {
-                        file_set_pos(in_file, position, SEEK_SET);
+                        mlv_reader_set_pos(in_file, position, SEEK_SET);
                         
-                        if(fread(&type, 4, 1, in_file) != 1)
+                        if(mlv_reader_read(&type, 4, in_file) != 1)
                         {
                             print_msg(MSG_ERROR, "BUG_ID_BLOCKSIZE_WRONG: Failed to read from source file\n");
                             goto abort;
@@ -3493,7 +6257,7 @@ read_headers:
                         {
                             fix_bug_1_offset = -(offset - range / 2);
                             print_msg(MSG_INFO, "BUG_ID_BLOCKSIZE_WRONG: Success, offset: %d bytes.\n", fix_bug_1_offset);
-                            file_set_pos(in_file, position_previous, SEEK_SET);
+                            mlv_reader_set_pos(in_file, position_previous, SEEK_SET);
                             position = position_previous;
                             break;
                         }
@@ -3507,7 +6271,7 @@ read_headers:
                 }
                 else
                 {
-                    file_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+                    mlv_reader_set_pos(in_file, position + buf.blockSize, SEEK_SET);
 
                     lua_handle_hdr(lua_state, buf.blockType, "", 0);
                 }
@@ -3521,6 +6285,14 @@ read_headers:
         if(block_xref)
         {
             block_xref_pos++;
+
+            /* frames outside of the requested range are not even read */
+            while(xref_seek && block_xref_pos < block_xref->entryCount && xrefs[block_xref_pos].frameType == MLV_FRAME_VIDF &&
+                  (block_xref_pos < xref_vidf_first || block_xref_pos > xref_vidf_last))
+            {
+                block_xref_pos++;
+            }
+
             if(block_xref_pos >= block_xref->entryCount)
             {
                 print_msg(MSG_INFO, "Reached end of all files after %i blocks\n", blocks_processed);
@@ -3530,11 +6302,31 @@ read_headers:
         
         position_previous = position;
     }
-    while(!feof(in_file));
+    while(!mlv_reader_eof(in_file));
 
 abort:
 
+    /* wait for the frames still being processed */
+    if(frame_pipe)
+    {
+        if(pipeline_destroy(frame_pipe, &frame_pipeline_free_job))
+        {
+            print_msg(MSG_ERROR, "Failed to process all frames\n");
+        }
+        frame_pipe = NULL;
+    }
+
+    if(stream)
+    {
+        if(stream_out_close(stream))
+        {
+            print_msg(MSG_ERROR, "Failed writing into stream\n");
+        }
+        stream = NULL;
+    }
+
     print_msg(MSG_INFO, "Processed %d video frames\n", vidf_frames_processed);
+    profile_summary();
 
     /* in average mode, finalize average calculation and output the resulting average */
     if(average_mode)
@@ -3584,18 +6376,46 @@ abort:
                 }
             }
             
+            uint16_t *row = malloc(video_xRes * sizeof(uint16_t));
             for(int y = 0; y < video_yRes; y++)
             {
-                uint16_t *dst_line = (uint16_t *)&frame_buffer[y * new_pitch];
                 for(int x = 0; x < video_xRes; x++)
                 {
                     uint32_t value = frame_arith_buffer[y * video_xRes + x];
 
                     value /= average_samples;
-                    bitinsert(dst_line, x, lv_rec_footer.raw_info.bits_per_pixel, value);
+                    row[x] = value;
                 }
+                bitpack_row(&frame_buffer[y * new_pitch], row, video_xRes, lv_rec_footer.raw_info.bits_per_pixel);
+            }
+            free(row);
+
+            /* keep the average in the library, with the fractional part the MLV frame loses */
+            if(dark_lib || flat_lib)
+            {
+                reflib_key_t key;
+                int kind = dark_lib ? REFLIB_DARK : REFLIB_FLAT;
+
+                memset(&key, 0x00, sizeof(key));
+                key.camera_model = idnt_info.cameraModel;
+                key.iso = expo_info.isoValue;
+                key.xRes = video_xRes;
+                key.yRes = video_yRes;
+                key.crop_x = last_vidf.cropPosX;
+                key.crop_y = last_vidf.cropPosY;
+                key.bits_per_pixel = lv_rec_footer.raw_info.bits_per_pixel;
+
+                char *ref_file = reflib_filename(dark_lib ? dark_lib : flat_lib, kind, &key);
+                if(!ref_file || reflib_store(ref_file, kind, &key, lv_rec_footer.raw_info.black_level, lv_rec_footer.raw_info.white_level, frame_arith_buffer, average_samples))
+                {
+                    print_msg(MSG_ERROR, "Failed writing reference frame '%s'\n", ref_file ? ref_file : "");
+                }
+                else
+                {
+                    print_msg(MSG_INFO, "Stored %s '%s'\n", dark_lib ? "darkframe" : "flat-field", ref_file);
+                }
+                free(ref_file);
             }
-            
 
             int frame_size = ((video_xRes * video_yRes * lv_rec_footer.raw_info.bits_per_pixel + 7) / 8);
 
@@ -3652,9 +6472,12 @@ abort:
             }
         }
         
-        main_header.videoFrameCount = vidf_frames_processed;
+        main_header.videoFrameCount = (extract_frames && !average_mode) ? vidf_frames_selected : vidf_frames_processed;
         main_header.audioFrameCount = audf_frames_processed;
 
+        /* the frames are stored in the format announced by the header that was written first */
+        main_header.videoClass = output_video_class;
+
         fseek(out_file, 0L, SEEK_SET);
         
         if(fwrite(&main_header, main_header.blockSize, 1, out_file) != 1)
@@ -3667,7 +6490,7 @@ abort:
     /* free list of input files */
     for(in_file_num = 0; in_file_num < in_file_count; in_file_num++)
     {
-        fclose(in_files[in_file_num]);
+        mlv_reader_close(in_files[in_file_num]);
     }
     free(in_files);
 
@@ -3698,10 +6521,20 @@ abort:
     /* passing NULL to free is absolutely legal, so no check required */
     free(lut_filename);
     free(subtract_filename);
+    free(dark_lib);
+    free(flat_lib);
+    reflib_calib_free(ref_calib);
     free(output_filename);
     free(prev_frame_buffer);
     free(frame_arith_buffer);
+    free(lj92_buffer);
+    free(image_setup_data);
+    free(image_buffer);
     free(block_xref);
+    chroma_free_planes(&chroma_planes);
+    chroma_free_tables();
+    raw_fix_analysis_free(fix_cache.analysis);
+    dng_set_sequence(0);
 
     print_msg(MSG_INFO, "Done\n");
     print_msg(MSG_INFO, "\n");
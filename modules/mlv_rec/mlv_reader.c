@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#if !defined(__WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mlv_reader.h"
+
+/* 32 bit builds can't map a whole chunk (up to 4 GiB), so map a window around the current position */
+#define MLV_READER_WINDOW   (64 * 1024 * 1024)
+
+struct mlv_reader
+{
+    FILE       *file;
+    int         mapped;
+
+    uint64_t    size;
+    uint64_t    pos;
+    int         eof;
+
+    /* currently mapped part of the file */
+    uint8_t    *window;
+    uint64_t    window_start;
+    uint64_t    window_size;
+    uint64_t    align;
+
+#if defined(__WIN32)
+    HANDLE      mapping;
+#else
+    int         fd;
+#endif
+};
+
+static void mlv_reader_unmap(mlv_reader_t *reader)
+{
+    if(!reader->window)
+    {
+        return;
+    }
+
+#if defined(__WIN32)
+    UnmapViewOfFile(reader->window);
+#else
+    munmap(reader->window, reader->window_size);
+#endif
+
+    reader->window = NULL;
+    reader->window_start = 0;
+    reader->window_size = 0;
+}
+
+/* make sure the given range is within the mapped window */
+static int mlv_reader_window(mlv_reader_t *reader, uint64_t offset, uint32_t size)
+{
+    if(reader->window && offset >= reader->window_start && offset + size <= reader->window_start + reader->window_size)
+    {
+        return 1;
+    }
+
+    if(offset + size > reader->size)
+    {
+        return 0;
+    }
+
+    mlv_reader_unmap(reader);
+
+    uint64_t start = offset - (offset % reader->align);
+    uint64_t length = offset - start + size;
+
+    /* 64 bit builds simply map the whole chunk at once */
+    if(sizeof(void *) >= 8)
+    {
+        start = 0;
+        length = reader->size;
+    }
+    else if(length < MLV_READER_WINDOW)
+    {
+        length = MLV_READER_WINDOW;
+    }
+
+    if(start + length > reader->size)
+    {
+        length = reader->size - start;
+    }
+
+#if defined(__WIN32)
+    void *window = MapViewOfFile(reader->mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start, (SIZE_T)length);
+    if(!window)
+    {
+        return 0;
+    }
+#else
+    void *window = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED, reader->fd, (off_t)start);
+    if(window == MAP_FAILED)
+    {
+        return 0;
+    }
+#endif
+
+    reader->window = window;
+    reader->window_start = start;
+    reader->window_size = length;
+
+    return 1;
+}
+
+mlv_reader_t *mlv_reader_open(FILE *file)
+{
+    mlv_reader_t *reader = calloc(1, sizeof(mlv_reader_t));
+
+    if(!reader)
+    {
+        return NULL;
+    }
+
+    reader->file = file;
+
+#if defined(__WIN32)
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    LARGE_INTEGER file_size;
+    SYSTEM_INFO sys_info;
+
+    GetSystemInfo(&sys_info);
+    reader->align = sys_info.dwAllocationGranularity;
+
+    if(handle != INVALID_HANDLE_VALUE && GetFileSizeEx(handle, &file_size) && file_size.QuadPart > 0)
+    {
+        reader->size = file_size.QuadPart;
+        reader->mapping = CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        reader->mapped = (reader->mapping != NULL);
+    }
+#else
+    struct stat st;
+
+    reader->fd = fileno(file);
+    reader->align = sysconf(_SC_PAGESIZE);
+
+    if(!fstat(reader->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        reader->size = st.st_size;
+        reader->mapped = 1;
+    }
+#endif
+
+    /* try to map the beginning, if that fails we stay with stdio */
+    if(reader->mapped && !mlv_reader_window(reader, 0, 0))
+    {
+#if defined(__WIN32)
+        CloseHandle(reader->mapping);
+        reader->mapping = NULL;
+#endif
+        reader->mapped = 0;
+    }
+
+    return reader;
+}
+
+void mlv_reader_close(mlv_reader_t *reader)
+{
+    if(!reader)
+    {
+        return;
+    }
+
+    mlv_reader_unmap(reader);
+
+#if defined(__WIN32)
+    if(reader->mapping)
+    {
+        CloseHandle(reader->mapping);
+    }
+#endif
+
+    fclose(reader->file);
+    free(reader);
+}
+
+int mlv_reader_read(void *dst, uint32_t size, mlv_reader_t *reader)
+{
+    if(!reader->mapped)
+    {
+        return fread(dst, size, 1, reader->file);
+    }
+
+    if(!size)
+    {
+        return 0;
+    }
+
+    if(!mlv_reader_window(reader, reader->pos, size))
+    {
+        /* like fread, consume the rest of the file and flag EOF */
+        if(reader->pos < reader->size && mlv_reader_window(reader, reader->pos, reader->size - reader->pos))
+        {
+            memcpy(dst, &reader->window[reader->pos - reader->window_start], reader->size - reader->pos);
+        }
+        reader->pos = (reader->pos < reader->size) ? reader->size : reader->pos;
+        reader->eof = 1;
+        return 0;
+    }
+
+    memcpy(dst, &reader->window[reader->pos - reader->window_start], size);
+    reader->pos += size;
+
+    return 1;
+}
+
+void *mlv_reader_map(mlv_reader_t *reader, uint32_t size)
+{
+    if(!reader->mapped || !mlv_reader_window(reader, reader->pos, size))
+    {
+        return NULL;
+    }
+
+    void *ptr = &reader->window[reader->pos - reader->window_start];
+    reader->pos += size;
+
+    return ptr;
+}
+
+int mlv_reader_set_pos(mlv_reader_t *reader, int64_t offset, int whence)
+{
+    if(!reader->mapped)
+    {
+#if defined(__WIN32)
+        return fseeko64(reader->file, offset, whence);
+#else
+        return fseeko(reader->file, offset, whence);
+#endif
+    }
+
+    int64_t base = 0;
+
+    switch(whence)
+    {
+        case SEEK_CUR:
+            base = reader->pos;
+            break;
+        case SEEK_END:
+            base = reader->size;
+            break;
+    }
+
+    if(base + offset < 0)
+    {
+        return -1;
+    }
+
+    reader->pos = base + offset;
+    reader->eof = 0;
+
+    return 0;
+}
+
+uint64_t mlv_reader_get_pos(mlv_reader_t *reader)
+{
+    if(!reader->mapped)
+    {
+#if defined(__WIN32)
+        return ftello64(reader->file);
+#else
+        return ftello(reader->file);
+#endif
+    }
+
+    return reader->pos;
+}
+
+int mlv_reader_eof(mlv_reader_t *reader)
+{
+    if(!reader->mapped)
+    {
+        return feof(reader->file);
+    }
+
+    return reader->eof;
+}
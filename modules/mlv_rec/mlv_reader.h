@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _mlv_reader_h_
+#define _mlv_reader_h_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+    memory mapped reader for the chunks (.MLV, .M00 ... .M99) of a recording.
+
+    the file is mapped in windows, so also 32 bit builds can walk through
+    multi-GB chunks. blocks are either copied out (mlv_reader_read, works
+    like fread) or accessed in place (mlv_reader_map). pointers returned by
+    mlv_reader_map stay valid until the next call on the same reader.
+
+    if a file cannot be mapped, the reader silently falls back to stdio.
+*/
+
+typedef struct mlv_reader mlv_reader_t;
+
+/* takes ownership of the file, it gets closed by mlv_reader_close() */
+mlv_reader_t *mlv_reader_open(FILE *file);
+void mlv_reader_close(mlv_reader_t *reader);
+
+/* same semantics as fread/fseeko/ftello/feof with a single item */
+int mlv_reader_read(void *dst, uint32_t size, mlv_reader_t *reader);
+int mlv_reader_set_pos(mlv_reader_t *reader, int64_t offset, int whence);
+uint64_t mlv_reader_get_pos(mlv_reader_t *reader);
+int mlv_reader_eof(mlv_reader_t *reader);
+
+/* return a pointer to the next 'size' bytes and skip them. NULL if not mapped or past the end */
+void *mlv_reader_map(mlv_reader_t *reader, uint32_t size);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mlv_scan.h"
+
+/* block types and their smallest valid size, see mlv.h */
+static const struct
+{
+    char type[4];
+    uint32_t min_size;
+} mlv_scan_types[] =
+{
+    { { 'M','L','V','I' }, 52 },
+    { { 'V','I','D','F' }, 32 },
+    { { 'A','U','D','F' }, 24 },
+    { { 'R','A','W','I' }, 16 },
+    { { 'R','A','W','C' }, 16 },
+    { { 'W','A','V','I' }, 16 },
+    { { 'E','X','P','O' }, 16 },
+    { { 'L','E','N','S' }, 16 },
+    { { 'R','T','C','I' }, 16 },
+    { { 'I','D','N','T' }, 16 },
+    { { 'X','R','E','F' }, 16 },
+    { { 'I','N','F','O' }, 16 },
+    { { 'D','I','S','O' }, 16 },
+    { { 'M','A','R','K' }, 16 },
+    { { 'S','T','Y','L' }, 16 },
+    { { 'E','L','V','L' }, 16 },
+    { { 'W','B','A','L' }, 16 },
+    { { 'D','E','B','G' }, 16 },
+    { { 'V','E','R','S' }, 16 },
+    { { 'D','E','L','T' }, 20 },
+    { { 'N','U','L','L' }, 16 },
+    { { 'B','K','U','P' }, 16 },
+};
+
+static uint32_t read_u32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+uint32_t mlv_scan_block(const uint8_t *buf, uint32_t avail)
+{
+    if(avail < 16)
+    {
+        return 0;
+    }
+
+    for(uint32_t type = 0; type < sizeof(mlv_scan_types) / sizeof(mlv_scan_types[0]); type++)
+    {
+        if(memcmp(buf, mlv_scan_types[type].type, 4))
+        {
+            continue;
+        }
+
+        uint32_t min_size = mlv_scan_types[type].min_size;
+        uint32_t size = read_u32(&buf[4]);
+
+        if(size < min_size || size > MLV_SCAN_MAX_BLOCK || avail < min_size)
+        {
+            return 0;
+        }
+
+        /* the padding in front of the frame data must fit into the block */
+        if(!memcmp(buf, "VIDF", 4) && read_u32(&buf[28]) > size - 32)
+        {
+            return 0;
+        }
+        if(!memcmp(buf, "AUDF", 4) && read_u32(&buf[20]) > size - 24)
+        {
+            return 0;
+        }
+
+        /* the file header carries a version string like "v2.0" */
+        if(!memcmp(buf, "MLVI", 4) && buf[8] != 'v')
+        {
+            return 0;
+        }
+
+        return size;
+    }
+
+    return 0;
+}
+
+static int is_upper(uint8_t c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+#if defined(__SSE2__)
+/* one bit per byte that is an upper case letter */
+static uint32_t upper_mask16(const uint8_t *buf)
+{
+    __m128i bytes = _mm_loadu_si128((const __m128i *)buf);
+
+    /* 'A'..'Z' moved to the bottom of the signed range, one compare does the range check */
+    __m128i shifted = _mm_add_epi8(bytes, _mm_set1_epi8((char)(0x80 - 'A')));
+    return _mm_movemask_epi8(_mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + 26))));
+}
+#endif
+
+uint32_t mlv_scan_next(const uint8_t *buf, uint32_t len, uint32_t start)
+{
+    uint32_t pos = start;
+
+#if defined(__SSE2__)
+    if(pos + 32 <= len)
+    {
+        uint32_t next = upper_mask16(&buf[pos]);
+
+        /* 16 start positions per step, a run may reach 3 bytes into the following 16 */
+        while(pos + 32 <= len)
+        {
+            uint32_t mask = next | (upper_mask16(&buf[pos + 16]) << 16);
+            uint32_t runs = mask & (mask >> 1) & (mask >> 2) & (mask >> 3) & 0xFFFF;
+
+            while(runs)
+            {
+                uint32_t bit = __builtin_ctz(runs);
+
+                if(mlv_scan_block(&buf[pos + bit], len - pos - bit))
+                {
+                    return pos + bit;
+                }
+                runs &= runs - 1;
+            }
+
+            next = mask >> 16;
+            pos += 16;
+        }
+    }
+#endif
+
+    for(; pos + 4 <= len; pos++)
+    {
+        if(is_upper(buf[pos]) && is_upper(buf[pos + 1]) && is_upper(buf[pos + 2]) && is_upper(buf[pos + 3]) &&
+           mlv_scan_block(&buf[pos], len - pos))
+        {
+            return pos;
+        }
+    }
+
+    return len;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _mlv_scan_h_
+#define _mlv_scan_h_
+
+#include <stdint.h>
+
+/*
+    block header search for damaged recordings (--verify, --recover).
+
+    candidates are runs of four upper case letters, found 16 bytes at a time with SSE2.
+    only known block types with a plausible header are reported, random frame data
+    rarely passes both tests.
+*/
+
+/* larger blocks are considered corrupt, same limit as the index builder in mlv_dump */
+#define MLV_SCAN_MAX_BLOCK  (50 * 1024 * 1024)
+
+/* bytes needed at a position to check the header there */
+#define MLV_SCAN_HDR_SIZE   52
+
+/* size of the block starting at 'buf' if it looks like a valid block header, else 0.
+   'avail' bytes can be read at 'buf', headers cut off by the end of the buffer are rejected */
+uint32_t mlv_scan_block(const uint8_t *buf, uint32_t avail);
+
+/* offset of the first valid block header at or after 'start', 'len' if there is none */
+uint32_t mlv_scan_next(const uint8_t *buf, uint32_t len, uint32_t start);
+
+#endif
@@ -0,0 +1,122 @@
+# Generates synthetic .MLV clips for benchmarking mlv_dump (see bench.sh)
+#
+# The frames are uncompressed; compressed clips are made from them with mlv_dump -c / --lj92.
+# Image content is a noisy gradient with a few cold pixels and a 1% vertical stripe pattern,
+# so the raw2dng corrections have something to do.
+#
+# usage: python mlv_synth.py [-W width] [-H height] [-b bits] [-n frames] [-c chunks] output.MLV
+
+from __future__ import division, print_function
+import argparse, random, struct
+
+ROW_POOL = 61           # distinct rows, frames are assembled from these to keep generation fast
+
+def pack_row(values, bits):
+    # MLV bit stream: MSB first, in little endian 16-bit words
+    acc = 0
+    count = 0
+    words = []
+    for v in values:
+        acc = (acc << bits) | v
+        count += bits
+        while count >= 16:
+            count -= 16
+            words.append((acc >> count) & 0xFFFF)
+            acc &= (1 << count) - 1
+    return struct.pack("<%dH" % len(words), *words)
+
+def make_rows(width, bits, black, white, rnd):
+    rows = []
+    cold = max(0, black - 300)
+    noise = max(2, (white - black) >> 9)
+    for r in range(ROW_POOL):
+        level = black + (white - black) * (r + 1) // (ROW_POOL + 2) // 2
+        values = []
+        for x in range(width):
+            v = level + (white - black) * x // width // 4 + rnd.randint(-noise, noise)
+            if x % 8 == 5:
+                v = black + (v - black) * 101 // 100
+            if (x * 7 + r * 13) % 4099 == 0:
+                v = cold
+            values.append(max(0, min(white, v)))
+        rows.append(pack_row(values, bits))
+    return rows
+
+def raw_info(width, height, bits, black, white):
+    pitch = width * bits // 8
+    color_matrix = [6722, 10000, -635, 10000, -963, 10000,
+                    -4287, 10000, 12460, 10000, 2028, 10000,
+                    -908, 10000, 2162, 10000, 5668, 10000]
+    return (struct.pack("<9i", 1, 0, height, width, pitch, pitch * height, bits, black, white) +
+            struct.pack("<4i", 0, 0, width, height) +       # jpeg
+            struct.pack("<4i", 0, 0, height, width) +       # active_area y1, x1, y2, x2
+            struct.pack("<2i", 0, 0) +                      # exposure_bias
+            struct.pack("<2i", 0x02010100, 21) +            # cfa_pattern, calibration_illuminant1
+            struct.pack("<18i", *color_matrix) +
+            struct.pack("<i", 1100))                        # dynamic_range
+
+def main():
+    parser = argparse.ArgumentParser(description="generate a synthetic MLV clip")
+    parser.add_argument("output")
+    parser.add_argument("-W", "--width", type=int, default=1920)
+    parser.add_argument("-H", "--height", type=int, default=1080)
+    parser.add_argument("-b", "--bits", type=int, default=14)
+    parser.add_argument("-n", "--frames", type=int, default=50)
+    parser.add_argument("-c", "--chunks", type=int, default=1)
+    parser.add_argument("-s", "--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    width, height, bits = args.width, args.height, args.bits
+    if width % 16 or height % 2 or not 10 <= bits <= 16 or args.frames < 1 or args.chunks < 1:
+        parser.error("width must be a multiple of 16, height even, 10..16 bits")
+
+    if not args.output.upper().endswith(".MLV"):
+        parser.error("output name must end with .MLV, chunks are named .M00, .M01 ...")
+
+    rnd = random.Random(args.seed)
+    black = 2048 >> (14 - bits) if bits < 14 else 2048 << (bits - 14)
+    white = (1 << bits) - 1 - (1 << (bits - 8))
+    rows = make_rows(width, bits, black, white, rnd)
+    frame_size = len(rows[0]) * height
+
+    guid = rnd.getrandbits(64)
+    fps_nom, fps_denom = 25000, 1000
+    frame_time = 1000000 * fps_denom // fps_nom
+    per_chunk = (args.frames + args.chunks - 1) // args.chunks
+    frame = 0
+    timestamp = 1000
+
+    for chunk in range(args.chunks):
+        name = args.output if chunk == 0 else "%s%02d" % (args.output[:-2], chunk - 1)
+        frames = min(per_chunk, args.frames - frame)
+        out = open(name, "wb")
+
+        out.write(b"MLVI" + struct.pack("<I", 52) + b"v2.0\0\0\0\0" +
+                  struct.pack("<QHHIHHIIII", guid, chunk, args.chunks, 0, 1, 0, frames, 0, fps_nom, fps_denom))
+
+        if chunk == 0:
+            info = raw_info(width, height, bits, black, white)
+            out.write(b"RAWI" + struct.pack("<IQHH", 20 + len(info), timestamp, width, height) + info)
+            out.write(b"IDNT" + struct.pack("<IQ", 84, timestamp) + b"Canon EOS 5D Mark III".ljust(32, b"\0") +
+                      struct.pack("<I", 0x80000285) + b"0".ljust(32, b"\0"))
+            out.write(b"EXPO" + struct.pack("<IQIIIIQ", 40, timestamp, 0, 400, 400, 0, frame_time))
+            out.write(b"LENS" + struct.pack("<IQHHHBBII", 96, timestamp, 35, 1000, 280, 0, 0, 0, 0) +
+                      b"Synthetic".ljust(32, b"\0") + b"".ljust(32, b"\0"))
+            out.write(b"RTCI" + struct.pack("<IQ10H", 44, timestamp, 0, 0, 12, 1, 0, 120, 0, 0, 0, 0) + b"UTC".ljust(8, b"\0"))
+            out.write(b"WBAL" + struct.pack("<IQ7I", 44, timestamp, 0, 5500, 1024, 1024, 1024, 0, 0))
+
+        for i in range(frames):
+            # like mlv_rec, pad the frame data to a 4 KiB boundary
+            space = (4096 - (out.tell() + 32) % 4096) % 4096
+            out.write(b"VIDF" + struct.pack("<IQIHHHHI", 32 + space + frame_size, timestamp, frame, 0, 0, 0, 0, space))
+            out.write(b"\0" * space)
+            offset = rnd.randrange(ROW_POOL)
+            out.write(b"".join(rows[(y * 17 + offset) % ROW_POOL] for y in range(height)))
+            timestamp += frame_time
+            frame += 1
+
+        out.close()
+        print("%s: %dx%d, %d bits, %d frames" % (name, width, height, bits, frames))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+
+#define JOB_FREE        0
+#define JOB_FILLING     1
+#define JOB_READY       2
+#define JOB_PROCESSING  3
+#define JOB_DONE        4
+
+typedef struct
+{
+    void       *data;
+    int         state;
+    uint64_t    seq;
+} pipeline_slot_t;
+
+struct pipeline
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+
+    pthread_t      *workers;
+    int             worker_count;
+    pthread_t       writer;
+    int             writer_running;
+
+    pipeline_func_t process;
+    pipeline_func_t write;
+    void           *ctx;
+
+    pipeline_slot_t *slots;
+    int             depth;
+
+    /* sequence numbers of the next job to fill and to write */
+    uint64_t        next_fill;
+    uint64_t        next_write;
+
+    int             error;
+    int             stop;
+};
+
+static pipeline_slot_t *pipeline_find_slot(pipeline_t *pipe, void *job)
+{
+    for(int pos = 0; pos < pipe->depth; pos++)
+    {
+        if(pipe->slots[pos].data == job)
+        {
+            return &pipe->slots[pos];
+        }
+    }
+    return NULL;
+}
+
+static void *pipeline_worker(void *arg)
+{
+    pipeline_t *pipe = arg;
+
+    pthread_mutex_lock(&pipe->lock);
+    while(1)
+    {
+        /* pick the oldest job that is ready for processing, so the writer is not starved */
+        pipeline_slot_t *slot = NULL;
+        for(int pos = 0; pos < pipe->depth; pos++)
+        {
+            if(pipe->slots[pos].state == JOB_READY && (!slot || pipe->slots[pos].seq < slot->seq))
+            {
+                slot = &pipe->slots[pos];
+            }
+        }
+
+        if(!slot)
+        {
+            if(pipe->stop)
+            {
+                break;
+            }
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+            continue;
+        }
+
+        slot->state = JOB_PROCESSING;
+        int failed = pipe->error;
+        pthread_mutex_unlock(&pipe->lock);
+
+        int ret = failed ? 0 : pipe->process(pipe->ctx, slot->data);
+
+        pthread_mutex_lock(&pipe->lock);
+        if(ret && !pipe->error)
+        {
+            pipe->error = ret;
+        }
+        slot->state = JOB_DONE;
+        pthread_cond_broadcast(&pipe->changed);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    return NULL;
+}
+
+static void *pipeline_writer(void *arg)
+{
+    pipeline_t *pipe = arg;
+
+    pthread_mutex_lock(&pipe->lock);
+    while(1)
+    {
+        pipeline_slot_t *slot = &pipe->slots[pipe->next_write % pipe->depth];
+
+        if(pipe->next_write == pipe->next_fill || slot->state != JOB_DONE)
+        {
+            if(pipe->stop && pipe->next_write == pipe->next_fill)
+            {
+                break;
+            }
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+            continue;
+        }
+
+        int failed = pipe->error;
+        pthread_mutex_unlock(&pipe->lock);
+
+        /* after an error, keep draining the queue so the reader does not block forever */
+        int ret = failed ? 0 : pipe->write(pipe->ctx, slot->data);
+
+        pthread_mutex_lock(&pipe->lock);
+        if(ret && !pipe->error)
+        {
+            pipe->error = ret;
+        }
+        slot->state = JOB_FREE;
+        pipe->next_write++;
+        pthread_cond_broadcast(&pipe->changed);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    return NULL;
+}
+
+pipeline_t *pipeline_create(int threads, int depth, int job_size, pipeline_func_t process, pipeline_func_t write, void *ctx)
+{
+    pipeline_t *pipe = calloc(1, sizeof(pipeline_t));
+
+    if(!pipe)
+    {
+        return NULL;
+    }
+
+    threads = threads < 1 ? 1 : threads;
+    depth = depth < threads + 1 ? threads + 1 : depth;
+
+    pipe->process = process;
+    pipe->write = write;
+    pipe->ctx = ctx;
+    pipe->depth = depth;
+    pipe->slots = calloc(depth, sizeof(pipeline_slot_t));
+    pipe->workers = calloc(threads, sizeof(pthread_t));
+
+    if(!pipe->slots || !pipe->workers)
+    {
+        free(pipe->slots);
+        free(pipe->workers);
+        free(pipe);
+        return NULL;
+    }
+
+    for(int pos = 0; pos < depth; pos++)
+    {
+        pipe->slots[pos].data = calloc(1, job_size);
+        if(!pipe->slots[pos].data)
+        {
+            for(int prev = 0; prev < pos; prev++)
+            {
+                free(pipe->slots[prev].data);
+            }
+            free(pipe->slots);
+            free(pipe->workers);
+            free(pipe);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->changed, NULL);
+
+    /* without a processing stage, jobs go straight from the reader to the writer */
+    if(process)
+    {
+        for(int pos = 0; pos < threads; pos++)
+        {
+            if(pthread_create(&pipe->workers[pipe->worker_count], NULL, pipeline_worker, pipe))
+            {
+                break;
+            }
+            pipe->worker_count++;
+        }
+    }
+
+    if(!process || pipe->worker_count)
+    {
+        pipe->writer_running = !pthread_create(&pipe->writer, NULL, pipeline_writer, pipe);
+    }
+
+    if(!pipe->writer_running)
+    {
+        pipeline_destroy(pipe, NULL);
+        return NULL;
+    }
+
+    return pipe;
+}
+
+void *pipeline_get_job(pipeline_t *pipe)
+{
+    void *job = NULL;
+
+    pthread_mutex_lock(&pipe->lock);
+    pipeline_slot_t *slot = &pipe->slots[pipe->next_fill % pipe->depth];
+
+    while(slot->state != JOB_FREE && !pipe->error)
+    {
+        pthread_cond_wait(&pipe->changed, &pipe->lock);
+    }
+
+    if(!pipe->error)
+    {
+        slot->state = JOB_FILLING;
+        slot->seq = pipe->next_fill;
+        job = slot->data;
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    return job;
+}
+
+static void pipeline_submit_state(pipeline_t *pipe, void *job, int state)
+{
+    pthread_mutex_lock(&pipe->lock);
+    pipeline_slot_t *slot = pipeline_find_slot(pipe, job);
+
+    if(slot && slot->state == JOB_FILLING)
+    {
+        slot->state = state;
+        pipe->next_fill++;
+        pthread_cond_broadcast(&pipe->changed);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+void pipeline_submit(pipeline_t *pipe, void *job)
+{
+    pipeline_submit_state(pipe, job, pipe->process ? JOB_READY : JOB_DONE);
+}
+
+void pipeline_submit_passthrough(pipeline_t *pipe, void *job)
+{
+    pipeline_submit_state(pipe, job, JOB_DONE);
+}
+
+int pipeline_flush(pipeline_t *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    while(pipe->next_write != pipe->next_fill)
+    {
+        pthread_cond_wait(&pipe->changed, &pipe->lock);
+    }
+    int ret = pipe->error;
+    pthread_mutex_unlock(&pipe->lock);
+
+    return ret;
+}
+
+int pipeline_failed(pipeline_t *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    int ret = pipe->error;
+    pthread_mutex_unlock(&pipe->lock);
+
+    return ret;
+}
+
+int pipeline_destroy(pipeline_t *pipe, void (*free_job)(void *job))
+{
+    if(!pipe)
+    {
+        return 0;
+    }
+
+    /* a slot that was taken but never submitted would block the writer */
+    pthread_mutex_lock(&pipe->lock);
+    for(int pos = 0; pos < pipe->depth; pos++)
+    {
+        if(pipe->slots[pos].state == JOB_FILLING)
+        {
+            pipe->slots[pos].state = JOB_FREE;
+        }
+    }
+    pipe->stop = 1;
+    pthread_cond_broadcast(&pipe->changed);
+    pthread_mutex_unlock(&pipe->lock);
+
+    for(int pos = 0; pos < pipe->worker_count; pos++)
+    {
+        pthread_join(pipe->workers[pos], NULL);
+    }
+
+    if(pipe->writer_running)
+    {
+        pthread_join(pipe->writer, NULL);
+    }
+
+    int ret = pipe->error;
+
+    for(int pos = 0; pos < pipe->depth; pos++)
+    {
+        if(free_job)
+        {
+            free_job(pipe->slots[pos].data);
+        }
+        free(pipe->slots[pos].data);
+    }
+
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->changed);
+    free(pipe->slots);
+    free(pipe->workers);
+    free(pipe);
+
+    return ret;
+}
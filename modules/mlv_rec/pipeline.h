@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _pipeline_h_
+#define _pipeline_h_
+
+/*
+    ordered three-stage frame pipeline for the host tools:
+
+      reader (caller thread) -> N processing threads -> one writer thread
+
+    the reader fills job slots in sequence, any worker may process any job,
+    but the writer always gets them back in the order they were submitted.
+    the number of job slots is fixed, so the reader blocks when it gets too
+    far ahead of the writer (bounded queue).
+
+    job slots are allocated and zeroed by the pipeline and reused round-robin,
+    so buffers stored inside a job survive until the slot comes around again.
+*/
+
+typedef struct pipeline pipeline_t;
+
+/* return 0 on success, anything else stops the pipeline */
+typedef int (*pipeline_func_t)(void *ctx, void *job);
+
+/* creates the pipeline and starts the threads. 'process' may be NULL for pass-through jobs */
+pipeline_t *pipeline_create(int threads, int depth, int job_size, pipeline_func_t process, pipeline_func_t write, void *ctx);
+
+/* reader side: wait for a free job slot. returns NULL if the pipeline has failed */
+void *pipeline_get_job(pipeline_t *pipe);
+
+/* reader side: hand over the job returned by pipeline_get_job() */
+void pipeline_submit(pipeline_t *pipe, void *job);
+
+/* reader side: same as submit, but the job skips the processing stage */
+void pipeline_submit_passthrough(pipeline_t *pipe, void *job);
+
+/* wait until all submitted jobs were written. returns the first error code, if any */
+int pipeline_flush(pipeline_t *pipe);
+
+/* nonzero after a process or write callback failed */
+int pipeline_failed(pipeline_t *pipe);
+
+/* flushes, stops the threads and frees the job slots. returns the first error code, if any */
+int pipeline_destroy(pipeline_t *pipe, void (*free_job)(void *job));
+
+#endif
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "reflib.h"
+#include "bitpack.h"
+
+#define REFLIB_MAGIC    "MLRF"
+#define REFLIB_VERSION  1
+
+/* file header, followed by xRes * yRes float values */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t kind;
+    reflib_key_t key;
+    int32_t black_level;
+    int32_t white_level;
+    uint32_t frames;
+} reflib_hdr_t;
+
+char *reflib_filename(const char *dir, int kind, reflib_key_t *key)
+{
+    size_t len = strlen(dir) + 128;
+    char *filename = malloc(len);
+
+    if(!filename)
+    {
+        return NULL;
+    }
+
+    snprintf(filename, len, "%s/%s_%08X_iso%u_%ux%u_%u_%u_%ubit.ref", dir, (kind == REFLIB_FLAT) ? "flat" : "dark",
+        key->camera_model, key->iso, key->xRes, key->yRes, key->crop_x, key->crop_y, key->bits_per_pixel);
+
+    return filename;
+}
+
+char *reflib_find(const char *dir, int kind, reflib_key_t *key)
+{
+    char *filename = reflib_filename(dir, kind, key);
+
+    if(filename)
+    {
+        FILE *file = fopen(filename, "rb");
+        if(!file)
+        {
+            free(filename);
+            return NULL;
+        }
+        fclose(file);
+    }
+    return filename;
+}
+
+int reflib_store(const char *filename, int kind, reflib_key_t *key, int black_level, int white_level, const uint32_t *sum, uint32_t frames)
+{
+    int pixels = key->xRes * key->yRes;
+    reflib_hdr_t hdr;
+
+    if(!frames)
+    {
+        return REFLIB_ERR_FORMAT;
+    }
+
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, REFLIB_MAGIC, 4);
+    hdr.version = REFLIB_VERSION;
+    hdr.kind = kind;
+    hdr.key = *key;
+    hdr.black_level = black_level;
+    hdr.white_level = white_level;
+    hdr.frames = frames;
+
+    float *row = malloc(key->xRes * sizeof(float));
+    if(!row)
+    {
+        return REFLIB_ERR_MALLOC;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if(!file)
+    {
+        free(row);
+        return REFLIB_ERR_FILE;
+    }
+
+    int ret = REFLIB_OK;
+    if(fwrite(&hdr, sizeof(hdr), 1, file) != 1)
+    {
+        ret = REFLIB_ERR_FILE;
+    }
+
+    for(int pos = 0; pos < pixels && ret == REFLIB_OK; pos += key->xRes)
+    {
+        for(int x = 0; x < key->xRes; x++)
+        {
+            row[x] = (float)((double)sum[pos + x] / frames);
+        }
+        if(fwrite(row, sizeof(float), key->xRes, file) != (size_t)key->xRes)
+        {
+            ret = REFLIB_ERR_FILE;
+        }
+    }
+
+    if(fclose(file))
+    {
+        ret = REFLIB_ERR_FILE;
+    }
+    free(row);
+
+    if(ret)
+    {
+        remove(filename);
+    }
+    return ret;
+}
+
+/* read a reference made for exactly this key */
+static int reflib_load(const char *filename, int kind, reflib_key_t *key, float **data, int *black_level)
+{
+    reflib_hdr_t hdr;
+    int pixels = key->xRes * key->yRes;
+
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+    {
+        return REFLIB_ERR_MISSING;
+    }
+
+    if(fread(&hdr, sizeof(hdr), 1, file) != 1 || memcmp(hdr.magic, REFLIB_MAGIC, 4) || hdr.version != REFLIB_VERSION ||
+       hdr.kind != (uint32_t)kind || memcmp(&hdr.key, key, sizeof(reflib_key_t)))
+    {
+        fclose(file);
+        return REFLIB_ERR_FORMAT;
+    }
+
+    *data = malloc(pixels * sizeof(float));
+    if(!*data)
+    {
+        fclose(file);
+        return REFLIB_ERR_MALLOC;
+    }
+
+    if(fread(*data, sizeof(float), pixels, file) != (size_t)pixels)
+    {
+        free(*data);
+        *data = NULL;
+        fclose(file);
+        return REFLIB_ERR_FILE;
+    }
+
+    fclose(file);
+    *black_level = hdr.black_level;
+    return REFLIB_OK;
+}
+
+/* gains that map the flat frame to its median on each Bayer channel, like frame_flatfield() in mlv_dump.c:
+   the medians are taken from the frame center and lowered by green's 5th percentile so whites do not clip */
+static void reflib_flat_gain(float *gain, const float *flat, int xRes, int yRes, int depth, int black)
+{
+    int levels = 1 << depth;
+    int32_t med[2][2] = {{0,0},{0,0}};
+    int32_t pr5[2][2] = {{0,0},{0,0}};
+    int total[2][2] = {{0,0},{0,0}};
+    int *hist = calloc(4 * levels, sizeof(int));
+
+    if(hist)
+    {
+        for(int y = yRes/4; y < yRes*3/4; y++)
+        {
+            for(int x = xRes/4; x < xRes*3/4; x++)
+            {
+                int value = (int)(flat[y * xRes + x] + 0.5f);
+                value = (value < 0) ? 0 : (value >= levels) ? levels - 1 : value;
+                hist[((y%2) * 2 + x%2) * levels + value]++;
+                total[y%2][x%2]++;
+            }
+        }
+
+        for(int c = 0; c < 4; c++)
+        {
+            int acc = 0;
+            for(int i = 0; i < levels; i++)
+            {
+                acc += hist[c * levels + i];
+
+                if(acc < total[c/2][c%2]/20)
+                {
+                    pr5[c/2][c%2] = i - black;
+                }
+                if(acc < total[c/2][c%2]/2)
+                {
+                    med[c/2][c%2] = i - black;
+                }
+            }
+        }
+        free(hist);
+    }
+
+    int32_t adj_num = (pr5[0][1] + pr5[1][0]) / 2;
+    int32_t adj_den = (med[0][1] + med[1][0]) / 2;
+
+    for(int y = 0; y < yRes; y++)
+    {
+        const float *flat_row = &flat[y * xRes];
+
+        for(int x = 0; x < xRes; x++)
+        {
+            float flat_value = flat_row[x] - black;
+
+            /* dead pixel in the flat frame, use a neighbor. less than one level above black counts as dead,
+               as it does for the integer frames in frame_flatfield(), instead of giving a huge gain */
+            if(flat_value < 1.0f)
+            {
+                float left  = flat_row[(x > 0) ? x - 1 : 0];
+                float right = flat_row[(x < xRes - 1) ? x + 1 : xRes - 1];
+                flat_value = ((left > right) ? left : right) - black;
+            }
+
+            if(flat_value >= 1.0f && adj_den > 0)
+            {
+                gain[y * xRes + x] = (float)((double)med[y%2][x%2] * adj_num / adj_den / flat_value);
+            }
+            else
+            {
+                gain[y * xRes + x] = 1.0f;
+            }
+        }
+    }
+}
+
+int reflib_calib_load(reflib_calib_t **calib, const char *dark_filename, const char *flat_filename, reflib_key_t *key, int black_level)
+{
+    int pixels = key->xRes * key->yRes;
+    int ret = REFLIB_OK;
+
+    *calib = NULL;
+
+    reflib_calib_t *cal = calloc(1, sizeof(reflib_calib_t));
+    if(!cal)
+    {
+        return REFLIB_ERR_MALLOC;
+    }
+    cal->key = *key;
+    cal->black_level = black_level;
+
+    if(dark_filename)
+    {
+        int dark_black = 0;
+
+        ret = reflib_load(dark_filename, REFLIB_DARK, key, &cal->offset, &dark_black);
+        if(ret)
+        {
+            goto abort;
+        }
+
+        /* the darkframe's own black level is what the clip's black level stands for */
+        for(int pos = 0; pos < pixels; pos++)
+        {
+            cal->offset[pos] -= dark_black;
+        }
+    }
+    else
+    {
+        cal->offset = calloc(pixels, sizeof(float));
+        if(!cal->offset)
+        {
+            ret = REFLIB_ERR_MALLOC;
+            goto abort;
+        }
+    }
+
+    cal->gain = malloc(pixels * sizeof(float));
+    if(!cal->gain)
+    {
+        ret = REFLIB_ERR_MALLOC;
+        goto abort;
+    }
+
+    if(flat_filename)
+    {
+        float *flat = NULL;
+        int flat_black = 0;
+
+        ret = reflib_load(flat_filename, REFLIB_FLAT, key, &flat, &flat_black);
+        if(ret)
+        {
+            goto abort;
+        }
+        reflib_flat_gain(cal->gain, flat, key->xRes, key->yRes, key->bits_per_pixel, flat_black);
+        free(flat);
+    }
+    else
+    {
+        for(int pos = 0; pos < pixels; pos++)
+        {
+            cal->gain[pos] = 1.0f;
+        }
+    }
+
+    *calib = cal;
+    return REFLIB_OK;
+
+abort:
+    reflib_calib_free(cal);
+    return ret;
+}
+
+void reflib_calib_free(reflib_calib_t *calib)
+{
+    if(calib)
+    {
+        free(calib->offset);
+        free(calib->gain);
+        free(calib);
+    }
+}
+
+#if defined(__SSE2__)
+/* 4 pixels widened to 32 bits, returned minus 0x8000 so packs (signed) keeps the full 16 bit range */
+static __m128i reflib_apply4(__m128i pixels, const float *offset, const float *gain, __m128 black, __m128 bias, __m128 max)
+{
+    __m128 value = _mm_sub_ps(_mm_cvtepi32_ps(pixels), black);
+
+    value = _mm_sub_ps(value, _mm_loadu_ps(offset));
+    value = _mm_mul_ps(value, _mm_loadu_ps(gain));
+    value = _mm_add_ps(value, bias);
+    value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), max);
+
+    return _mm_sub_epi32(_mm_cvttps_epi32(value), _mm_set1_epi32(0x8000));
+}
+#endif
+
+/* correct 8 pixels. the row tail goes through here too, so every pixel is rounded the same way */
+static void reflib_apply8(uint16_t *row, const float *offset, const float *gain, float black, float max)
+{
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128 black4 = _mm_set1_ps(black);
+    __m128 bias4 = _mm_set1_ps(black + 0.5f);
+    __m128 max4 = _mm_set1_ps(max);
+    __m128i pixels = _mm_loadu_si128((const __m128i *)row);
+
+    __m128i lo = reflib_apply4(_mm_unpacklo_epi16(pixels, zero), &offset[0], &gain[0], black4, bias4, max4);
+    __m128i hi = reflib_apply4(_mm_unpackhi_epi16(pixels, zero), &offset[4], &gain[4], black4, bias4, max4);
+
+    _mm_storeu_si128((__m128i *)row, _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16((int16_t)0x8000)));
+#else
+    for(int x = 0; x < 8; x++)
+    {
+        float value = ((float)row[x] - black - offset[x]) * gain[x] + (black + 0.5f);
+        value = (value < 0.0f) ? 0.0f : (value > max) ? max : value;
+        row[x] = (uint16_t)value;
+    }
+#endif
+}
+
+void reflib_apply(reflib_calib_t *calib, uint8_t *frame_buffer, int depth)
+{
+    int xRes = calib->key.xRes;
+    int yRes = calib->key.yRes;
+    int pitch = xRes * depth / 8;
+    float black = (float)calib->black_level;
+    float max = (float)((1 << depth) - 1);
+    uint16_t *row = malloc(xRes * sizeof(uint16_t));
+
+    if(!row)
+    {
+        return;
+    }
+
+    for(int y = 0; y < yRes; y++)
+    {
+        const float *offset = &calib->offset[y * xRes];
+        const float *gain = &calib->gain[y * xRes];
+        int x = 0;
+
+        bitunpack_row(&frame_buffer[y * pitch], row, xRes, depth);
+
+        for(; x + 8 <= xRes; x += 8)
+        {
+            reflib_apply8(&row[x], &offset[x], &gain[x], black, max);
+        }
+
+        if(x < xRes)
+        {
+            uint16_t tail[8] = { 0 };
+            float tail_offset[8] = { 0 };
+            float tail_gain[8] = { 0 };
+            int count = xRes - x;
+
+            memcpy(tail, &row[x], count * sizeof(uint16_t));
+            memcpy(tail_offset, &offset[x], count * sizeof(float));
+            memcpy(tail_gain, &gain[x], count * sizeof(float));
+            reflib_apply8(tail, tail_offset, tail_gain, black, max);
+            memcpy(&row[x], tail, count * sizeof(uint16_t));
+        }
+
+        bitpack_row(&frame_buffer[y * pitch], row, xRes, depth);
+    }
+
+    free(row);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _reflib_h_
+#define _reflib_h_
+
+#include <stdint.h>
+
+/*
+    darkframe and flat-field library (--dark-lib, --flat-lib).
+
+    a library is a directory of averaged reference frames, one file per reference.
+    the file name is built from the key (camera, ISO, resolution, crop position and bit depth),
+    so finding the reference for a clip is a single open, no index has to be kept up to date.
+
+    the frames are stored unpacked as 32 bit floats, so the average keeps its fractional part.
+    when loading, darkframe and flat-field are merged into one offset and one gain per pixel,
+    which are applied in a single pass over the frame.
+*/
+
+#define REFLIB_DARK         0
+#define REFLIB_FLAT         1
+
+#define REFLIB_OK           0
+#define REFLIB_ERR_MISSING  1   /* no reference for this key */
+#define REFLIB_ERR_FORMAT   2   /* not a reference file, or made for another key */
+#define REFLIB_ERR_FILE     3   /* read or write error */
+#define REFLIB_ERR_MALLOC   4
+
+typedef struct
+{
+    uint32_t camera_model;
+    uint32_t iso;
+    uint16_t xRes;
+    uint16_t yRes;
+    uint16_t crop_x;
+    uint16_t crop_y;
+    uint32_t bits_per_pixel;
+} reflib_key_t;
+
+/* darkframe offsets (black subtracted) and flat-field gains, for frames with the key they were loaded for */
+typedef struct
+{
+    reflib_key_t key;
+    int black_level;
+    float *offset;
+    float *gain;
+} reflib_calib_t;
+
+/* path of the reference for this key in the library directory, free() it after use */
+char *reflib_filename(const char *dir, int kind, reflib_key_t *key);
+
+/* path of the reference for this key if the library has one, else NULL. free() it after use */
+char *reflib_find(const char *dir, int kind, reflib_key_t *key);
+
+/* store the average of 'frames' frames, 'sum' holds xRes * yRes pixel sums */
+int reflib_store(const char *filename, int kind, reflib_key_t *key, int black_level, int white_level, const uint32_t *sum, uint32_t frames);
+
+/* merge the darkframe and the flat-field into a calibration. either file may be NULL */
+int reflib_calib_load(reflib_calib_t **calib, const char *dark_filename, const char *flat_filename, reflib_key_t *key, int black_level);
+void reflib_calib_free(reflib_calib_t *calib);
+
+/* value = (value - black - offset) * gain + black on a packed frame, clipped to the bit depth */
+void reflib_apply(reflib_calib_t *calib, uint8_t *frame_buffer, int depth);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "stream_out.h"
+
+#define BUFFER_FREE     0
+#define BUFFER_FILLING  1
+#define BUFFER_FULL     2
+
+typedef struct
+{
+    uint8_t    *data;
+    size_t      allocated;
+    size_t      size;
+    int         state;
+} stream_buffer_t;
+
+struct stream_out
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;
+    pthread_t       writer;
+
+    FILE           *file;
+    stream_buffer_t buffers[2];
+
+    /* buffer the caller fills next and the one the writer waits for */
+    int             fill;
+    int             write;
+
+    int             error;
+    int             stop;
+};
+
+static void *stream_out_writer(void *arg)
+{
+    stream_out_t *stream = arg;
+
+    pthread_mutex_lock(&stream->lock);
+    while(1)
+    {
+        stream_buffer_t *buffer = &stream->buffers[stream->write];
+
+        if(buffer->state != BUFFER_FULL)
+        {
+            if(stream->stop)
+            {
+                break;
+            }
+            pthread_cond_wait(&stream->changed, &stream->lock);
+            continue;
+        }
+
+        int failed = stream->error;
+        pthread_mutex_unlock(&stream->lock);
+
+        /* after an error, keep releasing buffers so the caller does not block forever */
+        int ret = failed ? 0 : (fwrite(buffer->data, buffer->size, 1, stream->file) != 1);
+
+        pthread_mutex_lock(&stream->lock);
+        if(ret)
+        {
+            stream->error = 1;
+        }
+        buffer->state = BUFFER_FREE;
+        stream->write ^= 1;
+        pthread_cond_broadcast(&stream->changed);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+
+stream_out_t *stream_out_open(FILE *file)
+{
+    stream_out_t *stream = calloc(1, sizeof(stream_out_t));
+
+    if(!stream)
+    {
+        return NULL;
+    }
+
+#ifdef SIGPIPE
+    /* when the consumer quits early, let fwrite fail instead of getting killed */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    stream->file = file;
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->changed, NULL);
+
+    if(pthread_create(&stream->writer, NULL, stream_out_writer, stream))
+    {
+        pthread_cond_destroy(&stream->changed);
+        pthread_mutex_destroy(&stream->lock);
+        free(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+void *stream_out_get(stream_out_t *stream, size_t size)
+{
+    stream_buffer_t *buffer = &stream->buffers[stream->fill];
+
+    pthread_mutex_lock(&stream->lock);
+    while(buffer->state != BUFFER_FREE && !stream->error)
+    {
+        pthread_cond_wait(&stream->changed, &stream->lock);
+    }
+
+    int failed = stream->error;
+    if(!failed)
+    {
+        buffer->state = BUFFER_FILLING;
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    if(failed)
+    {
+        return NULL;
+    }
+
+    /* the writer does not touch a buffer while it is being filled */
+    if(size > buffer->allocated)
+    {
+        uint8_t *new_data = realloc(buffer->data, size);
+        if(!new_data)
+        {
+            pthread_mutex_lock(&stream->lock);
+            buffer->state = BUFFER_FREE;
+            pthread_mutex_unlock(&stream->lock);
+            return NULL;
+        }
+        buffer->data = new_data;
+        buffer->allocated = size;
+    }
+
+    return buffer->data;
+}
+
+void stream_out_put(stream_out_t *stream, size_t size)
+{
+    stream_buffer_t *buffer = &stream->buffers[stream->fill];
+
+    pthread_mutex_lock(&stream->lock);
+    buffer->size = size;
+    buffer->state = BUFFER_FULL;
+    stream->fill ^= 1;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+int stream_out_close(stream_out_t *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->stop = 1;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+
+    pthread_join(stream->writer, NULL);
+
+    int error = stream->error || fflush(stream->file);
+
+    pthread_cond_destroy(&stream->changed);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream->buffers[0].data);
+    free(stream->buffers[1].data);
+    free(stream);
+
+    return error;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _stream_out_h_
+#define _stream_out_h_
+
+#include <stdio.h>
+
+/*
+    double buffered writer for streaming frames into a pipe, e.g. stdout into an encoder.
+
+    the caller fills one buffer while a thread writes the other one, so converting
+    the next frame overlaps with the consumer reading the previous one. when the
+    consumer is slower, stream_out_get() blocks until a buffer was written.
+*/
+
+typedef struct stream_out stream_out_t;
+
+/* start the writer thread for an already opened file */
+stream_out_t *stream_out_open(FILE *file);
+
+/* get a buffer for at least 'size' bytes. returns NULL if a write failed */
+void *stream_out_get(stream_out_t *stream, size_t size);
+
+/* queue 'size' bytes of the buffer returned by stream_out_get() */
+void stream_out_put(stream_out_t *stream, size_t size);
+
+/* write all queued data and stop the thread. returns nonzero if a write failed */
+int stream_out_close(stream_out_t *stream);
+
+#endif
@@ -149,13 +149,19 @@ void FAST reverse_bytes_order(char* buf, int count)
         _wswap_end:\
         " : : "r"(buf), "r"(count) : "r2", "r3", "r4", "r5", "r6", "r7");
 #else
-    short* buf16 = (short*) buf;
+    /* two pixels at a time */
+    uint32_t* buf32 = (uint32_t*) buf;
     int i;
-    for (i = 0; i < count/2; i++)
+    for (i = 0; i < count/4; i++)
     {
-        short x = buf16[i];
-        buf[2*i+1] = x;
-        buf[2*i] = x >> 8;
+        uint32_t x = buf32[i];
+        buf32[i] = ((x & 0x00FF00FF) << 8) | ((x >> 8) & 0x00FF00FF);
+    }
+    if (count & 2)
+    {
+        char x = buf[count-2];
+        buf[count-2] = buf[count-1];
+        buf[count-1] = x;
     }
 #endif
 }
@@ -199,6 +205,8 @@ static char cam_name[32]                    = "Canikon";
 static char cam_serial[64]                  = "";
 static char dng_artist_name[64]             = "";
 static char dng_copyright[64]               = "";
+static int dng_orientation                  = 1;                // 1: 0th row is top, 0th column is left
+static const char* dng_xmp                  = 0;                // XMP packet, optional
 static const short cam_PreviewBitsPerSample[]  = {8,8,8};
 static const int cam_Resolution[]              = {180,1};
 static int cam_AsShotNeutral[6]         = {473635,1000000,1000000,1000000,624000,1000000}; // wbgain default: daylight
@@ -213,6 +221,17 @@ static int cam_max_av[2]                = { 0, 96 };
 static int cam_focal_length[2]          = { 0, 1000 };
 static char* software_ver = "Magic Lantern";
 static int cam_FrameRate[]          = {25000,1000};
+static int dng_compression          = 1;                        // 1: uncompressed, 7: lossless JPEG
+static struct dng_tiles* dng_tiles  = 0;                        // tiled image being written, 0: single strip
+static int* dng_tile_offsets        = 0;                        // TileOffsets, filled at header generation
+static dng_tile_encoder_t dng_encoder = 0;                      // save_dng compresses with it, see dng_set_compression
+static int dng_tile_width           = 256;
+static int dng_tile_height          = 256;
+static int dng_sequence             = 0;                        // keep header and thumbnail setup for the next frame
+static int* dng_layout              = 0;                        // tag, type and count of the entries in dng_header_buf
+static int dng_layout_size          = 0;
+static unsigned char* thumbnail_lut = 0;                        // raw_to_8bit for every raw value, for wb 0 and -1
+static int thumbnail_lut_key[3];
 
 struct t_data_for_exif{
     short iso;
@@ -274,6 +293,7 @@ static int find_tag_index(struct dir_entry * ifd, int num, unsigned short tag)
 #define ORIENTATION_INDEX           find_tag_index(ifd0, DIR_SIZE(ifd0), 0x112)
 #define CHDK_VER_INDEX              find_tag_index(ifd0, DIR_SIZE(ifd0), 0x131)
 #define ARTIST_NAME_INDEX           find_tag_index(ifd0, DIR_SIZE(ifd0), 0x13B)
+#define XMP_INDEX                   find_tag_index(ifd0, DIR_SIZE(ifd0), 0x2BC)
 #define SUBIFDS_INDEX               find_tag_index(ifd0, DIR_SIZE(ifd0), 0x14A)
 #define COPYRIGHT_INDEX             find_tag_index(ifd0, DIR_SIZE(ifd0), 0x8298)
 #define EXIF_IFD_INDEX              find_tag_index(ifd0, DIR_SIZE(ifd0), 0x8769)
@@ -285,6 +305,12 @@ static int find_tag_index(struct dir_entry * ifd, int num, unsigned short tag)
 
 // Index of specific entries in ifd1 below.
 #define RAW_DATA_INDEX              find_tag_index(ifd1, DIR_SIZE(ifd1), 0x111)
+#define ROWS_PER_STRIP_INDEX        find_tag_index(ifd1, DIR_SIZE(ifd1), 0x116)
+#define STRIP_BYTE_COUNTS_INDEX     find_tag_index(ifd1, DIR_SIZE(ifd1), 0x117)
+#define TILE_WIDTH_INDEX            find_tag_index(ifd1, DIR_SIZE(ifd1), 0x142)
+#define TILE_LENGTH_INDEX           find_tag_index(ifd1, DIR_SIZE(ifd1), 0x143)
+#define TILE_OFFSETS_INDEX          find_tag_index(ifd1, DIR_SIZE(ifd1), 0x144)
+#define TILE_BYTE_COUNTS_INDEX      find_tag_index(ifd1, DIR_SIZE(ifd1), 0x145)
 #define BADPIXEL_OPCODE_INDEX       find_tag_index(ifd1, DIR_SIZE(ifd1), 0xC740)
 
 // Index of specific entries in exif_ifd below.
@@ -334,6 +360,28 @@ static void add_val_to_buf(int val, int size)
     add_to_buf(&val,size);
 }
 
+/* stores one value of the header layout, returns 1 if the previous header had the same value there */
+static int layout_put(int pos, int value)
+{
+    int same = (pos < dng_layout_size && dng_layout[pos] == value);
+    dng_layout[pos] = value;
+    return same;
+}
+
+static void free_dng_header(void)
+{
+    if (dng_header_buf)
+    {
+        ufree(dng_header_buf);
+        dng_header_buf=NULL;
+    }
+    if (thumbnail_buf)
+    {
+        free(thumbnail_buf);
+        thumbnail_buf = 0;
+    }
+}
+
 
 void dng_set_camname(char *str)
 {
@@ -406,6 +454,52 @@ void dng_set_datetime(char *datetime, char *subsectime)
     strncpy(cam_subsectime, subsectime, sizeof(cam_subsectime));
 }
 
+void dng_set_orientation(int orientation)
+{
+    dng_orientation = orientation;
+}
+
+void dng_set_artist(char *str)
+{
+    strncpy(dng_artist_name, str, sizeof(dng_artist_name) - 1);
+}
+
+void dng_set_copyright(char *str)
+{
+    strncpy(dng_copyright, str, sizeof(dng_copyright) - 1);
+}
+
+/* the string is not copied, it must stay valid until the DNG is saved (0 = no XMP) */
+void dng_set_xmp(const char *xmp)
+{
+    dng_xmp = xmp;
+}
+
+/* warning: not thread safe */
+void dng_set_compression(dng_tile_encoder_t encoder, int tile_width, int tile_height)
+{
+    dng_encoder = encoder;
+    dng_tile_width = tile_width;
+    dng_tile_height = tile_height;
+}
+
+/* for image sequences: header and thumbnail setup are kept from one save_dng to the next,
+   so only the values that changed need to be written. 0 frees all that. warning: not thread safe */
+void dng_set_sequence(int enable)
+{
+    dng_sequence = enable;
+
+    if (!enable)
+    {
+        free_dng_header();
+        free(dng_layout);
+        dng_layout = 0;
+        dng_layout_size = 0;
+        free(thumbnail_lut);
+        thumbnail_lut = 0;
+    }
+}
+
 
 static void create_dng_header(struct raw_info * raw_info){
     int i,j;
@@ -432,6 +526,7 @@ static void create_dng_header(struct raw_info * raw_info){
         {0x132,  T_ASCII,      20, (int)cam_datetime},                 // DateTime
         {0x13B,  T_ASCII|T_PTR,64, (int)dng_artist_name},              // Artist: Filled at header generation.
         {0x14A,  T_LONG,       1,  0},                                 // SubIFDs offset
+        {0x2BC,  T_BYTE|T_SKIP,0,  (int)dng_xmp},                      // XMP: only if set
         {0x8298, T_ASCII|T_PTR,64, (int)dng_copyright},                // Copyright
         {0x8769, T_LONG,       1,  0},                                 // EXIF_IFD offset
         {0x9216, T_BYTE,       4,  0x00000001},                        // TIFF/EPStandardID: 1.0.0.0
@@ -457,7 +552,7 @@ static void create_dng_header(struct raw_info * raw_info){
         {0x100,  T_LONG|T_PTR, 1,  (int)&camera_sensor.raw_rowpix},    // ImageWidth
         {0x101,  T_LONG|T_PTR, 1,  (int)&camera_sensor.raw_rows},      // ImageLength
         {0x102,  T_SHORT|T_PTR,1,  (int)&camera_sensor.bits_per_pixel},// BitsPerSample
-        {0x103,  T_SHORT,      1,  1},                                 // Compression: Uncompressed
+        {0x103,  T_SHORT|T_PTR,1,  (int)&dng_compression},             // Compression: Uncompressed or lossless JPEG
         {0x106,  T_SHORT,      1,  0x8023},                            // PhotometricInterpretation: CFA
         {0x111,  T_LONG,       1,  0},                                 // StripOffsets: Offset
         {0x115,  T_SHORT,      1,  1},                                 // SamplesPerPixel: 1
@@ -467,6 +562,10 @@ static void create_dng_header(struct raw_info * raw_info){
         {0x11B,  T_RATIONAL,   1,  (int)cam_Resolution},               // YResolution
         {0x11C,  T_SHORT,      1,  1},                                 // PlanarConfiguration: 1
         {0x128,  T_SHORT,      1,  2},                                 // ResolutionUnit: inch
+        {0x142,  T_LONG|T_SKIP,1,  0},                                 // TileWidth: only for tiled images
+        {0x143,  T_LONG|T_SKIP,1,  0},                                 // TileLength
+        {0x144,  T_LONG|T_PTR|T_SKIP, 0, 0},                           // TileOffsets
+        {0x145,  T_LONG|T_PTR|T_SKIP, 0, 0},                           // TileByteCounts
         {0x828D, T_SHORT,      2,  0x00020002},                        // CFARepeatPatternDim: Rows = 2, Cols = 2
         {0x828E, T_BYTE|T_PTR, 4,  (int)&camera_sensor.cfa_pattern},
         {0xC61A, T_LONG|T_PTR, 1,  (int)&camera_sensor.black_level},   // BlackLevel
@@ -528,6 +627,24 @@ static void create_dng_header(struct raw_info * raw_info){
             break;
         }
 
+    if (dng_tiles)
+    {
+        // tiled image: the tile tags replace the strip tags
+        ifd1[RAW_DATA_INDEX].type |= T_SKIP;
+        ifd1[ROWS_PER_STRIP_INDEX].type |= T_SKIP;
+        ifd1[STRIP_BYTE_COUNTS_INDEX].type |= T_SKIP;
+        ifd1[TILE_WIDTH_INDEX].type &= ~T_SKIP;
+        ifd1[TILE_WIDTH_INDEX].offset = dng_tiles->tile_width;
+        ifd1[TILE_LENGTH_INDEX].type &= ~T_SKIP;
+        ifd1[TILE_LENGTH_INDEX].offset = dng_tiles->tile_height;
+        ifd1[TILE_OFFSETS_INDEX].type &= ~T_SKIP;
+        ifd1[TILE_OFFSETS_INDEX].count = dng_tiles->count;
+        ifd1[TILE_OFFSETS_INDEX].offset = (int)dng_tile_offsets;
+        ifd1[TILE_BYTE_COUNTS_INDEX].type &= ~T_SKIP;
+        ifd1[TILE_BYTE_COUNTS_INDEX].count = dng_tiles->count;
+        ifd1[TILE_BYTE_COUNTS_INDEX].offset = (int)dng_tiles->size;
+    }
+
     // filling EXIF fields
     int ifd_count = DIR_SIZE(ifd_list);
 
@@ -537,45 +654,96 @@ static void create_dng_header(struct raw_info * raw_info){
     ifd0[CHDK_VER_INDEX].count = strlen(software_ver) + 1;
     ifd0[ARTIST_NAME_INDEX].count = strlen(dng_artist_name) + 1;
     ifd0[COPYRIGHT_INDEX].count = strlen(dng_copyright) + 1;
+    ifd0[ORIENTATION_INDEX].offset = dng_orientation;
     //~ ifd0[ORIENTATION_INDEX].offset = get_orientation_for_exif(exif_data.orientation);
 
+    if (dng_xmp && dng_xmp[0])
+    {
+        ifd0[XMP_INDEX].type &= ~T_SKIP;
+        ifd0[XMP_INDEX].count = strlen(dng_xmp);
+    }
+
     //~ exif_ifd[EXPOSURE_PROGRAM_INDEX].offset = get_exp_program_for_exif(exif_data.exp_program);
     //~ exif_ifd[METERING_MODE_INDEX].offset = get_metering_mode_for_exif(exif_data.metering_mode);
     //~ exif_ifd[FLASH_MODE_INDEX].offset = get_flash_mode_for_exif(exif_data.flash_mode, exif_data.flash_fired);
     //~ exif_ifd[SSTIME_INDEX].count = exif_ifd[SSTIME_ORIG_INDEX].count = strlen(cam_subsectime)+1;
 
-    // calculating offset of RAW data and count of entries for each IFD
-    raw_offset=TIFF_HDR_SIZE;
-
+    // skipped entries are not saved
     for (j=0;j<ifd_count;j++)
     {
-        raw_offset+=6; // IFD header+footer
+        ifd_list[j].count = 0;
         for(i=0; i<ifd_list[j].entry_count; i++)
+            if ((ifd_list[j].entry[i].type & T_SKIP) == 0)
+                ifd_list[j].count++;
+    }
+
+    // sequence mode: if all entries have the same size as in the previous header, only their values are updated
+    int update = 0;
+    if (dng_sequence)
+    {
+        if (!dng_layout)
+            dng_layout = malloc((3 * (DIR_SIZE(ifd0) + DIR_SIZE(ifd1) + DIR_SIZE(exif_ifd)) + 2) * sizeof(int));
+
+        if (dng_layout)
         {
-            if ((ifd_list[j].entry[i].type & T_SKIP) == 0)  // Exclude skipped entries (e.g. GPS info if camera doesn't have GPS)
+            int k = 0;
+            update = (dng_header_buf != 0);
+            for (j=0;j<ifd_count;j++)
+                for(i=0; i<ifd_list[j].entry_count; i++)
+                    if ((ifd_list[j].entry[i].type & T_SKIP) == 0)
+                    {
+                        update &= layout_put(k++, ifd_list[j].entry[i].tag);
+                        update &= layout_put(k++, ifd_list[j].entry[i].type);
+                        update &= layout_put(k++, ifd_list[j].entry[i].count);
+                    }
+            update &= layout_put(k++, dng_th_width);
+            update &= layout_put(k++, dng_th_height);
+            update &= (k == dng_layout_size);
+            dng_layout_size = k;
+        }
+    }
+
+    if (update)
+    {
+        raw_offset = dng_header_buf_size;
+    }
+    else
+    {
+        free_dng_header();
+
+        // calculating offset of RAW data and count of entries for each IFD
+        raw_offset=TIFF_HDR_SIZE;
+
+        for (j=0;j<ifd_count;j++)
+        {
+            raw_offset+=6; // IFD header+footer
+            for(i=0; i<ifd_list[j].entry_count; i++)
             {
-                raw_offset+=12; // IFD directory entry size
-                int size_ext=get_type_size(ifd_list[j].entry[i].type)*ifd_list[j].entry[i].count;
-                if (size_ext>4) raw_offset+=size_ext+(size_ext&1);
+                if ((ifd_list[j].entry[i].type & T_SKIP) == 0)  // Exclude skipped entries (e.g. GPS info if camera doesn't have GPS)
+                {
+                    raw_offset+=12; // IFD directory entry size
+                    int size_ext=get_type_size(ifd_list[j].entry[i].type)*ifd_list[j].entry[i].count;
+                    if (size_ext>4) raw_offset+=size_ext+(size_ext&1);
+                }
             }
         }
-    }
 
-    // creating buffer for writing data
-    raw_offset=(raw_offset/512+1)*512; // exlusively for CHDK fast file writing
-    dng_header_buf_size=raw_offset;
-    dng_header_buf=umalloc(raw_offset);
-    dng_header_buf_offset=0;
-    if (!dng_header_buf) return;
+        // creating buffer for writing data
+        raw_offset=(raw_offset/512+1)*512; // exlusively for CHDK fast file writing
+        dng_header_buf_size=raw_offset;
+        dng_header_buf=umalloc(raw_offset);
+        if (!dng_header_buf) return;
 
-    // create buffer for thumbnail
-    thumbnail_buf = malloc(dng_th_width*dng_th_height*3);
-    if (!thumbnail_buf)
-    {
-        ufree(dng_header_buf);
-        dng_header_buf = 0;
-        return;
+        // create buffer for thumbnail
+        thumbnail_buf = malloc(dng_th_width*dng_th_height*3);
+        if (!thumbnail_buf)
+        {
+            ufree(dng_header_buf);
+            dng_header_buf = 0;
+            return;
+        }
     }
+    dng_header_buf_offset=0;
 
     //  writing offsets for EXIF IFD and RAW data and calculating offset for extra data
 
@@ -586,6 +754,17 @@ static void create_dng_header(struct raw_info * raw_info){
     ifd0[THUMB_DATA_INDEX].offset = raw_offset;                                     //StripOffsets for thumbnail
     ifd1[RAW_DATA_INDEX].offset = raw_offset + dng_th_width * dng_th_height * 3;    //StripOffsets for main image
 
+    if (dng_tiles)
+    {
+        // tiles are written one after another, behind the thumbnail
+        int tile_offset = ifd1[RAW_DATA_INDEX].offset;
+        for (i = 0; i < dng_tiles->count; i++)
+        {
+            dng_tile_offsets[i] = tile_offset;
+            tile_offset += dng_tiles->size[i];
+        }
+    }
+
     for (j=0;j<ifd_count;j++)
     {
         extra_offset += 6 + ifd_list[j].count * 12; // IFD header+footer
@@ -597,7 +776,7 @@ static void create_dng_header(struct raw_info * raw_info){
     add_val_to_buf(42, sizeof(short));          // An arbitrary but carefully chosen number that further identifies the file as a TIFF file.
     add_val_to_buf(TIFF_HDR_SIZE, sizeof(int)); // offset of first IFD
 
-    // writing IFDs
+    // writing IFDs (when updating, tag, type and count are already there)
 
     for (j=0;j<ifd_count;j++)
     {
@@ -607,9 +786,16 @@ static void create_dng_header(struct raw_info * raw_info){
         {
             if ((ifd_list[j].entry[i].type & T_SKIP) == 0)
             {
-                add_val_to_buf(ifd_list[j].entry[i].tag, sizeof(short));
-                add_val_to_buf(ifd_list[j].entry[i].type & 0xFF, sizeof(short));
-                add_val_to_buf(ifd_list[j].entry[i].count, sizeof(int));
+                if (update)
+                {
+                    dng_header_buf_offset += 8;
+                }
+                else
+                {
+                    add_val_to_buf(ifd_list[j].entry[i].tag, sizeof(short));
+                    add_val_to_buf(ifd_list[j].entry[i].type & 0xFF, sizeof(short));
+                    add_val_to_buf(ifd_list[j].entry[i].count, sizeof(int));
+                }
                 size_ext=get_type_size(ifd_list[j].entry[i].type)*ifd_list[j].entry[i].count;
                 if (size_ext<=4) 
                 {
@@ -652,21 +838,8 @@ static void create_dng_header(struct raw_info * raw_info){
     }
 
     // writing zeros to tail of dng header (just for fun)
-    for (i=dng_header_buf_offset; i<dng_header_buf_size; i++) dng_header_buf[i]=0;
-}
-
-static void free_dng_header(void)
-{
-    if (dng_header_buf)
-    {
-        ufree(dng_header_buf);
-        dng_header_buf=NULL;
-    }
-    if (thumbnail_buf)
-    {
-        free(thumbnail_buf);
-        thumbnail_buf = 0;
-    }
+    if (!update)
+        for (i=dng_header_buf_offset; i<dng_header_buf_size; i++) dng_header_buf[i]=0;
 }
 
 //-------------------------------------------------------------------
@@ -686,10 +859,39 @@ static inline int raw_to_8bit(int raw, int wb, struct raw_info * raw_info)
     return COERCE(out, 0, 255);
 }
 
+/* raw_to_8bit as a table for all 16 bit values get_raw_pixel may return,
+ * kept while the levels don't change (only used for sequences) */
+static unsigned char* get_thumbnail_lut(struct raw_info * raw_info)
+{
+    int bpp = raw_info->bits_per_pixel;
+    int i;
+
+    if (thumbnail_lut && thumbnail_lut_key[0] == bpp && thumbnail_lut_key[1] == raw_info->black_level && thumbnail_lut_key[2] == raw_info->white_level)
+        return thumbnail_lut;
+
+    if (!thumbnail_lut)
+        thumbnail_lut = malloc(2 << 16);
+    if (!thumbnail_lut)
+        return 0;
+
+    for (i = 0; i < (1 << 16); i++)
+    {
+        thumbnail_lut[i] = raw_to_8bit(i, 0, raw_info);
+        thumbnail_lut[i + (1 << 16)] = raw_to_8bit(i, -1, raw_info);
+    }
+
+    thumbnail_lut_key[0] = bpp;
+    thumbnail_lut_key[1] = raw_info->black_level;
+    thumbnail_lut_key[2] = raw_info->white_level;
+    return thumbnail_lut;
+}
+
 static void create_thumbnail(struct raw_info * raw_info)
 {
     register int i, j, x, y, yadj, xadj;
     register char *buf = thumbnail_buf;
+    unsigned char* lut = dng_sequence ? get_thumbnail_lut(raw_info) : 0;
+    unsigned char* lut_green = lut ? lut + (1 << 16) : 0;
 
     // The sensor bayer patterns are:
     //  0x02010100  0x01000201  0x01020001
@@ -707,18 +909,168 @@ static void create_thumbnail(struct raw_info * raw_info)
             x = camera_sensor.active_area.x1 + ((camera_sensor.jpeg.x + (camera_sensor.jpeg.width  * j) / dng_th_width)  & 0xFFFFFFFE) + xadj;
             y = camera_sensor.active_area.y1 + ((camera_sensor.jpeg.y + (camera_sensor.jpeg.height * i) / dng_th_height) & 0xFFFFFFFE) + yadj;
 
+            if (lut)
+            {
+                *buf++ = lut[get_raw_pixel(x,y) & 0xFFFF];               // red pixel
+                *buf++ = lut_green[get_raw_pixel(x+1,y) & 0xFFFF];       // green pixel
+                *buf++ = lut[get_raw_pixel(x+1,y+1) & 0xFFFF];           // blue pixel
+                continue;
+            }
+
             *buf++ = raw_to_8bit(get_raw_pixel(x,y), 0, raw_info);        // red pixel
             *buf++ = raw_to_8bit(get_raw_pixel(x+1,y), -1, raw_info);      // green pixel
             *buf++ = raw_to_8bit(get_raw_pixel(x+1,y+1), 0, raw_info);    // blue pixel
         }
 }
 
+//-------------------------------------------------------------------
+// Functions for compressing the image into lossless JPEG tiles
+
+/* the pixels are packed MSB first into little endian 16 bit words. 16 bit pixels are big endian (see raw_to_8bit) */
+static void unpack_row(struct raw_info * raw_info, int y, int x0, int width, unsigned short * out)
+{
+    int bpp = raw_info->bits_per_pixel;
+    unsigned short* words = (void*)((char*)raw_info->buffer + y * (raw_info->width * bpp / 8));
+    int bitpos = x0 * bpp;
+    int x;
+
+    if (bpp == 16)
+    {
+        for (x = 0; x < width; x++)
+        {
+            out[x] = (words[x0 + x] >> 8) | (words[x0 + x] << 8);
+        }
+        return;
+    }
+
+    unsigned short* word = words + bitpos / 16;
+    unsigned int acc = *word++;
+    int avail = 16 - bitpos % 16;
+
+    for (x = 0; x < width; x++)
+    {
+        if (avail < bpp)
+        {
+            acc = (acc << 16) | *word++;
+            avail += 16;
+        }
+        avail -= bpp;
+        out[x] = (acc >> avail) & ((1 << bpp) - 1);
+    }
+}
+
+int dng_encode_tiles(struct raw_info * raw_info, dng_tile_encoder_t encoder, int tile_width, int tile_height, struct dng_tiles * tiles)
+{
+    // TIFF wants tile sizes in multiples of 16
+    tile_width = MAX(16, (tile_width + 15) & ~15);
+    tile_height = MAX(16, (tile_height + 15) & ~15);
+
+    int tiles_x = (raw_info->width + tile_width - 1) / tile_width;
+    int tiles_y = (raw_info->height + tile_height - 1) / tile_height;
+    int x, y, tx, ty;
+
+    tiles->tile_width = tile_width;
+    tiles->tile_height = tile_height;
+    tiles->count = tiles_x * tiles_y;
+    tiles->data = calloc(tiles->count, sizeof(tiles->data[0]));
+    tiles->size = calloc(tiles->count, sizeof(tiles->size[0]));
+
+    unsigned short* tile = malloc(tile_width * tile_height * sizeof(unsigned short));
+    if (!tile || !tiles->data || !tiles->size)
+    {
+        free(tile);
+        return 0;
+    }
+
+    for (ty = 0; ty < tiles_y; ty++)
+    {
+        for (tx = 0; tx < tiles_x; tx++)
+        {
+            int x0 = tx * tile_width;
+            int y0 = ty * tile_height;
+            int width = MIN(tile_width, raw_info->width - x0);
+
+            for (y = 0; y < tile_height; y++)
+            {
+                unsigned short* row = tile + y * tile_width;
+
+                // tiles on the right and bottom edge are padded with constant values, which cost next to nothing
+                if (y0 + y >= raw_info->height)
+                {
+                    for (x = 0; x < tile_width; x++)
+                    {
+                        row[x] = row[-tile_width];
+                    }
+                    continue;
+                }
+
+                unpack_row(raw_info, y0 + y, x0, width, row);
+                for (x = width; x < tile_width; x++)
+                {
+                    row[x] = row[x - MIN(x, 2)];
+                }
+            }
+
+            int index = ty * tiles_x + tx;
+            if (encoder(tile, tile_width, tile_height, raw_info->bits_per_pixel, 2, &tiles->data[index], &tiles->size[index]))
+            {
+                free(tile);
+                return 0;
+            }
+        }
+    }
+
+    free(tile);
+    return 1;
+}
+
+void dng_free_tiles(struct dng_tiles * tiles)
+{
+    int i;
+    if (tiles->data)
+    {
+        for (i = 0; i < tiles->count; i++)
+        {
+            free(tiles->data[i]);
+        }
+    }
+    free(tiles->data);
+    free(tiles->size);
+    tiles->data = 0;
+    tiles->size = 0;
+    tiles->count = 0;
+}
+
 //-------------------------------------------------------------------
 // Write DNG header, thumbnail and data to file
 
-static int write_dng(FILE* fd, struct raw_info * raw_info) 
+static int write_dng(FILE* fd, struct raw_info * raw_info, char* lj92_data, int lj92_size, struct dng_tiles * tiles)
 {
+    int raw_size = camera_sensor.raw_size;
+    int i;
+
+    /* a compressed image is stored as a single strip holding the LJ92 stream, or as tiles with one stream each */
+    if (lj92_data)
+    {
+        dng_compression = 7;
+        camera_sensor.raw_size = lj92_size;
+    }
+    if (tiles)
+    {
+        dng_tile_offsets = malloc(tiles->count * sizeof(int));
+        if (!dng_tile_offsets) return 0;
+        dng_compression = 7;
+        dng_tiles = tiles;
+    }
+
     create_dng_header(raw_info);
+
+    dng_compression = 1;
+    dng_tiles = 0;
+    free(dng_tile_offsets);
+    dng_tile_offsets = 0;
+    camera_sensor.raw_size = raw_size;
+
     char* rawadr = (void*)raw_info->buffer;
 
     if (dng_header_buf)
@@ -727,10 +1079,25 @@ static int write_dng(FILE* fd, struct raw_info * raw_info)
         if (write(fd, dng_header_buf, dng_header_buf_size) != dng_header_buf_size) return 0;
         if (write(fd, thumbnail_buf, dng_th_width*dng_th_height*3) != dng_th_width*dng_th_height*3) return 0;
 
-        reverse_bytes_order(UNCACHEABLE(rawadr), camera_sensor.raw_size);
-        if (write(fd, UNCACHEABLE(rawadr), camera_sensor.raw_size) != camera_sensor.raw_size) return 0;
+        if (tiles)
+        {
+            for (i = 0; i < tiles->count; i++)
+            {
+                if (write(fd, tiles->data[i], tiles->size[i]) != tiles->size[i]) return 0;
+            }
+        }
+        else if (lj92_data)
+        {
+            if (write(fd, lj92_data, lj92_size) != lj92_size) return 0;
+        }
+        else
+        {
+            reverse_bytes_order(UNCACHEABLE(rawadr), camera_sensor.raw_size);
+            if (write(fd, UNCACHEABLE(rawadr), camera_sensor.raw_size) != camera_sensor.raw_size) return 0;
+        }
 
-        free_dng_header();
+        if (!dng_sequence)
+            free_dng_header();
     }
     return 1;
 }
@@ -742,8 +1109,7 @@ PROP_HANDLER(PROP_CAM_MODEL)
 }
 #endif
 
-/* returns 1 on success, 0 on error */
-int save_dng(char* filename, struct raw_info * raw_info)
+static int save_dng_file(char* filename, struct raw_info * raw_info, void* lj92_data, int lj92_size, struct dng_tiles * tiles)
 {
     #ifdef RAW_DEBUG_BLACK
     raw_info->active_area.x1 = 0;
@@ -758,7 +1124,7 @@ int save_dng(char* filename, struct raw_info * raw_info)
     
     FILE* f = FIO_CreateFile(filename);
     if (!f) return 0;
-    int ok = write_dng(f, raw_info);
+    int ok = write_dng(f, raw_info, lj92_data, lj92_size, tiles);
     FIO_CloseFile(f);
     if (!ok)
     {
@@ -767,3 +1133,29 @@ int save_dng(char* filename, struct raw_info * raw_info)
     }
     return 1;
 }
+
+/* returns 1 on success, 0 on error. with lj92_data set, raw_info->buffer is only used for the thumbnail */
+int save_dng_lj92(char* filename, struct raw_info * raw_info, void* lj92_data, int lj92_size)
+{
+    return save_dng_file(filename, raw_info, lj92_data, lj92_size, 0);
+}
+
+/* returns 1 on success, 0 on error. raw_info->buffer is only used for the thumbnail */
+int save_dng_tiles(char* filename, struct raw_info * raw_info, struct dng_tiles * tiles)
+{
+    return save_dng_file(filename, raw_info, 0, 0, tiles);
+}
+
+/* returns 1 on success, 0 on error */
+int save_dng(char* filename, struct raw_info * raw_info)
+{
+    if (dng_encoder)
+    {
+        struct dng_tiles tiles;
+        int ok = dng_encode_tiles(raw_info, dng_encoder, dng_tile_width, dng_tile_height, &tiles) && save_dng_tiles(filename, raw_info, &tiles);
+        dng_free_tiles(&tiles);
+        return ok;
+    }
+
+    return save_dng_file(filename, raw_info, 0, 0, 0);
+}
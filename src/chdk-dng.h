@@ -15,5 +15,38 @@ void dng_set_focal(int nom, int denom);
 void dng_set_iso(int value);
 void dng_set_wbgain(int gain_r_n, int gain_r_d, int gain_g_n, int gain_g_d, int gain_b_n, int gain_b_d);
 void dng_set_datetime(char *datetime, char *subsectime);
+void dng_set_orientation(int orientation);
+void dng_set_artist(char *str);
+void dng_set_copyright(char *str);
+void dng_set_xmp(const char *xmp);
+
+/* image sequences: keep the DNG header and thumbnail setup from one save_dng to the next,
+   only the values that changed are written. 0 when done, to free them */
+void dng_set_sequence(int enable);
+
+/* encodes a 'width' x 'height' image with 'components' interleaved components into a new buffer,
+   returns 0 on success (same interface as lj92_encode) */
+typedef int (*dng_tile_encoder_t)(const unsigned short *image, int width, int height, int bitdepth, int components, unsigned char **encoded, int *encoded_size);
+
+/* image data as independently encoded lossless JPEG tiles (DNG compression 7), in row order */
+struct dng_tiles
+{
+    int tile_width;
+    int tile_height;
+    int count;
+    unsigned char **data;
+    int *size;
+};
+
+/* save_dng writes lossless JPEG tiles made with this encoder, 0 switches back to uncompressed data.
+   the tile size is rounded up to a multiple of 16 */
+void dng_set_compression(dng_tile_encoder_t encoder, int tile_width, int tile_height);
+
+/* split the image in raw_info into tiles and encode them. this only reads raw_info, so it can run
+   on several frames at once. returns 1 on success; free the tiles with dng_free_tiles either way.
+   like everywhere else in here, 16 bit images are expected as big endian words */
+struct raw_info;
+int dng_encode_tiles(struct raw_info *raw_info, dng_tile_encoder_t encoder, int tile_width, int tile_height, struct dng_tiles *tiles);
+void dng_free_tiles(struct dng_tiles *tiles);
 
 #endif // __CHDK_DNG_H_
@@ -16,8 +16,10 @@
 
 #include "crc32.h"
 
-/* crc32table[] built by crc32_init() */
-static uint32_t crc32table[256];
+/* crc32table[] built by crc32_init().
+ * crc32table[0] is the classic byte table, crc32table[k][i] is the crc of
+ * byte i followed by k zero bytes, so 8 bytes can be looked up at once (slice-by-8) */
+static uint32_t crc32table[8][256];
 
 /* Calculate crc32. Little endian.
  * Standard seed is 0xffffffff or 0.
@@ -25,8 +27,33 @@ static uint32_t crc32table[256];
 uint32_t crc32 (void *data, unsigned int len, uint32_t seed)
 {
   uint8_t *d = data;
+
+  /* byte wise up to an aligned address, so the word loads below are aligned */
+  while (len && ((uintptr_t) d & 3)) {
+    seed = (seed>>8) ^ crc32table[0][(seed ^ *d++) & 0xFF];
+    len--;
+  }
+
+  /* the tables are for little endian word loads; other hosts use the byte loop */
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (len >= 8) {
+    uint32_t one = *(uint32_t *) d ^ seed;
+    uint32_t two = *(uint32_t *) (d + 4);
+    seed = crc32table[7][ one        & 0xFF] ^
+           crc32table[6][(one >>  8) & 0xFF] ^
+           crc32table[5][(one >> 16) & 0xFF] ^
+           crc32table[4][ one >> 24        ] ^
+           crc32table[3][ two        & 0xFF] ^
+           crc32table[2][(two >>  8) & 0xFF] ^
+           crc32table[1][(two >> 16) & 0xFF] ^
+           crc32table[0][ two >> 24        ];
+    d += 8;
+    len -= 8;
+  }
+#endif
+
   while (len--)
-    seed = ((seed>>8) & 0x00FFFFFF) ^ crc32table [(seed ^ *d++) & 0xFF];
+    seed = (seed>>8) ^ crc32table[0][(seed ^ *d++) & 0xFF];
   return seed;
 }
 
@@ -41,6 +68,14 @@ void crc32_init()
     crc = i;
     for (j=8; j>0; j--)
       crc = (crc>>1) ^ ((crc&1) ? poly : 0);
-    crc32table[i] = crc;
+    crc32table[0][i] = crc;
+  }
+
+  for (i=0; i<256; i++) {
+    crc = crc32table[0][i];
+    for (j=1; j<8; j++) {
+      crc = (crc>>8) ^ crc32table[0][crc & 0xFF];
+      crc32table[j][i] = crc;
+    }
   }
 }
@@ -47,45 +47,81 @@ void FAST hist_build_raw()
 {
     if (!raw_update_params()) return;
 
+    /* cached in raw.c, rebuilt when the white level or bit depth change (small black level changes only shift it) */
+    const uint8_t* r2ev = raw_get_ev_bins(HIST_WIDTH, 12);
+    if (!r2ev) return;
+
     memset(&histogram, 0, sizeof(histogram));
     histogram.is_raw = 1;
 
     int step = lv ? 4 : 2;
 
-    char r2ev[16384];
-    for (int i = 0; i < 16384; i++)
-        r2ev[i] = COERCE((raw_to_ev(i) + 12) * (HIST_WIDTH-1) / 12, 0, HIST_WIDTH-1);
+    /* one sample every 8 bitmap pixels, inside the active area */
+    int xs = 0, xe = 0, n = 0;
+    for (int j = os.x0; j < os.x_max; j += 8)
+    {
+        int x = BM2RAW_X(j);
+        if (x < raw_info.active_area.x1+8 || x > raw_info.active_area.x2-8) continue;
+        if (!n) xs = x;
+        xe = x;
+        n++;
+    }
+
+    /* the samples are unpacked in row segments, at an even raw stride, so they stay on red and green columns */
+    xs &= ~1;
+    int dx = n > 1 ? (((xe & ~1) - xs) / (n - 1) + 1) & ~1 : 2;
+    dx = MAX(dx, 2);
+    n = MIN(n, (xe - xs) / dx + 1);
+
+    /* same pixels as raw_*_pixel_dark: the darker of two rows of the same color, two lines apart */
+    uint16_t r0[32], r1[32], g0[32], g1[32], b0[32], b1[32];
 
     for (int i = os.y0; i < os.y_max; i += step)
     {
         int y = BM2RAW_Y(i);
         if (y < raw_info.active_area.y1+8 || y > raw_info.active_area.y2-8) continue;
 
-        for (int j = os.x0; j < os.x_max; j += 8)
-        {
-            int x = BM2RAW_X(j);
-            if (x < raw_info.active_area.x1+8 || x > raw_info.active_area.x2-8) continue;
+        int yrg = y & ~1;
+        int ygb = yrg - 1;
 
-            int r = raw_red_pixel_dark(x, y);
-            int g = raw_green_pixel_dark(x, y);
-            int b = raw_blue_pixel_dark(x, y);
+        for (int k = 0; k < n; k += COUNT(r0))
+        {
+            int count = MIN(COUNT(r0), n - k);
+            int x = xs + k * dx;
 
-            /* ignore bad pixels */
-            if (r == 0 || g == 0 || b == 0) continue;
+            raw_unpack_row(raw_info.buffer, x,   yrg,     dx, count, r0);
+            raw_unpack_row(raw_info.buffer, x,   yrg - 2, dx, count, r1);
+            raw_unpack_row(raw_info.buffer, x+1, yrg,     dx, count, g0);
+            raw_unpack_row(raw_info.buffer, x+1, yrg - 2, dx, count, g1);
+            raw_unpack_row(raw_info.buffer, x+1, ygb,     dx, count, b0);
+            raw_unpack_row(raw_info.buffer, x+1, ygb - 2, dx, count, b1);
 
-            int ir = r2ev[r];
-            int ig = r2ev[g];
-            int ib = r2ev[b];
-            
-            histogram.hist_r[ir]++;
-            histogram.hist_g[ig]++;
-            histogram.hist_b[ib]++;
-            histogram.total_px++;
+            for (int m = 0; m < count; m++)
+            {
+                int r = MIN(r0[m], r1[m]);
+                int g = MIN(g0[m], g1[m]);
+                int b = MIN(b0[m], b1[m]);
+
+                /* ignore bad pixels */
+                if (r == 0 || g == 0 || b == 0) continue;
+
+                int ir = r2ev[r];
+                int ig = r2ev[g];
+                int ib = r2ev[b];
+                
+                histogram.hist_r[ir]++;
+                histogram.hist_g[ig]++;
+                histogram.hist_b[ib]++;
+                histogram.total_px++;
+            }
         }
     }
     
     /* in dark areas, spread the histogram count to show solid histogram instead of isolated bars */
-    for (int i = 0; i < 5000; i++)
+    /* (raw values below 5000 at 14 bits; r2ev only covers 0 ... 2^bits_per_pixel - 1) */
+    int size = 1 << raw_info.bits_per_pixel;
+    int dark = MIN(5000 * size / 16384, size - 1);
+    for (int i = 1; i < dark; i++)
     {
         int ev0 = r2ev[i];
         int evplus = r2ev[i+1];
@@ -428,65 +464,37 @@ int FAST raw_hist_get_percentile_levels(int* percentiles_x10, int* output_raw_va
     if (!raw_update_params()) goto err;
     get_yuv422_vram();
 
-    int* hist = malloc(16384*4);
+    int* hist = raw_hist_buffer_get();
     if (!hist) goto err;
-    memset(hist, 0, 16384*4);
 
     int off = get_y_skip_offset_for_histogram();
     if (speed == 0 && gray_projection == GRAY_PROJECTION_GREEN)
     {
-        /* time: 1-2 seconds on full raw 5D3 */
-        //~ int t0 = get_ms_clock();
-        for (struct raw_pixblock * row = (struct raw_pixblock *) raw_info.buffer + raw_info.active_area.y1 * raw_info.width / 8 + (raw_info.active_area.x1 + 7) / 8; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.active_area.y2; row += 2 * raw_info.width / 8)
-        {
-            struct raw_pixblock * row2 = row + raw_info.pitch / sizeof(struct raw_pixblock);
+        /* all green pixels of the active area */
+        /* time: 1-2 seconds on full raw 5D3 (with per-pixel access) */
+        int x0 = (raw_info.active_area.x1 + 7) & ~7;
+        int w = (raw_info.jpeg.width + 7) & ~7;
+        uint16_t buf[256];
 
-            struct raw_pixblock * p;
-            struct raw_pixblock * q;
-            for (p = row, q = row2; (void*)p < (void*)row + raw_info.jpeg.width * 14/8; p++, q++)
+        for (int y = raw_info.active_area.y1; y < raw_info.active_area.y2; y += 2)
+        {
+            /**
+             *  y:   rgrgrgrg rgrgrgrg
+             *  y+1: gbgbgbgb gbgbgbgb
+             */
+            for (int x = 0; x < w; x += 2 * COUNT(buf))
             {
+                int count = MIN(COUNT(buf), (w - x) / 2);
+
+                raw_unpack_row(raw_info.buffer, x0 + x + 1, y, 2, count, buf);
+                for (int i = 0; i < count; i++)
+                    hist[buf[i]]++;
 
-                /**
-                 *  p: abcdefgh abcdefgh
-                 *  q: abcdefgh abcdefgh
-                 *
-                 *     rgrgrgrg rgrgrgrg
-                 *     gbgbgbgb gbgbgbgb
-                 */
-
-                //~ int pa = ((int)(p->a));
-                int pb = ((int)(p->b_lo | (p->b_hi << 12)));
-                //~ int pc = ((int)(p->c_lo | (p->c_hi << 10)));
-                int pd = ((int)(p->d_lo | (p->d_hi << 8)));
-                //~ int pe = ((int)(p->e_lo | (p->e_hi << 6)));
-                int pf = ((int)(p->f_lo | (p->f_hi << 4)));
-                //~ int pg = ((int)(p->g_lo | (p->g_hi << 2)));
-                int ph = ((int)(p->h));
-                int qa = ((int)(q->a));
-                //~ int qb = ((int)(q->b_lo | (q->b_hi << 12)));
-                int qc = ((int)(q->c_lo | (q->c_hi << 10)));
-                //~ int qd = ((int)(q->d_lo | (q->d_hi << 8)));
-                int qe = ((int)(q->e_lo | (q->e_hi << 6)));
-                //~ int qf = ((int)(q->f_lo | (q->f_hi << 4)));
-                int qg = ((int)(q->g_lo | (q->g_hi << 2)));
-                //~ int qh = ((int)(q->h));
-
-                hist[pb]++;
-                hist[pd]++;
-                hist[pf]++;
-                hist[ph]++;
-                hist[qa]++;
-                hist[qc]++;
-                hist[qe]++;
-                hist[qg]++;
-
-                /* to check if we sample only the active area */
-                //~ p->a = rand();
+                raw_unpack_row(raw_info.buffer, x0 + x, y + 1, 2, count, buf);
+                for (int i = 0; i < count; i++)
+                    hist[buf[i]]++;
             }
         }
-        //~ int t1 = get_ms_clock();
-        //~ NotifyBox(5000, "%d ", t1 - t0);
-        //~ save_dng("A:/foo.dng");
     }
     else
     {
@@ -527,7 +535,7 @@ int FAST raw_hist_get_percentile_levels(int* percentiles_x10, int* output_raw_va
         output_raw_values[k] = ans;
     }
 
-    free(hist);
+    raw_hist_buffer_release(hist);
     return 1;
 
 err:
@@ -1325,121 +1325,159 @@ void raw_set_geometry(int width, int height, int skip_left, int skip_right, int
     dbg_printf("  should be: (%d,%d) - (%d,%d)\n", raw_info.active_area.x1, raw_info.active_area.y1, raw_info.active_area.x2, raw_info.active_area.y2);
 }
 
+/* pixel at (x,y) in a raw buffer, at raw_info.bits_per_pixel */
+/* same bit offset math as raw_unpack_row: MSB first in little endian 16-bit words */
+static inline int raw_pixel_at(void* raw_buffer, int x, int y)
+{
+    const int bpp = raw_info.bits_per_pixel;
+    const int bit = x * bpp;
+    const uint16_t* w = (void*)raw_buffer + y * raw_info.pitch + (bit >> 4) * 2;
+    int end = (bit & 15) + bpp;
+    uint32_t v = w[0];
+    if (end > 16)
+    {
+        v = (v << 16) | w[1];
+        end -= 16;
+    }
+    return (v >> (16 - end)) & ((1 << bpp) - 1);
+}
+
+/* the approximate color getters use the first and the last pixel of each group of 8 (red/green on even lines, green/blue on odd ones) */
 int FAST raw_red_pixel(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2;
-    int i = ((y * raw_info.width + x) / 8);
-    return buf[i].a;
+    return raw_pixel_at(raw_info.buffer, x & ~7, y);
 }
 
 int FAST raw_green_pixel(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2;
-    int i = ((y * raw_info.width + x) / 8);
-    return buf[i].h;
+    return raw_pixel_at(raw_info.buffer, (x & ~7) + 7, y);
 }
 
 int FAST raw_blue_pixel(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2 - 1;
-    int i = ((y * raw_info.width + x) / 8);
-    return buf[i].h;
+    return raw_pixel_at(raw_info.buffer, (x & ~7) + 7, y);
 }
 
 int FAST raw_red_pixel_dark(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2;
-    int i = ((y * raw_info.width + x) / 8);
-    return MIN(buf[i].a, buf[i - raw_info.width*2/8].a);
+    x = x & ~7;
+    return MIN(raw_pixel_at(raw_info.buffer, x, y), raw_pixel_at(raw_info.buffer, x, y - 2));
 }
 
 int FAST raw_green_pixel_dark(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2;
-    int i = ((y * raw_info.width + x) / 8);
-    return MIN(buf[i].h, buf[i - raw_info.width*2/8].h);
+    x = (x & ~7) + 7;
+    return MIN(raw_pixel_at(raw_info.buffer, x, y), raw_pixel_at(raw_info.buffer, x, y - 2));
 }
 
 int FAST raw_blue_pixel_dark(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2 - 1;
-    int i = ((y * raw_info.width + x) / 8);
-    return MIN(buf[i].h, buf[i - raw_info.width*2/8].h);
+    x = (x & ~7) + 7;
+    return MIN(raw_pixel_at(raw_info.buffer, x, y), raw_pixel_at(raw_info.buffer, x, y - 2));
 }
 
 int FAST raw_red_pixel_bright(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2;
-    int i = ((y * raw_info.width + x) / 8);
-    return MAX(buf[i].a, buf[i - raw_info.width*2/8].a);
+    x = x & ~7;
+    return MAX(raw_pixel_at(raw_info.buffer, x, y), raw_pixel_at(raw_info.buffer, x, y - 2));
 }
 
 int FAST raw_green_pixel_bright(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2;
-    int i = ((y * raw_info.width + x) / 8);
-    return MAX(buf[i].h, buf[i - raw_info.width*2/8].h);
+    x = (x & ~7) + 7;
+    return MAX(raw_pixel_at(raw_info.buffer, x, y), raw_pixel_at(raw_info.buffer, x, y - 2));
 }
 
 int FAST raw_blue_pixel_bright(int x, int y)
 {
-    struct raw_pixblock * buf = (void*)raw_info.buffer;
     y = (y/2) * 2 - 1;
-    int i = ((y * raw_info.width + x) / 8);
-    return MAX(buf[i].h, buf[i - raw_info.width*2/8].h);
+    x = (x & ~7) + 7;
+    return MAX(raw_pixel_at(raw_info.buffer, x, y), raw_pixel_at(raw_info.buffer, x, y - 2));
 }
 
 
 int FAST raw_get_pixel(int x, int y) {
-    struct raw_pixblock * p = (void*)raw_info.buffer + y * raw_info.pitch + (x/8)*14;
-    switch (x%8) {
-        case 0: return p->a;
-        case 1: return p->b_lo | (p->b_hi << 12);
-        case 2: return p->c_lo | (p->c_hi << 10);
-        case 3: return p->d_lo | (p->d_hi << 8);
-        case 4: return p->e_lo | (p->e_hi << 6);
-        case 5: return p->f_lo | (p->f_hi << 4);
-        case 6: return p->g_lo | (p->g_hi << 2);
-        case 7: return p->h;
-    }
-    return p->a;
+    return raw_pixel_at(raw_info.buffer, x, y);
 }
 
 int FAST raw_get_pixel_ex(void* raw_buffer, int x, int y) {
-    struct raw_pixblock * p = (void*)raw_buffer + y * raw_info.pitch + (x/8)*14;
-    switch (x%8) {
-        case 0: return p->a;
-        case 1: return p->b_lo | (p->b_hi << 12);
-        case 2: return p->c_lo | (p->c_hi << 10);
-        case 3: return p->d_lo | (p->d_hi << 8);
-        case 4: return p->e_lo | (p->e_hi << 6);
-        case 5: return p->f_lo | (p->f_hi << 4);
-        case 6: return p->g_lo | (p->g_hi << 2);
-        case 7: return p->h;
-    }
-    return p->a;
+    return raw_pixel_at(raw_buffer, x, y);
 }
 
 void FAST raw_set_pixel(int x, int y, int value)
 {
-    struct raw_pixblock * p = (void*)raw_info.buffer + y * raw_info.pitch + (x/8)*14;
-    switch (x%8) {
-        case 0: p->a = value; break;
-        case 1: p->b_lo = value; p->b_hi = value >> 12; break;
-        case 2: p->c_lo = value; p->c_hi = value >> 10; break;
-        case 3: p->d_lo = value; p->d_hi = value >> 8; break;
-        case 4: p->e_lo = value; p->e_hi = value >> 6; break;
-        case 5: p->f_lo = value; p->f_hi = value >> 4; break;
-        case 6: p->g_lo = value; p->g_hi = value >> 2; break;
-        case 7: p->h = value; break;
+    const int bpp = raw_info.bits_per_pixel;
+    const int bit = x * bpp;
+    const uint32_t mask = (1 << bpp) - 1;
+    uint16_t* w = (void*)raw_info.buffer + y * raw_info.pitch + (bit >> 4) * 2;
+    int end = (bit & 15) + bpp;
+
+    if (end > 16)
+    {
+        /* the pixel continues in the next word */
+        int shift = 32 - end;
+        uint32_t v = (w[0] << 16) | w[1];
+        v = (v & ~(mask << shift)) | ((value & mask) << shift);
+        w[0] = v >> 16;
+        w[1] = v;
+    }
+    else
+    {
+        int shift = 16 - end;
+        w[0] = (w[0] & ~(mask << shift)) | ((value & mask) << shift);
+    }
+}
+
+void FAST raw_unpack_row(void* raw_buffer, int x, int y, int step, int count, uint16_t* out)
+{
+    if (count <= 0) return;
+
+    /* pixels are packed MSB first in little endian 16-bit words, at any bit depth */
+    const int bpp = raw_info.bits_per_pixel;
+    const uint32_t mask = (1 << bpp) - 1;
+    const uint16_t* row = (void*)raw_buffer + y * raw_info.pitch;
+    int bit = x * bpp;
+
+    if (step == 1)
+    {
+        /* stream the row through a bit buffer: one 16-bit load for every 16 bits of output */
+        const uint16_t* src = row + (bit >> 4);
+        uint32_t acc = *src++;
+        int bits = 16 - (bit & 15);
+        for (int i = 0; i < count; i++)
+        {
+            if (bits < bpp)
+            {
+                acc = (acc << 16) | *src++;
+                bits += 16;
+            }
+            bits -= bpp;
+            out[i] = (acc >> bits) & mask;
+        }
+        return;
+    }
+
+    /* subsampled: locate each pixel from its bit offset; the next word is read only if the pixel continues there */
+    const int dbit = step * bpp;
+    for (int i = 0; i < count; i++, bit += dbit)
+    {
+        const uint16_t* w = row + (bit >> 4);
+        int end = (bit & 15) + bpp;
+        uint32_t v = w[0];
+        if (end > 16)
+        {
+            v = (v << 16) | w[1];
+            end -= 16;
+        }
+        out[i] = (v >> (16 - end)) & mask;
     }
 }
 
@@ -1496,6 +1534,65 @@ int FAST raw_get_gray_pixel(int x, int y, int gray_projection)
     }
 }
 
+/* log2 of 1..16383 in fixed point (RAW_LOG2_ONE = 1 EV), rounded; 32K, kept once built */
+#define RAW_LOG2_ONE 4096
+static uint16_t* raw_log2_table = 0;
+
+static int raw_log2_init()
+{
+    if (raw_log2_table)
+    {
+        return 1;
+    }
+
+    uint16_t* table = malloc(16384 * sizeof(uint16_t));
+    if (!table)
+    {
+        return 0;
+    }
+
+    table[0] = 0;
+    for (int i = 1; i < 16384; i++)
+    {
+        table[i] = (int)(log2f(i) * RAW_LOG2_ONE + 0.5f);
+    }
+
+    /* two tasks may get here at the same time; keep the first table */
+    uint32_t old = cli();
+    if (!raw_log2_table)
+    {
+        raw_log2_table = table;
+        table = 0;
+    }
+    sei(old);
+
+    free(table);
+    return 1;
+}
+
+/* only valid once the table is built; values above the table are halved, one EV at a time */
+static inline int raw_log2_fx(int x)
+{
+    int ev = 0;
+    while (x >= 16384)
+    {
+        x >>= 1;
+        ev += RAW_LOG2_ONE;
+    }
+    return raw_log2_table[MAX(x, 1)] + ev;
+}
+
+static inline float raw_log2_fast(int x)
+{
+    return raw_log2_table ? raw_log2_fx(x) / (float) RAW_LOG2_ONE : log2f(x);
+}
+
+float FAST raw_log2(int x)
+{
+    raw_log2_init();
+    return raw_log2_fast(x);
+}
+
 /* input: 0 - 16384 (valid range: from black level to white level) */
 /* output: -14 ... 0 */
 float FAST raw_to_ev(int raw)
@@ -1532,7 +1629,7 @@ float FAST raw_to_ev(int raw)
         raw_max = adjusted_white - raw_info.black_level;
     }
     
-    float raw_ev = -log2f(raw_max) + log2f(COERCE(raw - raw_info.black_level, 1, raw_max));
+    float raw_ev = -raw_log2_fast(raw_max) + raw_log2_fast(COERCE(raw - raw_info.black_level, 1, raw_max));
     return raw_ev;
 }
 
@@ -1542,39 +1639,165 @@ int FAST ev_to_raw(float ev)
     return raw_info.black_level + powf(2, ev) * raw_max;
 }
 
+/* black level may move this much (at 14 bits) before the bins are rebuilt; they are shifted instead */
+#define RAW_EV_BINS_BLACK_MARGIN 16
+
+const uint8_t* FAST raw_get_ev_bins(int num_bins, int ev_range)
+{
+    static uint8_t* bins = 0;
+    static int bins_size = 0;
+    static int key[4] = {-1};
+    static int bins_black = 0;
+
+    if (num_bins < 1 || num_bins > 256 || ev_range < 1)
+    {
+        return 0;
+    }
+
+    int black = raw_info.black_level;
+    int white = raw_info.white_level;
+    int size = 1 << raw_info.bits_per_pixel;
+    int margin = MAX(1, RAW_EV_BINS_BLACK_MARGIN * size / 16384);
+
+    /**
+     * Black level jitters by a few units between LiveView updates. The bins
+     * depend on raw - black, so for a small change the table is returned
+     * shifted by the difference; the white level part (log2 of white - black)
+     * moves by less than 0.002 EV, well within one bin.
+     */
+    int new_key[4] = { white, raw_info.bits_per_pixel, num_bins, ev_range };
+    if (bins && memcmp(key, new_key, sizeof(key)) == 0 && ABS(black - bins_black) <= margin)
+    {
+        return bins + margin + bins_black - black;
+    }
+
+    if (!raw_log2_init())
+    {
+        return 0;
+    }
+
+    /* entry i is for raw value i - margin */
+    int table_size = size + 2 * margin;
+    if (table_size != bins_size)
+    {
+        free(bins);
+        bins = malloc(table_size);
+        bins_size = bins ? table_size : 0;
+        if (!bins) return 0;
+    }
+
+    /* same as raw_to_ev, in fixed point: table lookups and integer math only */
+    int raw_max = white - black;
+    int log_max = raw_log2_fx(MAX(raw_max, 1));
+    int range = ev_range * RAW_LOG2_ONE;
+
+    for (int i = 0; i < table_size; i++)
+    {
+        int raw = i - margin;
+
+        if (unlikely(white > 16383) && unlikely(raw > 10000))
+        {
+            /* photo mode ExpSim hack, see raw_to_ev */
+            int adjusted_white = white + (15000 - white) * MIN(raw - 10000, 5000) / 5000;
+            raw_max = adjusted_white - black;
+            log_max = raw_log2_fx(MAX(raw_max, 1));
+        }
+
+        int ev = raw_log2_fx(COERCE(raw - black, 1, MAX(raw_max, 1))) - log_max;
+        bins[i] = COERCE((ev + range) * (num_bins-1) / range, 0, num_bins-1);
+    }
+
+    memcpy(key, new_key, sizeof(key));
+    bins_black = black;
+    return bins + margin;
+}
+
+/* only one caller at a time gets the cached buffer; the others get (and free) their own */
+static int* raw_hist_buf = 0;
+static volatile int raw_hist_buf_busy = 0;
+
+int* raw_hist_buffer_get()
+{
+    uint32_t old = cli();
+    int busy = raw_hist_buf_busy;
+    raw_hist_buf_busy = 1;
+    sei(old);
+
+    int* hist = 0;
+    if (!busy)
+    {
+        if (!raw_hist_buf)
+        {
+            raw_hist_buf = malloc(16384*4);
+        }
+        hist = raw_hist_buf;
+        if (!hist) raw_hist_buf_busy = 0;
+    }
+    else
+    {
+        hist = malloc(16384*4);
+    }
+
+    if (hist) memset(hist, 0, 16384*4);
+    return hist;
+}
+
+void raw_hist_buffer_release(int* hist)
+{
+    if (hist && hist == raw_hist_buf)
+    {
+        raw_hist_buf_busy = 0;
+    }
+    else
+    {
+        free(hist);
+    }
+}
+
 static void autodetect_black_level_calc(int x1, int x2, int y1, int y2, int dx, int dy, int* out_mean, int* out_stdev_x100)
 {
+    uint16_t buf[256];
     int black = 0;
     int num = 0;
     /* compute average level */
     for (int y = y1; y < y2; y += dy)
     {
-        for (int x = x1; x < x2; x += dx)
+        for (int x = x1; x < x2; x += dx * COUNT(buf))
         {
-            int p = raw_get_pixel(x, y);
-            if (p == 0) continue;               /* bad pixel */
-            black += p;
-            num++;
+            int n = MIN(COUNT(buf), (x2 - x + dx - 1) / dx);
+            raw_unpack_row(raw_info.buffer, x, y, dx, n, buf);
+            for (int i = 0; i < n; i++)
+            {
+                int p = buf[i];
+                if (p == 0) continue;           /* bad pixel */
+                black += p;
+                num++;
+            }
         }
     }
 
-    int mean = black / num;
+    int mean = num ? black / num : 0;
 
     /* compute standard deviation */
     int stdev = 0;
     for (int y = y1; y < y2; y += dy)
     {
-        for (int x = x1; x < x2; x += dx)
+        for (int x = x1; x < x2; x += dx * COUNT(buf))
         {
-            int p = raw_get_pixel(x, y);
-            if (p == 0) continue;
-            int dif = p - mean;
-            stdev += dif * dif;
-            
-            #ifdef RAW_DEBUG_BLACK
-            /* to check if we are reading the black level from the proper spot, enable RAW_DEBUG_BLACK here and in save_dng. */
-            raw_set_pixel(x, y, rand());
-            #endif
+            int n = MIN(COUNT(buf), (x2 - x + dx - 1) / dx);
+            raw_unpack_row(raw_info.buffer, x, y, dx, n, buf);
+            for (int i = 0; i < n; i++)
+            {
+                int p = buf[i];
+                if (p == 0) continue;
+                int dif = p - mean;
+                stdev += dif * dif;
+
+                #ifdef RAW_DEBUG_BLACK
+                /* to check if we are reading the black level from the proper spot, enable RAW_DEBUG_BLACK here and in save_dng. */
+                raw_set_pixel(x + i * dx, y, rand());
+                #endif
+            }
         }
     }
     
@@ -1716,28 +1939,34 @@ static int autodetect_white_level(int initial_guess)
 
     //~ bmp_printf(FONT_MED, 50, 50, "White...");
 
+    /* every 40th pixel, starting from a multiple of 8, skipping 5% at the left and right */
+    uint16_t buf[256];
+    int skip_5p = ((raw_info.active_area.x2 - raw_info.active_area.x1) * 6/128)/8*8;
+    int x1 = raw_info.active_area.x1/8*8 + skip_5p;
+    int x2 = raw_info.active_area.x2/8*8 - skip_5p;
+
     int raw_height = raw_info.active_area.y2 - raw_info.active_area.y1;
     for (int y = raw_info.active_area.y1 + raw_height/10; y < raw_info.active_area.y2 - raw_height/10; y += 5)
     {
-        int pitch = raw_info.width/8*14;
-        int row = (intptr_t) raw_info.buffer + y * pitch;
-        int skip_5p = ((raw_info.active_area.x2 - raw_info.active_area.x1) * 6/128)/8*14; /* skip 5% */
-        int row_crop_start = row + raw_info.active_area.x1/8*14 + skip_5p;
-        int row_crop_end = row + raw_info.active_area.x2/8*14 - skip_5p;
-        
-        for (struct raw_pixblock * p = (void*)row_crop_start; (void*)p < (void*)row_crop_end; p += 5)
+        for (int x = x1; x < x2; x += 40 * COUNT(buf))
         {
-            if (p->a > max)
+            int n = MIN(COUNT(buf), (x2 - x + 39) / 40);
+            raw_unpack_row(raw_info.buffer, x, y, 40, n, buf);
+            for (int i = 0; i < n; i++)
             {
-                max = p->a;
-                confirms = 1;
-            }
-            else if (p->a == max)
-            {
-                confirms++;
-                if (confirms > 5)
+                int p = buf[i];
+                if (p > max)
+                {
+                    max = p;
+                    confirms = 1;
+                }
+                else if (p == max)
                 {
-                    white = max - 500;
+                    confirms++;
+                    if (confirms > 5)
+                    {
+                        white = max - 500;
+                    }
                 }
             }
         }
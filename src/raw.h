@@ -84,12 +84,17 @@ int raw_green_pixel(int x, int y);
 int raw_blue_pixel(int x, int y);
 
 /* get/set the pixel at specified coords (exact, but you can get whatever color happens to be there) */
+/* these and the color getters work at 10, 12 and 14 bits per pixel (raw_info.bits_per_pixel) */
 int raw_get_pixel(int x, int y);
 void raw_set_pixel(int x, int y, int value);
 
 /* get a pixel from a custom raw buffer (not from the main one) */
 int raw_get_pixel_ex(void* raw_buffer, int x, int y);
 
+/* unpack 'count' pixels from line y of a raw buffer, starting at x and taking every 'step'-th pixel */
+/* works at 10, 12 and 14 bits per pixel (raw_info.bits_per_pixel); use this in loops instead of raw_get_pixel */
+void raw_unpack_row(void* raw_buffer, int x, int y, int step, int count, uint16_t* out);
+
 /* get a grayscale pixel according to some projection from RGB */
 int raw_get_gray_pixel(int x, int y, int gray_projection);
 #define GRAY_PROJECTION_RED 0
@@ -118,6 +123,19 @@ int raw_blue_pixel_bright(int x, int y);
 float raw_to_ev(int raw);
 int ev_to_raw(float ev);
 
+/* log2(x) for raw values, looked up from a cached fixed point table (accurate to 1/8192 EV) */
+float raw_log2(int x);
+
+/* raw value => histogram bin lookup table, for 'num_bins' bins covering 'ev_range' EV below the white level */
+/* same as COERCE((raw_to_ev(raw) + ev_range) * (num_bins-1) / ev_range, 0, num_bins-1), for raw values up to 1 << bits_per_pixel */
+/* cached until white level, bit depth or layout change; small black level changes only shift it. returns 0 if out of memory */
+const uint8_t* raw_get_ev_bins(int num_bins, int ev_range);
+
+/* a cleared 16384-bin histogram, for raw percentiles; the buffer is kept between calls */
+/* give it back with raw_hist_buffer_release; returns 0 if out of memory */
+int* raw_hist_buffer_get();
+void raw_hist_buffer_release(int* hist);
+
 /* quick preview of the raw buffer */
 void raw_preview_fast();
 
@@ -238,6 +256,15 @@ extern struct raw_capture_info raw_capture_info;
 /* save a DNG file; all parameters are taken from raw_info */
 int save_dng(char* filename, struct raw_info * raw_info);
 
+/* save a DNG file with an already encoded lossless JPEG (LJ92) stream as image data;
+ * the pixels in raw_info are only used for the thumbnail */
+int save_dng_lj92(char* filename, struct raw_info * raw_info, void* lj92_data, int lj92_size);
+
+/* save a DNG file with lossless JPEG tiles from dng_encode_tiles (chdk-dng.h);
+ * the pixels in raw_info are only used for the thumbnail */
+struct dng_tiles;
+int save_dng_tiles(char* filename, struct raw_info * raw_info, struct dng_tiles * tiles);
+
 /* do not include ML headers if used in postprocessing */
 #ifdef CONFIG_MAGICLANTERN
 /** Menu helpers **/
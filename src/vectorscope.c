@@ -125,9 +125,11 @@ void vectorscope_addpixel(uint8_t y, int8_t u, int8_t v)
     int U = u << vectorscope_gain;
     
     int r = U*U + V*V;
-    const int r_sqrt = (int)sqrtf(r);
     if (r > 124*124)
     {
+        /* soft-float, so only for the few pixels that need it */
+        const int r_sqrt = (int)sqrtf(r);
+
         /* almost out of circle, mark it with red */
         for (int R = 124; R < 128; R++)
         {
@@ -495,20 +495,25 @@ static void hist_add_pixel(uint32_t pixel, int Y)
     
     /* luma component is always computed, since we need histogram.max */
     /* and it's much less expensive than RGB anyway */
-    histogram.total_px++;
     uint32_t hist_level = (Y * HIST_WIDTH) >> 8;
+    histogram.hist[ hist_level & (HIST_WIDTH-1)]++;
+}
 
+/* after the pass, rather than checking every pixel */
+static void hist_update_max()
+{
     // Ignore the 0 bin.  It generates too much noise
-    unsigned count = ++ (histogram.hist[ hist_level & (HIST_WIDTH-1)]);
-    if( hist_level && count > histogram.max )
-        histogram.max = count;
+    for (int i = 1; i < HIST_WIDTH; i++)
+        if (histogram.hist[i] > histogram.max)
+            histogram.max = histogram.hist[i];
 }
 #endif
 
 #ifdef FEATURE_WAVEFORM
-static inline void waveform_add_pixel(int x, int Y)
+/* wx: waveform column, ((x-os.x0) * WAVEFORM_WIDTH) / os.x_ex, tracked by the caller */
+static inline void waveform_add_pixel(int wx, int Y)
 {
-    uint8_t* w = &WAVEFORM(((x-os.x0) * WAVEFORM_WIDTH) / os.x_ex, (Y * WAVEFORM_HEIGHT) >> 8);
+    uint8_t* w = &WAVEFORM(wx, (Y * WAVEFORM_HEIGHT) >> 8);
     if ((*w) < 250) (*w)++;
 }
 #endif
@@ -562,13 +567,41 @@ hist_build()
         return;
     }
     
+    /* single pass: each YUV word is read once and fed to all enabled consumers */
+    /* the flags are globals, so check them once here rather than in the inner loop */
+    #ifdef FEATURE_HISTOGRAM
+    const int hist_yuv = hist_draw && !histogram.is_raw;
+    int total_px = 0;
+    #endif
+    #ifdef FEATURE_WAVEFORM
+    const int wf_step = 2 * WAVEFORM_WIDTH;
+    #endif
+
     int mz = nondigic_zoom_overlay_enabled();
     int off = get_y_skip_offset_for_histogram();
     for( y = os.y0 + off; y < os.y_max - off; y += 2 )
     {
+        uint32_t * const v_row = (uint32_t*)((uint8_t*)buf + BM2LV_R(y));
+
+        #ifdef FEATURE_WAVEFORM
+        /* waveform column, updated incrementally (no division per pixel) */
+        int wx = 0;
+        int wx_rem = 0;
+        #endif
+
         for( x = os.x0 ; x < os.x_max ; x += 2 )
         {
-            uint32_t pixel = buf[BM2LV(x,y) >> 2];
+            uint32_t pixel = v_row[BM2LV_X(x) >> 1];
+
+            #ifdef FEATURE_WAVEFORM
+            int wx_cur = wx;
+            wx_rem += wf_step;
+            while (wx_rem >= os.x_ex)
+            {
+                wx_rem -= os.x_ex;
+                wx++;
+            }
+            #endif
 
             // ignore magic zoom borders
             if (mz && (pixel == MZ_WHITE || pixel == MZ_BLACK || pixel == MZ_GREEN))
@@ -577,16 +610,17 @@ hist_build()
             int Y = UYVY_GET_AVG_Y(pixel);
             
             #ifdef FEATURE_HISTOGRAM
-            if (hist_draw && !histogram.is_raw)
+            if (hist_yuv)
             {
                 hist_add_pixel(pixel, Y);
+                total_px++;
             }
             #endif
             
             #ifdef FEATURE_WAVEFORM
             if (waveform_draw) 
             {
-                waveform_add_pixel(x, Y);
+                waveform_add_pixel(wx_cur, Y);
             }
             #endif
             
@@ -600,6 +634,14 @@ hist_build()
             #endif
         }
     }
+
+    #ifdef FEATURE_HISTOGRAM
+    if (hist_yuv)
+    {
+        histogram.total_px = total_px;
+        hist_update_max();
+    }
+    #endif
 }
 #endif
 
@@ -2457,21 +2499,27 @@ static void spotmeter_step()
 
         raw_luma = 0;
         int raw_count = 0;
+        const int xr1 = MAX(xcr - dxr, raw_info.active_area.x1);
+        const int xr2 = MIN(xcr + dxr, raw_info.active_area.x2);
+        uint16_t line[128];
         for( y = ycr - dxr ; y <= ycr + dxr ; y++ )
         {
             if (y < raw_info.active_area.y1 || y > raw_info.active_area.y2) continue;
-            for( x = xcr - dxr ; x <= xcr + dxr ; x++ )
+            for( x = xr1 ; x <= xr2 ; x += COUNT(line) )
             {
-                if (x < raw_info.active_area.x1 || x > raw_info.active_area.x2) continue;
-
-                raw_luma += raw_get_pixel(x, y);
-                raw_count++;
-                
-                /* define this to check if spotmeter reads from the right place;
-                 * you should see some gibberish on raw zebras, right inside the spotmeter box */
-                #ifdef RAW_SPOTMETER_TEST
-                raw_set_pixel(raw_buf, x, y, rand());
-                #endif
+                int n = MIN(COUNT(line), xr2 - x + 1);
+                raw_unpack_row(raw_info.buffer, x, y, 1, n, line);
+                for (int i = 0; i < n; i++)
+                {
+                    raw_luma += line[i];
+                    raw_count++;
+
+                    /* define this to check if spotmeter reads from the right place;
+                     * you should see some gibberish on raw zebras, right inside the spotmeter box */
+                    #ifdef RAW_SPOTMETER_TEST
+                    raw_set_pixel(x + i, y, rand());
+                    #endif
+                }
             }
         }
         if (!raw_count) return;